@@ -0,0 +1,191 @@
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+#include "shmem_accum.h"
+
+// input arg [1]: base pointer of the shared memory of an accumulator (allocate_shared_matrix with Accumulate set),
+//                created by host, or attached writable without option Slice
+// input arg [2]: first column (1-based) which values are added to, all dimensions after the first one are treated as
+//                columns, or "merge" for adding the stripes of all processes to the matrix
+// input arg [3]: values, same class / complexity as the accumulator (dense), with the same number of rows, added to
+//                the columns starting from input arg [2] (ignored by "merge")
+// input arg [4]: (optional) struct of options
+//   Strategy: "auto" (default), "atomic" or "stripe" (see shmem_accum.h), "auto" claims a stripe of the process once
+//             the contention of atomic additions observed by all processes is high, "stripe" raises an error if no
+//             stripe is free
+//   Threads: number of threads, 0 (default) for automatic selection
+// output arg [1]: (optional) struct of statistics
+//   adding: Strategy ("atomic" or "stripe"), Stripe (1-based, 0 for atomic additions), Elements, Retries (failed
+//           compare-and-swap), Adders (processes adding atomically at the same time, including the caller), Threads,
+//           Seconds, Throughput in GB/s
+//   "merge": Strategy ("merge"), Stripes (merged stripes), Elements (of the matrix), Threads, Seconds
+// additions to stripes are not visible in the matrix before "merge", which must not run concurrently with additions
+// (e.g. it is called by the host after parfor), atomic additions and "merge" are published as a new version of the
+// matrix (see shmem_sync.h)
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("accumulate_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(2, 4);
+    if (nlhs > 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 1");
+    const mxArray* options = nrhs > 3 ? prhs[3] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 4);
+
+    // address containing base ptr
+    if (!mxIsUint64(prhs[0]) || mxGetNumberOfElements(prhs[0]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 base pointer");
+    char* ptr_base = (char*)*(unsigned long long*)mxGetData(prhs[0]);
+    if (ptr_base == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
+    shmem_header_t hdr = { 0 };
+    const char* header_err = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), &hdr);
+    if (header_err)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+    if (!(hdr.array_attribute & ARRAY_ACCUMULATE))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Matrix is not an accumulator, allocate it with option Accumulate");
+    char* accum = shmem_accum_ptr(&hdr, ptr_base);
+    if (accum == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "Read invalid accumulator block");
+    char* stats = shmem_stats_ptr(&hdr, ptr_base);
+    int data_class = (int)hdr.matrix_type;
+    int elem_size = shmem_class_size(data_class);
+    unsigned long long n_rows = shmem_header_dim(&hdr, 0);
+    unsigned long long n_cols = 1;
+    for (unsigned int i = 1; i < hdr.n_dims; i++)
+        n_cols *= shmem_header_dim(&hdr, i);
+    char* data = ptr_base + hdr.header_size + ARRAY_HEADER_SIZE;
+
+    int n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    if (n_threads < 0 || n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+
+    // MERGE
+    if (mxIsChar(prhs[1])) {
+        char cmd[16];
+        if (mxGetString(prhs[1], cmd, sizeof(cmd)) || strcmp(cmd, "merge") != 0)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [2] must be a column index or \"merge\"");
+        unsigned long long n = n_rows * n_cols * (hdr.data_size / elem_size);
+        double start_time = shmem_time_seconds();
+        shmem_version_begin(stats);
+        long long n_merged = shmem_accum_merge(accum, ptr_base, data_class, data, n, &n_threads);
+        shmem_version_end(stats);
+        double seconds = shmem_time_seconds() - start_time;
+        if (n_merged < 0)
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+        SHMEM_DEBUG_OUTPUT("Merged %lld stripes in %f seconds (%d threads)\n", n_merged, seconds, n_threads);
+        if (nlhs >= 1) {
+            const char* stat_fields[] = { "Strategy", "Stripes", "Elements", "Threads", "Seconds" };
+            plhs[0] = mxCreateStructMatrix(1, 1, 5, stat_fields);
+            if (plhs[0] == NULL)
+                mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+            mxSetField(plhs[0], 0, "Strategy", mxCreateString("merge"));
+            shmem_set_field_scalar(plhs[0], "Stripes", (double)n_merged);
+            shmem_set_field_scalar(plhs[0], "Elements", (double)n);
+            shmem_set_field_scalar(plhs[0], "Threads", n_threads);
+            shmem_set_field_scalar(plhs[0], "Seconds", seconds);
+        }
+        return;
+    }
+
+    // VALUES
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [2] must be a column index or \"merge\"");
+    double first_col = mxGetScalar(prhs[1]);
+    if (first_col < 1 || first_col != (double)(unsigned long long)first_col)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Column index must be a positive integer");
+    if (nrhs < 3)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [3] (values) is required");
+    const mxArray* values = prhs[2];
+    if (mxGetClassID(values) != (mxClassID)data_class)
+        mexErrMsgIdAndTxt("SharedMatrix:DataTypeError", "Values must have the same class as the accumulator");
+    if (!mxIsComplex(values) != !(hdr.array_attribute & ARRAY_COMPLEX))
+        mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Complexity of values differs from the accumulator");
+    if (mxIsSparse(values))
+        mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Values must be dense");
+    unsigned long long col = (unsigned long long)first_col - 1;
+    unsigned long long n_values_cols = 0;
+    const char* src = NULL;
+    if (!mxIsEmpty(values)) {
+        if (mxGetM(values) != n_rows)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Values must have %lld rows", n_rows);
+        n_values_cols = mxGetNumberOfElements(values) / n_rows;
+        if (hdr.array_attribute & ARRAY_COMPLEX) {
+#ifdef SHMEM_COMPLEX_SUPPORTED
+            src = (const char*)get_ic_ptr(values, data_class);
+#endif
+        }
+        else {
+            src = (const char*)mxGetData(values);
+        }
+        if (src == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array");
+    }
+    if (col + n_values_cols > n_cols)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Column index exceeds matrix dimensions");
+
+    // STRATEGY
+    char strategy_name[16];
+    shmem_option_string(options, "Strategy", strategy_name, sizeof(strategy_name), "auto");
+    int strategy = shmem_accum_from_name(strategy_name);
+    if (strategy < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Strategy must be \"auto\", \"atomic\" or \"stripe\"");
+    unsigned long long pid = shmem_accum_current_pid();
+    unsigned long long start_time_ticks = shmem_process_start_time(pid);
+    long long stripe = -1;
+    long long adders = 0;
+    if (strategy != SHMEM_ACCUM_ATOMIC)
+        stripe = shmem_accum_stripe_owned(accum, pid, start_time_ticks, strategy == SHMEM_ACCUM_STRIPE);
+    if (stripe < 0 && strategy == SHMEM_ACCUM_STRIPE)
+        mexErrMsgIdAndTxt("SharedMatrix:NoStripe", "No stripe of the accumulator is free (%lld stripes)", shmem_accum_n_stripes(accum));
+    if (stripe < 0) {
+        shmem_sync_add(accum + SHMEM_ACCUM_ADDERS, 1);
+        adders = (long long)shmem_sync_load(accum + SHMEM_ACCUM_ADDERS);
+        if (strategy == SHMEM_ACCUM_AUTO && shmem_accum_choose(accum, adders) == SHMEM_ACCUM_STRIPE) {
+            stripe = shmem_accum_stripe_owned(accum, pid, start_time_ticks, 1);
+            if (stripe >= 0)
+                shmem_sync_add(accum + SHMEM_ACCUM_ADDERS, -1);
+        }
+    }
+
+    // ADD
+    unsigned long long n = n_values_cols * n_rows * (hdr.data_size / elem_size);
+    char* dst = data + col * n_rows * hdr.data_size;
+    unsigned long long retries = 0;
+    double start_time = shmem_time_seconds();
+    if (stripe >= 0) {
+        char* entry = accum + SHMEM_ACCUM_TABLE + stripe * SHMEM_STATS_LINE_BYTES;
+        if (n > 0 && !SHMEM_READ_CAST(unsigned long long, entry, SHMEM_ACCUM_DIRTY))
+            shmem_sync_add(entry + SHMEM_ACCUM_DIRTY, 1);
+        dst = shmem_accum_stripe(accum, ptr_base, stripe) + col * n_rows * hdr.data_size;
+        n_threads = n > 0 ? shmem_parallel_accumulate(data_class, dst, src, n, 0, n_threads, &retries) : 0;
+        shmem_sync_add(accum + SHMEM_ACCUM_STRIPE_ELEMENTS, (long long)n);
+    }
+    else {
+        shmem_version_begin(stats);
+        n_threads = n > 0 ? shmem_parallel_accumulate(data_class, dst, src, n, 1, n_threads, &retries) : 0;
+        shmem_version_end(stats);
+        shmem_sync_add(accum + SHMEM_ACCUM_ATOMIC_ELEMENTS, (long long)n);
+        shmem_sync_add(accum + SHMEM_ACCUM_CAS_RETRIES, (long long)retries);
+        shmem_sync_add(accum + SHMEM_ACCUM_ADDERS, -1);
+    }
+    double seconds = shmem_time_seconds() - start_time;
+    if (n > 0 && n_threads == 0)
+        mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+    SHMEM_DEBUG_OUTPUT("Added %lld elements in %f seconds (%s, %lld retries, %d threads)\n", n, seconds, stripe >= 0 ? "stripe" : "atomic", retries, n_threads);
+
+    if (nlhs >= 1) {
+        const char* stat_fields[] = { "Strategy", "Stripe", "Elements", "Retries", "Adders", "Threads", "Seconds", "Throughput" };
+        plhs[0] = mxCreateStructMatrix(1, 1, 8, stat_fields);
+        if (plhs[0] == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        mxSetField(plhs[0], 0, "Strategy", mxCreateString(shmem_accum_name(stripe >= 0 ? SHMEM_ACCUM_STRIPE : SHMEM_ACCUM_ATOMIC)));
+        shmem_set_field_scalar(plhs[0], "Stripe", (double)(stripe + 1));
+        shmem_set_field_scalar(plhs[0], "Elements", (double)n);
+        shmem_set_field_scalar(plhs[0], "Retries", (double)retries);
+        shmem_set_field_scalar(plhs[0], "Adders", (double)adders);
+        shmem_set_field_scalar(plhs[0], "Threads", n_threads);
+        shmem_set_field_scalar(plhs[0], "Seconds", seconds);
+        shmem_set_field_scalar(plhs[0], "Throughput", seconds > 0 ? (double)(n * elem_size) / seconds / 1e9 : 0);
+    }
+}
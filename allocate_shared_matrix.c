@@ -0,0 +1,223 @@
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_attach.h"
+#include "shmem_stats.h"
+#include "shmem_numa.h"
+#include "shmem_accum.h"
+#include "shmem_sync.h"
+
+// input arg [1]: shared memory name
+// input arg [2]: struct describing the matrix
+//   Class: class name ("double" (default), "single", "logical", "int8", ..., "uint64")
+//   Dims: dimensions (at least 2 elements, exactly 2 for sparse matrix)
+//   Complex: true for complex matrix, false (default) otherwise
+//   Sparse: true for sparse matrix (double or logical), false (default) otherwise
+//   Nzmax: number of non-zero elements allocated for sparse matrix
+//   Accumulate: true for an accumulator (dense numeric matrix) which workers add to by accumulate_shared_matrix,
+//               false (default) otherwise
+//   Stripes: number of private stripes of an accumulator (0 by default, in [0, SHMEM_ACCUM_MAX_STRIPES]), each of them
+//            is as large as the matrix (pages are allocated when they are first written)
+//   Capacity: columns reserved for an appendable matrix (dense 2-D, not an accumulator), at least the columns of Dims,
+//             0 (default) otherwise. Dims gives the committed columns, further columns are added by
+//             append_shared_matrix. Address space is reserved for the capacity, the shared memory object is grown
+//             by chunks as columns are appended (POSIX API, a WIN API section is committed at full capacity).
+// input arg [3]: (optional) struct of options
+//   HugePages, AlignColumns, Numa, NumaNodes: same as create_shared_matrix
+//   Chunk: bytes the shared memory object of an appendable matrix is initially backed by (multiples of it, covering
+//          the committed columns), SHMEM_APPEND_CHUNK_BYTES by default
+// output arg [1]: base pointer of shared memory
+// output arg [2]: shared memory handle
+// output arg [3]: writable matlab array over shared memory (zero-initialized), it must be detached by
+//                 delete_shared_matrix(handle, base pointer, {array}, name)
+// output arg [4]: (optional) actual shared memory name, differs from input arg [1] if the segment is placed on hugetlbfs
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("allocate_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(2, 3);
+    const mxArray* spec = prhs[1];
+    MATLAB_OPTIONS_CHECK(spec, 2);
+    const mxArray* options = nrhs > 2 ? prhs[2] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 3);
+    if (nlhs < 3 || nlhs > 4)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "allocate_shared_matrix returns base pointer, handle, data array and optional name");
+
+    // SHARED MEMORY NAME CHECK
+    char shmem_name[MAX_SHMEM_NAME_LENGTH];
+    if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], shmem_name, MAX_SHMEM_NAME_LENGTH))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
+    if (strlen(shmem_name) == 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
+    SHMEM_DEBUG_OUTPUT("Shared memory name: %s\n", shmem_name);
+
+    // MATRIX DESCRIPTION
+    char class_name[16];
+    shmem_option_string(spec, "Class", class_name, sizeof(class_name), "double");
+    int data_class = shmem_class_from_name(class_name);
+    if (data_class == mxUNKNOWN_CLASS)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Unsupported data type: %s", class_name);
+    unsigned long long array_attribute = 0;
+    if (shmem_option_scalar(spec, "Sparse", 0) != 0)
+        array_attribute |= ARRAY_SPARSE;
+    if (shmem_option_scalar(spec, "Complex", 0) != 0) {
+#ifndef SHMEM_COMPLEX_SUPPORTED
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Complex array is not supported before R2018a");
+#else
+        array_attribute |= ARRAY_COMPLEX;
+#endif
+    }
+    if (data_class == mxLOGICAL_CLASS) {
+        if (array_attribute & ARRAY_COMPLEX)
+            mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Logical attribute could not composite with complex");
+        array_attribute |= ARRAY_LOGICAL;
+    }
+    if ((array_attribute & ARRAY_SPARSE) && data_class != mxDOUBLE_CLASS && data_class != mxLOGICAL_CLASS)
+        mexErrMsgIdAndTxt("SharedMatrix:DataTypeError", "Sparse matrix only supports double and logical data");
+    int data_size = shmem_class_size(data_class);
+    if (array_attribute & ARRAY_COMPLEX) data_size *= 2;
+    unsigned long long n_stripes = 0;
+    if (shmem_option_scalar(spec, "Accumulate", 0) != 0) {
+        if ((array_attribute & ARRAY_SPARSE) || !shmem_accum_supported(data_class))
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Accumulator must be a dense numeric matrix");
+        array_attribute |= ARRAY_ACCUMULATE;
+        double n_stripes_value = shmem_option_scalar(spec, "Stripes", 0);
+        if (n_stripes_value < 0 || n_stripes_value > SHMEM_ACCUM_MAX_STRIPES || n_stripes_value != (double)(int)n_stripes_value)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Stripes must be an integer in range [0, %d]", SHMEM_ACCUM_MAX_STRIPES);
+        n_stripes = (unsigned long long)n_stripes_value;
+    }
+
+    const mxArray* dims_array = mxGetField(spec, 0, "Dims");
+    if (dims_array == NULL || !mxIsDouble(dims_array) || mxIsComplex(dims_array) || mxGetNumberOfElements(dims_array) < 2)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Dims must be a vector of at least 2 dimensions");
+    mwSize n_dims = (mwSize)mxGetNumberOfElements(dims_array);
+    if ((array_attribute & ARRAY_SPARSE) && n_dims != 2)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Sparse matrix only supports 2 dimensions");
+    mwSize static_dims[MAX_STATIC_ALLOCATED_DIMS];
+    mwSize* dims = (n_dims <= MAX_STATIC_ALLOCATED_DIMS) ? static_dims : (mwSize*)mxMalloc(sizeof(mwSize) * n_dims);
+    for (mwSize i = 0; i < n_dims; i++) {
+        double dim = mxGetPr(dims_array)[i];
+        if (dim < 0 || dim != (double)(mwSize)dim)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Dims must be non-negative integers");
+        dims[i] = (mwSize)dim;
+    }
+    mwSize committed_cols = dims[n_dims - 1];
+    double capacity = shmem_option_scalar(spec, "Capacity", 0);
+    if (capacity != 0) {
+        if (n_dims != 2 || (array_attribute & (ARRAY_SPARSE | ARRAY_ACCUMULATE)))
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Capacity is only supported for dense 2-D matrices");
+        if (capacity < committed_cols || capacity != (double)(mwSize)capacity)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Capacity must be an integer not less than the columns of Dims");
+        array_attribute |= ARRAY_APPEND;
+        // the payload is laid out for the capacity, the header records the committed columns
+        dims[1] = (mwSize)capacity;
+    }
+    double chunk = shmem_option_scalar(options, "Chunk", (double)SHMEM_APPEND_CHUNK_BYTES);
+    if (!(chunk >= 1) || chunk != (double)(unsigned long long)chunk)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Chunk must be a positive integer");
+    unsigned long long nzmax = 0;
+    if (array_attribute & ARRAY_SPARSE) {
+        double nzmax_value = shmem_option_scalar(spec, "Nzmax", 1);
+        if (nzmax_value < 1)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Nzmax must be a positive integer");
+        nzmax = (unsigned long long)nzmax_value;
+        SHMEM_DEBUG_OUTPUT("Nzmax: %lld\n", nzmax);
+    }
+
+    int hugepage_mode = SHMEM_HUGEPAGE_NONE;
+    unsigned long long hugepage_size = 0;
+    shmem_option_hugepages(options, &hugepage_mode, &hugepage_size);
+    shmem_numa_t numa;
+    shmem_option_numa(options, &numa);
+    if (numa.policy == SHMEM_NUMA_COLUMNS && (array_attribute & ARRAY_SPARSE))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option Numa \"columns\" is only supported for dense matrices");
+
+    // COMPUTE REQUIRED BYTES
+    unsigned int header_size_padded = 0;
+    unsigned long long payload_size_padded = 0;
+    shmem_layout_sizes(data_size, array_attribute, (unsigned int)n_dims, dims, nzmax, &header_size_padded, &payload_size_padded);
+    header_size_padded = (unsigned int)shmem_stats_header_size(header_size_padded);
+    if (shmem_option_scalar(options, "AlignColumns", 0) != 0 && !(array_attribute & ARRAY_SPARSE))
+        header_size_padded = shmem_align_data_start(header_size_padded, shmem_align_page_size(hugepage_mode, hugepage_size));
+    unsigned long long n_cols = 1;
+    for (mwSize i = 1; i < n_dims; i++)
+        n_cols *= dims[i];
+    unsigned long long accum_offset = 0, stripe_bytes = 0, stripe_offset = 0;
+    if (array_attribute & ARRAY_ACCUMULATE) {
+        unsigned long long data_bytes = dims[0] * n_cols * data_size;
+        accum_offset = shmem_accum_offset(header_size_padded, data_bytes);
+        shmem_accum_sizes(header_size_padded, data_bytes, n_stripes, shmem_align_page_size(hugepage_mode, hugepage_size), &stripe_bytes, &stripe_offset,
+                          &payload_size_padded);
+    }
+    unsigned long long total_size = header_size_padded + payload_size_padded;
+    SHMEM_DEBUG_OUTPUT("Total size: %lld\n", total_size);
+
+    unsigned long long* base_pointer = NULL;
+    unsigned long long* output_handle = NULL;
+    MATLAB_CREATE_UINT64_RETURN_MATRIX(0, base_pointer, unsigned long long);
+    MATLAB_CREATE_UINT64_RETURN_MATRIX(1, output_handle, unsigned long long);
+
+    // CREATE SHARED MEMORY (zero-initialized by the OS, an all-zero Jc is a valid empty sparse matrix)
+    shmem_handle_t shmem;
+    void* ptr = NULL;
+    unsigned long long segment_flags = 0;
+    shmem_create_segment(shmem_name, total_size, hugepage_mode, hugepage_size, &shmem, &ptr, &segment_flags);
+    if (shmem_name_is_file(shmem_name))
+        numa.policy = SHMEM_NUMA_NONE;
+    shmem_numa_setup(ptr, total_size, segment_flags, &numa, header_size_padded + ARRAY_HEADER_SIZE, dims[0] * (unsigned long long)data_size, n_cols);
+    dims[n_dims - 1] = committed_cols;
+    shmem_write_header(ptr, header_size_padded, data_class, array_attribute | segment_flags | SHMEM_FLAG_STATS, payload_size_padded, (unsigned int)n_dims, dims, nzmax);
+    if (array_attribute & ARRAY_ACCUMULATE)
+        shmem_accum_init(ptr, accum_offset, n_stripes, stripe_bytes, stripe_offset);
+    if (dims != static_dims)
+        mxFree(dims);
+
+    shmem_header_t hdr = { 0 };
+    const char* err_id = "SharedMatrix:CorruptMemory";
+    const char* err_msg = shmem_parse_header(ptr, total_size, &hdr);
+    mxArray* output_array = NULL;
+    unsigned long long append_bytes = 0;
+    if (err_msg == NULL && (array_attribute & ARRAY_APPEND)) {
+        // only the chunks holding the committed columns are backed, the header and ARRAY_HEADER are inside them
+        append_bytes = shmem_append_backing_bytes(&hdr, committed_cols, (unsigned long long)chunk);
+        int resize_err = shmem_resize_segment(shmem, append_bytes, segment_flags);
+        if (resize_err) {
+            shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+            mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "Failed to resize shared memory: %d", resize_err);
+        }
+#if SHMEM_API == SHMEM_WIN_API
+        append_bytes = total_size;
+#endif
+    }
+    if (err_msg == NULL) {
+#if ARRAY_HEADER_SIZE > 0
+        shmem_write_array_headers(&hdr, ((char*)ptr) + header_size_padded);
+#endif
+        output_array = shmem_create_attached_array(&hdr, ((char*)ptr) + header_size_padded, &err_id, &err_msg);
+    }
+    if (output_array == NULL) {
+        shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+        mexErrMsgIdAndTxt(err_id, "%s", err_msg);
+    }
+    // the output array is counted as an attach, it is detached by delete_shared_matrix
+    char* stats = shmem_stats_ptr(&hdr, ptr);
+    shmem_stats_init(stats, 0, 0, shmem_map_size(total_size, segment_flags), 0);
+    shmem_numa_record(stats, &numa);
+    if (array_attribute & ARRAY_APPEND) {
+        SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_APPEND_CAPACITY, (unsigned long long)capacity);
+        SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_APPEND_COLUMNS, committed_cols);
+        SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_APPEND_BYTES, append_bytes);
+    }
+    shmem_stats_add(stats, SHMEM_STATS_ACTIVE_ATTACHES, 1);
+    shmem_stats_add(stats, SHMEM_STATS_ATTACHES, 1);
+    plhs[2] = output_array;
+    if (nlhs >= 4) {
+        plhs[3] = mxCreateString(shmem_name);
+        if (plhs[3] == NULL) {
+            shmem_detach_array(output_array);
+            shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateString");
+        }
+    }
+    *base_pointer = (unsigned long long)ptr;
+    *output_handle = (unsigned long long)shmem;
+}
@@ -0,0 +1,136 @@
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_attach.h"
+#include "shmem_copy.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+
+// input arg [1]: base pointer of an appendable matrix (allocate_shared_matrix with Capacity)
+// input arg [2]: shared memory handle (allocate_shared_matrix)
+// input arg [3]: values, same class / complexity as the shared matrix with the same number of rows (dense), its
+//                columns are appended after the committed columns, empty for only extending input arg [4]
+// input arg [4]: (optional) cell of arrays over the matrix (the array returned by allocate_shared_matrix), extended to
+//                the committed columns after the append
+// input arg [5]: (optional) struct of options
+//   Threads / NonTemporal: same as create_shared_matrix
+//   Chunk: bytes the shared memory object grows by at a time (SHMEM_APPEND_CHUNK_BYTES by default)
+// output arg [1]: (optional) committed columns after the append
+// output arg [2]: (optional) struct: Columns (appended columns), Capacity, BackingBytes (bytes backed by the shared
+//                 memory object), GrownBytes (bytes added to the backing object by this call), Seconds, Throughput
+//                 (GB/s of the copy)
+// only the host appends (a single producer). The append is an in-place update (see shmem_sync.h), workers extend
+// their arrays to the new columns by read_shared_matrix(name, 'extend', cell) without attaching again
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("append_shared_matrix");
+    if (nlhs > 2)
+        mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "append_shared_matrix returns at most two values");
+    MATLAB_PRHS_PTR_CHECK_RANGE(3, 5);
+    const mxArray* options = nrhs > 4 ? prhs[4] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 5);
+
+    // address containing base ptr
+    if (!mxIsUint64(prhs[0]) || mxGetNumberOfElements(prhs[0]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 base pointer");
+    char* ptr_base = (char*)*(unsigned long long*)mxGetData(prhs[0]);
+    if (ptr_base == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
+    if (!mxIsUint64(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [2] must be a uint64 shared memory handle");
+    shmem_handle_t handle = (shmem_handle_t)*(unsigned long long*)mxGetData(prhs[1]);
+    shmem_header_t hdr = { 0 };
+    const char* header_err = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), &hdr);
+    if (header_err)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+    char* stats = shmem_stats_ptr(&hdr, ptr_base);
+    if (!(hdr.array_attribute & ARRAY_APPEND) || stats == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Shared matrix is not appendable, allocate it with Capacity");
+    const mxArray* cell = nrhs > 3 ? prhs[3] : NULL;
+    if (cell && !mxIsCell(cell) && !mxIsEmpty(cell))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [4] must be a cell");
+
+    double chunk = shmem_option_scalar(options, "Chunk", (double)SHMEM_APPEND_CHUNK_BYTES);
+    if (!(chunk >= 1) || chunk != (double)(unsigned long long)chunk)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Chunk must be a positive integer");
+    shmem_copy_options_t copy_options;
+    copy_options.n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    copy_options.non_temporal = (int)shmem_option_scalar(options, "NonTemporal", -1);
+    if (copy_options.n_threads < 0 || copy_options.n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+
+    // VALUE CHECK
+    const mxArray* values = prhs[2];
+    unsigned long long n_rows = shmem_header_dim(&hdr, 0);
+    unsigned long long capacity = SHMEM_READ_CAST(unsigned long long, stats, SHMEM_STATS_APPEND_CAPACITY);
+    unsigned long long committed = shmem_append_columns(stats);
+    unsigned long long n_cols = 0;
+    const char* src_pr = NULL;
+    if (!mxIsEmpty(values)) {
+        if (mxGetClassID(values) != (mxClassID)hdr.matrix_type)
+            mexErrMsgIdAndTxt("SharedMatrix:DataTypeError", "Values must have the same class as the shared matrix");
+        if (!mxIsComplex(values) != !(hdr.array_attribute & ARRAY_COMPLEX))
+            mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Complexity of values differs from the shared matrix");
+        if (mxIsSparse(values))
+            mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Values must be a dense matrix");
+        if (mxGetM(values) != n_rows)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Values must have %lld rows", n_rows);
+        n_cols = mxGetNumberOfElements(values) / n_rows;
+        if (n_cols > capacity - committed)
+            mexErrMsgIdAndTxt("SharedMatrix:CapacityExceeded", "Appending %lld columns exceeds the capacity of %lld columns (%lld committed)", n_cols, capacity, committed);
+        src_pr = (const char*)shmem_attached_data(values);
+        if (src_pr == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array");
+    }
+
+    // GROW AND APPEND
+    double start_time = shmem_time_seconds();
+    unsigned long long backing_bytes = SHMEM_READ_CAST(unsigned long long, stats, SHMEM_STATS_APPEND_BYTES);
+    unsigned long long grown_bytes = 0;
+    if (n_cols > 0) {
+        unsigned long long required = shmem_append_backing_bytes(&hdr, committed + n_cols, (unsigned long long)chunk);
+        if (required > backing_bytes) {
+            int resize_err = shmem_resize_segment(handle, required, hdr.segment_flags);
+            if (resize_err)
+                mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "Failed to grow shared memory to %lld bytes: %d", required, resize_err);
+            grown_bytes = required - backing_bytes;
+            backing_bytes = required;
+            SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_APPEND_BYTES, backing_bytes);
+        }
+        shmem_copy_task_t copy_task;
+        copy_task.dst = ptr_base + shmem_column_offset(&hdr, committed);
+        copy_task.src = src_pr;
+        copy_task.size = n_cols * n_rows * hdr.data_size;
+        shmem_version_begin(stats);
+        shmem_parallel_copy(&copy_task, 1, &copy_options, NULL);
+        committed += n_cols;
+        shmem_append_publish(stats, ptr_base, &hdr, committed);
+        shmem_version_end(stats);
+    }
+    double seconds = shmem_time_seconds() - start_time;
+
+    if (cell) {
+        for (size_t i = 0; i < mxGetNumberOfElements(cell); i++) {
+            mxArray* data_array = mxGetCell(cell, i);
+            if (data_array == NULL || shmem_attached_data(data_array) == NULL)
+                continue; // detached
+            if ((char*)shmem_attached_data(data_array) != ptr_base + shmem_column_offset(&hdr, 0))
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Array %d of input argument [4] is not attached to the shared matrix", (int)i + 1);
+            shmem_extend_array(data_array, committed);
+        }
+    }
+    if (nlhs > 0)
+        plhs[0] = mxCreateDoubleScalar((double)committed);
+    if (nlhs > 1) {
+        const char* info_fields[] = { "Columns", "Capacity", "BackingBytes", "GrownBytes", "Seconds", "Throughput" };
+        plhs[1] = mxCreateStructMatrix(1, 1, sizeof(info_fields) / sizeof(info_fields[0]), info_fields);
+        if (plhs[1] == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        shmem_set_field_scalar(plhs[1], "Columns", (double)n_cols);
+        shmem_set_field_scalar(plhs[1], "Capacity", (double)capacity);
+        shmem_set_field_scalar(plhs[1], "BackingBytes", (double)backing_bytes);
+        shmem_set_field_scalar(plhs[1], "GrownBytes", (double)grown_bytes);
+        shmem_set_field_scalar(plhs[1], "Seconds", seconds);
+        shmem_set_field_scalar(plhs[1], "Throughput", seconds > 0 ? (double)(n_cols * n_rows * hdr.data_size) / seconds / 1e9 : 0);
+    }
+}
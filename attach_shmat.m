@@ -7,8 +7,14 @@ function [dev_struct, data_struct] = attach_shmat(host_struct)
 % clear('a', 'b'); % remove the existed variable
 % [dev, data] = attach_shmat(host); % usually executed in parfor, etc.
 % disp(data.a); disp(data.b);
+if isa(host_struct, 'shared_matrix_host')
+    % bundle created by create_shmat, all variables are mapped at once
+    dev_struct = host_struct.attach();
+    data_struct = dev_struct.get_data();
+    return
+end
 if ~isstruct(host_struct)
-    error('Parameter host_struct must be an instance of struct');
+    error('Parameter host_struct must be an instance of struct or shared_matrix_host');
 end
 fields = fieldnames(host_struct);
 for i = 1:length(fields)
@@ -0,0 +1,153 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Minimal mock of the Matlab matrix API (mx* functions), enough to build the MEX sources outside of Matlab (see
+ * bench/Makefile), arrays use the interleaved complex layout of R2018a
+ */
+#pragma once
+#ifndef _SHMAT_MOCK_MATRIX_H_
+#define _SHMAT_MOCK_MATRIX_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef ptrdiff_t mwSignedIndex;
+
+typedef enum {
+    mxUNKNOWN_CLASS = 0, mxCELL_CLASS, mxSTRUCT_CLASS, mxLOGICAL_CLASS, mxCHAR_CLASS, mxVOID_CLASS,
+    mxDOUBLE_CLASS, mxSINGLE_CLASS, mxINT8_CLASS, mxUINT8_CLASS, mxINT16_CLASS, mxUINT16_CLASS,
+    mxINT32_CLASS, mxUINT32_CLASS, mxINT64_CLASS, mxUINT64_CLASS, mxFUNCTION_CLASS
+} mxClassID;
+typedef enum { mxREAL = 0, mxCOMPLEX = 1 } mxComplexity;
+typedef bool mxLogical;
+typedef char mxChar;
+
+#ifndef MX_HAS_INTERLEAVED_COMPLEX
+#define MX_HAS_INTERLEAVED_COMPLEX 1
+#endif
+
+typedef struct { double real, imag; } mxComplexDouble;
+typedef struct { float real, imag; } mxComplexSingle;
+typedef struct { int8_t real, imag; } mxComplexInt8;
+typedef struct { uint8_t real, imag; } mxComplexUint8;
+typedef struct { int16_t real, imag; } mxComplexInt16;
+typedef struct { uint16_t real, imag; } mxComplexUint16;
+typedef struct { int32_t real, imag; } mxComplexInt32;
+typedef struct { uint32_t real, imag; } mxComplexUint32;
+typedef struct { int64_t real, imag; } mxComplexInt64;
+typedef struct { uint64_t real, imag; } mxComplexUint64;
+
+typedef struct mxArray_tag mxArray;
+
+void* mxMalloc(size_t n);
+void* mxCalloc(size_t n, size_t size);
+void* mxRealloc(void* ptr, size_t n);
+void mxFree(void* ptr);
+void mxDestroyArray(mxArray* arr);
+mxArray* mxDuplicateArray(const mxArray* arr);
+
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID cls, mxComplexity flag);
+mxArray* mxCreateNumericArray(mwSize ndim, const mwSize* dims, mxClassID cls, mxComplexity flag);
+mxArray* mxCreateUninitNumericArray(mwSize ndim, const mwSize* dims, mxClassID cls, mxComplexity flag);
+mxArray* mxCreateUninitNumericMatrix(mwSize m, mwSize n, mxClassID cls, mxComplexity flag);
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag);
+mxArray* mxCreateDoubleScalar(double value);
+mxArray* mxCreateLogicalScalar(bool value);
+mxArray* mxCreateLogicalMatrix(mwSize m, mwSize n);
+mxArray* mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag);
+mxArray* mxCreateSparseLogicalMatrix(mwSize m, mwSize n, mwSize nzmax);
+mxArray* mxCreateString(const char* str);
+mxArray* mxCreateCharArray(mwSize ndim, const mwSize* dims);
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n);
+mxArray* mxCreateCellArray(mwSize ndim, const mwSize* dims);
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char** names);
+mxArray* mxCreateStructArray(mwSize ndim, const mwSize* dims, int nfields, const char** names);
+
+mxClassID mxGetClassID(const mxArray* arr);
+const char* mxGetClassName(const mxArray* arr);
+size_t mxGetElementSize(const mxArray* arr);
+mwSize mxGetNumberOfDimensions(const mxArray* arr);
+const mwSize* mxGetDimensions(const mxArray* arr);
+int mxSetDimensions(mxArray* arr, const mwSize* dims, mwSize ndim);
+size_t mxGetM(const mxArray* arr);
+size_t mxGetN(const mxArray* arr);
+void mxSetM(mxArray* arr, mwSize m);
+void mxSetN(mxArray* arr, mwSize n);
+size_t mxGetNumberOfElements(const mxArray* arr);
+bool mxIsEmpty(const mxArray* arr);
+
+double* mxGetPr(const mxArray* arr);
+void mxSetPr(mxArray* arr, double* pr);
+void* mxGetData(const mxArray* arr);
+void mxSetData(mxArray* arr, void* data);
+double mxGetScalar(const mxArray* arr);
+double mxGetNaN(void);
+double mxGetInf(void);
+mwIndex* mxGetIr(const mxArray* arr);
+mwIndex* mxGetJc(const mxArray* arr);
+void mxSetIr(mxArray* arr, mwIndex* ir);
+void mxSetJc(mxArray* arr, mwIndex* jc);
+mwSize mxGetNzmax(const mxArray* arr);
+void mxSetNzmax(mxArray* arr, mwSize nzmax);
+
+mxComplexDouble* mxGetComplexDoubles(const mxArray* arr);
+mxComplexSingle* mxGetComplexSingles(const mxArray* arr);
+mxComplexInt8* mxGetComplexInt8s(const mxArray* arr);
+mxComplexUint8* mxGetComplexUint8s(const mxArray* arr);
+mxComplexInt16* mxGetComplexInt16s(const mxArray* arr);
+mxComplexUint16* mxGetComplexUint16s(const mxArray* arr);
+mxComplexInt32* mxGetComplexInt32s(const mxArray* arr);
+mxComplexUint32* mxGetComplexUint32s(const mxArray* arr);
+mxComplexInt64* mxGetComplexInt64s(const mxArray* arr);
+mxComplexUint64* mxGetComplexUint64s(const mxArray* arr);
+int mxSetComplexDoubles(mxArray* arr, mxComplexDouble* p);
+int mxSetComplexSingles(mxArray* arr, mxComplexSingle* p);
+int mxSetComplexInt8s(mxArray* arr, mxComplexInt8* p);
+int mxSetComplexUint8s(mxArray* arr, mxComplexUint8* p);
+int mxSetComplexInt16s(mxArray* arr, mxComplexInt16* p);
+int mxSetComplexUint16s(mxArray* arr, mxComplexUint16* p);
+int mxSetComplexInt32s(mxArray* arr, mxComplexInt32* p);
+int mxSetComplexUint32s(mxArray* arr, mxComplexUint32* p);
+int mxSetComplexInt64s(mxArray* arr, mxComplexInt64* p);
+int mxSetComplexUint64s(mxArray* arr, mxComplexUint64* p);
+
+bool mxIsNumeric(const mxArray* arr);
+bool mxIsLogical(const mxArray* arr);
+bool mxIsChar(const mxArray* arr);
+bool mxIsCell(const mxArray* arr);
+bool mxIsStruct(const mxArray* arr);
+bool mxIsSparse(const mxArray* arr);
+bool mxIsComplex(const mxArray* arr);
+bool mxIsDouble(const mxArray* arr);
+bool mxIsSingle(const mxArray* arr);
+bool mxIsInt8(const mxArray* arr);
+bool mxIsInt16(const mxArray* arr);
+bool mxIsInt32(const mxArray* arr);
+bool mxIsInt64(const mxArray* arr);
+bool mxIsUint8(const mxArray* arr);
+bool mxIsUint16(const mxArray* arr);
+bool mxIsUint32(const mxArray* arr);
+bool mxIsUint64(const mxArray* arr);
+
+int mxGetString(const mxArray* arr, char* buf, mwSize buflen);
+char* mxArrayToString(const mxArray* arr);
+
+mxArray* mxGetCell(const mxArray* arr, mwIndex i);
+void mxSetCell(mxArray* arr, mwIndex i, mxArray* value);
+int mxGetNumberOfFields(const mxArray* arr);
+const char* mxGetFieldNameByNumber(const mxArray* arr, int n);
+int mxGetFieldNumber(const mxArray* arr, const char* name);
+mxArray* mxGetField(const mxArray* arr, mwIndex i, const char* name);
+mxArray* mxGetFieldByNumber(const mxArray* arr, mwIndex i, int n);
+void mxSetField(mxArray* arr, mwIndex i, const char* name, mxArray* value);
+void mxSetFieldByNumber(mxArray* arr, mwIndex i, int n, mxArray* value);
+
+#endif
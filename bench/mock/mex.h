@@ -0,0 +1,26 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Minimal mock of the Matlab MEX API (mex* functions)
+ */
+#pragma once
+#ifndef _SHMAT_MOCK_MEX_H_
+#define _SHMAT_MOCK_MEX_H_
+
+#include "matrix.h"
+
+void mexErrMsgIdAndTxt(const char* id, const char* fmt, ...);
+void mexWarnMsgIdAndTxt(const char* id, const char* fmt, ...);
+int mexPrintf(const char* fmt, ...);
+void mexLock(void);
+void mexUnlock(void);
+bool mexIsLocked(void);
+int mexAtExit(void (*fn)(void));
+void mexMakeArrayPersistent(mxArray* arr);
+void mexMakeMemoryPersistent(void* ptr);
+
+#endif
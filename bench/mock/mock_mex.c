@@ -0,0 +1,372 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Minimal mock of the Matlab MEX / matrix API
+ *
+ * Every buffer is preceded by a 16-byte header like buffers of the Matlab memory manager on GLNXA64 (it is copied as
+ * ARRAY_HEADER). mexErrMsgIdAndTxt returns to the enclosing mock_call by longjmp, memory allocated by the failed call
+ * is not released.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include "mex.h"
+#include "mock_mex.h"
+
+#define MOCK_BUFFER_HEADER_SIZE 16
+
+static void* mock_malloc(size_t n) {
+    char* p = (char*)malloc(n + MOCK_BUFFER_HEADER_SIZE);
+    if (p == NULL)
+        return NULL;
+    memset(p, 0x5a, MOCK_BUFFER_HEADER_SIZE);
+    return p + MOCK_BUFFER_HEADER_SIZE;
+}
+
+static void* mock_calloc(size_t n, size_t size) {
+    char* p = (char*)calloc(1, n * size + MOCK_BUFFER_HEADER_SIZE);
+    return p ? p + MOCK_BUFFER_HEADER_SIZE : NULL;
+}
+
+static void mock_free(void* p) {
+    if (p)
+        free(((char*)p) - MOCK_BUFFER_HEADER_SIZE);
+}
+
+static char* mock_strdup(const char* s) {
+    char* d = (char*)mock_malloc(strlen(s) + 1);
+    strcpy(d, s);
+    return d;
+}
+
+#define MOCK_MAX_DIMS 16
+
+struct mxArray_tag {
+    mxClassID cls;
+    int complex_flag;
+    int sparse;
+    mwSize ndims;
+    mwSize dims[MOCK_MAX_DIMS];
+    void* data;
+    mwIndex* ir;
+    mwIndex* jc;
+    mwSize nzmax;
+    int nfields;
+    char** field_names;
+};
+
+static jmp_buf* mock_jmp = NULL; // jump buffer of the innermost mock_call
+static char mock_err_id[128];
+static char mock_err_msg[512];
+int mock_lock_count = 0;
+static void (*mock_exit_fn)(void) = NULL;
+
+static size_t class_size(mxClassID cls) {
+    switch (cls) {
+    case mxDOUBLE_CLASS: case mxINT64_CLASS: case mxUINT64_CLASS: return 8;
+    case mxSINGLE_CLASS: case mxINT32_CLASS: case mxUINT32_CLASS: return 4;
+    case mxINT16_CLASS: case mxUINT16_CLASS: case mxCHAR_CLASS: return 2;
+    case mxINT8_CLASS: case mxUINT8_CLASS: case mxLOGICAL_CLASS: return 1;
+    case mxCELL_CLASS: case mxSTRUCT_CLASS: return sizeof(mxArray*);
+    default: return 0;
+    }
+}
+
+void* mxMalloc(size_t n) { return mock_malloc(n ? n : 1); }
+void* mxCalloc(size_t n, size_t size) { return mock_calloc(n ? n : 1, size ? size : 1); }
+void mxFree(void* ptr) { mock_free(ptr); }
+void* mxRealloc(void* ptr, size_t n) {
+    if (ptr == NULL)
+        return mock_malloc(n);
+    char* p = (char*)realloc(((char*)ptr) - MOCK_BUFFER_HEADER_SIZE, n + MOCK_BUFFER_HEADER_SIZE);
+    return p ? p + MOCK_BUFFER_HEADER_SIZE : NULL;
+}
+
+static mwSize numel(const mxArray* a) {
+    mwSize n = 1;
+    for (mwSize i = 0; i < a->ndims; i++) n *= a->dims[i];
+    return n;
+}
+
+static mxArray* new_array(mxClassID cls, mwSize ndim, const mwSize* dims, int complex_flag) {
+    if (ndim > MOCK_MAX_DIMS)
+        mexErrMsgIdAndTxt("Mock:NotSupported", "Too many dimensions");
+    mxArray* a = (mxArray*)mock_calloc(1, sizeof(mxArray));
+    a->cls = cls;
+    a->complex_flag = complex_flag;
+    a->ndims = ndim < 2 ? 2 : ndim;
+    a->dims[0] = a->dims[1] = 1;
+    for (mwSize i = 0; i < ndim; i++) a->dims[i] = dims[i];
+    while (a->ndims > 2 && a->dims[a->ndims - 1] == 1) a->ndims--;
+    return a;
+}
+
+mxArray* mxCreateNumericArray(mwSize ndim, const mwSize* dims, mxClassID cls, mxComplexity flag) {
+    mxArray* a = new_array(cls, ndim, dims, flag == mxCOMPLEX);
+    a->data = mock_calloc(numel(a) ? numel(a) : 1, class_size(cls) * (flag == mxCOMPLEX ? 2 : 1));
+    return a;
+}
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID cls, mxComplexity flag) {
+    mwSize dims[2] = { m, n };
+    return mxCreateNumericArray(2, dims, cls, flag);
+}
+// the mock initializes all arrays
+mxArray* mxCreateUninitNumericArray(mwSize ndim, const mwSize* dims, mxClassID cls, mxComplexity flag) { return mxCreateNumericArray(ndim, dims, cls, flag); }
+mxArray* mxCreateUninitNumericMatrix(mwSize m, mwSize n, mxClassID cls, mxComplexity flag) { return mxCreateNumericMatrix(m, n, cls, flag); }
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag) { return mxCreateNumericMatrix(m, n, mxDOUBLE_CLASS, flag); }
+mxArray* mxCreateDoubleScalar(double value) {
+    mxArray* a = mxCreateDoubleMatrix(1, 1, mxREAL);
+    *(double*)a->data = value;
+    return a;
+}
+mxArray* mxCreateLogicalMatrix(mwSize m, mwSize n) { return mxCreateNumericMatrix(m, n, mxLOGICAL_CLASS, mxREAL); }
+mxArray* mxCreateLogicalScalar(bool value) {
+    mxArray* a = mxCreateLogicalMatrix(1, 1);
+    *(mxLogical*)a->data = value;
+    return a;
+}
+static mxArray* create_sparse(mxClassID cls, mwSize m, mwSize n, mwSize nzmax, int complex_flag) {
+    mwSize dims[2] = { m, n };
+    mxArray* a = new_array(cls, 2, dims, complex_flag);
+    if (nzmax == 0) nzmax = 1;
+    a->sparse = 1;
+    a->nzmax = nzmax;
+    a->data = mock_calloc(nzmax, class_size(cls) * (complex_flag ? 2 : 1));
+    a->ir = (mwIndex*)mock_calloc(nzmax, sizeof(mwIndex));
+    a->jc = (mwIndex*)mock_calloc(n + 1, sizeof(mwIndex));
+    return a;
+}
+mxArray* mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag) { return create_sparse(mxDOUBLE_CLASS, m, n, nzmax, flag == mxCOMPLEX); }
+mxArray* mxCreateSparseLogicalMatrix(mwSize m, mwSize n, mwSize nzmax) { return create_sparse(mxLOGICAL_CLASS, m, n, nzmax, 0); }
+mxArray* mxCreateString(const char* str) {
+    mwSize dims[2] = { 1, strlen(str) };
+    mxArray* a = new_array(mxCHAR_CLASS, 2, dims, 0);
+    a->data = mock_calloc(dims[1] + 1, 1);
+    memcpy(a->data, str, dims[1]);
+    return a;
+}
+mxArray* mxCreateCharArray(mwSize ndim, const mwSize* dims) {
+    mxArray* a = new_array(mxCHAR_CLASS, ndim, dims, 0);
+    a->data = mock_calloc(numel(a) + 1, 2);
+    return a;
+}
+mxArray* mxCreateCellArray(mwSize ndim, const mwSize* dims) {
+    mxArray* a = new_array(mxCELL_CLASS, ndim, dims, 0);
+    a->data = mock_calloc(numel(a) ? numel(a) : 1, sizeof(mxArray*));
+    return a;
+}
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n) { mwSize dims[2] = { m, n }; return mxCreateCellArray(2, dims); }
+mxArray* mxCreateStructArray(mwSize ndim, const mwSize* dims, int nfields, const char** names) {
+    mxArray* a = new_array(mxSTRUCT_CLASS, ndim, dims, 0);
+    a->nfields = nfields;
+    a->field_names = (char**)mock_calloc(nfields ? nfields : 1, sizeof(char*));
+    for (int i = 0; i < nfields; i++) a->field_names[i] = mock_strdup(names[i]);
+    a->data = mock_calloc((numel(a) ? numel(a) : 1) * (nfields ? nfields : 1), sizeof(mxArray*));
+    return a;
+}
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char** names) { mwSize dims[2] = { m, n }; return mxCreateStructArray(2, dims, nfields, names); }
+
+void mxDestroyArray(mxArray* a) {
+    if (a == NULL) return;
+    if (a->cls == mxCELL_CLASS || a->cls == mxSTRUCT_CLASS) {
+        mwSize n = numel(a) * (a->cls == mxSTRUCT_CLASS ? a->nfields : 1);
+        for (mwSize i = 0; i < n; i++) mxDestroyArray(((mxArray**)a->data)[i]);
+        for (int i = 0; i < a->nfields; i++) mock_free(a->field_names[i]);
+        mock_free(a->field_names);
+    }
+    mock_free(a->data);
+    mock_free(a->ir);
+    mock_free(a->jc);
+    mock_free(a);
+}
+mxArray* mxDuplicateArray(const mxArray* src) {
+    mxArray* a = (mxArray*)mock_malloc(sizeof(mxArray));
+    *a = *src;
+    size_t es = class_size(src->cls) * (src->complex_flag ? 2 : 1);
+    size_t n = src->sparse ? src->nzmax : numel(src);
+    if (src->cls == mxSTRUCT_CLASS) n *= src->nfields;
+    a->data = mock_malloc((n ? n : 1) * es);
+    if (src->data) memcpy(a->data, src->data, n * es);
+    if (src->cls == mxCELL_CLASS || src->cls == mxSTRUCT_CLASS)
+        for (size_t i = 0; i < n; i++) ((mxArray**)a->data)[i] = ((mxArray**)src->data)[i] ? mxDuplicateArray(((mxArray**)src->data)[i]) : NULL;
+    if (src->nfields) {
+        a->field_names = (char**)mock_calloc(src->nfields, sizeof(char*));
+        for (int i = 0; i < src->nfields; i++) a->field_names[i] = mock_strdup(src->field_names[i]);
+    }
+    if (src->sparse) {
+        a->ir = (mwIndex*)mock_malloc(src->nzmax * sizeof(mwIndex));
+        memcpy(a->ir, src->ir, src->nzmax * sizeof(mwIndex));
+        a->jc = (mwIndex*)mock_malloc((src->dims[1] + 1) * sizeof(mwIndex));
+        memcpy(a->jc, src->jc, (src->dims[1] + 1) * sizeof(mwIndex));
+    }
+    return a;
+}
+
+mxClassID mxGetClassID(const mxArray* a) { return a->cls; }
+const char* mxGetClassName(const mxArray* a) {
+    static const char* names[] = { "unknown", "cell", "struct", "logical", "char", "void", "double", "single",
+        "int8", "uint8", "int16", "uint16", "int32", "uint32", "int64", "uint64", "function_handle" };
+    return names[a->cls];
+}
+size_t mxGetElementSize(const mxArray* a) { return class_size(a->cls) * (a->complex_flag ? 2 : 1); }
+mwSize mxGetNumberOfDimensions(const mxArray* a) { return a->ndims; }
+const mwSize* mxGetDimensions(const mxArray* a) { return a->dims; }
+int mxSetDimensions(mxArray* a, const mwSize* dims, mwSize ndim) {
+    if (ndim > MOCK_MAX_DIMS)
+        return 1;
+    a->ndims = ndim;
+    for (mwSize i = 0; i < ndim; i++) a->dims[i] = dims[i];
+    return 0;
+}
+size_t mxGetM(const mxArray* a) { return a->dims[0]; }
+size_t mxGetN(const mxArray* a) { size_t n = 1; for (mwSize i = 1; i < a->ndims; i++) n *= a->dims[i]; return n; }
+void mxSetM(mxArray* a, mwSize m) { a->dims[0] = m; }
+void mxSetN(mxArray* a, mwSize n) { a->ndims = 2; a->dims[1] = n; }
+size_t mxGetNumberOfElements(const mxArray* a) { return numel(a); }
+bool mxIsEmpty(const mxArray* a) { return numel(a) == 0; }
+
+double* mxGetPr(const mxArray* a) { return (double*)a->data; }
+void mxSetPr(mxArray* a, double* pr) { a->data = pr; }
+void* mxGetData(const mxArray* a) { return a->data; }
+void mxSetData(mxArray* a, void* data) { a->data = data; }
+double mxGetNaN(void) { return 0.0 / 0.0; }
+double mxGetInf(void) { return 1.0 / 0.0; }
+double mxGetScalar(const mxArray* a) {
+    if (a->data == NULL || numel(a) == 0) return 0;
+    switch (a->cls) {
+    case mxDOUBLE_CLASS: return *(double*)a->data;
+    case mxSINGLE_CLASS: return *(float*)a->data;
+    case mxINT8_CLASS: return *(int8_t*)a->data;
+    case mxUINT8_CLASS: case mxLOGICAL_CLASS: return *(uint8_t*)a->data;
+    case mxINT16_CLASS: return *(int16_t*)a->data;
+    case mxUINT16_CLASS: case mxCHAR_CLASS: return *(uint16_t*)a->data;
+    case mxINT32_CLASS: return *(int32_t*)a->data;
+    case mxUINT32_CLASS: return *(uint32_t*)a->data;
+    case mxINT64_CLASS: return (double)*(int64_t*)a->data;
+    case mxUINT64_CLASS: return (double)*(uint64_t*)a->data;
+    default: return 0;
+    }
+}
+mwIndex* mxGetIr(const mxArray* a) { return a->ir; }
+mwIndex* mxGetJc(const mxArray* a) { return a->jc; }
+void mxSetIr(mxArray* a, mwIndex* ir) { a->ir = ir; }
+void mxSetJc(mxArray* a, mwIndex* jc) { a->jc = jc; }
+mwSize mxGetNzmax(const mxArray* a) { return a->nzmax; }
+void mxSetNzmax(mxArray* a, mwSize nzmax) { a->nzmax = nzmax; }
+
+#define MOCK_COMPLEX(T) \
+    mxComplex##T* mxGetComplex##T##s(const mxArray* a) { return a->complex_flag ? (mxComplex##T*)a->data : NULL; } \
+    int mxSetComplex##T##s(mxArray* a, mxComplex##T* p) { a->data = p; return 1; }
+MOCK_COMPLEX(Double) MOCK_COMPLEX(Single) MOCK_COMPLEX(Int8) MOCK_COMPLEX(Uint8) MOCK_COMPLEX(Int16)
+MOCK_COMPLEX(Uint16) MOCK_COMPLEX(Int32) MOCK_COMPLEX(Uint32) MOCK_COMPLEX(Int64) MOCK_COMPLEX(Uint64)
+
+bool mxIsNumeric(const mxArray* a) { return a->cls >= mxDOUBLE_CLASS && a->cls <= mxUINT64_CLASS; }
+bool mxIsLogical(const mxArray* a) { return a->cls == mxLOGICAL_CLASS; }
+bool mxIsChar(const mxArray* a) { return a->cls == mxCHAR_CLASS; }
+bool mxIsCell(const mxArray* a) { return a->cls == mxCELL_CLASS; }
+bool mxIsStruct(const mxArray* a) { return a->cls == mxSTRUCT_CLASS; }
+bool mxIsSparse(const mxArray* a) { return a->sparse; }
+bool mxIsComplex(const mxArray* a) { return a->complex_flag; }
+bool mxIsDouble(const mxArray* a) { return a->cls == mxDOUBLE_CLASS; }
+bool mxIsSingle(const mxArray* a) { return a->cls == mxSINGLE_CLASS; }
+bool mxIsInt8(const mxArray* a) { return a->cls == mxINT8_CLASS; }
+bool mxIsInt16(const mxArray* a) { return a->cls == mxINT16_CLASS; }
+bool mxIsInt32(const mxArray* a) { return a->cls == mxINT32_CLASS; }
+bool mxIsInt64(const mxArray* a) { return a->cls == mxINT64_CLASS; }
+bool mxIsUint8(const mxArray* a) { return a->cls == mxUINT8_CLASS; }
+bool mxIsUint16(const mxArray* a) { return a->cls == mxUINT16_CLASS; }
+bool mxIsUint32(const mxArray* a) { return a->cls == mxUINT32_CLASS; }
+bool mxIsUint64(const mxArray* a) { return a->cls == mxUINT64_CLASS; }
+
+int mxGetString(const mxArray* a, char* buf, mwSize buflen) {
+    if (a->cls != mxCHAR_CLASS || buflen == 0) return 1;
+    size_t n = numel(a);
+    size_t copy = n < buflen - 1 ? n : buflen - 1;
+    memcpy(buf, a->data, copy);
+    buf[copy] = 0;
+    return copy < n;
+}
+char* mxArrayToString(const mxArray* a) {
+    if (a->cls != mxCHAR_CLASS) return NULL;
+    char* s = (char*)mock_malloc(numel(a) + 1);
+    memcpy(s, a->data, numel(a));
+    s[numel(a)] = 0;
+    return s;
+}
+
+mxArray* mxGetCell(const mxArray* a, mwIndex i) { return ((mxArray**)a->data)[i]; }
+void mxSetCell(mxArray* a, mwIndex i, mxArray* v) { ((mxArray**)a->data)[i] = v; }
+int mxGetNumberOfFields(const mxArray* a) { return a->nfields; }
+const char* mxGetFieldNameByNumber(const mxArray* a, int n) { return (n >= 0 && n < a->nfields) ? a->field_names[n] : NULL; }
+int mxGetFieldNumber(const mxArray* a, const char* name) {
+    for (int i = 0; i < a->nfields; i++) if (strcmp(a->field_names[i], name) == 0) return i;
+    return -1;
+}
+mxArray* mxGetFieldByNumber(const mxArray* a, mwIndex i, int n) { return ((mxArray**)a->data)[i * a->nfields + n]; }
+mxArray* mxGetField(const mxArray* a, mwIndex i, const char* name) {
+    int n = mxGetFieldNumber(a, name);
+    return n < 0 ? NULL : mxGetFieldByNumber(a, i, n);
+}
+void mxSetFieldByNumber(mxArray* a, mwIndex i, int n, mxArray* v) { ((mxArray**)a->data)[i * a->nfields + n] = v; }
+void mxSetField(mxArray* a, mwIndex i, const char* name, mxArray* v) {
+    int n = mxGetFieldNumber(a, name);
+    if (n >= 0) mxSetFieldByNumber(a, i, n, v);
+}
+
+void mexErrMsgIdAndTxt(const char* id, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    snprintf(mock_err_id, sizeof(mock_err_id), "%s", id);
+    vsnprintf(mock_err_msg, sizeof(mock_err_msg), fmt, args);
+    va_end(args);
+    if (mock_jmp) longjmp(*mock_jmp, 1);
+    fprintf(stderr, "%s: %s\n", mock_err_id, mock_err_msg);
+    abort();
+}
+void mexWarnMsgIdAndTxt(const char* id, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "Warning %s: ", id);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+int mexPrintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int r = vprintf(fmt, args);
+    va_end(args);
+    return r;
+}
+void mexLock(void) { mock_lock_count++; }
+void mexUnlock(void) { if (mock_lock_count > 0) mock_lock_count--; }
+bool mexIsLocked(void) { return mock_lock_count > 0; }
+int mexAtExit(void (*fn)(void)) { mock_exit_fn = fn; return 0; }
+
+void mock_unload(void) {
+    if (mock_exit_fn)
+        mock_exit_fn();
+    mock_exit_fn = NULL;
+    mock_lock_count = 0;
+}
+void mexMakeArrayPersistent(mxArray* arr) { (void)arr; }
+void mexMakeMemoryPersistent(void* ptr) { (void)ptr; }
+
+const char* mock_call(mock_mex_function fn, int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    jmp_buf env;
+    jmp_buf* saved = mock_jmp;
+    mock_jmp = &env;
+    if (setjmp(env)) {
+        mock_jmp = saved;
+        return mock_err_id;
+    }
+    fn(nlhs, plhs, nrhs, prhs);
+    mock_jmp = saved;
+    return NULL;
+}
+const char* mock_last_error(void) { return mock_err_msg; }
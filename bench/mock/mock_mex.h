@@ -0,0 +1,28 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Calling MEX functions built against the mock, each source is compiled with -DmexFunction=<name>_mex
+ */
+#pragma once
+#ifndef _SHMAT_MOCK_MEX_CALL_H_
+#define _SHMAT_MOCK_MEX_CALL_H_
+
+#include "mex.h"
+
+typedef void (*mock_mex_function)(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+
+// number of mexLock calls not balanced by mexUnlock
+extern int mock_lock_count;
+
+// calls a mexFunction, returns NULL on success or the error identifier raised by mexErrMsgIdAndTxt
+const char* mock_call(mock_mex_function fn, int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+// message of the last error raised by mexErrMsgIdAndTxt
+const char* mock_last_error(void);
+// runs the function registered by mexAtExit, the same as "clear mex" in Matlab
+void mock_unload(void);
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Benchmark of create / attach / detach without Matlab (POSIX API only)
+ *
+ * create_shared_matrix, read_shared_matrix and delete_shared_matrix are built against the mock MEX API (see Makefile)
+ * and called directly. For every matrix size, class and kind (dense / sparse) it reports
+ *   create: copy throughput and wall time, minor page faults of the host
+ *   attach: latency percentiles of the first (cold, the segment is mapped) and later (warm, attach cache hit) attaches
+ *   detach: latency percentiles
+ *   readers: 1..N forked processes attach the matrix concurrently and read all its pages, attach latency percentiles
+ *            over all readers, aggregate read bandwidth and page faults per reader
+ * The data read by every process is verified against a checksum of the source, the exit status is non-zero if any
+ * check or MEX call fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "mock_mex.h"
+
+#define MEX_FUNCTION(name) void name##_mex(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+MEX_FUNCTION(create_shared_matrix);
+MEX_FUNCTION(read_shared_matrix);
+MEX_FUNCTION(delete_shared_matrix);
+
+#define BENCH_MAX_LIST 16
+// rows of dense matrices, and of sparse matrices (with BENCH_SPARSE_PER_COLUMN non-zero elements per column)
+#define BENCH_DENSE_ROWS 4096
+#define BENCH_SPARSE_ROWS 65536
+#define BENCH_SPARSE_PER_COLUMN 512
+
+typedef struct {
+    unsigned long long sizes[BENCH_MAX_LIST]; // payload bytes of the source matrix
+    int n_sizes;
+    mxClassID classes[BENCH_MAX_LIST];
+    int n_classes;
+    int dense;
+    int sparse;
+    int readers[BENCH_MAX_LIST];
+    int n_readers;
+    int iterations; // warm attach / detach iterations, cold attaches use iterations / 10
+    int threads; // option Threads of create_shared_matrix
+    const char* hugepages;
+    FILE* csv;
+} bench_options_t;
+
+// result of a reader process, sent to the parent through a pipe
+typedef struct {
+    double attach_seconds;
+    double read_seconds;
+    unsigned long long bytes;
+    long minor_faults;
+    long major_faults;
+    int ok;
+} bench_reader_result_t;
+
+static int bench_failures = 0;
+
+static double bench_time_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_faults(long* minor_faults, long* major_faults) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    *minor_faults = usage.ru_minflt;
+    *major_faults = usage.ru_majflt;
+}
+
+static int bench_compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// p-th percentile (0-100) of n samples, sorts samples
+static double bench_percentile(double* samples, int n, double p) {
+    if (n == 0)
+        return 0;
+    qsort(samples, n, sizeof(double), bench_compare_double);
+    int i = (int)(p / 100 * (n - 1) + 0.5);
+    return samples[i];
+}
+
+// call a MEX function, failures are reported and counted, returns 0 on failure
+static int bench_call(const char* what, mock_mex_function fn, int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    const char* err = mock_call(fn, nlhs, plhs, nrhs, (const mxArray**)prhs);
+    if (err == NULL)
+        return 1;
+    fprintf(stderr, "%s failed: %s: %s\n", what, err, mock_last_error());
+    bench_failures++;
+    return 0;
+}
+
+// checksum of n bytes (sum of 64-bit words and the remaining bytes), reads every byte
+static unsigned long long bench_checksum(const void* ptr, unsigned long long n) {
+    const unsigned long long* words = (const unsigned long long*)ptr;
+    unsigned long long sum = 0, n_words = n / 8;
+    for (unsigned long long i = 0; i < n_words; i++)
+        sum += words[i] ^ i;
+    for (unsigned long long i = n_words * 8; i < n; i++)
+        sum += ((const unsigned char*)ptr)[i];
+    return sum;
+}
+
+// checksum of the data (and row indices) of a dense or sparse matrix
+static unsigned long long bench_matrix_checksum(const mxArray* arr, unsigned long long* bytes) {
+    unsigned long long n = mxIsSparse(arr) ? mxGetJc(arr)[mxGetN(arr)] : mxGetNumberOfElements(arr);
+    unsigned long long sum = bench_checksum(mxGetData(arr), n * mxGetElementSize(arr));
+    *bytes = n * mxGetElementSize(arr);
+    if (mxIsSparse(arr)) {
+        sum += bench_checksum(mxGetIr(arr), n * sizeof(mwIndex)) + bench_checksum(mxGetJc(arr), (mxGetN(arr) + 1) * sizeof(mwIndex));
+        *bytes += (n + mxGetN(arr) + 1) * sizeof(mwIndex);
+    }
+    return sum;
+}
+
+// source matrix of about size bytes (data and row indices)
+static mxArray* bench_source(mxClassID cls, int sparse, unsigned long long size) {
+    if (sparse) {
+        unsigned long long nnz_per_col = BENCH_SPARSE_PER_COLUMN;
+        unsigned long long n_cols = size / (nnz_per_col * (8 + sizeof(mwIndex)));
+        if (n_cols == 0) n_cols = 1;
+        mxArray* arr = mxCreateSparse(BENCH_SPARSE_ROWS, n_cols, n_cols * nnz_per_col, mxREAL);
+        mwIndex* ir = mxGetIr(arr);
+        mwIndex* jc = mxGetJc(arr);
+        double* pr = mxGetPr(arr);
+        unsigned long long k = 0;
+        for (unsigned long long c = 0; c < n_cols; c++) {
+            jc[c] = k;
+            for (unsigned long long i = 0; i < nnz_per_col; i++, k++) {
+                ir[k] = i * (BENCH_SPARSE_ROWS / nnz_per_col) + (c % (BENCH_SPARSE_ROWS / nnz_per_col));
+                pr[k] = (double)(k % 1000) + 0.5;
+            }
+        }
+        jc[n_cols] = k;
+        return arr;
+    }
+    mxArray* probe = mxCreateNumericMatrix(1, 1, cls, mxREAL);
+    unsigned long long element_size = mxGetElementSize(probe);
+    mxDestroyArray(probe);
+    unsigned long long n_cols = size / (BENCH_DENSE_ROWS * element_size);
+    if (n_cols == 0) n_cols = 1;
+    mxArray* arr = mxCreateNumericMatrix(BENCH_DENSE_ROWS, n_cols, cls, mxREAL);
+    unsigned char* data = (unsigned char*)mxGetData(arr);
+    unsigned long long n_bytes = BENCH_DENSE_ROWS * n_cols * element_size;
+    for (unsigned long long i = 0; i < n_bytes; i++)
+        data[i] = (unsigned char)(i * 2654435761ULL >> 13);
+    return arr;
+}
+
+static mxArray* bench_detach_args(const char* name, mxArray* arr, mxArray** args) {
+    mxArray* cell = mxCreateCellMatrix(1, 1);
+    mxSetCell(cell, 0, arr);
+    args[0] = mxCreateString(name);
+    args[1] = mxCreateString("detach");
+    args[2] = cell;
+    return cell;
+}
+
+static void bench_destroy_args(mxArray** args, int n) {
+    for (int i = 0; i < n; i++)
+        mxDestroyArray(args[i]);
+}
+
+// attach name (read-only), returns the attached array or NULL, *seconds is the latency
+static mxArray* bench_attach(const char* name, double* seconds) {
+    const char* fields[] = { "Mode" };
+    mxArray* args[2] = { mxCreateString(name), mxCreateStructMatrix(1, 1, 1, fields) };
+    mxSetField(args[1], 0, "Mode", mxCreateString("readonly"));
+    mxArray* out[3] = { NULL, NULL, NULL };
+    double start_time = bench_time_seconds();
+    int ok = bench_call("read_shared_matrix", read_shared_matrix_mex, 3, out, 2, args);
+    *seconds = bench_time_seconds() - start_time;
+    bench_destroy_args(args, 2);
+    mxDestroyArray(out[1]);
+    mxDestroyArray(out[2]);
+    return ok ? out[0] : NULL;
+}
+
+// detach arr (the array is destroyed), returns the latency
+static double bench_detach(const char* name, mxArray* arr) {
+    mxArray* args[3];
+    bench_detach_args(name, arr, args);
+    double start_time = bench_time_seconds();
+    bench_call("read_shared_matrix (detach)", read_shared_matrix_mex, 0, NULL, 3, args);
+    double seconds = bench_time_seconds() - start_time;
+    bench_destroy_args(args, 3); // the cell destroys the detached (empty) array
+    return seconds;
+}
+
+static void bench_flush(void) {
+    mxArray* args[2] = { mxCreateString(""), mxCreateString("flush") };
+    bench_call("read_shared_matrix (flush)", read_shared_matrix_mex, 0, NULL, 2, args);
+    bench_destroy_args(args, 2);
+}
+
+// reader process: waits for the start signal, attaches, reads and verifies the matrix, writes the result to fd
+static void bench_reader(const char* name, int start_fd, int result_fd, unsigned long long checksum) {
+    bench_reader_result_t result;
+    memset(&result, 0, sizeof(result));
+    char go;
+    if (read(start_fd, &go, 1) != 1)
+        _exit(1);
+    long minor_start, major_start, minor_end, major_end;
+    bench_faults(&minor_start, &major_start);
+    mxArray* arr = bench_attach(name, &result.attach_seconds);
+    if (arr) {
+        double start_time = bench_time_seconds();
+        result.ok = bench_matrix_checksum(arr, &result.bytes) == checksum;
+        result.read_seconds = bench_time_seconds() - start_time;
+        bench_detach(name, arr);
+    }
+    bench_faults(&minor_end, &major_end);
+    result.minor_faults = minor_end - minor_start;
+    result.major_faults = major_end - major_start;
+    if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+        _exit(1);
+    _exit(0);
+}
+
+// run n_readers reader processes concurrently, prints their statistics
+static void bench_readers(const char* label, const char* name, int n_readers, unsigned long long checksum, const bench_options_t* options) {
+    int start_pipe[2], result_pipe[2];
+    if (pipe(start_pipe) || pipe(result_pipe)) {
+        perror("pipe");
+        bench_failures++;
+        return;
+    }
+    fflush(stdout);
+    int n_started = 0;
+    for (int i = 0; i < n_readers; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(start_pipe[1]);
+            close(result_pipe[0]);
+            bench_reader(name, start_pipe[0], result_pipe[1], checksum);
+        }
+        if (pid > 0)
+            n_started++;
+    }
+    close(start_pipe[0]);
+    close(result_pipe[1]);
+    // all readers start at the same time
+    double start_time = bench_time_seconds();
+    for (int i = 0; i < n_started; i++)
+        if (write(start_pipe[1], "g", 1) != 1)
+            break;
+    close(start_pipe[1]);
+
+    double* attach_samples = (double*)malloc(sizeof(double) * (n_started > 0 ? n_started : 1));
+    int n_results = 0, n_ok = 0;
+    double sum_faults = 0;
+    unsigned long long bytes = 0;
+    bench_reader_result_t result;
+    while (n_results < n_started && read(result_pipe[0], &result, sizeof(result)) == sizeof(result)) {
+        attach_samples[n_results++] = result.attach_seconds;
+        n_ok += result.ok;
+        sum_faults += result.minor_faults + result.major_faults;
+        bytes += result.bytes;
+    }
+    double wall_seconds = bench_time_seconds() - start_time;
+    close(result_pipe[0]);
+    for (int i = 0; i < n_started; i++)
+        wait(NULL);
+    if (n_ok != n_readers) {
+        fprintf(stderr, "%s: %d of %d readers failed\n", label, n_readers - n_ok, n_readers);
+        bench_failures++;
+    }
+    double p50 = bench_percentile(attach_samples, n_results, 50) * 1e6;
+    double p99 = bench_percentile(attach_samples, n_results, 99) * 1e6;
+    double bandwidth = wall_seconds > 0 ? bytes / wall_seconds / 1e9 : 0;
+    double faults = n_results > 0 ? sum_faults / n_results : 0;
+    printf("  %2d readers: attach p50 %9.1f us  p99 %9.1f us  read %7.2f GB/s  faults/reader %9.0f\n", n_readers, p50, p99, bandwidth, faults);
+    if (options->csv)
+        fprintf(options->csv, "%s,readers,%d,%.3f,%.3f,%.4f,%.0f\n", label, n_readers, p50, p99, bandwidth, faults);
+    free(attach_samples);
+}
+
+static void bench_matrix(const char* label, mxArray* src, const bench_options_t* options) {
+    char name[64];
+    snprintf(name, sizeof(name), "shmat_bench_%d", (int)getpid());
+    unsigned long long src_bytes;
+    unsigned long long checksum = bench_matrix_checksum(src, &src_bytes);
+
+    // CREATE
+    const char* fields[] = { "Threads", "HugePages" };
+    mxArray* create_args[3] = { mxCreateString(name), src, mxCreateStructMatrix(1, 1, 2, fields) };
+    mxSetField(create_args[2], 0, "Threads", mxCreateDoubleScalar(options->threads));
+    mxSetField(create_args[2], 0, "HugePages", mxCreateString(options->hugepages));
+    mxArray* host[3] = { NULL, NULL, NULL };
+    long minor_start, major_start, minor_end, major_end;
+    bench_faults(&minor_start, &major_start);
+    double start_time = bench_time_seconds();
+    int ok = bench_call("create_shared_matrix", create_shared_matrix_mex, 3, host, 3, create_args);
+    double create_seconds = bench_time_seconds() - start_time;
+    bench_faults(&minor_end, &major_end);
+    mxDestroyArray(create_args[0]);
+    mxDestroyArray(create_args[2]);
+    if (!ok)
+        return;
+    double throughput = mxGetScalar(mxGetField(host[2], 0, "Throughput"));
+    printf("%-24s %9.1f MB  create %8.3f ms  %7.2f GB/s  faults %9ld\n", label, src_bytes / 1e6, create_seconds * 1e3, throughput,
+           (minor_end - minor_start) + (major_end - major_start));
+    if (options->csv)
+        fprintf(options->csv, "%s,create,%llu,%.6f,%.4f,%ld\n", label, src_bytes, create_seconds, throughput, (minor_end - minor_start) + (major_end - major_start));
+
+    // ATTACH / DETACH
+    int n_cold = options->iterations / 10 > 0 ? options->iterations / 10 : 1;
+    double* cold = (double*)malloc(sizeof(double) * n_cold);
+    double* warm = (double*)malloc(sizeof(double) * options->iterations);
+    double* detach = (double*)malloc(sizeof(double) * options->iterations);
+    for (int i = 0; i < n_cold; i++) {
+        mxArray* arr = bench_attach(name, &cold[i]);
+        if (arr == NULL)
+            break;
+        unsigned long long bytes;
+        if (i == 0 && bench_matrix_checksum(arr, &bytes) != checksum) {
+            fprintf(stderr, "%s: attached data differs from the source\n", label);
+            bench_failures++;
+        }
+        bench_detach(name, arr);
+        bench_flush(); // the next attach maps the segment again
+    }
+    // the first attach maps the segment, it is kept by the attach cache for the warm attaches
+    double first;
+    mxArray* keep = bench_attach(name, &first);
+    for (int i = 0; keep && i < options->iterations; i++) {
+        mxArray* arr = bench_attach(name, &warm[i]);
+        if (arr == NULL)
+            break;
+        detach[i] = bench_detach(name, arr);
+    }
+    if (keep)
+        bench_detach(name, keep);
+    bench_flush();
+    double cold_p50 = bench_percentile(cold, n_cold, 50) * 1e6, cold_p99 = bench_percentile(cold, n_cold, 99) * 1e6;
+    double warm_p50 = bench_percentile(warm, options->iterations, 50) * 1e6, warm_p99 = bench_percentile(warm, options->iterations, 99) * 1e6;
+    double detach_p50 = bench_percentile(detach, options->iterations, 50) * 1e6, detach_p99 = bench_percentile(detach, options->iterations, 99) * 1e6;
+    printf("  attach cold p50 %9.1f us  p99 %9.1f us | warm p50 %7.1f us  p99 %7.1f us | detach p50 %7.1f us  p99 %7.1f us\n",
+           cold_p50, cold_p99, warm_p50, warm_p99, detach_p50, detach_p99);
+    if (options->csv) {
+        fprintf(options->csv, "%s,attach_cold,%.3f,%.3f\n", label, cold_p50, cold_p99);
+        fprintf(options->csv, "%s,attach_warm,%.3f,%.3f\n", label, warm_p50, warm_p99);
+        fprintf(options->csv, "%s,detach,%.3f,%.3f\n", label, detach_p50, detach_p99);
+    }
+    free(cold);
+    free(warm);
+    free(detach);
+
+    // CONCURRENT READERS
+    for (int i = 0; i < options->n_readers; i++)
+        bench_readers(label, name, options->readers[i], checksum, options);
+
+    // DELETE
+    mxArray* delete_args[4] = { host[1], host[0], mxCreateDoubleMatrix(0, 0, mxREAL), mxCreateString(name) };
+    start_time = bench_time_seconds();
+    bench_call("delete_shared_matrix", delete_shared_matrix_mex, 0, NULL, 4, delete_args);
+    printf("  delete %.3f ms\n", (bench_time_seconds() - start_time) * 1e3);
+    bench_destroy_args(delete_args, 4);
+    mxDestroyArray(host[2]);
+}
+
+// parse "1M,64M,1G" style list of sizes, returns number of items
+static int bench_parse_sizes(const char* str, unsigned long long* sizes) {
+    int n = 0;
+    char* buf = strdup(str);
+    for (char* tok = strtok(buf, ","); tok && n < BENCH_MAX_LIST; tok = strtok(NULL, ",")) {
+        char* end;
+        unsigned long long value = strtoull(tok, &end, 10);
+        if (*end == 'K' || *end == 'k') value <<= 10;
+        else if (*end == 'M' || *end == 'm') value <<= 20;
+        else if (*end == 'G' || *end == 'g') value <<= 30;
+        if (value > 0)
+            sizes[n++] = value;
+    }
+    free(buf);
+    return n;
+}
+
+static int bench_parse_ints(const char* str, int* values) {
+    int n = 0;
+    char* buf = strdup(str);
+    for (char* tok = strtok(buf, ","); tok && n < BENCH_MAX_LIST; tok = strtok(NULL, ","))
+        if (atoi(tok) > 0)
+            values[n++] = atoi(tok);
+    free(buf);
+    return n;
+}
+
+static int bench_parse_classes(const char* str, mxClassID* classes) {
+    static const struct { const char* name; mxClassID cls; } names[] = {
+        { "double", mxDOUBLE_CLASS }, { "single", mxSINGLE_CLASS }, { "int8", mxINT8_CLASS }, { "uint8", mxUINT8_CLASS },
+        { "int16", mxINT16_CLASS }, { "uint16", mxUINT16_CLASS }, { "int32", mxINT32_CLASS }, { "uint32", mxUINT32_CLASS },
+        { "int64", mxINT64_CLASS }, { "uint64", mxUINT64_CLASS }, { "logical", mxLOGICAL_CLASS }
+    };
+    int n = 0;
+    char* buf = strdup(str);
+    for (char* tok = strtok(buf, ","); tok && n < BENCH_MAX_LIST; tok = strtok(NULL, ","))
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (strcmp(tok, names[i].name) == 0)
+                classes[n++] = names[i].cls;
+    free(buf);
+    return n;
+}
+
+static void bench_usage(const char* prog) {
+    printf("usage: %s [options]\n"
+           "  --sizes LIST       payload sizes, e.g. 1M,64M,1G (default: 1M,16M,256M)\n"
+           "  --classes LIST     classes of dense matrices, e.g. double,single,int8 (default: double,single)\n"
+           "  --dense-only       skip sparse matrices\n"
+           "  --sparse-only      skip dense matrices\n"
+           "  --readers LIST     numbers of concurrent reader processes (default: 1,2,4,8)\n"
+           "  --iterations N     attach / detach iterations (default: 200)\n"
+           "  --threads N        copy threads of create, 0 for automatic selection (default: 0)\n"
+           "  --hugepages MODE   option HugePages of create (default: none)\n"
+           "  --csv FILE         also write the results to FILE\n"
+           "  --quick            small sweep for a quick check (1M,8M, 1,2 readers, 20 iterations)\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    bench_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.n_sizes = bench_parse_sizes("1M,16M,256M", options.sizes);
+    options.n_classes = bench_parse_classes("double,single", options.classes);
+    options.dense = options.sparse = 1;
+    options.n_readers = bench_parse_ints("1,2,4,8", options.readers);
+    options.iterations = 200;
+    options.hugepages = "none";
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--quick") == 0) {
+            options.n_sizes = bench_parse_sizes("1M,8M", options.sizes);
+            options.n_readers = bench_parse_ints("1,2", options.readers);
+            options.iterations = 20;
+        }
+        else if (strcmp(arg, "--dense-only") == 0) options.sparse = 0;
+        else if (strcmp(arg, "--sparse-only") == 0) options.dense = 0;
+        else if (value && strcmp(arg, "--sizes") == 0) { options.n_sizes = bench_parse_sizes(value, options.sizes); i++; }
+        else if (value && strcmp(arg, "--classes") == 0) { options.n_classes = bench_parse_classes(value, options.classes); i++; }
+        else if (value && strcmp(arg, "--readers") == 0) { options.n_readers = bench_parse_ints(value, options.readers); i++; }
+        else if (value && strcmp(arg, "--iterations") == 0) { options.iterations = atoi(value); i++; }
+        else if (value && strcmp(arg, "--threads") == 0) { options.threads = atoi(value); i++; }
+        else if (value && strcmp(arg, "--hugepages") == 0) { options.hugepages = value; i++; }
+        else if (value && strcmp(arg, "--csv") == 0) {
+            options.csv = fopen(value, "w");
+            if (options.csv == NULL) {
+                perror(value);
+                return 2;
+            }
+            i++;
+        }
+        else {
+            bench_usage(argv[0]);
+            return strcmp(arg, "--help") == 0 ? 0 : 2;
+        }
+    }
+    if (options.n_sizes == 0 || options.iterations <= 0 || (options.dense && options.n_classes == 0)) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+    if (options.csv)
+        fprintf(options.csv, "matrix,metric,values...\n");
+
+    for (int s = 0; s < options.n_sizes; s++) {
+        char label[64];
+        for (int c = 0; options.dense && c < options.n_classes; c++) {
+            mxArray* src = bench_source(options.classes[c], 0, options.sizes[s]);
+            snprintf(label, sizeof(label), "dense %s %lluM", mxGetClassName(src), options.sizes[s] >> 20);
+            bench_matrix(label, src, &options);
+            mxDestroyArray(src);
+        }
+        if (options.sparse) {
+            mxArray* src = bench_source(mxDOUBLE_CLASS, 1, options.sizes[s]);
+            snprintf(label, sizeof(label), "sparse double %lluM", options.sizes[s] >> 20);
+            bench_matrix(label, src, &options);
+            mxDestroyArray(src);
+        }
+    }
+    mock_unload();
+    if (options.csv)
+        fclose(options.csv);
+    if (bench_failures) {
+        printf("%d failures\n", bench_failures);
+        return 1;
+    }
+    return 0;
+}
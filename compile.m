@@ -6,7 +6,7 @@ try
     disp('Compiling test_platform.c');
     mex('test_platform.c', '-silent');
     platform = test_platform();
-    compile_files = {'create_shared_matrix.c', 'delete_shared_matrix.c', 'read_shared_matrix.c'};
+    compile_files = {'create_shared_matrix.c', 'delete_shared_matrix.c', 'read_shared_matrix.c', 'allocate_shared_matrix.c', 'write_shared_matrix.c', 'decode_shared_matrix.c', 'compute_shared_matrix.c', 'shared_matrix_stats.c', 'shared_matrix_gc.c', 'load_shared_matrix.c', 'accumulate_shared_matrix.c', 'output_shared_matrix.c', 'append_shared_matrix.c', 'shared_matrix_trace.c'};
     wrap_mex = @mex;
     % build silently
     wrap_mex = @(file, varargin) wrap_mex(file, '-silent', varargin{:});
@@ -14,7 +14,7 @@ try
         disp('Compiler: MSVC, using WIN API');
     elseif platform == 2
         disp('Compiler: GCC, using POSIX API');
-        wrap_mex = @(file, varargin) wrap_mex(file, varargin{:}, '-lrt');
+        wrap_mex = @(file, varargin) wrap_mex(file, varargin{:}, '-lrt', '-lpthread');
     else
         error('SharedMatrix:NotSupported', 'Underlying supported API not found');
     end
@@ -5,7 +5,7 @@
  */
 
 /*
- * MEMORY LAYOUT documentation V1.0.3
+ * MEMORY LAYOUT documentation V1.0.10
  *
  * <<< SHARED MEMORY POINTER STARTS HERE
  * 
@@ -13,17 +13,23 @@
  * uint32 LAYOUT_VERSION default: SHMEM_MEMORY_LAYOUT_VERSION, for future compatibility usage
  * uint32 HEADER_SIZE, size (in byte) of the header
  * uint64 MATRIX_TYPE, indicating the matrix type (double, single, int, uint, etc)
- * uint64 MATRIX_FLAG, indicating the matrix is sparse, complex, etc
+ * uint64 MATRIX_FLAG, indicating the matrix is sparse, complex, etc (bit 0-7), and segment attributes (bit 8-23, see SHMEM_FLAG_*)
  * uint64 PAYLOAD_SIZE, size (in byte) of payload
  * uint32 N_MATRIX_DIMENSION, number of dimensions of shared matrix
  * (uint64*N_MATRIX_DIMENSION) MATRIX_DIMENSIONS, size of each dimension
  * uint64 (optional) NZ_MAX, max allocated size for sparse matrix, optional, required when sparse flag is set
+ * uint64 (optional) ENCODING, double SCALE, double OFFSET, reduced precision encoding of ARRAY_DATA (see
+ *     shmem_codec.h), required when ARRAY_ENCODED is set, MATRIX_TYPE is still the class of the decoded elements
+ * (byte*SHMEM_STATS_BYTES) (optional) STATISTICS, usage counters and references of the segment (see shmem_stats.h),
+ *     starts at the next multiple of SHMEM_STATS_LINE_BYTES after the fields above, present in the header of the
+ *     segment (not in nested blocks) if SHMEM_FLAG_STATS is set
  * 
- * (unused memory padded to SHMEM_DATA_PADDED_BYTES bytes)
+ * (unused memory padded to SHMEM_DATA_PADDED_BYTES bytes, or until ARRAY_DATA starts at a page boundary if the
+ * matrix is created with option AlignColumns)
  * 
  * [ P A Y L O A D ]
  * (byte*16) (optional) ARRAY_HEADER, Matlab matrix header (required in Linux R2017b)
- * (byte*N) ARRAY_DATA, data payload (real / interleaved complex)
+ * (byte*N) ARRAY_DATA, data payload (real / interleaved complex, or codes of ENCODING)
  * (unused memory padded to SHMEM_DATA_PADDED_BYTES bytes)
  * 
  * (byte*(NZMAX*sizeof(mwIndex))) (optional) SPARSE_MATRIX_IR, Ir value for sparse matrix
@@ -31,8 +37,48 @@
  * 
  * (byte*(NZMAX*sizeof(mwIndex))) (optional) SPARSE_MATRIX_JC, Jc value for sparse matrix
  * (unused memory padded to SHMEM_DATA_PADDED_BYTES bytes)
+ *
+ * (unused memory padded to SHMEM_BUNDLE_ALIGN_BYTES bytes, relative to the matrix header)
+ * (optional) TRANSPOSED_MATRIX, header and payload of the transpose of a sparse matrix (NZ_MAX is the number of
+ * non-zero elements), present if ARRAY_TRANSPOSE is set in MATRIX_FLAG, included in PAYLOAD_SIZE
+ *
+ * (unused memory padded to SHMEM_BUNDLE_ALIGN_BYTES bytes, relative to the matrix header)
+ * (optional) ACCUMULATOR, stripe table and private stripes of a dense accumulator (see shmem_accum.h), present if
+ * ARRAY_ACCUMULATE is set in MATRIX_FLAG, included in PAYLOAD_SIZE
  * 
  * >>> END OF SHARED MEMORY
+ *
+ * (unused memory padded to page size recorded in MATRIX_FLAG, if huge pages are used)
+ *
+ * An appendable matrix (ARRAY_APPEND) reserves ARRAY_DATA for APPEND_CAPACITY columns (see shmem_stats.h), only the
+ * first APPEND_BYTES bytes of the segment are backed by the shared memory object (POSIX API), the rest is reserved
+ * address space of the mappings and must not be accessed.
+ *
+ * BUNDLE LAYOUT (struct or cell array, all elements stored in one segment, nested bundles are stored as blocks)
+ *
+ * <<< SHARED MEMORY POINTER STARTS HERE
+ *
+ * [ B U N D L E   H E A D E R ]
+ * uint32 LAYOUT_VERSION, uint32 HEADER_SIZE, same as matrix header
+ * uint64 MATRIX_TYPE, mxSTRUCT_CLASS or mxCELL_CLASS
+ * uint64 MATRIX_FLAG, segment attributes only
+ * uint64 PAYLOAD_SIZE, size (in byte) of all blocks including padding
+ * uint32 N_MATRIX_DIMENSION, number of dimensions of the struct / cell array
+ * (uint64*N_MATRIX_DIMENSION) MATRIX_DIMENSIONS, size of each dimension
+ * uint64 N_FIELDS, number of fields of struct, 0 for cell
+ * (char*SHMEM_BUNDLE_FIELD_NAME_BYTES*N_FIELDS) FIELD_NAMES, null terminated field names
+ * (uint64*N_BLOCKS) BLOCK_OFFSETS, offset (in byte) of each element relative to the bundle header, 0 for an unassigned
+ *     (empty) element, N_BLOCKS = number of elements * N_FIELDS for struct (fields of the first element first), number
+ *     of elements for cell
+ * (byte*SHMEM_STATS_BYTES) (optional) STATISTICS, same as matrix header
+ *
+ * (unused memory padded to SHMEM_BUNDLE_ALIGN_BYTES bytes)
+ *
+ * [ B L O C K S ]
+ * matrix or bundle header and payload as above (without page padding), each block starts at a multiple of
+ * SHMEM_BUNDLE_ALIGN_BYTES bytes
+ *
+ * >>> END OF SHARED MEMORY
  */
 #pragma once
 #ifndef _SHARED_MATRIX_COMPILER_DEF_H_
@@ -55,6 +101,15 @@
 #define ARRAY_SPARSE  0x1
 #define ARRAY_COMPLEX 0x2
 #define ARRAY_LOGICAL 0x4
+// the transpose of a sparse matrix is stored after its payload (TRANSPOSED_MATRIX)
+#define ARRAY_TRANSPOSE 0x8
+// ARRAY_DATA stores codes of a reduced precision encoding (dense real double / single only)
+#define ARRAY_ENCODED 0x10
+// dense numeric matrix accumulated by accumulate_shared_matrix, ACCUMULATOR is stored after its payload
+#define ARRAY_ACCUMULATE 0x20
+// dense 2-D matrix appended column by column by append_shared_matrix, PAYLOAD_SIZE covers the reserved capacity and
+// the last dimension is the number of committed columns
+#define ARRAY_APPEND 0x40
 // Valid attributes
 // #  SPARSE COMPLEX LOGICAL
 // 1  O      X       X
@@ -63,17 +118,78 @@
 // 4  O      O       X
 // 5  O      X       O
 
+// Segment attributes (stored in MATRIX_FLAG together with array attributes)
+// backed by a file on hugetlbfs
+#define SHMEM_FLAG_HUGETLB 0x100
+// backed by shared memory object advised to use transparent huge pages, mappings are aligned to huge page size
+#define SHMEM_FLAG_THP     0x200
+// header holds the STATISTICS block (set for the header at the beginning of a segment only)
+#define SHMEM_FLAG_STATS   0x400
+// shared memory object of a size class of the segment pool, returned to the pool when it is released (see shmem_pool.h)
+#define SHMEM_FLAG_POOLED  0x800
+// bit 16-23: log2 of page size used for mapping, 0 for default page size
+#define SHMEM_FLAG_PAGE_SHIFT_OFFSET 16
+#define SHMEM_FLAG_SEGMENT_MASK 0xffff00ULL
+
 // MODIFIABLE defines
-// Maximum string length of shared memory
-#define MAX_SHMEM_NAME_LENGTH 64
+// Maximum string length of shared memory (including file backed segment path)
+#define MAX_SHMEM_NAME_LENGTH 1024
+// Shared memory name prefix for file backed segments (e.g. hugetlbfs), followed by the file path
+#define SHMEM_FILE_NAME_PREFIX "file:"
 // All data will be padded to multiple of ? bytes, 16 bytes at least, value must be 2^n
 #define SHMEM_DATA_PADDED_BYTES 16
 // Comment the following line to enable runtime output (requires re-compile)
 #define NO_DEBUG_OUTPUT
 // Maximum pre-allocated size for storing MATRIX_DIMENSIONS array, if N_MATRIX_DIMENSION is larger than this value, then a dynamic memory allocation is made
 #define MAX_STATIC_ALLOCATED_DIMS 4
+// Maximum number of native threads whose bookkeeping is allocated on stack
+#define MAX_STATIC_ALLOCATED_THREADS 64
+// Payload copy is performed chunk by chunk (in bytes)
+#define SHMEM_COPY_CHUNK_BYTES (4ULL << 20)
+// Minimum payload size (in bytes) for each copy thread, small matrices are copied by the calling thread only
+#define SHMEM_COPY_MIN_BYTES_PER_THREAD (16ULL << 20)
+// Maximum number of copy threads if it is not specified by user
+#define SHMEM_COPY_MAX_AUTO_THREADS 32
+// Maximum number of copy threads specified by user
+#define SHMEM_COPY_MAX_THREADS 1024
+// Last level cache size (in bytes) assumed if it is not reported by the OS, used for enabling non-temporal copy
+#define SHMEM_DEFAULT_LLC_BYTES (32ULL << 20)
+// Maximum number of CPUs handled by thread affinity = 64 * value
+#define SHMEM_MAX_CPU_MASK_WORDS 16
+// Minimum number of bytes prefaulted by each thread when attaching with Populate = "parallel"
+#define SHMEM_PREFAULT_MIN_BYTES_PER_THREAD (32ULL << 20)
+// Maximum number of unreferenced mappings kept by the per-process attach cache (read_shared_matrix)
+#define SHMEM_ATTACH_CACHE_MAX_IDLE 16
+// Number of bytes read for parsing header before the segment is mapped, larger headers are rejected
+#define SHMEM_HEADER_PROBE_BYTES 4096
+// Alignment of blocks in a bundle (multiple of SHMEM_DATA_PADDED_BYTES), one cache line avoids false sharing
+#define SHMEM_BUNDLE_ALIGN_BYTES 64
+// Maximum nesting level of struct / cell arrays in a bundle
+#define SHMEM_BUNDLE_MAX_DEPTH 64
+// Source files of load_shared_matrix are read chunk by chunk (in bytes, a multiple of SHMEM_LOAD_DIRECT_ALIGN)
+#define SHMEM_LOAD_CHUNK_BYTES (16ULL << 20)
+// Alignment (in bytes) of file offsets, sizes and buffers of unbuffered reads (O_DIRECT), 4 KB covers all block sizes
+#define SHMEM_LOAD_DIRECT_ALIGN 4096
+// Minimum size (in bytes) of the data of a source file read unbuffered by default, smaller files go through page cache
+#define SHMEM_LOAD_DIRECT_MIN_BYTES (1ULL << 30)
+// Maximum number of private stripes of an accumulator (allocate_shared_matrix with Accumulate set)
+#define SHMEM_ACCUM_MAX_STRIPES 256
+// Strategy "auto" of accumulate_shared_matrix switches to a stripe once more than 1 / ? of the atomic additions retried
+#define SHMEM_ACCUM_RETRY_RATIO 1024
+// ... or once this number of processes add atomically at the same time
+#define SHMEM_ACCUM_STRIPE_ADDERS 4
+// Stripes are merged block by block (in bytes), the blocks of all stripes merged together stay in cache
+#define SHMEM_ACCUM_MERGE_BLOCK_BYTES (256ULL << 10)
+// Backing object of an appendable matrix grows by multiples of ? bytes (rounded up to the page size of the segment)
+#define SHMEM_APPEND_CHUNK_BYTES (64ULL << 20)
+// Event tracing is enabled by setting this environment variable to a non-zero value (see shmem_trace.h)
+#define SHMEM_TRACE_ENV "SHMEM_TRACE"
+// Shared memory name of the trace ring of a process, followed by the process id
+#define SHMEM_TRACE_NAME_PREFIX "shmem_trace_"
+// Number of events kept by the trace ring of each process (older events are overwritten), value must be 2^n
+#define SHMEM_TRACE_EVENTS 65536
 // First integer for memory integrity test
-#define SHMEM_MEMORY_LAYOUT_VERSION 0x01000300
+#define SHMEM_MEMORY_LAYOUT_VERSION 0x01000a00
 
 // Matlab architecture, pass it by -D option
 #ifdef ARCH_WIN64
@@ -100,7 +216,10 @@
 #        include <sys/mman.h>
 #        include <unistd.h>
 #        include <errno.h>
+#        include <dirent.h>
 #        define SHMEM_API SHMEM_POSIX_API
+// directory of POSIX shared memory objects
+#        define SHMEM_POSIX_SHM_DIR "/dev/shm"
 // assumes ARCH_GLNXA64
 #        ifndef ARRAY_HEADER_SIZE
 #            define ARRAY_HEADER_SIZE 16
@@ -157,11 +276,11 @@ inline void set_ic_ptr(mxArray* arr, int cls, void* ptr) {
 // INT_CEIL(a,b) = (int) ceil( ((double)a) / ((double)b) ), where a and b are positive integers
 #define INT_CEIL(a,b) (1+((a)-1)/(b))
 
+// debug messages are recorded as trace events while tracing is enabled (arguments are not evaluated otherwise)
 #ifndef NO_DEBUG_OUTPUT
-#define SHMEM_DEBUG_OUTPUT printf
+#define SHMEM_DEBUG_OUTPUT(...) (printf(__VA_ARGS__), SHMEM_TRACE_MESSAGE(__VA_ARGS__))
 #else
-inline int _empty_printf(const char* fmt, ...) { return 0; }
-#define SHMEM_DEBUG_OUTPUT _empty_printf
+#define SHMEM_DEBUG_OUTPUT(...) SHMEM_TRACE_MESSAGE(__VA_ARGS__)
 #endif // NO_DEBUG_OUTPUT
 
 // make read and write cast more elegant (maybe)
@@ -179,6 +298,17 @@ inline int _empty_printf(const char* fmt, ...) { return 0; }
         mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Expected "#n " input arguments, but got %d", nrhs); \
     MATLAB_PRHS_PTR_CHECK(n) \
 }
+// check first n prhs argument is valid or not, plus nrhs must be in range [min_n, max_n]
+#define MATLAB_PRHS_PTR_CHECK_RANGE(min_n,max_n) { \
+    if (nrhs < (min_n) || nrhs > (max_n)) \
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Expected "#min_n " to "#max_n " input arguments, but got %d", nrhs); \
+    MATLAB_PRHS_PTR_CHECK(nrhs) \
+}
+// check the optional option argument is a scalar struct or empty array
+#define MATLAB_OPTIONS_CHECK(arr,i) { \
+    if (!mxIsEmpty(arr) && !(mxIsStruct(arr) && mxGetNumberOfElements(arr) == 1)) \
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [%d] must be a scalar struct of options", (i)); \
+}
 // create a 1x1 uint64 matrix to plhs[i], and ptr ref. to the created matrix for reading and writing
 #define MATLAB_CREATE_UINT64_RETURN_MATRIX(i,ptr,dtype) { \
     plhs[i] = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL); \
@@ -189,4 +319,44 @@ inline int _empty_printf(const char* fmt, ...) { return 0; }
         mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array"); \
 }
 
+// read a numeric scalar from field of an option struct, returns default_value if options / field is empty or not exist
+static inline double shmem_option_scalar(const mxArray* options, const char* field, double default_value) {
+    if (options == NULL || !mxIsStruct(options) || mxIsEmpty(options))
+        return default_value;
+    const mxArray* value = mxGetField(options, 0, field);
+    if (value == NULL || mxIsEmpty(value))
+        return default_value;
+    if (!mxIsNumeric(value) && !mxIsLogical(value))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option %s must be a numeric or logical scalar", field);
+    return mxGetScalar(value);
+}
+
+// read a string from field of an option struct, copies default_value if options / field is empty or not exist
+static inline void shmem_option_string(const mxArray* options, const char* field, char* buf, size_t len, const char* default_value) {
+    const mxArray* value = NULL;
+    if (options != NULL && mxIsStruct(options) && !mxIsEmpty(options))
+        value = mxGetField(options, 0, field);
+    if (value == NULL || mxIsEmpty(value)) {
+        snprintf(buf, len, "%s", default_value);
+        return;
+    }
+    if (!mxIsChar(value) || mxGetString(value, buf, (mwSize)len))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option %s must be a string (max length: %d)", field, (int)len - 1);
+}
+
+// set a scalar double field of a 1x1 struct
+static inline void shmem_set_field_scalar(mxArray* st, const char* field, double value) {
+    mxArray* value_arr = mxCreateDoubleScalar(value);
+    if (value_arr == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateDoubleScalar");
+    mxSetField(st, 0, field, value_arr);
+}
+
+// event tracing (SHMEM_TRACE_MESSAGE used by SHMEM_DEBUG_OUTPUT)
+#ifdef SHMEM_API
+#    include "shmem_trace.h"
+#else
+#    define SHMEM_TRACE_MESSAGE(...) 0
+#endif
+
 #endif
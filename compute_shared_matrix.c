@@ -0,0 +1,175 @@
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_kernels.h"
+#include "shmem_sync.h"
+
+// m * n result of min / max, same class as the matrix
+static mxArray* minmax_result(int matrix_type, mwSize m, unsigned long long n) {
+    if (matrix_type == mxLOGICAL_CLASS)
+        return mxCreateLogicalMatrix(m, (mwSize)n);
+    if (matrix_type == mxCHAR_CLASS) {
+        mwSize dims[2] = { m, (mwSize)n };
+        return mxCreateCharArray(2, dims);
+    }
+    return mxCreateUninitNumericMatrix(m, (mwSize)n, (mxClassID)matrix_type, mxREAL);
+}
+
+// input arg [1]: base pointer of the shared memory (created by host, or attached without option Slice) of a real
+//                matrix, dense of any numeric class, char or logical, or sparse (CSC)
+// input arg [2]: operation, all dimensions after the first one are treated as columns:
+//   "colsum": sum(A, 1), 1 * n double
+//   "rowsum": sum(A, 2), m * 1 double
+//   "min", "max": min(A, [], 1) / max(A, [], 1), 1 * n of the class of A (full for a sparse matrix), NaN is ignored,
+//                 0 * n for a matrix without rows
+//   "dot": x.' * A, 1 * n double, x is a vector of m elements
+//   "gemv": A * x, m * 1 double, x is a vector of one element for each column
+//   "colnorm": vecnorm(A, 2, 1), 1 * n double
+// input arg [3]: vector x (double) of "dot" and "gemv", ignored by the other operations
+// input arg [4]: (optional) struct of options
+//   Columns: [first, last] (1-based) columns computed on (n = last - first + 1), all columns if empty (default)
+//   Threads: number of threads, 0 (default) for automatic selection
+//   Kernel: "auto" (default), "avx2" or "scalar", falls back to the best kernel supported by the CPU (AVX2 kernels
+//           are used for double / single matrices only)
+// output arg [1]: result, a private array of the worker, products and sums are accumulated in double precision
+// output arg [2]: (optional) struct of statistics (Bytes of the matrix read, Seconds, Throughput in GB/s, Threads,
+//                 Kernel)
+// the payload is read in place, nothing is copied; values written concurrently by write_shared_matrix may be mixed
+// with old ones, compare the versions before and after the call for a consistent result
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("compute_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(2, 4);
+    if (nlhs > 2)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 2");
+    const mxArray* options = nrhs > 3 ? prhs[3] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 4);
+
+    // address containing base ptr
+    if (!mxIsUint64(prhs[0]) || mxGetNumberOfElements(prhs[0]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 base pointer");
+    const char* ptr_base = (const char*)*(unsigned long long*)mxGetData(prhs[0]);
+    if (ptr_base == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
+    shmem_header_t hdr = { 0 };
+    const char* header_err = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), &hdr);
+    if (header_err)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+    if (shmem_is_bundle(hdr.matrix_type))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Struct / cell array is not supported, compute on its elements instead");
+    if (hdr.array_attribute & ARRAY_COMPLEX)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Complex matrix is not supported");
+    if (hdr.array_attribute & ARRAY_ENCODED)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Matrix created with option Encoding is not supported, decode it first");
+
+    // OPERATION
+    char op_name[16];
+    if (!mxIsChar(prhs[1]) || mxGetString(prhs[1], op_name, sizeof(op_name)))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [2] must be an operation name");
+    int op = shmem_kernel_from_name(op_name);
+    if (op < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Operation must be \"colsum\", \"rowsum\", \"min\", \"max\", \"dot\", \"gemv\" or \"colnorm\"");
+
+    // COLUMN RANGE
+    unsigned long long n_rows = shmem_header_dim(&hdr, 0);
+    unsigned long long n_cols = 1;
+    for (unsigned int i = 1; i < hdr.n_dims; i++)
+        n_cols *= shmem_header_dim(&hdr, i);
+    unsigned long long col_begin = 0, col_end = n_cols;
+    const mxArray* columns = options ? mxGetField(options, 0, "Columns") : NULL;
+    if (columns != NULL && !mxIsEmpty(columns)) {
+        if (!mxIsDouble(columns) || mxIsComplex(columns) || mxGetNumberOfElements(columns) != 2)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Columns must be [first, last]");
+        const double* range = mxGetPr(columns);
+        if (range[0] < 1 || range[1] < range[0] || range[1] > (double)n_cols || range[0] != (double)(unsigned long long)range[0] ||
+            range[1] != (double)(unsigned long long)range[1])
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Column range must be integers in [1, %lld]", n_cols);
+        col_begin = (unsigned long long)range[0] - 1;
+        col_end = (unsigned long long)range[1];
+    }
+
+    // VECTOR
+    const double* x = NULL;
+    if (op == SHMEM_KERNEL_DOT || op == SHMEM_KERNEL_GEMV) {
+        unsigned long long x_size = op == SHMEM_KERNEL_DOT ? n_rows : col_end - col_begin;
+        if (nrhs < 3 || !mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxIsSparse(prhs[2]))
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [3] must be a real double vector");
+        if (mxGetNumberOfElements(prhs[2]) != x_size)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Input arg [3] must have %lld elements", x_size);
+        x = mxGetPr(prhs[2]);
+    }
+
+    // KERNEL OPTIONS
+    int n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    if (n_threads < 0 || n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+    char kernel_name[16];
+    shmem_option_string(options, "Kernel", kernel_name, sizeof(kernel_name), "auto");
+    int kernel = shmem_codec_kernel();
+    if (strcmp(kernel_name, "scalar") == 0) kernel = SHMEM_CODEC_KERNEL_SCALAR;
+    else if (strcmp(kernel_name, "avx2") == 0) kernel = SHMEM_CODEC_KERNEL_AVX2;
+    else if (strcmp(kernel_name, "auto") != 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Kernel must be \"auto\", \"avx2\" or \"scalar\"");
+    if (kernel > SHMEM_CODEC_KERNEL_AVX2)
+        kernel = SHMEM_CODEC_KERNEL_AVX2;
+    if (kernel > shmem_codec_kernel())
+        kernel = shmem_codec_kernel();
+    const shmem_kernel_ops_t* ops = shmem_kernel_ops((int)hdr.matrix_type, hdr.data_size, kernel);
+    if (ops == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Class %s is not supported", shmem_class_name(hdr.matrix_type));
+    if (hdr.matrix_type != mxDOUBLE_CLASS && hdr.matrix_type != mxSINGLE_CLASS)
+        kernel = SHMEM_CODEC_KERNEL_SCALAR;
+
+    // MATRIX
+    shmem_kernel_matrix_t a;
+    const char* payload_ptr = ptr_base + hdr.header_size;
+    a.pr = payload_ptr + ARRAY_HEADER_SIZE;
+    a.ir = NULL;
+    a.jc = NULL;
+    a.n_rows = n_rows;
+    a.data_size = hdr.data_size;
+    if (hdr.array_attribute & ARRAY_SPARSE) {
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(hdr.nzmax, hdr.data_size, &ofs_ir, &ofs_jc);
+        a.ir = (const mwIndex*)(payload_ptr + ofs_ir + ARRAY_HEADER_SIZE);
+        a.jc = (const mwIndex*)(payload_ptr + ofs_jc + ARRAY_HEADER_SIZE);
+    }
+
+    // the columns may still be copied by create_shared_matrix (option Async), only they are waited for
+    shmem_fill_wait(shmem_stats_ptr(&hdr, (void*)ptr_base), a.ir != NULL ? ~0ULL : shmem_column_offset(&hdr, col_end), mxGetInf());
+
+    // COMPUTE
+    unsigned long long n_results = shmem_kernel_is_row(op) ? n_rows : col_end - col_begin;
+    if (op == SHMEM_KERNEL_MIN || op == SHMEM_KERNEL_MAX)
+        plhs[0] = minmax_result((int)hdr.matrix_type, n_rows > 0 ? 1 : 0, n_results);
+    else if (shmem_kernel_is_row(op))
+        plhs[0] = mxCreateUninitNumericMatrix((mwSize)n_results, 1, mxDOUBLE_CLASS, mxREAL);
+    else
+        plhs[0] = mxCreateUninitNumericMatrix(1, (mwSize)n_results, mxDOUBLE_CLASS, mxREAL);
+    if (plhs[0] == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateUninitNumericMatrix");
+    unsigned long long bytes = (a.ir != NULL ? (a.jc[col_end] - a.jc[col_begin]) * (hdr.data_size + sizeof(mwIndex))
+                                             : (col_end - col_begin) * n_rows * hdr.data_size);
+    double start_time = shmem_time_seconds();
+    if (mxGetNumberOfElements(plhs[0]) > 0) {
+        n_threads = shmem_parallel_compute(&a, ops, op, x, col_begin, col_end, mxGetData(plhs[0]), n_threads);
+        if (n_threads == 0)
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+    }
+    else {
+        n_threads = 0;
+    }
+    double seconds = shmem_time_seconds() - start_time;
+    SHMEM_DEBUG_OUTPUT("Computed %s on %lld bytes in %f seconds (%s, %d threads)\n", op_name, bytes, seconds, shmem_codec_kernel_name(kernel), n_threads);
+
+    if (nlhs >= 2) {
+        const char* stat_fields[] = { "Bytes", "Seconds", "Throughput", "Threads", "Kernel" };
+        plhs[1] = mxCreateStructMatrix(1, 1, 5, stat_fields);
+        if (plhs[1] == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        shmem_set_field_scalar(plhs[1], "Bytes", (double)bytes);
+        shmem_set_field_scalar(plhs[1], "Seconds", seconds);
+        shmem_set_field_scalar(plhs[1], "Throughput", seconds > 0 ? (double)bytes / seconds / 1e9 : 0);
+        shmem_set_field_scalar(plhs[1], "Threads", n_threads);
+        mxSetField(plhs[1], 0, "Kernel", mxCreateString(shmem_codec_kernel_name(kernel)));
+    }
+}
@@ -1,43 +1,70 @@
 #include "compiler_def.h"
+#include "shmem_copy.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_transpose.h"
+#include "shmem_codec.h"
+#include "shmem_stats.h"
+#include "shmem_pool.h"
+#include "shmem_numa.h"
 
-// input arg [1]: shared memory name
-// input arg [2]: input array
-// output arg [1]: base pointer of shared memory
-// output arg [2]: shared memory handle (optional, required in win api)
-void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
-    MATLAB_PRHS_PTR_CHECK_STRICT(2);
+// copies started by option Async, the MEX file is locked until they are finished and released
+typedef struct _async_job_entry {
+    shmem_async_copy_t* job;
+    struct _async_job_entry* next;
+} async_job_entry_t;
 
-    // SHARED MEMORY NAME CHECK
-    char shmem_name[MAX_SHMEM_NAME_LENGTH];
-    if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], shmem_name, MAX_SHMEM_NAME_LENGTH))
-        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
-    if (strlen(shmem_name) == 0)
-        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
-    SHMEM_DEBUG_OUTPUT("Shared memory name: %s\n", shmem_name);
-    
-    // OUTPUT ARGUMENT CHECK
-    unsigned long long* base_pointer = NULL;
-    unsigned long long* output_value = NULL;
-    if (nlhs == 1 || nlhs == 2) {
-#if SHMEM_API == SHMEM_WIN_API
-        if (nlhs == 1)
-            mexErrMsgIdAndTxt("SharedMatrix:NotEnoughOutput", "Win API based shared matrix needs to return a handle of the memory");
-#endif
-        MATLAB_CREATE_UINT64_RETURN_MATRIX(0, base_pointer, unsigned long long);
-        if (nlhs == 2)
-            MATLAB_CREATE_UINT64_RETURN_MATRIX(1, output_value, unsigned long long);
-    }
-    else {
-        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 2");
+static async_job_entry_t* async_jobs = NULL;
+static int async_jobs_exit_registered = 0;
+
+// release finished copies (all copies, waiting for them, if wait_all is set)
+static void async_jobs_reap(int wait_all) {
+    async_job_entry_t** link = &async_jobs;
+    while (*link) {
+        async_job_entry_t* entry = *link;
+        if (wait_all || entry->job->finished) {
+            *link = entry->next;
+            shmem_async_copy_free(entry->job);
+            free(entry);
+            mexUnlock();
+        }
+        else {
+            link = &entry->next;
+        }
     }
+}
+
+static void async_jobs_at_exit(void) {
+    async_jobs_reap(1);
+}
 
+// layout of a block (matrix or bundle) of the input
+typedef struct {
+    const mxArray* array;
+    int data_class; // mxSTRUCT_CLASS or mxCELL_CLASS for bundle
+    int data_size; // doubled for complex
+    unsigned long long array_attribute;
+    unsigned long long n_elements; // nzmax for sparse array, number of blocks for bundle
+    unsigned int header_size_padded;
+    unsigned long long payload_size_padded;
+} block_desc_t;
+
+// blocks of the input in depth-first order
+typedef struct {
+    block_desc_t* items;
+    size_t n;
+    size_t capacity;
+} block_list_t;
+
+// check attribute, data type and dimension of arr and compute its layout, raises matlab error if it is unsupported
+static void describe_array(const mxArray* arr, block_desc_t* desc) {
     // ARRAY ATTRIBUTE CHECK
     unsigned long long array_attribute = 0;
-    if (mxIsSparse(prhs[1])) {
+    if (mxIsSparse(arr)) {
         array_attribute |= ARRAY_SPARSE;
         SHMEM_DEBUG_OUTPUT("Attribute flag: ARRAY_SPARSE\n");
     }
-    if (mxIsComplex(prhs[1])) {
+    if (mxIsComplex(arr)) {
 #ifndef SHMEM_COMPLEX_SUPPORTED
         mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Complex array is not supported before R2018a");
 #else
@@ -45,8 +72,8 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
         SHMEM_DEBUG_OUTPUT("Attribute flag: ARRAY_COMPLEX\n");
 #endif
     }
-    if (!mxIsNumeric(prhs[1])) {
-        if (mxIsLogical(prhs[1])) {
+    if (!mxIsNumeric(arr) && !mxIsChar(arr)) {
+        if (mxIsLogical(arr)) {
             // logical array
             if (array_attribute & ARRAY_COMPLEX)
                 mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Logical attribute could not composite with complex");
@@ -54,175 +81,565 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
             SHMEM_DEBUG_OUTPUT("Attribute flag: ARRAY_LOGICAL\n");
         }
         else
-            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Only supports numeric or logical data");
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Only supports numeric, logical or char data (in struct / cell arrays)");
     }
     
     // DATA TYPE CHECK
     int data_size = 0;
     int data_class = mxUNKNOWN_CLASS;
-    unsigned long long n_elements = 0;
-    if (mxIsInt8(prhs[1])) { data_size = 1; data_class = mxINT8_CLASS; }
-    else if (mxIsInt16(prhs[1])) { data_size = 2; data_class = mxINT16_CLASS; }
-    else if (mxIsInt32(prhs[1])) { data_size = 4; data_class = mxINT32_CLASS; }
-    else if (mxIsInt64(prhs[1])) { data_size = 8; data_class = mxINT64_CLASS; }
-    else if (mxIsUint8(prhs[1])) { data_size = 1; data_class = mxUINT8_CLASS; }
-    else if (mxIsUint16(prhs[1])) { data_size = 2; data_class = mxUINT16_CLASS; }
-    else if (mxIsUint32(prhs[1])) { data_size = 4; data_class = mxUINT32_CLASS; }
-    else if (mxIsUint64(prhs[1])) { data_size = 8; data_class = mxUINT64_CLASS; }
-    else if (mxIsSingle(prhs[1])) { data_size = 4; data_class = mxSINGLE_CLASS; }
-    else if (mxIsDouble(prhs[1])) { data_size = 8; data_class = mxDOUBLE_CLASS; }
-    else if (mxIsLogical(prhs[1])) { data_size = 1; data_class = mxLOGICAL_CLASS; }
+    if (mxIsInt8(arr)) { data_size = 1; data_class = mxINT8_CLASS; }
+    else if (mxIsInt16(arr)) { data_size = 2; data_class = mxINT16_CLASS; }
+    else if (mxIsInt32(arr)) { data_size = 4; data_class = mxINT32_CLASS; }
+    else if (mxIsInt64(arr)) { data_size = 8; data_class = mxINT64_CLASS; }
+    else if (mxIsUint8(arr)) { data_size = 1; data_class = mxUINT8_CLASS; }
+    else if (mxIsUint16(arr)) { data_size = 2; data_class = mxUINT16_CLASS; }
+    else if (mxIsUint32(arr)) { data_size = 4; data_class = mxUINT32_CLASS; }
+    else if (mxIsUint64(arr)) { data_size = 8; data_class = mxUINT64_CLASS; }
+    else if (mxIsSingle(arr)) { data_size = 4; data_class = mxSINGLE_CLASS; }
+    else if (mxIsDouble(arr)) { data_size = 8; data_class = mxDOUBLE_CLASS; }
+    else if (mxIsLogical(arr)) { data_size = 1; data_class = mxLOGICAL_CLASS; }
+    else if (mxIsChar(arr)) { data_size = 2; data_class = mxCHAR_CLASS; }
     else { mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Unsupported data type"); };
     if (array_attribute & ARRAY_COMPLEX) data_size *= 2;
     SHMEM_DEBUG_OUTPUT("Data size: %d, data class: %d\n", data_size, data_class);
     
     // DIMENSION CHECK
-    mwSize n_dims = mxGetNumberOfDimensions(prhs[1]);
+    mwSize n_dims = mxGetNumberOfDimensions(arr);
     SHMEM_DEBUG_OUTPUT("Numbers of dimensions: %d\n", n_dims);
     if (n_dims == 0)
         mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Zero dimension is unsupported");
-    const mwSize* dims = mxGetDimensions(prhs[1]);
+    const mwSize* dims = mxGetDimensions(arr);
     SHMEM_DEBUG_OUTPUT("Dimensions: %d", dims[0]); for (int i = 1; i < n_dims; i++) SHMEM_DEBUG_OUTPUT(" * %d", dims[i]); SHMEM_DEBUG_OUTPUT("\n");
     if ((array_attribute & ARRAY_SPARSE) && n_dims != 2)
         mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Sparse matrix only supports 2 dimensions");
     
     // COMPUTE REQUIRED BYTES
-    unsigned long long payload_size = 0;
-    unsigned int header_size = 36 + n_dims * 8;
+    unsigned long long n_elements = 0;
     if (array_attribute & ARRAY_SPARSE) {
-        // sparse array
-        n_elements = (unsigned long long)mxGetNzmax(prhs[1]);
+        n_elements = (unsigned long long)mxGetNzmax(arr);
         SHMEM_DEBUG_OUTPUT("Nzmax: %lld\n", n_elements);
-        payload_size = n_elements * data_size + ARRAY_HEADER_SIZE; // Pr, Pi
-        payload_size = INT_CEIL(payload_size, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES; // padded
-        payload_size += n_elements * sizeof(mwIndex) + ARRAY_HEADER_SIZE; // Ir
-        payload_size = INT_CEIL(payload_size, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES; // padded
-        payload_size += (dims[1] + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE; // Jc
-        header_size += 8; // extra header for NZ_MAX
     }
     else {
-        // dense array
         n_elements = 1;
         for (int i = 0; i < n_dims; i++)
             n_elements *= dims[i];
-        payload_size = ARRAY_HEADER_SIZE + n_elements * data_size;
-    }
-    unsigned int header_size_padded = INT_CEIL(header_size, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES; // padded
-    unsigned long long payload_size_padded = INT_CEIL(payload_size, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
-    SHMEM_DEBUG_OUTPUT("Header size: %d (padded: %d)\n", header_size, header_size_padded);
-    SHMEM_DEBUG_OUTPUT("Payload size: %lld (padded: %lld)\n", payload_size, payload_size_padded);
-    unsigned long long total_size = header_size_padded + payload_size_padded;
-    SHMEM_DEBUG_OUTPUT("Total size: %lld\n", total_size);
-    
-    // CREATE SHARED MEMORY
-#if SHMEM_API == SHMEM_WIN_API
-    SHMEM_DEBUG_OUTPUT("API call: CreateFileMappingA\n");
-    HANDLE shmem = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((total_size >> 32) & 0xffffffff), (DWORD)(total_size & 0xffffffff), shmem_name);
-    if (shmem == NULL) {
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API CreateFileMappingA failed: %d", GetLastError());
-    }
-    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile\n");
-    void* ptr = MapViewOfFile(shmem, FILE_MAP_ALL_ACCESS, 0, 0, total_size);
-    if (ptr == NULL) {
-        int map_vof_err = GetLastError();
-        SHMEM_DEBUG_OUTPUT("API call: CloseHandle\n");
-        CloseHandle(shmem);
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API MapViewOfFile failed: %d", map_vof_err);
     }
-#elif SHMEM_API == SHMEM_POSIX_API
-    SHMEM_DEBUG_OUTPUT("API call: shm_open\n");
-    int shmem = shm_open(shmem_name, O_CREAT | O_RDWR, 0666);
-    if (shmem == -1) {
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API shm_open failed: %d", errno);
-    }
-    SHMEM_DEBUG_OUTPUT("API call: ftruncate\n");
-    int trunc_result = ftruncate(shmem, total_size);
-    if (trunc_result == -1) {
-        int trunc_errno = errno;
-        SHMEM_DEBUG_OUTPUT("API call: close\n");
-        close(shmem);
-        SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
-        shm_unlink(shmem_name);
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API ftruncate failed: %d", trunc_errno);
-    }
-    SHMEM_DEBUG_OUTPUT("API call: mmap\n");
-    void* ptr = mmap(0, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, shmem, 0);
-    if (ptr == MAP_FAILED) {
-        int map_errno = errno;
-        SHMEM_DEBUG_OUTPUT("API call: close\n");
-        close(shmem);
-        SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
-        shm_unlink(shmem_name);
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API mmap failed: %d", map_errno);
-    }
-#endif
-    SHMEM_DEBUG_OUTPUT("Handle: %lld\n", (unsigned long long)shmem);
-    SHMEM_DEBUG_OUTPUT("Shared memory pointer: %p\n", ptr);
-    
-    // MEMORY COPY
-    // HEADER
-    SHMEM_WRITE_CAST(unsigned int, ptr, 0, SHMEM_MEMORY_LAYOUT_VERSION); // LAYOUT_VERSION
-    SHMEM_WRITE_CAST(unsigned int, ptr, 4, header_size_padded); // HEADER_SIZE
-    SHMEM_WRITE_CAST(unsigned long long, ptr, 8, data_class); // MATRIX_TYPE
-    SHMEM_WRITE_CAST(unsigned long long, ptr, 16, array_attribute); // MATRIX_FLAG
-    SHMEM_WRITE_CAST(unsigned long long, ptr, 24, payload_size_padded); // PAYLOAD_SIZE
-    SHMEM_WRITE_CAST(unsigned int, ptr, 32, n_dims); // N_MATRIX_DIMENSION
-    for (int i = 0; i < n_dims; i++)
-        SHMEM_WRITE_CAST(unsigned long long, ptr, 36+i*8, dims[i]);
-    if (array_attribute & ARRAY_SPARSE)
-        SHMEM_WRITE_CAST(unsigned long long, ptr, 36+n_dims*8, n_elements);
-
-    // PAYLOAD
-    // register exception cleanup
-#if SHMEM_API == SHMEM_WIN_API
-#define EXC_CLEANUP SHMEM_DEBUG_OUTPUT("API call: UnmapViewOfFile\n"); UnmapViewOfFile(ptr); SHMEM_DEBUG_OUTPUT("API call: CloseHandle\n"); CloseHandle(shmem)
-#elif SHMEM_API == SHMEM_POSIX_API
-#define EXC_CLEANUP SHMEM_DEBUG_OUTPUT("API call: munmap\n"); munmap(ptr, total_size); SHMEM_DEBUG_OUTPUT("API call: close\n"); close(shmem); SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n"); shm_unlink(shmem_name)
-#endif
-#define CHECK_PTR(ptr) { if (ptr == NULL) { EXC_CLEANUP; mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array"); } }
+    desc->array = arr;
+    desc->data_class = data_class;
+    desc->data_size = data_size;
+    desc->array_attribute = array_attribute;
+    desc->n_elements = n_elements;
+    shmem_layout_sizes(data_size, array_attribute, (unsigned int)n_dims, dims, n_elements, &desc->header_size_padded, &desc->payload_size_padded);
+}
 
-    const char* src_pr = NULL;
-    if (array_attribute & ARRAY_COMPLEX) {
+// data pointer (real / interleaved complex) of the array of desc
+static const char* source_data(const block_desc_t* desc) {
+    if (desc->array_attribute & ARRAY_COMPLEX) {
         // complex array
 #ifdef SHMEM_COMPLEX_SUPPORTED
-        src_pr = (const char*)get_ic_ptr(prhs[1], data_class);
+        return (const char*)get_ic_ptr(desc->array, desc->data_class);
+#else
+        return NULL;
 #endif
     }
-    else {
-        // non-complex array
-        src_pr = (const char*)mxGetPr(prhs[1]);
-    }
+    // non-complex array
+    return (const char*)mxGetPr(desc->array);
+}
+
+/*
+ * Write matrix header of desc to block_ptr and fill copy tasks of its payload (at most 3)
+ * returns number of copy tasks, -1 if a null pointer is got from the array
+ */
+static int prepare_copy(const block_desc_t* desc, char* block_ptr, unsigned long long segment_flags, shmem_copy_task_t* copy_tasks) {
+    const mxArray* arr = desc->array;
+    mwSize n_dims = mxGetNumberOfDimensions(arr);
+    const mwSize* dims = mxGetDimensions(arr);
+    unsigned long long n_elements = desc->n_elements;
+    int data_size = desc->data_size;
+    shmem_write_header(block_ptr, desc->header_size_padded, desc->data_class, desc->array_attribute | segment_flags, desc->payload_size_padded, (unsigned int)n_dims, dims, n_elements);
+    if (desc->array_attribute & ARRAY_ENCODED)
+        return 0; // payload is encoded after the copy
+
+    const char* src_pr = source_data(desc);
     SHMEM_DEBUG_OUTPUT("Array pr: %p\n", src_pr);
-    CHECK_PTR(src_pr);
+    if (src_pr == NULL)
+        return (n_elements == 0 && !(desc->array_attribute & ARRAY_SPARSE)) ? 0 : -1; // empty arrays may have no data
 
-    char* dst_pr = ((char*)ptr) + header_size_padded;
+    char* dst_pr = block_ptr + desc->header_size_padded;
     src_pr = src_pr - ARRAY_HEADER_SIZE;
-    if (array_attribute & ARRAY_SPARSE) {
+    int n_copy_tasks = 0;
+    if (desc->array_attribute & ARRAY_SPARSE) {
         // sparse non-complex array
-        const char* src_ir = (const char*)mxGetIr(prhs[1]);
+        const char* src_ir = (const char*)mxGetIr(arr);
         SHMEM_DEBUG_OUTPUT("Array ir: %p\n", src_ir);
-        CHECK_PTR(src_ir);
-        src_ir = src_ir - ARRAY_HEADER_SIZE;
-        const char* src_jc = (const char*)mxGetJc(prhs[1]);
+        const char* src_jc = (const char*)mxGetJc(arr);
         SHMEM_DEBUG_OUTPUT("Array jc: %p\n", src_jc);
-        CHECK_PTR(src_jc);
+        if (src_ir == NULL || src_jc == NULL)
+            return -1;
+        src_ir = src_ir - ARRAY_HEADER_SIZE;
         src_jc = src_jc - ARRAY_HEADER_SIZE;
-        unsigned long long ofs_ir = n_elements * data_size + ARRAY_HEADER_SIZE;
-        ofs_ir = INT_CEIL(ofs_ir, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
-        unsigned long long ofs_jc = ofs_ir + n_elements * sizeof(mwIndex) + ARRAY_HEADER_SIZE;
-        ofs_jc = INT_CEIL(ofs_jc, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(n_elements, data_size, &ofs_ir, &ofs_jc);
         char* dst_ir = dst_pr + ofs_ir;
         char* dst_jc = dst_pr + ofs_jc;
-        SHMEM_DEBUG_OUTPUT("pr: memcpy %p -> %p (size: %lld)\n", src_pr, dst_pr, n_elements * data_size + ARRAY_HEADER_SIZE);
-        memcpy(dst_pr, src_pr, n_elements * data_size + ARRAY_HEADER_SIZE);
-        SHMEM_DEBUG_OUTPUT("ir: memcpy %p -> %p (size: %lld)\n", src_ir, dst_ir, n_elements * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
-        memcpy(dst_ir, src_ir, n_elements * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
-        SHMEM_DEBUG_OUTPUT("jc: memcpy %p -> %p (size: %lld)\n", src_jc, dst_jc, (dims[1] + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
-        memcpy(dst_jc, src_jc, (dims[1] + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
+        // Pr, Ir and Jc are copied concurrently
+        SHMEM_DEBUG_OUTPUT("pr: copy %p -> %p (size: %lld)\n", src_pr, dst_pr, n_elements * data_size + ARRAY_HEADER_SIZE);
+        copy_tasks[n_copy_tasks].dst = dst_pr; copy_tasks[n_copy_tasks].src = src_pr; copy_tasks[n_copy_tasks++].size = n_elements * data_size + ARRAY_HEADER_SIZE;
+        SHMEM_DEBUG_OUTPUT("ir: copy %p -> %p (size: %lld)\n", src_ir, dst_ir, n_elements * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
+        copy_tasks[n_copy_tasks].dst = dst_ir; copy_tasks[n_copy_tasks].src = src_ir; copy_tasks[n_copy_tasks++].size = n_elements * sizeof(mwIndex) + ARRAY_HEADER_SIZE;
+        SHMEM_DEBUG_OUTPUT("jc: copy %p -> %p (size: %lld)\n", src_jc, dst_jc, (dims[1] + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
+        copy_tasks[n_copy_tasks].dst = dst_jc; copy_tasks[n_copy_tasks].src = src_jc; copy_tasks[n_copy_tasks++].size = (dims[1] + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE;
     }
     else {
-        SHMEM_DEBUG_OUTPUT("pr: memcpy %p -> %p (size: %lld)\n", src_pr, dst_pr, payload_size);
-        memcpy(dst_pr, src_pr, payload_size);
+        unsigned long long payload_size = ARRAY_HEADER_SIZE + n_elements * data_size; // dense payload without padding
+        SHMEM_DEBUG_OUTPUT("pr: copy %p -> %p (size: %lld)\n", src_pr, dst_pr, payload_size);
+        copy_tasks[n_copy_tasks].dst = dst_pr; copy_tasks[n_copy_tasks].src = src_pr; copy_tasks[n_copy_tasks++].size = payload_size;
+    }
+    return n_copy_tasks;
+}
+
+// the k-th element of a struct / cell array (fields of struct element k / n_fields), NULL if it is unassigned
+static const mxArray* bundle_element(const mxArray* arr, size_t k) {
+    if (mxIsCell(arr))
+        return mxGetCell(arr, k);
+    int n_fields = mxGetNumberOfFields(arr);
+    return mxGetFieldByNumber(arr, k / n_fields, k % n_fields);
+}
+
+/*
+ * Describe arr and all its elements (if it is a struct or cell array) in depth-first order, raises matlab error if any
+ * array is unsupported
+ * returns size of the block (header and payload)
+ */
+static unsigned long long describe_block(const mxArray* arr, block_list_t* list, int depth) {
+    if (depth > SHMEM_BUNDLE_MAX_DEPTH)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Struct / cell array is nested deeper than %d levels", SHMEM_BUNDLE_MAX_DEPTH);
+    if (list->n == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = (block_desc_t*)mxRealloc(list->items, sizeof(block_desc_t) * list->capacity);
+    }
+    size_t idx = list->n++;
+    block_desc_t desc;
+    memset(&desc, 0, sizeof(desc));
+    if (!mxIsStruct(arr) && !mxIsCell(arr)) {
+        describe_array(arr, &desc);
+        list->items[idx] = desc;
+        return desc.header_size_padded + desc.payload_size_padded;
+    }
+    desc.array = arr;
+    desc.data_class = mxIsStruct(arr) ? mxSTRUCT_CLASS : mxCELL_CLASS;
+    unsigned long long n_fields = mxIsStruct(arr) ? mxGetNumberOfFields(arr) : 0;
+    desc.n_elements = mxIsStruct(arr) ? mxGetNumberOfElements(arr) * n_fields : mxGetNumberOfElements(arr);
+    unsigned long long header_size = shmem_bundle_header_size((unsigned int)mxGetNumberOfDimensions(arr), n_fields, desc.n_elements);
+    if (header_size > 0xffffffffULL)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Too many elements in struct / cell array");
+    desc.header_size_padded = (unsigned int)header_size;
+    for (size_t k = 0; k < desc.n_elements; k++) {
+        const mxArray* element = bundle_element(arr, k);
+        if (element)
+            desc.payload_size_padded += shmem_bundle_block_size(describe_block(element, list, depth + 1), 0);
+    }
+    list->items[idx] = desc;
+    return desc.header_size_padded + desc.payload_size_padded;
+}
+
+/*
+ * Write header of the next block of list (and all its elements) at block_ptr and fill copy tasks of the payloads,
+ * blocks are consumed in the same order as describe_block
+ * returns 0 on success, -1 if a null pointer is got from an array
+ */
+static int write_block(const block_list_t* list, size_t* next, char* block_ptr, unsigned long long segment_flags, shmem_copy_task_t* copy_tasks, int* n_copy_tasks) {
+    const block_desc_t* desc = &list->items[(*next)++];
+    if (!shmem_is_bundle(desc->data_class)) {
+        int n = prepare_copy(desc, block_ptr, segment_flags, copy_tasks + *n_copy_tasks);
+        if (n < 0)
+            return -1;
+        *n_copy_tasks += n;
+        return 0;
+    }
+    const mxArray* arr = desc->array;
+    int n_fields = mxIsStruct(arr) ? mxGetNumberOfFields(arr) : 0;
+    shmem_write_bundle_header(block_ptr, desc->header_size_padded, desc->data_class, segment_flags, desc->payload_size_padded,
+                              (unsigned int)mxGetNumberOfDimensions(arr), mxGetDimensions(arr), n_fields);
+    shmem_header_t hdr = { 0 };
+    shmem_parse_header(block_ptr, desc->header_size_padded, &hdr);
+    // names and offsets are written completely, a segment reused from the pool holds the bytes of its previous matrix
+    for (int i = 0; i < n_fields; i++) {
+        char* name = shmem_bundle_field_name(&hdr, block_ptr, i);
+        strncpy(name, mxGetFieldNameByNumber(arr, i), SHMEM_BUNDLE_FIELD_NAME_BYTES - 1);
+        name[SHMEM_BUNDLE_FIELD_NAME_BYTES - 1] = 0;
+    }
+    unsigned long long block_offset = desc->header_size_padded;
+    for (size_t k = 0; k < desc->n_elements; k++) {
+        if (bundle_element(arr, k) == NULL) {
+            shmem_bundle_set_offset(&hdr, block_ptr, k, 0); // unassigned
+            continue;
+        }
+        const block_desc_t* element_desc = &list->items[*next];
+        shmem_bundle_set_offset(&hdr, block_ptr, k, block_offset);
+        if (write_block(list, next, block_ptr + block_offset, 0, copy_tasks, n_copy_tasks))
+            return -1;
+        block_offset += shmem_bundle_block_size(element_desc->header_size_padded + element_desc->payload_size_padded, 0);
+    }
+    return 0;
+}
+
+// input arg [1]: shared memory name
+// input arg [2]: input array, or a struct / cell array (nested arbitrarily) whose numeric, logical and char arrays are
+//                stored in one segment (bundle, see compiler_def.h)
+// input arg [3]: (optional) struct of options
+//   Threads: number of copy threads, 0 (default) for automatic selection
+//   NonTemporal: use non-temporal stores for copying, -1 (default) for enabling when payload is larger than LLC
+//   HugePages: "none" (default), "thp" (transparent huge pages), "hugetlb" (hugetlbfs with default huge page size) or
+//              huge page size such as "2M" / "1G" (hugetlbfs), falls back to "thp" and then "none" if unavailable,
+//              ignored for file backed segments
+//   Transpose: true for storing the transpose of a sparse matrix in the same segment (built by Threads threads), it
+//              is attached by read_shared_matrix with option Transposed, false (default) otherwise
+//   AlignColumns: true for padding the header of a dense matrix so that its data starts at a page boundary, slices
+//                 (see read_shared_matrix) then start at a page boundary if the size of a column is a multiple of the
+//                 page size, false (default) otherwise, ignored for sparse matrices and struct / cell arrays
+//   Encoding: "none" (default), "single", "half", "bfloat16", "int8" or "int16" for storing a real dense double /
+//             single matrix in reduced precision (see shmem_codec.h), the codes are attached by read_shared_matrix and
+//             decoded by decode_shared_matrix
+//   Scale, Offset: element x is stored as (x - Offset) / Scale, by default Scale is 1 and Offset is 0 for floating
+//                  point encodings, integer encodings map the range of the finite elements to the whole code range
+//   Pool: true for placing the matrix in a segment of the segment pool (see shmem_pool.h), a released segment of the
+//         same size class is reused if there is one, the segment is returned to the pool by delete_shared_matrix,
+//         false (default) otherwise, ignored for file backed segments, with option HugePages and by WIN API
+//   Numa: NUMA placement of the pages (Linux only, see shmem_numa.h), "none" (default), "interleave" across NumaNodes,
+//         "bind" to NumaNodes, or "columns" for placing contiguous column blocks of a dense matrix on each node of
+//         NumaNodes, falls back to "none" with a warning if it fails, ignored for file backed segments
+//   NumaNodes: node ids of Numa (0-based), all online nodes by default, required by "bind"
+//   Async: true for returning right after the headers are written, the payload is copied by background threads and
+//          readers (read_shared_matrix) wait for the columns they access (see shmem_sync.h), the input array must not
+//          be freed or modified in place until the copy is complete (delete_shared_matrix waits for it), not supported
+//          with Encoding, Transpose and file backed segments, false (default) otherwise
+// a shared memory name prefixed by SHMEM_FILE_NAME_PREFIX creates a persistent shared matrix in that file, the file is
+// written completely before it replaces an existing file of the same name
+// output arg [1]: base pointer of shared memory
+// output arg [2]: shared memory handle (optional, required in win api)
+// output arg [3]: (optional) struct of copy statistics (Bytes, Seconds, Throughput in GB/s, Threads, NonTemporal, PageSize,
+//                 TransposeSeconds, EncodeSeconds, PoolReused, Async), Seconds is 0 for a copy in background
+// output arg [4]: (optional) actual shared memory name, differs from input arg [1] if the segment is placed on hugetlbfs
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("create_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(2, 3);
+    const mxArray* options = nrhs > 2 ? prhs[2] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 3);
+    if (!async_jobs_exit_registered) {
+        mexAtExit(async_jobs_at_exit);
+        async_jobs_exit_registered = 1;
+    }
+    async_jobs_reap(0);
+
+    // SHARED MEMORY NAME CHECK
+    char shmem_name[MAX_SHMEM_NAME_LENGTH];
+    if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], shmem_name, MAX_SHMEM_NAME_LENGTH))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
+    if (strlen(shmem_name) == 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
+    SHMEM_DEBUG_OUTPUT("Shared memory name: %s\n", shmem_name);
+    
+    // OUTPUT ARGUMENT CHECK
+    unsigned long long* base_pointer = NULL;
+    unsigned long long* output_value = NULL;
+    if (nlhs >= 1 && nlhs <= 4) {
+#if SHMEM_API == SHMEM_WIN_API
+        if (nlhs == 1)
+            mexErrMsgIdAndTxt("SharedMatrix:NotEnoughOutput", "Win API based shared matrix needs to return a handle of the memory");
+#endif
+        MATLAB_CREATE_UINT64_RETURN_MATRIX(0, base_pointer, unsigned long long);
+        if (nlhs >= 2)
+            MATLAB_CREATE_UINT64_RETURN_MATRIX(1, output_value, unsigned long long);
+    }
+    else {
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 4");
+    }
+
+    // COPY OPTIONS
+    shmem_copy_options_t copy_options;
+    copy_options.n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    copy_options.non_temporal = (int)shmem_option_scalar(options, "NonTemporal", -1);
+    if (copy_options.n_threads < 0 || copy_options.n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+    int async_copy = shmem_option_scalar(options, "Async", 0) != 0;
+
+    // HUGE PAGE OPTIONS
+    int hugepage_mode = SHMEM_HUGEPAGE_NONE;
+    unsigned long long hugepage_size = 0;
+    shmem_option_hugepages(options, &hugepage_mode, &hugepage_size);
+
+    // NUMA OPTIONS
+    shmem_numa_t numa;
+    shmem_option_numa(options, &numa);
+
+    // INPUT CHECK AND COMPUTE REQUIRED BYTES
+    block_list_t blocks = { NULL, 0, 0 };
+    unsigned long long total_size = describe_block(prhs[1], &blocks, 0);
+    SHMEM_DEBUG_OUTPUT("Total size: %lld\n", total_size);
+    
+    // PERSISTENT SEGMENT
+    char publish_name[MAX_SHMEM_NAME_LENGTH] = "";
+    if (shmem_name_is_file(shmem_name)) {
+        strcpy(publish_name, shmem_name);
+        if (shmem_staging_name(publish_name, shmem_name, MAX_SHMEM_NAME_LENGTH))
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "File name is too long");
+        hugepage_mode = SHMEM_HUGEPAGE_NONE;
+        numa.policy = SHMEM_NUMA_NONE; // the page cache of files does not follow the policy
+    }
+
+    // REDUCED PRECISION ENCODING
+    block_desc_t* top = &blocks.items[0];
+    char encoding_name[16];
+    shmem_option_string(options, "Encoding", encoding_name, sizeof(encoding_name), "none");
+    int encoding = shmem_encoding_from_name(encoding_name);
+    if (encoding < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Encoding must be \"none\", \"single\", \"half\", \"bfloat16\", \"int8\" or \"int16\"");
+    double encoding_scale = shmem_option_scalar(options, "Scale", 0); // 0: determined by encoding and data
+    double encoding_offset = encoding_scale != 0 ? shmem_option_scalar(options, "Offset", 0) : 0;
+    if (encoding != SHMEM_ENCODING_NONE) {
+        if (shmem_is_bundle(top->data_class) || top->array_attribute != 0 || (top->data_class != mxDOUBLE_CLASS && top->data_class != mxSINGLE_CLASS))
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option Encoding is only supported for real dense double or single matrices");
+        if (encoding_scale - encoding_scale != 0 || encoding_offset - encoding_offset != 0)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Scale and Offset must be finite");
+        top->array_attribute |= ARRAY_ENCODED;
+        top->data_size = shmem_encoding_size(encoding);
+        shmem_layout_sizes(top->data_size, top->array_attribute, (unsigned int)mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]), top->n_elements,
+                           &top->header_size_padded, &top->payload_size_padded);
+        total_size = top->header_size_padded + top->payload_size_padded;
+    }
+
+    // STATISTICS BLOCK
+    // usage counters are kept in the header of the segment (see shmem_stats.h)
+    unsigned long long stats_header_size = shmem_stats_header_size(top->header_size_padded);
+    if (stats_header_size > 0xffffffffULL)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Header with statistics block exceeds 4 GB");
+    total_size += stats_header_size - top->header_size_padded;
+    top->header_size_padded = (unsigned int)stats_header_size;
+
+    // COLUMN ALIGNMENT
+    if (shmem_option_scalar(options, "AlignColumns", 0) != 0 && !shmem_is_bundle(blocks.items[0].data_class) &&
+        !(blocks.items[0].array_attribute & ARRAY_SPARSE)) {
+        unsigned int header_size_padded = blocks.items[0].header_size_padded;
+        blocks.items[0].header_size_padded = shmem_align_data_start(header_size_padded, shmem_align_page_size(hugepage_mode, hugepage_size));
+        total_size += blocks.items[0].header_size_padded - header_size_padded;
+        SHMEM_DEBUG_OUTPUT("Header padded to %d bytes for column alignment\n", blocks.items[0].header_size_padded);
+    }
+
+    // TRANSPOSED MATRIX
+    int build_transpose = shmem_option_scalar(options, "Transpose", 0) != 0;
+    unsigned long long transpose_offset = 0, transpose_nzmax = 0, transpose_payload_size = 0;
+    unsigned int transpose_header_size = 0;
+    mwSize transpose_dims[2] = { 0, 0 };
+    if (build_transpose) {
+        if (shmem_is_bundle(top->data_class) || !(top->array_attribute & ARRAY_SPARSE))
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option Transpose is only supported for sparse matrices");
+        transpose_dims[0] = mxGetN(prhs[1]);
+        transpose_dims[1] = mxGetM(prhs[1]);
+        transpose_nzmax = mxGetJc(prhs[1])[mxGetN(prhs[1])];
+        if (transpose_nzmax == 0)
+            transpose_nzmax = 1;
+        shmem_layout_sizes(top->data_size, top->array_attribute, 2, transpose_dims, transpose_nzmax, &transpose_header_size, &transpose_payload_size);
+        transpose_offset = shmem_bundle_block_size(top->header_size_padded, top->payload_size_padded);
+        top->array_attribute |= ARRAY_TRANSPOSE;
+        top->payload_size_padded = transpose_offset - top->header_size_padded + transpose_header_size + transpose_payload_size;
+        total_size = top->header_size_padded + top->payload_size_padded;
+    }
+
+    if (async_copy && (encoding != SHMEM_ENCODING_NONE || build_transpose || *publish_name))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option Async is not supported with options Encoding, Transpose or a file backed segment");
+
+    // NUMA COLUMN BLOCKS
+    unsigned long long numa_column_bytes = 0, numa_n_cols = 0;
+    if (numa.policy == SHMEM_NUMA_COLUMNS) {
+        if (shmem_is_bundle(top->data_class) || (top->array_attribute & ARRAY_SPARSE))
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option Numa \"columns\" is only supported for dense matrices");
+        numa_column_bytes = mxGetM(prhs[1]) * (unsigned long long)top->data_size;
+        numa_n_cols = mxGetN(prhs[1]);
+    }
+
+    // CREATE SHARED MEMORY
+    shmem_handle_t shmem = 0;
+    void* ptr = NULL;
+    unsigned long long segment_flags = 0;
+    int use_pool = shmem_option_scalar(options, "Pool", 0) != 0 && hugepage_mode == SHMEM_HUGEPAGE_NONE && !shmem_name_is_file(shmem_name);
+    int pool_reused = 0;
+#if SHMEM_API == SHMEM_WIN_API
+    use_pool = 0;
+#elif SHMEM_API == SHMEM_POSIX_API
+    if (use_pool) {
+        const char* failed_api = NULL;
+        int create_errno = shmem_pool_create(shmem_name, total_size, &shmem, &ptr, &pool_reused, &failed_api);
+        if (create_errno)
+            mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API %s failed: %d", failed_api, create_errno);
+        segment_flags = SHMEM_FLAG_POOLED;
+        SHMEM_DEBUG_OUTPUT("Pooled segment of %lld bytes (%s)\n", shmem_pool_class_size(total_size), pool_reused ? "reused" : "new");
+        // counters of STATISTICS start from zero
+        if (pool_reused)
+            memset(ptr, 0, blocks.items[0].header_size_padded);
+    }
+#endif
+    if (!use_pool)
+        shmem_create_segment(shmem_name, total_size, hugepage_mode, hugepage_size, &shmem, &ptr, &segment_flags);
+    // pages are placed before the payload is written
+    shmem_numa_setup(ptr, total_size, segment_flags, &numa, top->header_size_padded + ARRAY_HEADER_SIZE, numa_column_bytes, numa_n_cols);
+    
+    // register exception cleanup, a copy in background is finished first
+    shmem_async_copy_t* async_job = NULL;
+#define EXC_CLEANUP { \
+    if (async_job) \
+        shmem_async_copy_free(async_job); \
+    shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags); \
+}
+
+    // MEMORY COPY
+    // headers are written while collecting copy tasks, all payloads are copied by one parallel copy (pages are split
+    // among threads regardless of array boundaries), or in background after the header is complete (option Async)
+    shmem_copy_task_t* copy_tasks = (shmem_copy_task_t*)mxMalloc(sizeof(shmem_copy_task_t) * 3 * blocks.n);
+    int n_copy_tasks = 0;
+    size_t next_block = 0;
+    if (write_block(&blocks, &next_block, (char*)ptr, segment_flags | SHMEM_FLAG_STATS, copy_tasks, &n_copy_tasks)) {
+        EXC_CLEANUP;
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array");
+    }
+    shmem_copy_stats_t copy_stats = { 0, 0, 0, 0 };
+    if (async_copy) {
+        for (int i = 0; i < n_copy_tasks; i++)
+            copy_stats.bytes += copy_tasks[i].size;
+    }
+    else {
+        shmem_parallel_copy(copy_tasks, n_copy_tasks, &copy_options, &copy_stats);
+        SHMEM_DEBUG_OUTPUT("Copied %lld bytes in %f seconds (%d threads)\n", copy_stats.bytes, copy_stats.seconds, copy_stats.n_threads);
+    }
+
+    // BUILD TRANSPOSED MATRIX
+    // the transpose is built from the input array, the copied pages are not read again
+    double transpose_seconds = 0;
+    if (build_transpose) {
+        double start_time = shmem_time_seconds();
+        char* transpose_ptr = ((char*)ptr) + transpose_offset;
+        shmem_write_header(transpose_ptr, transpose_header_size, top->data_class, top->array_attribute & ~ARRAY_TRANSPOSE, transpose_payload_size, 2, transpose_dims, transpose_nzmax);
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(transpose_nzmax, top->data_size, &ofs_ir, &ofs_jc);
+        char* payload_ptr = transpose_ptr + transpose_header_size;
+        shmem_sparse_transpose_t transpose;
+        transpose.n_rows = mxGetM(prhs[1]);
+        transpose.n_cols = mxGetN(prhs[1]);
+        transpose.jc = mxGetJc(prhs[1]);
+        transpose.ir = mxGetIr(prhs[1]);
+        transpose.pr = source_data(top);
+        transpose.data_size = top->data_size;
+        transpose.dst_pr = payload_ptr + ARRAY_HEADER_SIZE;
+        transpose.dst_ir = (mwIndex*)(payload_ptr + ofs_ir + ARRAY_HEADER_SIZE);
+        transpose.dst_jc = (mwIndex*)(payload_ptr + ofs_jc + ARRAY_HEADER_SIZE);
+#if ARRAY_HEADER_SIZE > 0
+        memcpy(payload_ptr, transpose.pr - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+        memcpy(payload_ptr + ofs_ir, ((const char*)transpose.ir) - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+        memcpy(payload_ptr + ofs_jc, ((const char*)transpose.jc) - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+#endif
+        if (shmem_parallel_sparse_transpose(&transpose, copy_options.n_threads) == 0) {
+            EXC_CLEANUP;
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+        }
+        transpose_seconds = shmem_time_seconds() - start_time;
+        SHMEM_DEBUG_OUTPUT("Transposed in %f seconds\n", transpose_seconds);
+    }
+
+    // ENCODE PAYLOAD
+    double encode_seconds = 0;
+    if (encoding != SHMEM_ENCODING_NONE) {
+        double start_time = shmem_time_seconds();
+        char* payload_ptr = ((char*)ptr) + top->header_size_padded;
+#if ARRAY_HEADER_SIZE > 0
+        // ARRAY_HEADER of the class of the codes
+        mxArray* template_array = mxCreateNumericMatrix(1, 1, (mxClassID)shmem_encoding_class(encoding), mxREAL);
+        if (template_array) {
+            memcpy(payload_ptr, ((const char*)mxGetData(template_array)) - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+            mxDestroyArray(template_array);
+        }
+#endif
+        if (shmem_parallel_encode(source_data(top), top->data_class == mxSINGLE_CLASS, top->n_elements, encoding, &encoding_scale, &encoding_offset,
+                                  payload_ptr + ARRAY_HEADER_SIZE, copy_options.n_threads) == 0) {
+            EXC_CLEANUP;
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+        }
+        shmem_write_encoding(ptr, (unsigned int)mxGetNumberOfDimensions(prhs[1]), encoding, encoding_scale, encoding_offset);
+        encode_seconds = shmem_time_seconds() - start_time;
+        SHMEM_DEBUG_OUTPUT("Encoded (scale: %g, offset: %g) in %f seconds\n", encoding_scale, encoding_offset, encode_seconds);
+    }
+    shmem_header_t hdr = { 0 };
+    if (shmem_parse_header(ptr, top->header_size_padded, &hdr) == NULL) {
+        char* stats = shmem_stats_ptr(&hdr, ptr);
+        shmem_stats_init(stats, copy_stats.bytes, copy_stats.seconds + transpose_seconds + encode_seconds, shmem_map_size(total_size, segment_flags),
+                         *publish_name != 0);
+        shmem_numa_record(stats, &numa);
+        if (async_copy)
+            async_job = shmem_async_copy_start(copy_tasks, n_copy_tasks, &copy_options, (const char*)ptr, stats, &copy_stats);
+    }
+    if (async_copy && async_job == NULL) {
+        // no background thread, copied before returning
+        async_copy = 0;
+        shmem_parallel_copy(copy_tasks, n_copy_tasks, &copy_options, &copy_stats);
+    }
+    mxFree(copy_tasks);
+    mxFree(blocks.items);
+
+    if (nlhs >= 3) {
+        const char* stat_fields[] = { "Bytes", "Seconds", "Throughput", "Threads", "NonTemporal", "PageSize", "TransposeSeconds", "EncodeSeconds", "PoolReused",
+                                      "Async" };
+        plhs[2] = mxCreateStructMatrix(1, 1, 10, stat_fields);
+        if (plhs[2] == NULL) {
+            EXC_CLEANUP;
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        }
+        shmem_set_field_scalar(plhs[2], "Bytes", (double)copy_stats.bytes);
+        shmem_set_field_scalar(plhs[2], "Seconds", copy_stats.seconds);
+        shmem_set_field_scalar(plhs[2], "Throughput", copy_stats.seconds > 0 ? copy_stats.bytes / copy_stats.seconds / 1e9 : 0);
+        shmem_set_field_scalar(plhs[2], "Threads", copy_stats.n_threads);
+        shmem_set_field_scalar(plhs[2], "NonTemporal", copy_stats.non_temporal);
+        shmem_set_field_scalar(plhs[2], "PageSize", (double)(shmem_flag_page_size(segment_flags) ? shmem_flag_page_size(segment_flags) : shmem_page_size()));
+        shmem_set_field_scalar(plhs[2], "TransposeSeconds", transpose_seconds);
+        shmem_set_field_scalar(plhs[2], "EncodeSeconds", encode_seconds);
+        shmem_set_field_scalar(plhs[2], "PoolReused", pool_reused);
+        shmem_set_field_scalar(plhs[2], "Async", async_copy);
+    }
+    if (nlhs >= 4) {
+        plhs[3] = mxCreateString(*publish_name ? publish_name : shmem_name);
+        if (plhs[3] == NULL) {
+            EXC_CLEANUP;
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateString");
+        }
+    }
+    async_job_entry_t* job_entry = NULL;
+    if (async_job) {
+        job_entry = (async_job_entry_t*)malloc(sizeof(async_job_entry_t));
+        if (job_entry == NULL) {
+            EXC_CLEANUP;
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+        }
+    }
+
+    // published after every step which may fail, the cleanup removes the staging file only (other processes may open
+    // the published file at once)
+    if (*publish_name) {
+#if SHMEM_API == SHMEM_POSIX_API
+        // start writing back to disk, does not wait for it
+        SHMEM_DEBUG_OUTPUT("API call: msync\n");
+        msync(ptr, total_size, MS_ASYNC);
+#endif
+        if (shmem_publish_segment(shmem_name, publish_name)) {
+            free(job_entry);
+            EXC_CLEANUP;
+            mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "Failed to rename %s to %s", shmem_name, publish_name);
+        }
+        strcpy(shmem_name, publish_name);
+    }
+    if (job_entry) {
+        job_entry->job = async_job;
+        job_entry->next = async_jobs;
+        async_jobs = job_entry;
+        mexLock();
     }
     *base_pointer = (unsigned long long)ptr;
     if (output_value)
@@ -1,19 +1,31 @@
-function host_struct = create_shmat(varargin)
-% Create a struct which contains the host shared memory for the given arguments
+function host = create_shmat(varargin)
+% Create a host holding all the given arguments in one shared memory segment (bundle)
 % Example:
 % a = randn(5);
 % b = a + eye(5);
-% host = create_shmat_host(a, b);
-% host.a is an instance of shared_matrix_host(a) object, and
-% host.b is an instance of shared_matrix_host(b) object
-for i = 1:nargin
+% host = create_shmat(a, b);
+% host is an instance of shared_matrix_host whose data is a struct with fields a and b, attach_shmat(host) maps the
+% whole struct with a single mapping per worker
+% create_shmat('-separate', a, b) creates one shared_matrix_host per argument instead, host.a is an instance of
+% shared_matrix_host(a) object, and host.b is an instance of shared_matrix_host(b) object
+separate = nargin >= 1 && ischar(varargin{1}) && strcmp(varargin{1}, '-separate');
+data_struct = struct();
+for i = 1 + separate:nargin
     arg_name = inputname(i);
     if isempty(arg_name)
         warning('No argument name specified for arg #%d, using "name%d" as argument name', i, i);
         arg_name = sprintf('Name%d', i);
     end
     arg = varargin{i};
-    arg_host = shared_matrix_host(arg);
-    host_struct.(arg_name) = arg_host;
+    if separate
+        data_struct.(arg_name) = shared_matrix_host(arg);
+    else
+        data_struct.(arg_name) = arg;
+    end
+end
+if separate
+    host = data_struct;
+else
+    host = shared_matrix_host(data_struct);
 end
 end
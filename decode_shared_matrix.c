@@ -0,0 +1,114 @@
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_codec.h"
+
+// input arg [1]: base pointer of the shared memory (created by host, or attached without option Slice) of a matrix
+//                created with option Encoding
+// input arg [2]: [first, last] column range decoded (1-based, inclusive), all dimensions after the first one are
+//                treated as columns, all columns if empty
+// input arg [3]: (optional) struct of options
+//   Class: "double" or "single", class of the decoded matrix, the class of the source matrix by default
+//   Threads: number of decode threads, 0 (default) for automatic selection
+//   Kernel: "auto" (default), "avx512", "avx2" or "scalar", falls back to the best kernel supported by the CPU
+// output arg [1]: decoded columns (rows * columns matrix, or the dimensions of the source matrix if all columns are
+//                 decoded), a private copy of the worker
+// output arg [2]: (optional) struct of decode statistics (Bytes of codes read, Seconds, Throughput in GB/s, Threads,
+//                 Kernel)
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("decode_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(1, 3);
+    if (nlhs > 2)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 2");
+    const mxArray* options = nrhs > 2 ? prhs[2] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 3);
+
+    // address containing base ptr
+    if (!mxIsUint64(prhs[0]) || mxGetNumberOfElements(prhs[0]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 base pointer");
+    const char* ptr_base = (const char*)*(unsigned long long*)mxGetData(prhs[0]);
+    if (ptr_base == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
+    shmem_header_t hdr = { 0 };
+    const char* header_err = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), &hdr);
+    if (header_err)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+    if (!(hdr.array_attribute & ARRAY_ENCODED))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Matrix is not created with option Encoding");
+
+    // COLUMN RANGE
+    unsigned long long n_rows = shmem_header_dim(&hdr, 0);
+    unsigned long long n_cols = 1;
+    for (unsigned int i = 1; i < hdr.n_dims; i++)
+        n_cols *= shmem_header_dim(&hdr, i);
+    unsigned long long col_begin = 0, col_end = n_cols;
+    if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+        if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 2)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [2] must be a [first, last] column range");
+        const double* range = mxGetPr(prhs[1]);
+        if (range[0] < 1 || range[1] < range[0] || range[1] > (double)n_cols || range[0] != (double)(unsigned long long)range[0] ||
+            range[1] != (double)(unsigned long long)range[1])
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Column range must be integers in [1, %lld]", n_cols);
+        col_begin = (unsigned long long)range[0] - 1;
+        col_end = (unsigned long long)range[1];
+    }
+
+    // DECODE OPTIONS
+    char class_name[16];
+    shmem_option_string(options, "Class", class_name, sizeof(class_name), hdr.matrix_type == mxSINGLE_CLASS ? "single" : "double");
+    int dst_class = shmem_class_from_name(class_name);
+    if (dst_class != mxDOUBLE_CLASS && dst_class != mxSINGLE_CLASS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Class must be \"double\" or \"single\"");
+    int n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    if (n_threads < 0 || n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+    char kernel_name[16];
+    shmem_option_string(options, "Kernel", kernel_name, sizeof(kernel_name), "auto");
+    int kernel = shmem_codec_kernel();
+    if (strcmp(kernel_name, "scalar") == 0) kernel = SHMEM_CODEC_KERNEL_SCALAR;
+    else if (strcmp(kernel_name, "avx2") == 0) kernel = SHMEM_CODEC_KERNEL_AVX2;
+    else if (strcmp(kernel_name, "avx512") == 0) kernel = SHMEM_CODEC_KERNEL_AVX512;
+    else if (strcmp(kernel_name, "auto") != 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Kernel must be \"auto\", \"avx512\", \"avx2\" or \"scalar\"");
+    if (kernel > shmem_codec_kernel())
+        kernel = shmem_codec_kernel();
+
+    // DECODE
+    if (col_begin == 0 && col_end == n_cols) {
+        mwSize static_dims[MAX_STATIC_ALLOCATED_DIMS];
+        mwSize* dims = hdr.n_dims <= MAX_STATIC_ALLOCATED_DIMS ? static_dims : (mwSize*)mxMalloc(sizeof(mwSize) * hdr.n_dims);
+        for (unsigned int i = 0; i < hdr.n_dims; i++)
+            dims[i] = (mwSize)shmem_header_dim(&hdr, i);
+        plhs[0] = mxCreateUninitNumericArray(hdr.n_dims, dims, (mxClassID)dst_class, mxREAL);
+        if (dims != static_dims)
+            mxFree(dims);
+    }
+    else {
+        plhs[0] = mxCreateUninitNumericMatrix((mwSize)n_rows, (mwSize)(col_end - col_begin), (mxClassID)dst_class, mxREAL);
+    }
+    if (plhs[0] == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateUninitNumericMatrix");
+    unsigned long long n_elements = n_rows * (col_end - col_begin);
+    double start_time = shmem_time_seconds();
+    if (n_elements > 0) {
+        n_threads = shmem_parallel_decode(ptr_base + shmem_column_offset(&hdr, col_begin), (int)hdr.encoding, n_elements, hdr.scale, hdr.offset,
+                                          mxGetData(plhs[0]), dst_class == mxSINGLE_CLASS, kernel, n_threads);
+        if (n_threads == 0)
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+    }
+    double seconds = shmem_time_seconds() - start_time;
+    SHMEM_DEBUG_OUTPUT("Decoded %lld elements in %f seconds (%s, %d threads)\n", n_elements, seconds, shmem_codec_kernel_name(kernel), n_threads);
+
+    if (nlhs >= 2) {
+        const char* stat_fields[] = { "Bytes", "Seconds", "Throughput", "Threads", "Kernel" };
+        plhs[1] = mxCreateStructMatrix(1, 1, 5, stat_fields);
+        if (plhs[1] == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        double bytes = (double)n_elements * hdr.data_size;
+        shmem_set_field_scalar(plhs[1], "Bytes", bytes);
+        shmem_set_field_scalar(plhs[1], "Seconds", seconds);
+        shmem_set_field_scalar(plhs[1], "Throughput", seconds > 0 ? bytes / seconds / 1e9 : 0);
+        shmem_set_field_scalar(plhs[1], "Threads", n_threads);
+        mxSetField(plhs[1], 0, "Kernel", mxCreateString(shmem_codec_kernel_name(kernel)));
+    }
+}
@@ -1,14 +1,33 @@
 #include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_attach.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+#include "shmem_pool.h"
 
 // input arg [1]: opened handle to release
 // input arg [2]: base pointer of the shared memory
 // input arg [3]: matlab cell containing array created from shared memory (not required for host memory)
-// input arg [4]: shared memory name (required in POSIX API)
+// input arg [4]: shared memory name (required in POSIX API), empty for keeping the segment (persistent file)
+// input arg [5]: (optional) struct of options
+//   PoolBytes: cap of the bytes kept in the segment pool (default 1 GB), a segment created with option Pool is returned
+//              to the pool instead of being removed, the oldest pooled segments are removed to stay below the cap
+// arrays returned by read_shared_matrix are released by read_shared_matrix(name, 'detach', cell) instead
+// the host drops its reference to the segment, the segment is removed here if no worker holds a reference, otherwise
+// by the worker dropping the last reference (see shmem_stats.h)
+// waits until a copy in background (option Async of create_shared_matrix) is complete
 void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("delete_shared_matrix");
     if (nlhs != 0)
         mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "delete_shared_matrix does not accept any output");
-    MATLAB_PRHS_PTR_CHECK_STRICT(4);
+    MATLAB_PRHS_PTR_CHECK_RANGE(4, 5);
     bool throw_error_not_supported = false;
+    const mxArray* options = nrhs > 4 ? prhs[4] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 5);
+    double pool_bytes = shmem_option_scalar(options, "PoolBytes", (double)SHMEM_POOL_DEFAULT_BYTES);
+    if (!(pool_bytes >= 0))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option PoolBytes must be non-negative");
 
     // address containing base ptr
     unsigned long long* ptr_base = (unsigned long long*)mxGetPr(prhs[1]);
@@ -18,6 +37,10 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
     if (ptr_base == NULL)
         mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
     SHMEM_DEBUG_OUTPUT("Base pointer: %p\n", ptr_base);
+    shmem_header_t hdr = { 0 };
+    char* stats = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), &hdr) == NULL ? shmem_stats_ptr(&hdr, ptr_base) : NULL;
+    // the payload may still be copied into this mapping by create_shared_matrix (option Async)
+    shmem_fill_wait(stats, ~0ULL, mxGetInf());
 
     const mxArray* cell = prhs[2];
     if (cell == NULL)
@@ -26,45 +49,33 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
         mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [3] must be a cell");
     if (mxGetM(cell) * mxGetN(cell) > 0) {
         // needs to replace matlab mxArray pointer
-
-        // check header
-        unsigned long long matrix_type = SHMEM_READ_CAST(unsigned long long, ptr_base, 8);
-        unsigned long long array_attribute = SHMEM_READ_CAST(unsigned long long, ptr_base, 16);
-        SHMEM_DEBUG_OUTPUT("Matrix type: %lld\n", matrix_type);
-        SHMEM_DEBUG_OUTPUT("Matrix flag: %lld\n", array_attribute);
-
         mxArray* data_array = mxGetCell(cell, 0);
         if (data_array == NULL)
             mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null array object pointer");
-        // set dimension
-        const mwSize zero_dims[] = { 0, 0 };
-        mxSetDimensions(data_array, zero_dims, 2);
-
-        if (array_attribute & ARRAY_SPARSE) {
-            // sparse array
-            mxSetNzmax(data_array, 0);
-            SHMEM_DEBUG_OUTPUT("CALL mxSetNzmax done\n");
-            mxSetIr(data_array, NULL);
-            SHMEM_DEBUG_OUTPUT("CALL mxSetIr done\n");
-            mxSetJc(data_array, NULL);
-            SHMEM_DEBUG_OUTPUT("CALL mxSetJc done\n");
-        }
-
-        // detach array
-        if (array_attribute & ARRAY_COMPLEX) {
-#ifndef SHMEM_COMPLEX_SUPPORTED
-            // no op will be performed here, throw the exception after releasing shared memory (probably matlab will crash in the future)
+        // no op will be performed on complex array before R2018a, throw the exception after releasing shared memory (probably matlab will crash in the future)
+        if (!shmem_detach_array(data_array)) {
             throw_error_not_supported = true;
-#else
-            set_ic_ptr(data_array, (int)matrix_type, NULL);
-#endif
         }
         else {
-            mxSetPr(data_array, NULL);
+            shmem_stats_add(stats, SHMEM_STATS_ACTIVE_ATTACHES, -1);
+            shmem_stats_add(stats, SHMEM_STATS_DETACHES, 1);
         }
-        SHMEM_DEBUG_OUTPUT("CALL mxSetPr done\n");
     }
-
+    char shmem_name[MAX_SHMEM_NAME_LENGTH] = "";
+    if (!mxIsEmpty(prhs[3])) {
+        if (!mxIsChar(prhs[3]) || mxGetString(prhs[3], shmem_name, MAX_SHMEM_NAME_LENGTH))
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [4]: shared memory name");
+        if (strlen(shmem_name) == 0)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
+        SHMEM_DEBUG_OUTPUT("Shared memory name: %s\n", shmem_name);
+    }
+    int remove_segment = *shmem_name != 0;
+    if (stats) {
+        shmem_stats_add(stats, SHMEM_STATS_MAPPED_BYTES, -(long long)shmem_map_size(hdr.total_size, hdr.segment_flags));
+        remove_segment = shmem_ref_release(stats, remove_segment);
+        if (*shmem_name && !remove_segment)
+            SHMEM_DEBUG_OUTPUT("Shared memory is referenced by workers, removed by the last of them\n");
+    }
 
     // release shared memory
     unsigned long long* ptr_handle = (unsigned long long*)mxGetPr(prhs[0]);
@@ -72,6 +83,7 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
         mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null data pointer from non-null array object");
     SHMEM_DEBUG_OUTPUT("Handle: %lld\n", *ptr_handle);
 #if SHMEM_API == SHMEM_WIN_API
+    (void)pool_bytes;
     HANDLE handle = (HANDLE)*ptr_handle;
     SHMEM_DEBUG_OUTPUT("API call: UnmapViewOfFile\n");
     UnmapViewOfFile(ptr_base);
@@ -79,25 +91,22 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
     CloseHandle(handle);
 #elif SHMEM_API == SHMEM_POSIX_API
     int handle = (int)*ptr_handle;
-    char shmem_name[MAX_SHMEM_NAME_LENGTH] = "";
-    if (!mxIsEmpty(prhs[3])) {
-        if (!mxIsChar(prhs[3]) || mxGetString(prhs[3], shmem_name, MAX_SHMEM_NAME_LENGTH))
-            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [4]: shared memory name");
-        if (strlen(shmem_name) == 0)
-            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
-        SHMEM_DEBUG_OUTPUT("Shared memory name: %s\n", shmem_name);
-    }
     unsigned int header_size = SHMEM_READ_CAST(unsigned int, ptr_base, 4);
     unsigned long long payload_size = SHMEM_READ_CAST(unsigned long long, ptr_base, 24);
+    unsigned long long segment_flags = SHMEM_READ_CAST(unsigned long long, ptr_base, 16) & SHMEM_FLAG_SEGMENT_MASK;
     unsigned long long total_size = payload_size + header_size;
     SHMEM_DEBUG_OUTPUT("Total size: %lld\n", total_size);
+    // no process holds a reference anymore, the segment can be reused
+    if (remove_segment && (segment_flags & SHMEM_FLAG_POOLED) && !shmem_name_is_file(shmem_name) &&
+        shmem_pool_put(shmem_name, ptr_base, pool_bytes >= 1.8e19 ? ~0ULL : (unsigned long long)pool_bytes) == 0)
+        remove_segment = 0;
     SHMEM_DEBUG_OUTPUT("API call: munmap\n");
-    munmap(ptr_base, total_size);
+    shmem_posix_unmap(ptr_base, total_size, segment_flags);
     SHMEM_DEBUG_OUTPUT("API call: close\n");
     close(handle);
-    if (*shmem_name) {
+    if (remove_segment) {
         SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
-        shm_unlink(shmem_name);
+        shmem_posix_unlink(shmem_name);
     }
 #endif
     if (throw_error_not_supported)
@@ -9,8 +9,13 @@ function detach_shmat(host_or_dev_struct)
 % disp(data.a); disp(data.b);
 % detach_shmat(dev);
 % detach_shmat(host);
+if isa(host_or_dev_struct, 'shared_matrix_host') || isa(host_or_dev_struct, 'shared_matrix')
+    % bundle created by create_shmat
+    host_or_dev_struct.detach();
+    return
+end
 if ~isstruct(host_or_dev_struct)
-    error('Parameter host_or_dev_struct must be an instance of struct');
+    error('Parameter host_or_dev_struct must be an instance of struct, shared_matrix_host or shared_matrix');
 end
 fields = fieldnames(host_or_dev_struct);
 for i = 1:length(fields)
@@ -0,0 +1,214 @@
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_attach.h"
+#include "shmem_stats.h"
+#include "shmem_numa.h"
+#include "shmem_load.h"
+
+// description of a raw file from options Class, Dims, Complex, Order and Offset
+static void raw_desc(const mxArray* options, shmem_load_desc_t* desc) {
+    char option_str[16];
+    shmem_option_string(options, "Class", option_str, sizeof(option_str), "double");
+    desc->data_class = shmem_class_from_name(option_str);
+    if (desc->data_class == mxUNKNOWN_CLASS)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Unsupported data type: %s", option_str);
+    desc->complex_flag = shmem_option_scalar(options, "Complex", 0) != 0;
+    if (desc->complex_flag) {
+#ifndef SHMEM_COMPLEX_SUPPORTED
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Complex array is not supported before R2018a");
+#endif
+        if (desc->data_class == mxLOGICAL_CLASS)
+            mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Logical attribute could not composite with complex");
+    }
+    desc->data_size = shmem_class_size(desc->data_class) * (desc->complex_flag ? 2 : 1);
+    const mxArray* dims_array = options ? mxGetField(options, 0, "Dims") : NULL;
+    if (dims_array == NULL || !mxIsDouble(dims_array) || mxIsComplex(dims_array) || mxGetNumberOfElements(dims_array) < 2 ||
+        mxGetNumberOfElements(dims_array) > SHMEM_LOAD_MAX_DIMS)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Option Dims must be a vector of 2 to %d dimensions for a raw file", SHMEM_LOAD_MAX_DIMS);
+    desc->n_dims = (unsigned int)mxGetNumberOfElements(dims_array);
+    for (unsigned int i = 0; i < desc->n_dims; i++) {
+        double dim = mxGetPr(dims_array)[i];
+        if (dim < 0 || dim != (double)(mwSize)dim)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Dims must be non-negative integers");
+        desc->dims[i] = (mwSize)dim;
+    }
+    shmem_option_string(options, "Order", option_str, sizeof(option_str), "F");
+    if (strcmp(option_str, "F") != 0 && strcmp(option_str, "C") != 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Order must be \"F\" (column-major) or \"C\" (row-major)");
+    desc->c_order = option_str[0] == 'C';
+    if (desc->c_order && desc->n_dims > 2)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Order \"C\" is only supported for 2 dimensions");
+    double offset = shmem_option_scalar(options, "Offset", 0);
+    if (offset < 0 || offset != (double)(unsigned long long)offset)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Offset must be a non-negative integer");
+    desc->data_offset = (unsigned long long)offset;
+}
+
+// input arg [1]: shared memory name
+// input arg [2]: path of the source file
+// input arg [3]: (optional) struct of options
+//   Format: "auto" (default, "npy" for a file name ending with .npy, "raw" otherwise), "raw" or "npy" (see shmem_load.h)
+//   Class, Dims, Complex: class name ("double" by default), dimensions and complexity of a raw file (ignored for npy)
+//   Order: "F" (default) for column-major elements, "C" for row-major elements (2-D only) of a raw file, they are
+//          transposed while they are read (npy files give their order in the header)
+//   Offset: bytes before the first element of a raw file, 0 by default
+//   Threads: number of reading threads, 0 (default) for automatic selection
+//   Direct: true for unbuffered reads (O_DIRECT / FILE_FLAG_NO_BUFFERING) bypassing page cache, false for buffered
+//           reads, -1 (default) for unbuffered reads of files holding at least SHMEM_LOAD_DIRECT_MIN_BYTES of data
+//   HugePages, AlignColumns, Numa, NumaNodes: same as create_shared_matrix
+// the elements are read into the segment without any copy held by Matlab
+// output arg [1]: base pointer of shared memory
+// output arg [2]: shared memory handle
+// output arg [3]: (optional) struct of load statistics (Bytes, Seconds, Throughput in GB/s, Threads, Direct,
+//                 Transposed, Format)
+// output arg [4]: (optional) actual shared memory name, differs from input arg [1] if the segment is placed on hugetlbfs
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("load_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(2, 3);
+    const mxArray* options = nrhs > 2 ? prhs[2] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 3);
+    if (nlhs < 2 || nlhs > 4)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "load_shared_matrix returns base pointer, handle, optional statistics and name");
+
+    // SHARED MEMORY NAME CHECK
+    char shmem_name[MAX_SHMEM_NAME_LENGTH];
+    if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], shmem_name, MAX_SHMEM_NAME_LENGTH))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
+    if (strlen(shmem_name) == 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
+    char path[MAX_SHMEM_NAME_LENGTH];
+    if (!mxIsChar(prhs[1]) || mxGetString(prhs[1], path, MAX_SHMEM_NAME_LENGTH) || strlen(path) == 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [2]: file path");
+    SHMEM_DEBUG_OUTPUT("Shared memory name: %s, source file: %s\n", shmem_name, path);
+
+    // SOURCE FILE
+    char format_name[8];
+    shmem_option_string(options, "Format", format_name, sizeof(format_name), "auto");
+    int format = SHMEM_LOAD_RAW;
+    if (strcmp(format_name, "auto") == 0) {
+        size_t len = strlen(path);
+        format = len >= 4 && strcmp(path + len - 4, ".npy") == 0 ? SHMEM_LOAD_NPY : SHMEM_LOAD_RAW;
+    }
+    else if (strcmp(format_name, "npy") == 0) {
+        format = SHMEM_LOAD_NPY;
+    }
+    else if (strcmp(format_name, "raw") != 0) {
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Format must be \"auto\", \"raw\" or \"npy\"");
+    }
+    shmem_load_desc_t desc;
+    memset(&desc, 0, sizeof(desc));
+    if (format == SHMEM_LOAD_RAW)
+        raw_desc(options, &desc);
+    shmem_load_file_t file = shmem_load_open(path, 0);
+    if (file == SHMEM_LOAD_NO_FILE)
+        mexErrMsgIdAndTxt("SharedMatrix:NotFound", "Could not open file %s", path);
+    unsigned long long file_size = 0;
+    const char* err_msg = format == SHMEM_LOAD_NPY ? shmem_load_npy_header(file, &desc) : NULL;
+    if (err_msg == NULL && shmem_load_file_size(file, &file_size) != 0)
+        err_msg = "Could not get the size of the file";
+    shmem_load_close(file);
+    if (err_msg)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "%s: %s", path, err_msg);
+    unsigned long long data_bytes = shmem_load_desc_bytes(&desc);
+    if (file_size < desc.data_offset || file_size - desc.data_offset < data_bytes)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "File %s holds %lld bytes of data, %lld bytes are required", path,
+                          file_size > desc.data_offset ? file_size - desc.data_offset : 0, data_bytes);
+    unsigned long long array_attribute = 0;
+    if (desc.complex_flag)
+        array_attribute |= ARRAY_COMPLEX;
+    if (desc.data_class == mxLOGICAL_CLASS)
+        array_attribute |= ARRAY_LOGICAL;
+
+    // OPTIONS
+    int n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    if (n_threads < 0 || n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+    int direct = (int)shmem_option_scalar(options, "Direct", -1);
+    if (direct < 0)
+        direct = data_bytes >= SHMEM_LOAD_DIRECT_MIN_BYTES;
+    int hugepage_mode = SHMEM_HUGEPAGE_NONE;
+    unsigned long long hugepage_size = 0;
+    shmem_option_hugepages(options, &hugepage_mode, &hugepage_size);
+    shmem_numa_t numa;
+    shmem_option_numa(options, &numa);
+
+    // COMPUTE REQUIRED BYTES
+    unsigned int header_size_padded = 0;
+    unsigned long long payload_size_padded = 0;
+    shmem_layout_sizes(desc.data_size, array_attribute, desc.n_dims, desc.dims, 0, &header_size_padded, &payload_size_padded);
+    header_size_padded = (unsigned int)shmem_stats_header_size(header_size_padded);
+    if (shmem_option_scalar(options, "AlignColumns", 0) != 0)
+        header_size_padded = shmem_align_data_start(header_size_padded, shmem_align_page_size(hugepage_mode, hugepage_size));
+    unsigned long long total_size = header_size_padded + payload_size_padded;
+    SHMEM_DEBUG_OUTPUT("Total size: %lld\n", total_size);
+
+    unsigned long long* base_pointer = NULL;
+    unsigned long long* output_handle = NULL;
+    MATLAB_CREATE_UINT64_RETURN_MATRIX(0, base_pointer, unsigned long long);
+    MATLAB_CREATE_UINT64_RETURN_MATRIX(1, output_handle, unsigned long long);
+
+    // CREATE SHARED MEMORY
+    shmem_handle_t shmem;
+    void* ptr = NULL;
+    unsigned long long segment_flags = 0;
+    shmem_create_segment(shmem_name, total_size, hugepage_mode, hugepage_size, &shmem, &ptr, &segment_flags);
+    if (shmem_name_is_file(shmem_name))
+        numa.policy = SHMEM_NUMA_NONE;
+    unsigned long long n_cols = 1;
+    for (unsigned int i = 1; i < desc.n_dims; i++)
+        n_cols *= desc.dims[i];
+    shmem_numa_setup(ptr, total_size, segment_flags, &numa, header_size_padded + ARRAY_HEADER_SIZE, desc.dims[0] * (unsigned long long)desc.data_size, n_cols);
+    shmem_write_header(ptr, header_size_padded, desc.data_class, array_attribute | segment_flags | SHMEM_FLAG_STATS, payload_size_padded,
+                       desc.n_dims, desc.dims, 0);
+    shmem_header_t hdr = { 0 };
+    err_msg = shmem_parse_header(ptr, total_size, &hdr);
+    if (err_msg) {
+        shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", err_msg);
+    }
+#if ARRAY_HEADER_SIZE > 0
+    shmem_write_array_headers(&hdr, ((char*)ptr) + header_size_padded);
+#endif
+
+    // READ ELEMENTS
+    double start_time = shmem_time_seconds();
+    int read_err = shmem_load_parallel_read(path, &desc, ((char*)ptr) + header_size_padded + ARRAY_HEADER_SIZE, &direct, &n_threads);
+    double seconds = shmem_time_seconds() - start_time;
+    if (read_err) {
+        shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+        if (read_err == -1)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "File %s is shorter than expected", path);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "Failed to read file %s: %d", path, read_err);
+    }
+    SHMEM_DEBUG_OUTPUT("Read %lld bytes in %f seconds (%d threads, direct: %d)\n", data_bytes, seconds, n_threads, direct);
+    char* stats = shmem_stats_ptr(&hdr, ptr);
+    shmem_stats_init(stats, data_bytes, seconds, shmem_map_size(total_size, segment_flags), 0);
+    shmem_numa_record(stats, &numa);
+
+    if (nlhs >= 3) {
+        const char* stat_fields[] = { "Bytes", "Seconds", "Throughput", "Threads", "Direct", "Transposed", "Format" };
+        plhs[2] = mxCreateStructMatrix(1, 1, 7, stat_fields);
+        if (plhs[2] == NULL) {
+            shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        }
+        shmem_set_field_scalar(plhs[2], "Bytes", (double)data_bytes);
+        shmem_set_field_scalar(plhs[2], "Seconds", seconds);
+        shmem_set_field_scalar(plhs[2], "Throughput", seconds > 0 ? (double)data_bytes / seconds / 1e9 : 0);
+        shmem_set_field_scalar(plhs[2], "Threads", n_threads);
+        shmem_set_field_scalar(plhs[2], "Direct", direct);
+        shmem_set_field_scalar(plhs[2], "Transposed", desc.c_order);
+        mxSetField(plhs[2], 0, "Format", mxCreateString(format == SHMEM_LOAD_NPY ? "npy" : "raw"));
+    }
+    if (nlhs >= 4) {
+        plhs[3] = mxCreateString(shmem_name);
+        if (plhs[3] == NULL) {
+            shmem_destroy_segment(shmem_name, shmem, ptr, total_size, segment_flags);
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateString");
+        }
+    }
+    *base_pointer = (unsigned long long)ptr;
+    *output_handle = (unsigned long long)shmem;
+}
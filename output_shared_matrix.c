@@ -0,0 +1,445 @@
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_access.h"
+#include "shmem_copy.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+
+/*
+ * Writer views of output matrices
+ *
+ * A writer view maps only the page aligned window holding a range of columns of a dense matrix, shared and writable
+ * (unlike a slice of read_shared_matrix, no page of it is remapped privately, columns sharing a page with the
+ * neighbouring views are written through to the segment). Every open view holds a reference to the segment and counts
+ * as a writer of the completion barrier (see shmem_sync.h), the MEX file is locked while any view is open. Views are
+ * not shared with the attach cache of read_shared_matrix.
+ */
+typedef struct _output_view {
+    unsigned long long id;
+    char name[MAX_SHMEM_NAME_LENGTH];
+    shmem_header_t hdr; // header of the matrix (dimensions point into header_buf)
+    char header_buf[SHMEM_HEADER_PROBE_BYTES];
+    char* ptr; // window of the segment
+    unsigned long long map_size;
+    unsigned long long segment_flags; // flags of the window mapping
+    unsigned long long offset; // offset of ptr in the segment
+    unsigned long long col_begin; // columns [col_begin, col_end) (0-based) of the view
+    unsigned long long col_end;
+    char* stats; // STATISTICS of the segment, NULL if unavailable
+    void* stats_map;
+    unsigned long long stats_map_size;
+    struct _output_view* next;
+} output_view_t;
+
+static output_view_t* output_views = NULL;
+static unsigned long long output_view_next_id = 1;
+static int output_exit_registered = 0;
+
+static void output_view_unmap(output_view_t* view) {
+    shmem_stats_unmap(view->stats_map, view->stats_map_size);
+#if SHMEM_API == SHMEM_WIN_API
+    SHMEM_DEBUG_OUTPUT("API call: UnmapViewOfFile\n");
+    UnmapViewOfFile(view->ptr);
+#elif SHMEM_API == SHMEM_POSIX_API
+    SHMEM_DEBUG_OUTPUT("API call: munmap\n");
+    shmem_posix_unmap(view->ptr, view->map_size, view->segment_flags);
+#endif
+}
+
+// release what output_view_open acquired for view, its columns are added to the completed columns if finished is set
+static void output_view_teardown(output_view_t* view, int finished) {
+    shmem_output_close(view->stats, finished ? view->col_end - view->col_begin : 0);
+    shmem_stats_add(view->stats, SHMEM_STATS_MAPPED_BYTES, -(long long)shmem_map_size(view->map_size, view->segment_flags));
+    if (shmem_ref_release(view->stats, 0)) {
+        SHMEM_DEBUG_OUTPUT("Last reference dropped, remove shared memory: %s\n", view->name);
+#if SHMEM_API == SHMEM_POSIX_API
+        shmem_posix_unlink(view->name);
+#endif
+    }
+    output_view_unmap(view);
+}
+
+// close registered view, its columns are added to the completed columns if finished is set
+static void output_view_close(output_view_t* view, int finished) {
+    output_view_teardown(view, finished);
+    output_view_t** link = &output_views;
+    while (*link != view)
+        link = &(*link)->next;
+    *link = view->next;
+    free(view);
+    mexUnlock();
+}
+
+static void output_at_exit(void) {
+    // views left open are not finished, the host waiting for them times out
+    while (output_views)
+        output_view_close(output_views, 0);
+}
+
+static output_view_t* output_view_find(const mxArray* arr) {
+    if (!mxIsUint64(arr) || mxGetNumberOfElements(arr) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 writer view");
+    unsigned long long id = *(unsigned long long*)mxGetData(arr);
+    for (output_view_t* view = output_views; view; view = view->next)
+        if (view->id == id)
+            return view;
+    mexErrMsgIdAndTxt("SharedMatrix:DataDetachedError", "Writer view %lld is not open in this process", id);
+    return NULL;
+}
+
+// check the header of an output matrix, returns NULL if columns [col_begin, col_end) could be written
+static const char* output_check(const shmem_header_t* hdr, unsigned long long col_begin, unsigned long long col_end, const char** err_id) {
+    *err_id = "SharedMatrix:NotSupported";
+    if (shmem_is_bundle(hdr->matrix_type) || (hdr->array_attribute & ARRAY_SPARSE))
+        return "Writer view is only supported for dense matrices";
+    if (hdr->array_attribute & (ARRAY_TRANSPOSE | ARRAY_ENCODED))
+        return "Matrix created with option Transpose or Encoding could not be written";
+    if (hdr->stats_offset == 0)
+        return "Matrix has no completion barrier, create it again";
+    *err_id = "SharedMatrix:DimensionError";
+    if (col_begin >= col_end || col_end > shmem_header_columns(hdr))
+        return "Columns exceed the columns of the matrix";
+    *err_id = "SharedMatrix:CorruptMemory";
+    if (shmem_column_offset(hdr, col_end) > hdr->total_size)
+        return "Shared memory is smaller than its header claims";
+    return NULL;
+}
+
+// map the window of view holding its columns, raises matlab error on failure
+static void output_view_open(output_view_t* view) {
+    const char* header_err = NULL;
+    const char* header_err_id = "SharedMatrix:CorruptMemory";
+    unsigned long long window_begin = 0, window_end = 0;
+#if SHMEM_API == SHMEM_WIN_API
+    HANDLE shmem = NULL;
+    if (shmem_name_is_file(view->name)) {
+        shmem = shmem_win_open_file(view->name, 0, 0);
+    }
+    else {
+        SHMEM_DEBUG_OUTPUT("API call: OpenFileMappingA\n");
+        shmem = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, view->name);
+    }
+    if (shmem == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API OpenFileMappingA failed: %d", GetLastError());
+    // the header is read through a mapping of the whole section, which is replaced by the window
+    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile\n");
+    void* whole = MapViewOfFile(shmem, FILE_MAP_READ, 0, 0, 0);
+    if (whole == NULL) {
+        int map_err = GetLastError();
+        CloseHandle(shmem);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API MapViewOfFile failed: %d", map_err);
+    }
+    MEMORY_BASIC_INFORMATION mem_info;
+    unsigned long long available = VirtualQuery(whole, &mem_info, sizeof(mem_info)) ? mem_info.RegionSize : 0;
+    unsigned long long probe = available < sizeof(view->header_buf) ? available : sizeof(view->header_buf);
+    memcpy(view->header_buf, whole, (size_t)probe);
+    UnmapViewOfFile(whole);
+    header_err = shmem_parse_header(view->header_buf, probe, &view->hdr);
+    if (header_err == NULL && view->hdr.total_size > available)
+        header_err = "Shared memory is smaller than its header claims";
+    if (header_err == NULL)
+        header_err = output_check(&view->hdr, view->col_begin, view->col_end, &header_err_id);
+    if (header_err) {
+        CloseHandle(shmem);
+        mexErrMsgIdAndTxt(header_err_id, "%s", header_err);
+    }
+    unsigned long long granularity = shmem_map_granularity(view->hdr.segment_flags);
+    window_begin = shmem_column_offset(&view->hdr, view->col_begin) / granularity * granularity;
+    window_end = INT_CEIL(shmem_column_offset(&view->hdr, view->col_end), granularity) * granularity;
+    if (window_end > view->hdr.total_size)
+        window_end = view->hdr.total_size;
+    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile (writer window %lld - %lld)\n", window_begin, window_end);
+    void* ptr = MapViewOfFile(shmem, FILE_MAP_ALL_ACCESS, (DWORD)(window_begin >> 32), (DWORD)(window_begin & 0xffffffff), (SIZE_T)(window_end - window_begin));
+    int map_err = GetLastError();
+    // the view keeps the section alive
+    CloseHandle(shmem);
+    if (ptr == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API MapViewOfFile failed: %d", map_err);
+    view->segment_flags = 0;
+#elif SHMEM_API == SHMEM_POSIX_API
+    SHMEM_DEBUG_OUTPUT("API call: shm_open\n");
+    int shmem = shmem_posix_open(view->name, O_RDWR);
+    if (shmem == -1)
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API shm_open failed: %d", errno);
+    SHMEM_DEBUG_OUTPUT("API call: pread\n");
+    ssize_t n_read = pread(shmem, view->header_buf, sizeof(view->header_buf), 0);
+    if (n_read >= 36 && shmem_header_probe_size(view->header_buf) > (unsigned long long)n_read)
+        header_err = "Too many dimensions";
+    else
+        header_err = shmem_parse_header(view->header_buf, n_read > 0 ? (unsigned long long)n_read : 0, &view->hdr);
+    if (header_err == NULL)
+        header_err = output_check(&view->hdr, view->col_begin, view->col_end, &header_err_id);
+    // the columns must be backed by the object, a truncated one would raise SIGBUS on writing
+    struct stat st;
+    if (header_err == NULL && (fstat(shmem, &st) != 0 || (unsigned long long)st.st_size < shmem_column_offset(&view->hdr, view->col_end)))
+        header_err = "Shared memory is smaller than its header claims";
+    if (header_err) {
+        close(shmem);
+        mexErrMsgIdAndTxt(header_err_id, "%s", header_err);
+    }
+    unsigned long long granularity = shmem_map_granularity(view->hdr.segment_flags);
+    window_begin = shmem_column_offset(&view->hdr, view->col_begin) / granularity * granularity;
+    window_end = INT_CEIL(shmem_column_offset(&view->hdr, view->col_end), granularity) * granularity;
+    SHMEM_DEBUG_OUTPUT("API call: mmap (writer window %lld - %lld)\n", window_begin, window_end);
+    void* ptr = mmap(0, (size_t)(window_end - window_begin), PROT_READ | PROT_WRITE, MAP_SHARED, shmem, (off_t)window_begin);
+    int map_errno = errno;
+    close(shmem);
+    if (ptr == MAP_FAILED)
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API mmap failed: %d", map_errno);
+    // a window is a regular mapping (not aligned to transparent huge pages), except on hugetlbfs
+    view->segment_flags = view->hdr.segment_flags & SHMEM_FLAG_HUGETLB ? view->hdr.segment_flags : 0;
+#endif
+    view->ptr = (char*)ptr;
+    view->offset = window_begin;
+    view->map_size = window_end - window_begin;
+    view->stats = shmem_stats_map(view->name, &view->hdr, &view->stats_map, &view->stats_map_size);
+    if (view->stats == NULL || !shmem_ref_acquire(view->stats)) {
+        output_view_unmap(view);
+        mexErrMsgIdAndTxt("SharedMatrix:Released", "Shared memory %s has been released by host", view->name);
+    }
+    shmem_stats_add(view->stats, SHMEM_STATS_MAPS, 1);
+    shmem_stats_add(view->stats, SHMEM_STATS_MAPPED_BYTES, (long long)shmem_map_size(view->map_size, view->segment_flags));
+    shmem_output_open(view->stats);
+}
+
+// info struct of an opened view, returns NULL on failure
+static mxArray* output_view_info(const output_view_t* view, double map_seconds) {
+    const char* info_fields[] = { "Columns", "MappedBytes", "MapSeconds" };
+    mxArray* info = mxCreateStructMatrix(1, 1, sizeof(info_fields) / sizeof(info_fields[0]), info_fields);
+    mxArray* columns = mxCreateDoubleMatrix(1, 2, mxREAL);
+    mxArray* mapped_bytes = mxCreateDoubleScalar((double)shmem_map_size(view->map_size, view->segment_flags));
+    mxArray* seconds = mxCreateDoubleScalar(map_seconds);
+    if (info == NULL || columns == NULL || mapped_bytes == NULL || seconds == NULL) {
+        if (info) mxDestroyArray(info);
+        if (columns) mxDestroyArray(columns);
+        if (mapped_bytes) mxDestroyArray(mapped_bytes);
+        if (seconds) mxDestroyArray(seconds);
+        return NULL;
+    }
+    mxGetPr(columns)[0] = (double)(view->col_begin + 1);
+    mxGetPr(columns)[1] = (double)view->col_end;
+    mxSetField(info, 0, "Columns", columns);
+    mxSetField(info, 0, "MappedBytes", mapped_bytes);
+    mxSetField(info, 0, "MapSeconds", seconds);
+    return info;
+}
+
+// parse [first, last] (1-based) columns of input arg i into [col_begin, col_end) (0-based)
+static void output_parse_columns(const mxArray* arr, int i, unsigned long long* col_begin, unsigned long long* col_end) {
+    if (!mxIsDouble(arr) || mxIsComplex(arr) || mxGetNumberOfElements(arr) != 2)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [%d] must be [first, last]", i);
+    double first = mxGetPr(arr)[0], last = mxGetPr(arr)[1];
+    if (first < 1 || last < first || first != (double)(unsigned long long)first || last != (double)(unsigned long long)last)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [%d] must be [first, last] integers with 1 <= first <= last", i);
+    *col_begin = (unsigned long long)first - 1;
+    *col_end = (unsigned long long)last;
+}
+
+// write values to the columns starting from first_col (1-based) of view
+static void output_view_write(output_view_t* view, double first_col, const mxArray* values, const shmem_copy_options_t* copy_options) {
+    const shmem_header_t* hdr = &view->hdr;
+    if (mxGetClassID(values) != (mxClassID)hdr->matrix_type)
+        mexErrMsgIdAndTxt("SharedMatrix:DataTypeError", "Values must have the same class as the shared matrix");
+    if (!mxIsComplex(values) != !(hdr->array_attribute & ARRAY_COMPLEX))
+        mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Complexity of values differs from the shared matrix");
+    if (mxIsSparse(values))
+        mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Values must be dense");
+    if (first_col < 1 || first_col != (double)(unsigned long long)first_col)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Column index must be a positive integer");
+    if (mxIsEmpty(values))
+        return;
+    unsigned long long n_rows = shmem_header_dim(hdr, 0);
+    if (mxGetM(values) != n_rows)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Values must have %lld rows", n_rows);
+    unsigned long long col = (unsigned long long)first_col - 1;
+    unsigned long long n_cols = mxGetNumberOfElements(values) / n_rows;
+    if (col < view->col_begin || col + n_cols > view->col_end)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Columns [%lld, %lld] exceed the writer view [%lld, %lld]",
+                          col + 1, col + n_cols, view->col_begin + 1, view->col_end);
+    const char* src = NULL;
+    if (hdr->array_attribute & ARRAY_COMPLEX) {
+#ifdef SHMEM_COMPLEX_SUPPORTED
+        src = (const char*)get_ic_ptr(values, (int)hdr->matrix_type);
+#endif
+    }
+    else {
+        src = (const char*)mxGetData(values);
+    }
+    if (src == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array");
+    shmem_copy_task_t task;
+    task.dst = view->ptr + (shmem_column_offset(hdr, col) - view->offset);
+    task.src = src;
+    task.size = n_cols * n_rows * hdr->data_size;
+    shmem_version_begin(view->stats);
+    shmem_parallel_copy(&task, 1, copy_options, NULL);
+    shmem_version_end(view->stats);
+}
+
+// STATISTICS of the output matrix at base pointer of input arg [1] (mapped writable by the host)
+static char* output_host_stats(const mxArray* arr, shmem_header_t* hdr) {
+    if (!mxIsUint64(arr) || mxGetNumberOfElements(arr) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 base pointer");
+    char* ptr_base = (char*)*(unsigned long long*)mxGetData(arr);
+    if (ptr_base == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
+    const char* header_err = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), hdr);
+    if (header_err)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+    char* stats = shmem_stats_ptr(hdr, ptr_base);
+    if (stats == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Matrix has no completion barrier, create it again");
+    return stats;
+}
+
+// open mode: [view, info] = output_shared_matrix(name, 'open', [first, last])
+// input arg [1]: shared memory name of a dense matrix (allocate_shared_matrix, best with AlignColumns so that views of
+//                different workers do not share pages)
+// input arg [3]: [first, last] (1-based) columns written by this process, all dimensions after the first one are
+//                treated as columns, the column ranges of all writers must be disjoint
+// output arg [1]: writer view (uint64 id), only valid in this process
+// output arg [2]: (optional) struct of view info (Columns, MappedBytes, MapSeconds)
+//
+// write mode: output_shared_matrix(view, 'write', first_col, values, options)
+// input arg [3]: index of the first column written (1-based, of the whole matrix), the columns of values must lie in
+//                the view
+// input arg [4]: values, same class / complexity as the shared matrix (dense), with the same number of rows
+// input arg [5]: (optional) struct of options
+//   Threads / NonTemporal: same as create_shared_matrix
+//
+// close mode: output_shared_matrix(view, 'close', finished)
+// input arg [3]: (optional) true (default) if all columns of the view are written, they are counted as completed,
+//                false for closing a view whose columns are not written (e.g. on error)
+// the view is unmapped and its reference to the segment released
+//
+// wait mode: [finished, done] = output_shared_matrix(base_ptr, 'wait', [columns, timeout])
+// input arg [1]: base pointer of the output matrix (host)
+// input arg [3]: (optional) waits until columns (all columns of the matrix if omitted or empty) are completed and no
+//                view is open, or timeout seconds (Inf if omitted) elapsed
+// output arg [1]: true if the columns are completed, the host reads them zero-copy through its own mapping (or through
+//                 read_shared_matrix in another process)
+// output arg [2]: (optional) number of completed columns
+// a writer which exits without closing its view keeps it open, the host waits until timeout
+//
+// reset mode: output_shared_matrix(base_ptr, 'reset')
+// clears the completed columns for the next round of writers, must not be called while any view is open
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("output_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(2, 5);
+    if (!output_exit_registered) {
+        mexAtExit(output_at_exit);
+        output_exit_registered = 1;
+    }
+    char command[16];
+    if (!mxIsChar(prhs[1]) || mxGetString(prhs[1], command, sizeof(command)))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [2]: command");
+
+    if (strcmp(command, "open") == 0) {
+        if (nrhs != 3)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "open requires input arg [3]: [first, last]");
+        if (nlhs > 2)
+            mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "open returns at most two values");
+        // the view is built on the stack until it is mapped, nothing is leaked by the errors raised meanwhile
+        output_view_t local;
+        memset(&local, 0, sizeof(local));
+        if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], local.name, MAX_SHMEM_NAME_LENGTH) || strlen(local.name) == 0)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
+        output_parse_columns(prhs[2], 3, &local.col_begin, &local.col_end);
+        double start_time = shmem_time_seconds();
+        output_view_open(&local);
+        double map_seconds = shmem_time_seconds() - start_time;
+        // the outputs are created before the view is registered, a view is never kept without its id returned
+        plhs[0] = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+        mxArray* info = nlhs > 1 ? output_view_info(&local, map_seconds) : NULL;
+        output_view_t* view = (output_view_t*)malloc(sizeof(output_view_t));
+        int mx_failed = plhs[0] == NULL || (nlhs > 1 && info == NULL);
+        if (mx_failed || view == NULL) {
+            free(view);
+            output_view_teardown(&local, 0);
+            if (mx_failed)
+                mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateNumericMatrix");
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+        }
+        *view = local;
+        view->hdr.dims = view->header_buf + (local.hdr.dims - local.header_buf);
+        view->id = output_view_next_id++;
+        view->next = output_views;
+        output_views = view;
+        mexLock();
+        *(unsigned long long*)mxGetData(plhs[0]) = view->id;
+        if (nlhs > 1)
+            plhs[1] = info;
+    }
+    else if (strcmp(command, "write") == 0) {
+        if (nrhs < 4)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "write requires input arg [3]: first column and [4]: values");
+        if (nlhs > 0)
+            mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "write does not return any value");
+        output_view_t* view = output_view_find(prhs[0]);
+        const mxArray* options = nrhs > 4 ? prhs[4] : NULL;
+        if (options)
+            MATLAB_OPTIONS_CHECK(options, 5);
+        if (!mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [3] must be the first column");
+        shmem_copy_options_t copy_options;
+        copy_options.n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+        copy_options.non_temporal = (int)shmem_option_scalar(options, "NonTemporal", -1);
+        if (copy_options.n_threads < 0 || copy_options.n_threads > SHMEM_COPY_MAX_THREADS)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+        output_view_write(view, mxGetPr(prhs[2])[0], prhs[3], &copy_options);
+    }
+    else if (strcmp(command, "close") == 0) {
+        if (nrhs > 3)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Too many input arguments");
+        if (nlhs > 0)
+            mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "close does not return any value");
+        output_view_t* view = output_view_find(prhs[0]);
+        int finished = 1;
+        if (nrhs == 3) {
+            if (mxGetNumberOfElements(prhs[2]) != 1 || !(mxIsLogical(prhs[2]) || mxIsNumeric(prhs[2])))
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [3] must be a logical scalar");
+            finished = mxGetScalar(prhs[2]) != 0;
+        }
+        output_view_close(view, finished);
+    }
+    else if (strcmp(command, "wait") == 0) {
+        if (nrhs > 3)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Too many input arguments");
+        if (nlhs > 2)
+            mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "wait returns at most two values");
+        shmem_header_t hdr = { 0 };
+        char* stats = output_host_stats(prhs[0], &hdr);
+        unsigned long long n_cols = shmem_is_bundle(hdr.matrix_type) ? 0 : shmem_header_columns(&hdr);
+        double timeout = mxGetInf();
+        if (nrhs == 3 && !mxIsEmpty(prhs[2])) {
+            if (!mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxGetNumberOfElements(prhs[2]) > 2)
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [3] must be [columns, timeout]");
+            double columns = mxGetPr(prhs[2])[0];
+            if (mxGetNumberOfElements(prhs[2]) > 1)
+                timeout = mxGetPr(prhs[2])[1];
+            if (!(columns >= 0) || !(timeout >= 0))
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Columns and timeout must be non-negative");
+            n_cols = (unsigned long long)columns;
+        }
+        unsigned long long done = 0;
+        int finished = shmem_output_wait(stats, n_cols, timeout, &done);
+        plhs[0] = mxCreateLogicalScalar(finished);
+        if (nlhs > 1)
+            plhs[1] = mxCreateDoubleScalar((double)done);
+    }
+    else if (strcmp(command, "reset") == 0) {
+        if (nrhs > 2)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Too many input arguments");
+        if (nlhs > 0)
+            mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "reset does not return any value");
+        shmem_header_t hdr = { 0 };
+        char* stats = output_host_stats(prhs[0], &hdr);
+        if (SHMEM_READ_CAST(unsigned int, stats, SHMEM_STATS_OUTPUT_WRITERS) != 0)
+            mexErrMsgIdAndTxt("SharedMatrix:Busy", "Writer views of the matrix are still open");
+        shmem_output_reset(stats);
+    }
+    else {
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Unknown command: %s", command);
+    }
+}
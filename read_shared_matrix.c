@@ -1,220 +1,968 @@
 #include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_attach.h"
+#include "shmem_access.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+#include "shmem_pool.h"
+
+/*
+ * Per-process attach cache
+ *
+ * Every shared memory segment is opened and mapped at most once per process. Each attach returns a new Matlab array
+ * over the cached mapping and increases its reference count, "detach" decreases it. A mapping without references is
+ * kept (idle) for later attaches, until it is flushed, the cache holds more than SHMEM_ATTACH_CACHE_MAX_IDLE idle
+ * mappings, or the segment is found to be removed by the host (checked on every call of this function). The MEX
+ * file is locked while any array references a cached mapping.
+ *
+ * Idle mappings are not kept for WIN API, since a removed segment could not be detected (the mapping keeps it alive).
+ * Read-only and read-write attaches of the same segment use separate mappings. A private (copy-on-write) mapping is
+ * only used by the attach which made it, it is released as soon as its arrays are detached, freeing the copied pages.
+ *
+ * A slice (option Slice) maps only the page aligned window holding a range of columns of a dense matrix, it is cached
+ * separately from the mapping of the whole segment (and from slices of other column ranges).
+ *
+ * Usage counters of the segment (see shmem_stats.h) are updated through the mapping, or through a writable mapping of
+ * the header page if the mapping is read-only or a slice.
+ *
+ * A referenced mapping holds a reference to the segment, after the host has detached the last reference dropped
+ * removes the segment. Attaching a released segment without references fails.
+ */
+// size of the header describing a slice mapping (two dimensions, padded)
+#define SHMEM_SLICE_HEADER_BYTES 128
+
+typedef struct _attach_cache_entry {
+    char name[MAX_SHMEM_NAME_LENGTH];
+#if SHMEM_API == SHMEM_WIN_API
+    HANDLE handle;
+#elif SHMEM_API == SHMEM_POSIX_API
+    int handle;
+#endif
+    void* ptr;
+    unsigned long long total_size;
+    unsigned long long segment_flags;
+    int mode; // SHMEM_ATTACH_READWRITE, SHMEM_ATTACH_READONLY or SHMEM_ATTACH_PRIVATE
+    int locked; // pages are locked in memory (KeepCached)
+    int ref_count;
+    int holds_reference; // holds a reference to the segment (REFERENCES of STATISTICS)
+    int stale; // removed by host, not returned by lookup anymore
+    unsigned long long slice_begin; // columns [slice_begin, slice_end) (0-based) of a slice mapping, 0 and 0 otherwise
+    unsigned long long slice_end;
+    unsigned long long offset; // offset of ptr in the segment (slice mapping only)
+    unsigned long long data_offset; // offset of the first element of the slice relative to ptr
+    char slice_header[SHMEM_SLICE_HEADER_BYTES]; // the slice as a rows * columns matrix
+    char* stats; // STATISTICS of the segment, NULL if unavailable
+    void* stats_map; // separate mapping of STATISTICS (read-only and slice mappings only)
+    unsigned long long stats_map_size;
+    unsigned long long last_used;
+    struct _attach_cache_entry* next;
+} attach_cache_entry_t;
+
+static attach_cache_entry_t* attach_cache = NULL;
+static int attach_cache_references = 0;
+static unsigned long long attach_cache_clock = 0;
+static int attach_cache_exit_registered = 0;
+
+// drop the reference of entry to the segment, removes the segment if it is the last reference after the host detached
+static void attach_cache_drop_reference(attach_cache_entry_t* entry) {
+    entry->holds_reference = 0;
+    if (shmem_ref_release(entry->stats, 0)) {
+        SHMEM_DEBUG_OUTPUT("Last reference dropped, remove shared memory: %s\n", entry->name);
+#if SHMEM_API == SHMEM_POSIX_API
+        SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
+        shmem_posix_unlink(entry->name);
+#endif
+        entry->stale = 1;
+    }
+}
+
+static int attach_cache_is_stale(attach_cache_entry_t* entry);
+
+static void attach_cache_release_mapping(attach_cache_entry_t* entry) {
+    SHMEM_DEBUG_OUTPUT("Release cached mapping: %s\n", entry->name);
+    // a segment returned to the pool may hold another matrix already
+    if ((entry->segment_flags & SHMEM_FLAG_POOLED) && attach_cache_is_stale(entry))
+        entry->stats = NULL;
+    if (entry->holds_reference)
+        attach_cache_drop_reference(entry);
+    shmem_stats_add(entry->stats, SHMEM_STATS_MAPPED_BYTES, -(long long)shmem_map_size(entry->total_size, entry->segment_flags));
+    shmem_stats_unmap(entry->stats_map, entry->stats_map_size);
+#if SHMEM_API == SHMEM_WIN_API
+    SHMEM_DEBUG_OUTPUT("API call: UnmapViewOfFile\n");
+    UnmapViewOfFile(entry->ptr);
+    SHMEM_DEBUG_OUTPUT("API call: CloseHandle\n");
+    CloseHandle(entry->handle);
+#elif SHMEM_API == SHMEM_POSIX_API
+    SHMEM_DEBUG_OUTPUT("API call: munmap\n");
+    shmem_posix_unmap(entry->ptr, entry->total_size, entry->segment_flags);
+    SHMEM_DEBUG_OUTPUT("API call: close\n");
+    close(entry->handle);
+#endif
+    free(entry);
+}
+
+// whether the segment has been removed (unlinked) by host, or returned to the segment pool
+static int attach_cache_is_stale(attach_cache_entry_t* entry) {
+    if (entry->stale)
+        return 1;
+#if SHMEM_API == SHMEM_POSIX_API
+    struct stat st;
+    if (fstat(entry->handle, &st) == 0 && st.st_nlink == 0)
+        entry->stale = 1;
+    // renamed into the segment pool
+    if ((entry->segment_flags & SHMEM_FLAG_POOLED) && !entry->stale && !shmem_pool_same_object(entry->handle, entry->name))
+        entry->stale = 1;
+#endif
+    return entry->stale;
+}
+
+// release idle mappings which are removed by host (or all idle mappings if flush_all is set)
+static void attach_cache_sweep(int flush_all) {
+    int n_idle = 0;
+    attach_cache_entry_t** link = &attach_cache;
+    while (*link) {
+        attach_cache_entry_t* entry = *link;
+        int release = 0;
+        if (entry->ref_count == 0) {
+#if SHMEM_API == SHMEM_WIN_API
+            release = 1;
+#else
+            release = flush_all || entry->mode == SHMEM_ATTACH_PRIVATE || attach_cache_is_stale(entry);
+#endif
+        }
+        if (release) {
+            *link = entry->next;
+            attach_cache_release_mapping(entry);
+        }
+        else {
+            if (entry->ref_count == 0) n_idle++;
+            link = &entry->next;
+        }
+    }
+    // evict least recently used idle mappings
+    while (n_idle > SHMEM_ATTACH_CACHE_MAX_IDLE) {
+        attach_cache_entry_t** lru = NULL;
+        for (link = &attach_cache; *link; link = &(*link)->next)
+            if ((*link)->ref_count == 0 && (lru == NULL || (*link)->last_used < (*lru)->last_used))
+                lru = link;
+        attach_cache_entry_t* entry = *lru;
+        *lru = entry->next;
+        attach_cache_release_mapping(entry);
+        n_idle--;
+    }
+}
+
+static void attach_cache_at_exit(void) {
+    // the MEX file is locked while any mapping is referenced, only idle mappings are left here
+    attach_cache_sweep(1);
+}
+
+// undo an attach which failed before any array is created
+static void attach_cache_abort(attach_cache_entry_t* entry) {
+    if (entry->ref_count == 0 && entry->holds_reference)
+        attach_cache_drop_reference(entry);
+    attach_cache_sweep(0);
+}
+
+static attach_cache_entry_t* attach_cache_find_name(const char* shmem_name, int mode, unsigned long long slice_begin, unsigned long long slice_end) {
+    if (mode == SHMEM_ATTACH_PRIVATE)
+        return NULL;
+    for (attach_cache_entry_t* entry = attach_cache; entry; entry = entry->next)
+        if (!entry->stale && entry->mode == mode && entry->slice_begin == slice_begin && entry->slice_end == slice_end &&
+            strcmp(entry->name, shmem_name) == 0 && !attach_cache_is_stale(entry))
+            return entry;
+    return NULL;
+}
+
+// any mapping of segment shmem_name holding its STATISTICS
+static attach_cache_entry_t* attach_cache_find_stats(const char* shmem_name) {
+    for (attach_cache_entry_t* entry = attach_cache; entry; entry = entry->next)
+        if (!entry->stale && entry->stats != NULL && strcmp(entry->name, shmem_name) == 0)
+            return entry;
+    return NULL;
+}
+
+static attach_cache_entry_t* attach_cache_find_ptr(const void* data) {
+    for (attach_cache_entry_t* entry = attach_cache; entry; entry = entry->next)
+        if ((const char*)data >= (const char*)entry->ptr && (const char*)data <= (const char*)entry->ptr + entry->total_size)
+            return entry;
+    return NULL;
+}
+
+// check whether columns [slice_begin, slice_end) of the matrix could be mapped as a slice, returns NULL if it could
+static const char* attach_slice_check(const shmem_header_t* hdr, unsigned long long slice_begin, unsigned long long slice_end, const char** err_id) {
+    *err_id = "SharedMatrix:NotSupported";
+    if (shmem_is_bundle(hdr->matrix_type) || (hdr->array_attribute & ARRAY_SPARSE))
+        return "Slice is only supported for dense matrices";
+    *err_id = "SharedMatrix:DimensionError";
+    if (slice_begin >= slice_end || slice_end > shmem_header_columns(hdr))
+        return "Slice exceeds the columns of the matrix";
+    *err_id = "SharedMatrix:CorruptMemory";
+    if (shmem_column_offset(hdr, slice_end) > hdr->total_size)
+        return "Shared memory is smaller than its header claims";
+    return NULL;
+}
+
+// window of the segment mapped for the slice of entry, starting at the ARRAY_HEADER in front of the first column
+static void attach_slice_window(const shmem_header_t* hdr, attach_cache_entry_t* entry, unsigned long long* window_begin, unsigned long long* window_end) {
+    unsigned long long granularity = shmem_map_granularity(hdr->segment_flags);
+    unsigned long long data_begin = shmem_column_offset(hdr, entry->slice_begin);
+    *window_begin = (data_begin - ARRAY_HEADER_SIZE) / granularity * granularity;
+    *window_end = INT_CEIL(shmem_column_offset(hdr, entry->slice_end), granularity) * granularity;
+    entry->offset = *window_begin;
+    entry->data_offset = data_begin - *window_begin;
+    // the slice is attached as a rows * columns matrix described by a private header
+    mwSize dims[2] = { (mwSize)shmem_header_dim(hdr, 0), (mwSize)(entry->slice_end - entry->slice_begin) };
+    shmem_write_header(entry->slice_header, sizeof(entry->slice_header), (int)hdr->matrix_type, hdr->array_attribute,
+                       ARRAY_HEADER_SIZE + dims[0] * dims[1] * hdr->data_size, 2, dims, 0);
+    if (hdr->array_attribute & ARRAY_ENCODED)
+        shmem_write_encoding(entry->slice_header, 2, hdr->encoding, hdr->scale, hdr->offset);
+}
+
+#if SHMEM_API == SHMEM_POSIX_API
+/*
+ * Map the slice window of entry. Except for a slice starting at the first column, the ARRAY_HEADER in front of the
+ * slice overlaps the previous column, the pages holding it are remapped privately (copy-on-write) and a copy of the
+ * ARRAY_HEADER of the matrix is written there. Elements of the slice on these pages are not updated by other processes
+ * afterwards, there are none if the slice starts at a page boundary (see option AlignColumns of create_shared_matrix).
+ * A private slice maps the whole window privately.
+ * returns MAP_FAILED on failure (errno is set)
+ */
+static void* attach_map_slice(int fd, const shmem_header_t* hdr, attach_cache_entry_t* entry, int map_flags) {
+    int readonly = entry->mode == SHMEM_ATTACH_READONLY;
+    unsigned long long window_begin, window_end;
+    attach_slice_window(hdr, entry, &window_begin, &window_end);
+    SHMEM_DEBUG_OUTPUT("API call: mmap (slice window %lld - %lld)\n", window_begin, window_end);
+    int prot = readonly ? PROT_READ : (PROT_READ | PROT_WRITE);
+    int share = entry->mode == SHMEM_ATTACH_PRIVATE ? MAP_PRIVATE : MAP_SHARED;
+    char* ptr = (char*)mmap(0, window_end - window_begin, prot, share | map_flags, fd, (off_t)window_begin);
+    if (ptr == MAP_FAILED)
+        return MAP_FAILED;
+#if ARRAY_HEADER_SIZE > 0
+    if (entry->slice_begin > 0) {
+        unsigned long long granularity = shmem_map_granularity(hdr->segment_flags);
+        size_t private_size = (size_t)(INT_CEIL(window_begin + entry->data_offset, granularity) * granularity - window_begin);
+        char array_header[ARRAY_HEADER_SIZE];
+        SHMEM_DEBUG_OUTPUT("API call: pread, mmap (MAP_PRIVATE)\n");
+        int ok = pread(fd, array_header, ARRAY_HEADER_SIZE, hdr->header_size) == ARRAY_HEADER_SIZE &&
+                 mmap(ptr, private_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)window_begin) != MAP_FAILED;
+        if (ok) {
+            memcpy(ptr + entry->data_offset - ARRAY_HEADER_SIZE, array_header, ARRAY_HEADER_SIZE);
+            if (readonly)
+                ok = mprotect(ptr, private_size, PROT_READ) == 0;
+        }
+        if (!ok) {
+            int map_errno = errno;
+            munmap(ptr, (size_t)(window_end - window_begin));
+            errno = map_errno;
+            return MAP_FAILED;
+        }
+    }
+#endif
+    entry->total_size = window_end - window_begin;
+    return ptr;
+}
+#endif
+
+/*
+ * Open and map the whole segment at once, or only the window holding columns [slice_begin, slice_end) of a dense
+ * matrix (if slice_end > 0), raises matlab error on failure
+ * mode: SHMEM_ATTACH_READWRITE, SHMEM_ATTACH_READONLY or SHMEM_ATTACH_PRIVATE (copy-on-write)
+ * populate: let the kernel populate page tables while mapping (MAP_POPULATE, POSIX API only)
+ */
+static attach_cache_entry_t* attach_cache_open(const char* shmem_name, int mode, int populate, unsigned long long slice_begin, unsigned long long slice_end) {
+    // the segment itself is only read through a private mapping
+    int readonly = mode != SHMEM_ATTACH_READWRITE;
+    attach_cache_entry_t* entry = (attach_cache_entry_t*)calloc(1, sizeof(attach_cache_entry_t));
+    if (entry == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+    strcpy(entry->name, shmem_name);
+    entry->mode = mode;
+    entry->slice_begin = slice_begin;
+    entry->slice_end = slice_end;
+    shmem_header_t hdr = { 0 };
+    const char* header_err = NULL;
+    const char* header_err_id = "SharedMatrix:CorruptMemory";
+#if SHMEM_API == SHMEM_WIN_API
+    DWORD access = mode == SHMEM_ATTACH_PRIVATE ? FILE_MAP_COPY : (readonly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS);
+    HANDLE shmem = NULL;
+    if (shmem_name_is_file(shmem_name)) {
+        shmem = shmem_win_open_file(shmem_name, readonly, 0);
+    }
+    else {
+        SHMEM_DEBUG_OUTPUT("API call: OpenFileMappingA\n");
+        shmem = OpenFileMappingA(access, FALSE, shmem_name);
+    }
+    if (shmem == NULL) {
+        int open_err = GetLastError();
+        free(entry);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API OpenFileMappingA failed: %d", open_err);
+    }
+    // map the whole section, its size is known after the mapping is made
+    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile\n");
+    void* ptr = MapViewOfFile(shmem, access, 0, 0, 0);
+    if (ptr == NULL) {
+        int map_err = GetLastError();
+        CloseHandle(shmem);
+        free(entry);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API MapViewOfFile failed: %d", map_err);
+    }
+    MEMORY_BASIC_INFORMATION mem_info;
+    unsigned long long available = VirtualQuery(ptr, &mem_info, sizeof(mem_info)) ? mem_info.RegionSize : 0;
+    header_err = shmem_parse_header(ptr, available, &hdr);
+    if (header_err == NULL && hdr.total_size > available)
+        header_err = "Shared memory is smaller than its header claims";
+    if (header_err == NULL && slice_end > 0)
+        header_err = attach_slice_check(&hdr, slice_begin, slice_end, &header_err_id);
+    if (header_err == NULL && slice_end > 0) {
+        // the whole section is only reserved in address space until the slice window replaces it
+        unsigned long long window_begin, window_end;
+        attach_slice_window(&hdr, entry, &window_begin, &window_end);
+        if (window_end > hdr.total_size)
+            window_end = hdr.total_size;
+        SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile (slice window %lld - %lld)\n", window_begin, window_end);
+        void* window_ptr = MapViewOfFile(shmem, access, (DWORD)(window_begin >> 32), (DWORD)(window_begin & 0xffffffff), (SIZE_T)(window_end - window_begin));
+        if (window_ptr == NULL) {
+            int map_err = GetLastError();
+            UnmapViewOfFile(ptr);
+            CloseHandle(shmem);
+            free(entry);
+            mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API MapViewOfFile failed: %d", map_err);
+        }
+        UnmapViewOfFile(ptr);
+        ptr = window_ptr;
+        entry->total_size = window_end - window_begin;
+    }
+    if (header_err) {
+        UnmapViewOfFile(ptr);
+        CloseHandle(shmem);
+        free(entry);
+        mexErrMsgIdAndTxt(header_err_id, "%s", header_err);
+    }
+#elif SHMEM_API == SHMEM_POSIX_API
+    SHMEM_DEBUG_OUTPUT("API call: shm_open\n");
+    int shmem = shmem_posix_open(shmem_name, readonly ? O_RDONLY : O_RDWR);
+    if (shmem == -1) {
+        int open_errno = errno;
+        free(entry);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API shm_open failed: %d", open_errno);
+    }
+    // header is read without mapping, then the whole segment is mapped with page size and alignment recorded in it
+    char header_buf[SHMEM_HEADER_PROBE_BYTES];
+    SHMEM_DEBUG_OUTPUT("API call: pread\n");
+    ssize_t n_read = pread(shmem, header_buf, sizeof(header_buf), 0);
+    if (n_read >= 36 && shmem_header_probe_size(header_buf) > (unsigned long long)n_read)
+        header_err = "Too many dimensions";
+    else
+        header_err = shmem_parse_header(header_buf, n_read > 0 ? (unsigned long long)n_read : 0, &hdr);
+    if (header_err == NULL && slice_end > 0)
+        header_err = attach_slice_check(&hdr, slice_begin, slice_end, &header_err_id);
+    if (header_err) {
+        close(shmem);
+        free(entry);
+        mexErrMsgIdAndTxt(header_err_id, "%s", header_err);
+    }
+    SHMEM_DEBUG_OUTPUT("API call: mmap\n");
+    int prot = mode == SHMEM_ATTACH_READONLY ? PROT_READ : (PROT_READ | PROT_WRITE);
+    int map_flags = 0;
+#ifdef MAP_POPULATE
+    if (populate)
+        map_flags = MAP_POPULATE;
+#endif
+    void* ptr = NULL;
+    if (slice_end > 0)
+        ptr = attach_map_slice(shmem, &hdr, entry, map_flags);
+    else if (mode == SHMEM_ATTACH_PRIVATE)
+        ptr = mmap(0, shmem_map_size(hdr.total_size, hdr.segment_flags), prot, MAP_PRIVATE | map_flags, shmem, 0);
+    else
+        ptr = shmem_posix_map_ex(shmem, hdr.total_size, prot, hdr.segment_flags, map_flags);
+    if (ptr == MAP_FAILED) {
+        int map_errno = errno;
+        close(shmem);
+        free(entry);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API mmap failed: %d", map_errno);
+    }
+#endif
+    SHMEM_DEBUG_OUTPUT("Handle: %lld\n", (unsigned long long)shmem);
+    SHMEM_DEBUG_OUTPUT("Shared memory pointer: %p\n", ptr);
+    entry->handle = shmem;
+    entry->ptr = ptr;
+    if (slice_end == 0) {
+        entry->total_size = hdr.total_size;
+        entry->segment_flags = hdr.segment_flags;
+    }
+    else {
+        // a slice window is a regular mapping (not aligned to transparent huge pages), except on hugetlbfs
+        entry->segment_flags = (hdr.segment_flags & SHMEM_FLAG_HUGETLB ? hdr.segment_flags : 0) | (hdr.segment_flags & SHMEM_FLAG_POOLED);
+    }
+    if (mode == SHMEM_ATTACH_READWRITE && slice_end == 0)
+        entry->stats = shmem_stats_ptr(&hdr, ptr);
+    else
+        entry->stats = shmem_stats_map(shmem_name, &hdr, &entry->stats_map, &entry->stats_map_size);
+    shmem_stats_add(entry->stats, SHMEM_STATS_MAPS, 1);
+    shmem_stats_add(entry->stats, SHMEM_STATS_MAPPED_BYTES, (long long)shmem_map_size(entry->total_size, entry->segment_flags));
+    entry->next = attach_cache;
+    attach_cache = entry;
+    return entry;
+}
+
+static void attach_cache_add_reference(attach_cache_entry_t* entry, int delta);
+
+/*
+ * Detach arrays attached by attach_block (elements of struct / cell arrays recursively), the references to their
+ * mappings are released if release_reference is set
+ * returns 0 if any array could not be detached
+ */
+static int detach_block(mxArray* data_array, int release_reference) {
+    if (mxIsStruct(data_array) || mxIsCell(data_array)) {
+        int ret = 1;
+        size_t n_elements = mxGetNumberOfElements(data_array);
+        int n_fields = mxIsStruct(data_array) ? mxGetNumberOfFields(data_array) : 1;
+        for (size_t i = 0; i < n_elements; i++)
+            for (int j = 0; j < n_fields; j++) {
+                mxArray* element = mxIsStruct(data_array) ? mxGetFieldByNumber(data_array, i, j) : mxGetCell(data_array, i);
+                if (element != NULL && !detach_block(element, release_reference))
+                    ret = 0;
+            }
+        return ret;
+    }
+    void* data = shmem_attached_data(data_array);
+    attach_cache_entry_t* entry = data ? attach_cache_find_ptr(data) : NULL;
+    if (entry == NULL)
+        return 1; // not attached from shared memory or already detached
+    if (!shmem_detach_array(data_array))
+        return 0; // keep the mapping referenced, matlab will crash if the array is accessed after unmapping
+    if (release_reference)
+        attach_cache_add_reference(entry, -1);
+    return 1;
+}
+
+/*
+ * Create matlab array over a parsed block (matrix or bundle) at block_ptr, a bundle is returned as struct / cell array
+ * whose elements are attached recursively (only the container arrays are allocated), n_arrays is increased by the
+ * number of attached arrays
+ * returns NULL on failure (the partially created array is released), err is set to the error identifier and message
+ */
+static mxArray* attach_block(const shmem_header_t* hdr, char* block_ptr, int depth, int* n_arrays, const char** err_id, const char** err_msg) {
+    if (!shmem_is_bundle(hdr->matrix_type)) {
+        mxArray* arr = shmem_create_attached_array(hdr, block_ptr + hdr->header_size, err_id, err_msg);
+        if (arr)
+            (*n_arrays)++;
+        return arr;
+    }
+    *err_id = "SharedMatrix:CorruptMemory";
+    if (depth > SHMEM_BUNDLE_MAX_DEPTH) {
+        *err_msg = "Bundle is nested too deeply";
+        return NULL;
+    }
+    mwSize static_dims[MAX_STATIC_ALLOCATED_DIMS];
+    mwSize* dims = (hdr->n_dims <= MAX_STATIC_ALLOCATED_DIMS) ? static_dims : (mwSize*)mxMalloc(sizeof(mwSize) * hdr->n_dims);
+    for (unsigned int i = 0; i < hdr->n_dims; i++)
+        dims[i] = (mwSize)shmem_header_dim(hdr, i);
+    mxArray* bundle = NULL;
+    if (hdr->matrix_type == mxCELL_CLASS) {
+        bundle = mxCreateCellArray(hdr->n_dims, dims);
+    }
+    else {
+        const char** names = (const char**)mxMalloc(sizeof(const char*) * (hdr->n_fields > 0 ? hdr->n_fields : 1));
+        for (unsigned long long i = 0; i < hdr->n_fields; i++) {
+            names[i] = shmem_bundle_field_name(hdr, block_ptr, i);
+            if (names[i][SHMEM_BUNDLE_FIELD_NAME_BYTES - 1] != 0)
+                names[i] = "";
+        }
+        bundle = mxCreateStructArray(hdr->n_dims, dims, (int)hdr->n_fields, names);
+        mxFree(names);
+    }
+    if (dims != static_dims)
+        mxFree(dims);
+    if (bundle == NULL) {
+        *err_id = "SharedMatrix:MatlabError";
+        *err_msg = "Failed to call Matlab mex API: mxCreateStructArray / mxCreateCellArray";
+        return NULL;
+    }
+    for (unsigned long long k = 0; k < hdr->n_blocks; k++) {
+        unsigned long long block_offset = shmem_bundle_offset(hdr, block_ptr, k);
+        if (block_offset == 0)
+            continue; // unassigned element
+        shmem_header_t block_hdr = { 0 };
+        *err_msg = shmem_parse_header(block_ptr + block_offset, hdr->total_size - block_offset, &block_hdr);
+        if (*err_msg == NULL && block_hdr.total_size > hdr->total_size - block_offset)
+            *err_msg = "Bundle is smaller than its blocks";
+        mxArray* element = *err_msg ? NULL : attach_block(&block_hdr, block_ptr + block_offset, depth + 1, n_arrays, err_id, err_msg);
+        if (element == NULL) {
+            detach_block(bundle, 0);
+            mxDestroyArray(bundle);
+            return NULL;
+        }
+        if (hdr->matrix_type == mxCELL_CLASS)
+            mxSetCell(bundle, (mwIndex)k, element);
+        else
+            mxSetFieldByNumber(bundle, (mwIndex)(k / hdr->n_fields), (int)(k % hdr->n_fields), element);
+    }
+    return bundle;
+}
+
+static void attach_cache_add_reference(attach_cache_entry_t* entry, int delta) {
+    if (delta != 0) {
+        shmem_stats_add(entry->stats, SHMEM_STATS_ACTIVE_ATTACHES, delta);
+        shmem_stats_add(entry->stats, delta > 0 ? SHMEM_STATS_ATTACHES : SHMEM_STATS_DETACHES, delta > 0 ? delta : -delta);
+    }
+    entry->ref_count += delta;
+    entry->last_used = ++attach_cache_clock;
+    if (entry->ref_count == 0 && entry->holds_reference)
+        attach_cache_drop_reference(entry);
+    int was_referenced = attach_cache_references > 0;
+    attach_cache_references += delta;
+    if (!was_referenced && attach_cache_references > 0)
+        mexLock();
+    else if (was_referenced && attach_cache_references == 0)
+        mexUnlock();
+}
+
+// set field of the info struct to value, returns 0 if value could not be created
+static int attach_info_field(mxArray* info, const char* field, mxArray* value) {
+    if (value == NULL)
+        return 0;
+    mxSetField(info, 0, field, value);
+    return 1;
+}
 
 // input arg [1]: shared memory name
-// output arg [1]: matlab array (data pointer is attached to shared memory)
+// input arg [2]: (optional) struct of attach options
+//   Mode: "readwrite" (default), "readonly" (mapped without write permission) or "private" (mapped copy-on-write,
+//         pages written by this process are copied and never seen by other processes, see shmem_access.h), a private
+//         mapping is made for every attach and released when its arrays are detached
+//   Populate: "none" (default), "map" (page tables populated by the kernel) or "parallel" (pages touched by threads)
+//   Advice: "normal" (default), "sequential", "random" or "willneed" (access pattern hint, POSIX API only), the hint
+//           applies to the mapping shared by all arrays attached to the segment in this process
+//   Columns: [first, last] (1-based) columns which are populated / advised, whole segment if empty (default)
+//   Slice: [first, last] (1-based) columns of a dense matrix which are mapped and returned as a rows * columns matrix,
+//          only the page aligned window holding them is mapped (option Columns is ignored), whole matrix if empty
+//          (default)
+//   Transposed: true for returning the transpose of a sparse matrix created with option Transpose (stored in the same
+//               segment, the columns of option Columns are the columns of the transpose), false (default) otherwise
+//   Threads: number of prefault threads for Populate = "parallel", 0 (default) for automatic selection
+//   Prefetch: true for reading the (columns of) segment into page cache asynchronously (POSIX API only), mainly for
+//             persistent (file backed) segments
+//   KeepCached: true for locking the whole mapping in memory until it is released from the attach cache (POSIX API
+//               only, limited by RLIMIT_MEMLOCK, a warning is raised on failure), not supported by Mode "private"
+//   ReadyTimeout: seconds to wait for a segment still written by create_shared_matrix (option Async) before raising
+//                 SharedMatrix:NotReady, Inf (default) for waiting until it is written; a slice only waits for its own
+//                 columns
+// output arg [1]: matlab array (data pointer is attached to shared memory), or a struct / cell array of attached arrays
+//                 if the segment is a bundle (option Columns is ignored)
 // output arg [2]: opened handle
-// output arg [3]: base pointer referenced to the entry address
+// output arg [3]: base pointer referenced to the entry address (the beginning of the window for a slice)
+// output arg [4]: (optional) struct of attach info (Mode, Populate, Advice, Threads, CacheHit, MapSeconds,
+//                 PopulateSeconds, PopulatedBytes, Prefetch, KeepCached, Slice, MappedBytes)
+//
+// detach mode: read_shared_matrix(name, 'detach', cell)
+// input arg [3]: matlab cell containing arrays returned by this function, they are detached and set to empty (all
+//                elements of struct / cell arrays returned for bundle are detached)
+//
+// version mode: [version, updating] = read_shared_matrix(name, 'version')
+// output arg [1]: version of the shared matrix (number of in-place updates, see write_shared_matrix)
+// output arg [2]: (optional) true if an update is in progress
+//
+// wait mode: version = read_shared_matrix(name, 'wait', [version, timeout])
+// waits until the version is newer than input arg [3](1) and no update is in progress, or timeout seconds (Inf if
+// omitted) elapsed, returns the current version (not newer on timeout)
+// the segment must be attached by this process (any mode), the version is read through the cached mapping
+//
+// ready mode: ready = read_shared_matrix(name, 'ready', timeout)
+// waits until the segment is completely written by create_shared_matrix (option Async), timeout seconds (0 if omitted)
+// elapsed or its host exited, returns true if the segment is completely written (see ReadyBytes of
+// shared_matrix_stats for the progress)
+//
+// extend mode: columns = read_shared_matrix(name, 'extend', cell)
+// extends the arrays of the cell attached from appendable matrices (allocate_shared_matrix with Capacity) to their
+// committed columns, the arrays keep referencing the same mapping, nothing is copied or mapped again
+// output arg [1]: (optional) committed columns of the last extended array, 0 if none is extended
+//
+// copied mode: [pages, bytes] = read_shared_matrix(name, 'copied')
+// output arg [1]: pages of the private mappings (Mode "private") of the segment in this process which are copied into
+//                 private memory of the process (written pages), NaN if unknown (Linux only)
+// output arg [2]: (optional) bytes of these pages
+//
+// flush mode: read_shared_matrix('', 'flush')
+// releases all idle mappings of the attach cache
+// output arg [1]: (optional) number of mappings still referenced by arrays
 void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
-    MATLAB_PRHS_PTR_CHECK_STRICT(1);
+    shmem_trace_mex("read_shared_matrix");
+    MATLAB_PRHS_PTR_CHECK_RANGE(1, 3);
+    if (!attach_cache_exit_registered) {
+        mexAtExit(attach_cache_at_exit);
+        attach_cache_exit_registered = 1;
+    }
 
     // SHARED MEMORY NAME CHECK
     char shmem_name[MAX_SHMEM_NAME_LENGTH];
     if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], shmem_name, MAX_SHMEM_NAME_LENGTH))
         mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
-    if (strlen(shmem_name) == 0)
-        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
     SHMEM_DEBUG_OUTPUT("Shared memory name: %s\n", shmem_name);
 
+    // COMMAND MODE
+    if (nrhs >= 2 && !mxIsStruct(prhs[1])) {
+        char command[16];
+        if (!mxIsChar(prhs[1]) || mxGetString(prhs[1], command, sizeof(command)))
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [2]: command");
+        if (strcmp(command, "detach") == 0) {
+            if (nrhs != 3 || !mxIsCell(prhs[2]))
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [3] must be a cell");
+            if (nlhs != 0)
+                mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "detach does not return any value");
+            int throw_error_not_supported = 0;
+            for (size_t i = 0; i < mxGetNumberOfElements(prhs[2]); i++) {
+                mxArray* data_array = mxGetCell(prhs[2], i);
+                if (data_array != NULL && !detach_block(data_array, 1))
+                    throw_error_not_supported = 1;
+            }
+            attach_cache_sweep(0);
+            if (throw_error_not_supported)
+                mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Complex array is not supported before R2018a, god bless matlab will not be crashed");
+        }
+        else if (strcmp(command, "version") == 0 || strcmp(command, "wait") == 0) {
+            int wait = strcmp(command, "wait") == 0;
+            if (nlhs > (wait ? 1 : 2))
+                mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "%s returns at most %d value(s)", command, wait ? 1 : 2);
+            double wait_version = 0, timeout = mxGetInf();
+            if (wait) {
+                if (nrhs != 3 || !mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxGetNumberOfElements(prhs[2]) < 1 || mxGetNumberOfElements(prhs[2]) > 2)
+                    mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [3] must be [version, timeout]");
+                wait_version = mxGetPr(prhs[2])[0];
+                if (mxGetNumberOfElements(prhs[2]) > 1)
+                    timeout = mxGetPr(prhs[2])[1];
+                if (!(wait_version >= 0) || !(timeout >= 0))
+                    mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Version and timeout must be non-negative");
+            }
+            else if (nrhs != 2) {
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Too many input arguments");
+            }
+            attach_cache_entry_t* entry = attach_cache_find_stats(shmem_name);
+            if (entry == NULL)
+                mexErrMsgIdAndTxt("SharedMatrix:DataDetachedError", "Shared memory %s is not attached by this process, or has no version", shmem_name);
+            int updating = 0;
+            unsigned long long version = wait ? shmem_version_wait(entry->stats, (unsigned long long)wait_version, timeout)
+                                              : shmem_version_load(entry->stats, &updating);
+            plhs[0] = mxCreateDoubleScalar((double)version);
+            if (nlhs > 1)
+                plhs[1] = mxCreateLogicalScalar(updating);
+        }
+        else if (strcmp(command, "ready") == 0) {
+            if (nlhs > 1)
+                mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "ready returns at most one value");
+            double timeout = 0;
+            if (nrhs == 3) {
+                if (!mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1 || !(mxGetPr(prhs[2])[0] >= 0))
+                    mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [3] must be a non-negative timeout");
+                timeout = mxGetPr(prhs[2])[0];
+            }
+            attach_cache_entry_t* entry = attach_cache_find_stats(shmem_name);
+            if (entry == NULL) {
+                // kept idle in the attach cache, released by the next sweep or reused by the next attach
+                entry = attach_cache_open(shmem_name, SHMEM_ATTACH_READONLY, 0, 0, 0);
+            }
+            plhs[0] = mxCreateLogicalScalar(shmem_fill_wait(entry->stats, ~0ULL, timeout));
+        }
+        else if (strcmp(command, "extend") == 0) {
+            if (nrhs != 3 || !mxIsCell(prhs[2]))
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input argument [3] must be a cell");
+            if (nlhs > 1)
+                mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "extend returns at most one value");
+            double committed = 0;
+            for (size_t i = 0; i < mxGetNumberOfElements(prhs[2]); i++) {
+                mxArray* data_array = mxGetCell(prhs[2], i);
+                void* data = data_array ? shmem_attached_data(data_array) : NULL;
+                attach_cache_entry_t* entry = data ? attach_cache_find_ptr(data) : NULL;
+                if (entry == NULL || entry->ref_count == 0)
+                    continue; // not attached from shared memory or already detached
+                shmem_header_t hdr = { 0 };
+                if (entry->slice_end > 0 || entry->stats == NULL || shmem_parse_header(entry->ptr, entry->total_size, &hdr) != NULL ||
+                    !(hdr.array_attribute & ARRAY_APPEND) || (char*)data != (char*)entry->ptr + shmem_column_offset(&hdr, 0))
+                    mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Array %d of input argument [3] is not an appendable matrix attached as a whole", (int)i + 1);
+                // the mapping covers the capacity, the array grows in place
+                unsigned long long n_cols = shmem_append_columns(entry->stats);
+                shmem_extend_array(data_array, n_cols);
+                committed = (double)n_cols;
+            }
+            if (nlhs > 0)
+                plhs[0] = mxCreateDoubleScalar(committed);
+        }
+        else if (strcmp(command, "copied") == 0) {
+            if (nrhs != 2)
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Too many input arguments");
+            if (nlhs > 2)
+                mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "copied returns at most two values");
+            double pages = 0, bytes = 0;
+            for (attach_cache_entry_t* entry = attach_cache; entry; entry = entry->next) {
+                if (entry->mode != SHMEM_ATTACH_PRIVATE || entry->ref_count == 0 || strcmp(entry->name, shmem_name) != 0)
+                    continue;
+                unsigned long long page = shmem_page_size();
+                long long copied = shmem_private_bytes(entry->ptr, shmem_map_size(entry->total_size, entry->segment_flags), &page);
+                if (copied < 0) {
+                    pages = bytes = mxGetNaN();
+                    break;
+                }
+                pages += (double)((unsigned long long)copied / page);
+                bytes += (double)copied;
+            }
+            plhs[0] = mxCreateDoubleScalar(pages);
+            if (nlhs > 1)
+                plhs[1] = mxCreateDoubleScalar(bytes);
+        }
+        else if (strcmp(command, "flush") == 0) {
+            if (nlhs > 1)
+                mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "flush returns at most one value");
+            attach_cache_sweep(1);
+            int n_referenced = 0;
+            for (attach_cache_entry_t* entry = attach_cache; entry; entry = entry->next)
+                n_referenced++;
+            if (nlhs == 1)
+                plhs[0] = mxCreateDoubleScalar(n_referenced);
+        }
+        else {
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Unknown command: %s", command);
+        }
+        return;
+    }
+
     // OUTPUT ARGUMENT CHECK
-    if (nlhs != 3)
-        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "read_shared_matrix returns two values: data array, handle");
+    if (strlen(shmem_name) == 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Empty shared memory name");
+    if (nrhs > 2)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Too many input arguments");
+    if (nlhs != 3 && nlhs != 4)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "read_shared_matrix returns three values: data array, handle, base pointer (and optional attach info)");
     unsigned long long* output_handle = NULL;
     unsigned long long* output_pointer = NULL;
     MATLAB_CREATE_UINT64_RETURN_MATRIX(1, output_handle, unsigned long long);
     MATLAB_CREATE_UINT64_RETURN_MATRIX(2, output_pointer, unsigned long long);
-    
-    // COMMON DEFINES FOR DIFFERENT API
-#if SHMEM_API == SHMEM_WIN_API
-#    define SHMEM_EXC_CLEANUP_HANDLE { SHMEM_DEBUG_OUTPUT("API call: CloseHandle\n"); CloseHandle(shmem); }
-#    define SHMEM_EXC_CLEANUP_PTR(ptr_name,size) { SHMEM_DEBUG_OUTPUT("API call: UnmapViewOfFile\n"); UnmapViewOfFile(ptr_name); }
-#    define SHMEM_ATTACH_PTR_FUNC MapViewOfFile
-#    define SHMEM_ATTACH_PTR_ARG(size) shmem, FILE_MAP_ALL_ACCESS, 0, 0, size
-//#    define SHMEM_ATTACH_PTR_NAME "WIN API MapViewOfFile"
-#    define SHMEM_ATTACH_PTR_ERRNO GetLastError()
-#    define SHMEM_API_FAILURE_COND NULL
-#    define SHMEM_API_STR  "WIN"
-#elif SHMEM_API == SHMEM_POSIX_API
-#    define SHMEM_EXC_CLEANUP_HANDLE { SHMEM_DEBUG_OUTPUT("API call: close\n"); close(shmem); SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n"); shm_unlink(shmem_name); }
-#    define SHMEM_EXC_CLEANUP_PTR(ptr_name,size) { SHMEM_DEBUG_OUTPUT("API call: munmap\n"); munmap(ptr_name, size); }
-#    define SHMEM_ATTACH_PTR_FUNC mmap
-#    define SHMEM_ATTACH_PTR_ARG(size) 0, size, PROT_READ|PROT_WRITE, MAP_SHARED, shmem, 0
-//#    define SHMEM_ATTACH_PTR_NAME "POSIX API mmap"
-#    define SHMEM_ATTACH_PTR_ERRNO errno
-#    define SHMEM_API_FAILURE_COND MAP_FAILED
-#    define SHMEM_API_STR "POSIX"
-#endif
-#define SHMEM_ATTACH_PTR_FUNC_STR2(x) #x
-#define SHMEM_ATTACH_PTR_FUNC_STR(x) SHMEM_ATTACH_PTR_FUNC_STR2(x)
-#define SHMEM_EXC_CLEANUP_HANDLE_PTR(ptr_name,size) { SHMEM_EXC_CLEANUP_PTR(ptr_name,size); SHMEM_EXC_CLEANUP_HANDLE; }
-#define SHMEM_ATTACH_PTR(ptr_name, size) { \
-    SHMEM_DEBUG_OUTPUT("API call: " SHMEM_ATTACH_PTR_FUNC_STR(SHMEM_ATTACH_PTR_FUNC) "\n"); \
-    ptr_name = SHMEM_ATTACH_PTR_FUNC(SHMEM_ATTACH_PTR_ARG(size)); \
-    if (ptr_name == SHMEM_API_FAILURE_COND) { \
-        int attach_ptr_errno = SHMEM_ATTACH_PTR_ERRNO; \
-        SHMEM_EXC_CLEANUP_HANDLE; \
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", SHMEM_API_STR " API " SHMEM_ATTACH_PTR_FUNC_STR(SHMEM_ATTACH_PTR_FUNC) " call failed: %d", attach_ptr_errno); \
-    } \
-    SHMEM_DEBUG_OUTPUT("Shared memory pointer: %p\n", ptr_name); \
-}
-
-    // HEADER VALIDATION
-    void* header_ptr = NULL;
-#if SHMEM_API == SHMEM_WIN_API
-    SHMEM_DEBUG_OUTPUT("API call: OpenFileMappingA\n");
-    HANDLE shmem = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, shmem_name);
-    if (shmem == NULL)
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API OpenFileMappingA failed: %d", GetLastError());
-#elif SHMEM_API == SHMEM_POSIX_API
-    SHMEM_DEBUG_OUTPUT("API call: shm_open\n");
-    int shmem = shm_open(shmem_name, O_RDWR, 0666);
-    if (shmem == -1) {
-        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API shm_open failed: %d", errno);
-    }
-#endif
-    SHMEM_DEBUG_OUTPUT("Handle: %lld\n", (unsigned long long)shmem);
-    SHMEM_ATTACH_PTR(header_ptr, 8);
-    if (SHMEM_READ_CAST(unsigned int, header_ptr, 0) != SHMEM_MEMORY_LAYOUT_VERSION) {
-        SHMEM_EXC_CLEANUP_HANDLE_PTR(header_ptr, 8);
-        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "Read invalid memory layout version");
-    }
-    unsigned int header_size = SHMEM_READ_CAST(unsigned int, header_ptr, 4);
-    SHMEM_DEBUG_OUTPUT("Header size: %d\n", header_size);
-    SHMEM_EXC_CLEANUP_PTR(header_ptr, 8);
-    if (header_size == 0) {
-        SHMEM_EXC_CLEANUP_HANDLE;
-        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "Read invalid header size");
-    }
-
-    // READ FULL HEADER
-    SHMEM_ATTACH_PTR(header_ptr, header_size);
-    unsigned long long matrix_type = SHMEM_READ_CAST(unsigned long long, header_ptr, 8);
-    SHMEM_DEBUG_OUTPUT("Matrix type: %lld\n", matrix_type);
-    unsigned long long array_attribute = SHMEM_READ_CAST(unsigned long long, header_ptr, 16);
-    SHMEM_DEBUG_OUTPUT("Matrix flag: %lld\n", array_attribute);
-    unsigned long long payload_size = SHMEM_READ_CAST(unsigned long long, header_ptr, 24);
-    SHMEM_DEBUG_OUTPUT("Matrix payload size: %lld\n", payload_size);
-    unsigned int n_dims = SHMEM_READ_CAST(unsigned int, header_ptr, 32);
-    SHMEM_DEBUG_OUTPUT("Matrix dimension: %d\n", n_dims);
-
-    int data_size = 0;
-    if (matrix_type == mxINT8_CLASS || matrix_type == mxUINT8_CLASS || matrix_type == mxLOGICAL_CLASS) data_size = 1;
-    else if (matrix_type == mxINT16_CLASS || matrix_type == mxUINT16_CLASS) data_size = 2;
-    else if (matrix_type == mxINT32_CLASS || matrix_type == mxUINT32_CLASS || matrix_type == mxSINGLE_CLASS) data_size = 4;
-    else if (matrix_type == mxINT64_CLASS || matrix_type == mxUINT64_CLASS || matrix_type == mxDOUBLE_CLASS) data_size = 8;
-    if (data_size == 0) {
-        SHMEM_EXC_CLEANUP_HANDLE_PTR(header_ptr, header_size);
-        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "Read invalid matrix type");
-    }
-
-    if (array_attribute & ARRAY_COMPLEX) {
-#ifndef SHMEM_COMPLEX_SUPPORTED
-        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Complex array is not supported before R2018a");
-#else
-        data_size *= 2;
-#endif
+
+    // ATTACH OPTIONS
+    const mxArray* options = nrhs > 1 ? prhs[1] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 2);
+    char option_str[16];
+    shmem_option_string(options, "Mode", option_str, sizeof(option_str), "readwrite");
+    int mode = shmem_parse_enum(option_str, shmem_attach_mode_names, 3);
+    if (mode < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Invalid option Mode: %s", option_str);
+    shmem_option_string(options, "Populate", option_str, sizeof(option_str), "none");
+    int populate = shmem_parse_enum(option_str, shmem_populate_names, 3);
+    if (populate < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Invalid option Populate: %s", option_str);
+    shmem_option_string(options, "Advice", option_str, sizeof(option_str), "normal");
+    int advice = shmem_parse_enum(option_str, shmem_advice_names, 4);
+    if (advice < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Invalid option Advice: %s", option_str);
+    int n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    if (n_threads < 0 || n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+    int transposed = shmem_option_scalar(options, "Transposed", 0) != 0;
+    int prefetch = shmem_option_scalar(options, "Prefetch", 0) != 0;
+    int keep_cached = shmem_option_scalar(options, "KeepCached", 0) != 0;
+    if (keep_cached && mode == SHMEM_ATTACH_PRIVATE)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option KeepCached is not supported by Mode private, it would copy every page");
+    double ready_timeout = shmem_option_scalar(options, "ReadyTimeout", mxGetInf());
+    if (!(ready_timeout >= 0))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option ReadyTimeout must be non-negative");
+    unsigned long long col_begin = 0, col_end = 0;
+    const mxArray* columns = options ? mxGetField(options, 0, "Columns") : NULL;
+    if (columns != NULL && !mxIsEmpty(columns)) {
+        if (!mxIsDouble(columns) || mxIsComplex(columns) || mxGetNumberOfElements(columns) != 2)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Columns must be [first, last]");
+        double first = mxGetPr(columns)[0], last = mxGetPr(columns)[1];
+        if (first < 1 || last < first)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Columns must be [first, last] with 1 <= first <= last");
+        col_begin = (unsigned long long)first - 1;
+        col_end = (unsigned long long)last;
     }
-    SHMEM_DEBUG_OUTPUT("Data size: %d\n", data_size);
-    
-    mwSize static_dims[MAX_STATIC_ALLOCATED_DIMS]; // pre-allocated stack space
-    mwSize* dims = (n_dims <= MAX_STATIC_ALLOCATED_DIMS) ? static_dims : (mwSize*)malloc(sizeof(mwSize)*n_dims);
-    if (dims == NULL) {
-        SHMEM_EXC_CLEANUP_HANDLE_PTR(header_ptr, header_size);
-        mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+    unsigned long long slice_begin = 0, slice_end = 0;
+    const mxArray* slice = options ? mxGetField(options, 0, "Slice") : NULL;
+    if (slice != NULL && !mxIsEmpty(slice)) {
+        if (!mxIsDouble(slice) || mxIsComplex(slice) || mxGetNumberOfElements(slice) != 2)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Slice must be [first, last]");
+        double first = mxGetPr(slice)[0], last = mxGetPr(slice)[1];
+        if (first < 1 || last < first || first != (double)(unsigned long long)first || last != (double)(unsigned long long)last)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Slice must be [first, last] integers with 1 <= first <= last");
+        slice_begin = (unsigned long long)first - 1;
+        slice_end = (unsigned long long)last;
+        col_begin = col_end = 0;
     }
-    for (int i = 0; i < n_dims; i++)
-        dims[i] = (mwSize)SHMEM_READ_CAST(unsigned long long, header_ptr, 36+i*8);
-    unsigned long long total_size = header_size + payload_size;
-    unsigned long long nzmax = 0;
-    if (array_attribute & ARRAY_SPARSE) {
-        nzmax = SHMEM_READ_CAST(unsigned long long, header_ptr, 36+n_dims*8);
-        SHMEM_DEBUG_OUTPUT("Nzmax: %lld\n", nzmax);
+
+    // LOOKUP OR MAP SHARED MEMORY
+    double start_time = shmem_time_seconds();
+    double trace_start = shmem_trace_begin();
+    attach_cache_sweep(0);
+    attach_cache_entry_t* entry = attach_cache_find_name(shmem_name, mode, slice_begin, slice_end);
+    int cache_hit = entry != NULL;
+    // MAP_POPULATE covers the whole mapping (segment or slice window), only used when no column range is given, it
+    // would copy every page of a private mapping
+    int populate_on_map = !cache_hit && populate == SHMEM_POPULATE_MAP && col_end == 0 && mode != SHMEM_ATTACH_PRIVATE;
+    if (entry == NULL)
+        entry = attach_cache_open(shmem_name, mode, populate_on_map, slice_begin, slice_end);
+    else
+        SHMEM_DEBUG_OUTPUT("Attach cache hit: %p\n", entry->ptr);
+    double map_seconds = shmem_time_seconds() - start_time;
+    shmem_trace_end(cache_hit ? "attach cache hit" : "attach map", trace_start, cache_hit ? 0 : entry->total_size);
+    if (!entry->holds_reference) {
+        if (!shmem_ref_acquire(entry->stats)) {
+            entry->stale = 1;
+            attach_cache_sweep(0);
+            mexErrMsgIdAndTxt("SharedMatrix:Released", "Shared memory %s has been released by host", shmem_name);
+        }
+        entry->holds_reference = 1;
     }
-    SHMEM_EXC_CLEANUP_PTR(header_ptr, header_size);
 
     // CREATE RETURN MATLAB ARRAY
-    mxArray* output_array = NULL;
-    int complex_flag = (array_attribute & ARRAY_COMPLEX) ? mxCOMPLEX : mxREAL;
-    if (array_attribute & ARRAY_SPARSE) {
-        // sparse array
-        if (n_dims != 2) {
-            SHMEM_EXC_CLEANUP_HANDLE;
-            if (n_dims > MAX_STATIC_ALLOCATED_DIMS) free(dims);
-            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Sparse matrix only supports 2 dimensions");
-        }
-        if (matrix_type == mxDOUBLE_CLASS)
-            output_array = mxCreateSparse(dims[0], dims[1], nzmax, complex_flag);
-        else if (matrix_type == mxLOGICAL_CLASS)
-            output_array = mxCreateSparseLogicalMatrix(dims[0], dims[1], nzmax);
-        else {
-            if (n_dims > MAX_STATIC_ALLOCATED_DIMS) free(dims);
-            mexErrMsgIdAndTxt("SharedMatrix:DataTypeError", "Sparse matrix only supports double and logical data");
+    shmem_header_t hdr = { 0 };
+    const char* header_err = NULL;
+    if (slice_end > 0)
+        header_err = shmem_parse_header(entry->slice_header, sizeof(entry->slice_header), &hdr);
+    else
+        header_err = shmem_parse_header(entry->ptr, entry->total_size, &hdr);
+    if (header_err) {
+        attach_cache_abort(entry);
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+    }
+    char* block_ptr = (char*)entry->ptr;
+    if (transposed) {
+        if (slice_end > 0 || !(hdr.array_attribute & ARRAY_TRANSPOSE)) {
+            attach_cache_abort(entry);
+            mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Option Transposed requires a sparse matrix created with option Transpose");
         }
+        unsigned long long transpose_offset = shmem_transpose_offset(&hdr);
+        header_err = transpose_offset < hdr.total_size ? shmem_parse_header(block_ptr + transpose_offset, hdr.total_size - transpose_offset, &hdr) : "Read invalid header size";
+        if (header_err == NULL && (hdr.total_size > entry->total_size - transpose_offset || !(hdr.array_attribute & ARRAY_SPARSE)))
+            header_err = "Read invalid transposed matrix";
+        if (header_err) {
+            attach_cache_abort(entry);
+            mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+        }
+        block_ptr += transpose_offset;
+    }
+    // the segment may still be copied by create_shared_matrix (option Async), a slice waits for its own columns only
+    unsigned long long ready_end = ~0ULL;
+    if (slice_end > 0)
+        ready_end = entry->offset + entry->data_offset + shmem_header_columns(&hdr) * shmem_header_dim(&hdr, 0) * hdr.data_size;
+    double trace_wait = shmem_trace_begin();
+    int fill_ready = shmem_fill_wait(entry->stats, ready_end, ready_timeout);
+    shmem_trace_end("fill wait", trace_wait, 0);
+    if (!fill_ready) {
+        attach_cache_abort(entry);
+        mexErrMsgIdAndTxt("SharedMatrix:NotReady", "Shared memory %s is not completely written yet, or its host exited while writing it", shmem_name);
+    }
+    const char* err_id = NULL;
+    const char* err_msg = NULL;
+    int n_arrays = 0;
+    mxArray* output_array = NULL;
+    if (slice_end > 0) {
+        output_array = shmem_create_attached_array(&hdr, (char*)entry->ptr + entry->data_offset - ARRAY_HEADER_SIZE, &err_id, &err_msg);
+        n_arrays = output_array != NULL;
     }
     else {
-        output_array = mxCreateNumericArray((mwSize)n_dims, dims, (int)matrix_type, complex_flag);
+        output_array = attach_block(&hdr, block_ptr, 0, &n_arrays, &err_id, &err_msg);
     }
     if (output_array == NULL) {
-        SHMEM_EXC_CLEANUP_HANDLE;
-        if (n_dims > MAX_STATIC_ALLOCATED_DIMS) free(dims);
-        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateNumericArray");
+        attach_cache_abort(entry);
+        mexErrMsgIdAndTxt(err_id, "%s", err_msg);
     }
-    SHMEM_DEBUG_OUTPUT("Output mxArray created: %p\n", output_array);
+    attach_cache_add_reference(entry, n_arrays);
 
-    // READ FULL SHARED MEMORY
-    void* ptr = NULL;
-    SHMEM_ATTACH_PTR(ptr, total_size);
-    char* ptr_pr = ((char*)ptr) + header_size;
-
-    // FREE ORIGINAL ARRAY
-    void* original_pr = NULL;
-    
-    // ATTACH PTR
-    SHMEM_DEBUG_OUTPUT("Set pr: %p\n", ptr_pr + ARRAY_HEADER_SIZE);
-    if (array_attribute & ARRAY_COMPLEX) {
-#ifdef SHMEM_COMPLEX_SUPPORTED
-        original_pr = get_ic_ptr(output_array, (int)matrix_type);
-        set_ic_ptr(output_array, (int)matrix_type, ptr_pr + ARRAY_HEADER_SIZE);
-#endif
+    // ACCESS HINTS AND POPULATION
+    shmem_range_t ranges[3];
+    if (shmem_is_bundle(hdr.matrix_type))
+        col_end = 0; // columns of a bundle are undefined, the whole segment is used
+    if (col_end > shmem_header_columns(&hdr))
+        col_end = shmem_header_columns(&hdr);
+    if (col_begin > col_end)
+        col_begin = col_end;
+    int n_ranges = 1;
+    if (slice_end > 0) {
+        ranges[0].ptr = (char*)entry->ptr + entry->data_offset;
+        ranges[0].size = shmem_header_columns(&hdr) * shmem_header_dim(&hdr, 0) * hdr.data_size;
     }
     else {
-        original_pr = mxGetPr(output_array);
-        mxSetPr(output_array, (double*)(ptr_pr + ARRAY_HEADER_SIZE));
-    }
-    SHMEM_DEBUG_OUTPUT("CALL mxSetPr done\n");
-
-    SHMEM_DEBUG_OUTPUT("Original pr: %p\n", original_pr);
-    if (original_pr) {
-        mxFree(original_pr);
-        SHMEM_DEBUG_OUTPUT("CALL mxFree done\n");
-    }
-    if (array_attribute & ARRAY_SPARSE) {
-        unsigned long long ofs_ir = nzmax * data_size + ARRAY_HEADER_SIZE;
-        ofs_ir = INT_CEIL(ofs_ir, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
-        unsigned long long ofs_jc = ofs_ir + nzmax * sizeof(mwIndex) + ARRAY_HEADER_SIZE;
-        ofs_jc = INT_CEIL(ofs_jc, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
-        char* ptr_ir = ptr_pr + ofs_ir;
-        char* ptr_jc = ptr_pr + ofs_jc;
-        void* original_ir = mxGetIr(output_array);
-        void* original_jc = mxGetJc(output_array);
-        SHMEM_DEBUG_OUTPUT("Original ir: %p\n", original_ir);
-        if (original_ir) {
-            mxFree(original_ir);
-            SHMEM_DEBUG_OUTPUT("CALL mxFree done\n");
-        }
-        SHMEM_DEBUG_OUTPUT("Original jc: %p\n", original_jc);
-        if (original_jc) {
-            mxFree(original_jc);
-            SHMEM_DEBUG_OUTPUT("CALL mxFree done\n");
-        }
-        SHMEM_DEBUG_OUTPUT("Set ir: %p\n", ptr_ir + ARRAY_HEADER_SIZE);
-        mxSetIr(output_array, (mwIndex*)(ptr_ir + ARRAY_HEADER_SIZE));
-        SHMEM_DEBUG_OUTPUT("CALL mxSetIr done\n");
-        SHMEM_DEBUG_OUTPUT("Set jc: %p\n", ptr_jc + ARRAY_HEADER_SIZE);
-        mxSetJc(output_array, (mwIndex*)(ptr_jc + ARRAY_HEADER_SIZE));
-        SHMEM_DEBUG_OUTPUT("CALL mxSetJc done\n");
+        n_ranges = shmem_column_ranges(&hdr, block_ptr, col_begin, col_end, ranges);
+    }
+    unsigned long long page = shmem_flag_page_size(entry->segment_flags);
+    if (page == 0)
+        page = shmem_page_size();
+    if (advice != SHMEM_ADVICE_NORMAL && shmem_advise(ranges, n_ranges, advice, page) != 0)
+        SHMEM_DEBUG_OUTPUT("Access pattern hint is not applied\n");
+    start_time = shmem_time_seconds();
+    double trace_populate = shmem_trace_begin();
+    unsigned long long populated_bytes = 0;
+    int populate_threads = 0;
+    if (populate_on_map) {
+        // pages of an appendable matrix beyond its committed columns are not backed, the kernel skips them
+        populated_bytes = (hdr.array_attribute & ARRAY_APPEND) ? ranges[0].size : shmem_map_size(entry->total_size, entry->segment_flags);
+    }
+    else if (populate != SHMEM_POPULATE_NONE) {
+        if (populate == SHMEM_POPULATE_MAP && shmem_populate_map(ranges, n_ranges, mode != SHMEM_ATTACH_READWRITE, page) == 0) {
+            for (int i = 0; i < n_ranges; i++)
+                populated_bytes += ranges[i].size;
+        }
+        else {
+            // MADV_POPULATE_* is unavailable (e.g. Linux < 5.14), touch pages instead
+            populated_bytes = shmem_parallel_prefault(ranges, n_ranges, n_threads, page, &populate_threads);
+        }
+    }
+#if SHMEM_API == SHMEM_POSIX_API
+    if (keep_cached && !entry->locked) {
+        SHMEM_DEBUG_OUTPUT("API call: mlock\n");
+        // only the committed columns of an appendable matrix are locked, later columns are not
+        unsigned long long lock_bytes = entry->total_size;
+        if ((hdr.array_attribute & ARRAY_APPEND) && slice_end == 0)
+            lock_bytes = shmem_column_offset(&hdr, shmem_header_columns(&hdr));
+        if (mlock(entry->ptr, shmem_map_size(lock_bytes, entry->segment_flags)) == 0)
+            entry->locked = 1;
+        else
+            mexWarnMsgIdAndTxt("SharedMatrix:KeepCachedFailed", "Failed to lock shared memory in memory (errno: %d), check RLIMIT_MEMLOCK", errno);
+    }
+    if (prefetch) {
+        // the kernel reads the pages in background, page cache is shared by all processes mapping the file
+        for (int i = 0; i < n_ranges; i++) {
+            SHMEM_DEBUG_OUTPUT("API call: posix_fadvise\n");
+            if (ranges[i].size > 0)
+                posix_fadvise(entry->handle, (off_t)(entry->offset + (ranges[i].ptr - (char*)entry->ptr)), (off_t)ranges[i].size, POSIX_FADV_WILLNEED);
+        }
     }
+#endif
+    double populate_seconds = shmem_time_seconds() - start_time;
+    shmem_trace_end("populate", trace_populate, populated_bytes);
+    shmem_trace_end("attach", trace_start, 0);
 
+    if (nlhs > 3) {
+        const char* info_fields[] = { "Mode", "Populate", "Advice", "Threads", "CacheHit", "MapSeconds", "PopulateSeconds", "PopulatedBytes", "Prefetch", "KeepCached", "Slice", "MappedBytes" };
+        mxArray* info = mxCreateStructMatrix(1, 1, sizeof(info_fields) / sizeof(info_fields[0]), info_fields);
+        int info_ok = info != NULL;
+        info_ok = info_ok && attach_info_field(info, "Mode", mxCreateString(shmem_attach_mode_names[mode]));
+        info_ok = info_ok && attach_info_field(info, "Populate", mxCreateString(shmem_populate_names[populate]));
+        info_ok = info_ok && attach_info_field(info, "Advice", mxCreateString(shmem_advice_names[advice]));
+        info_ok = info_ok && attach_info_field(info, "Threads", mxCreateDoubleScalar(populate_threads));
+        info_ok = info_ok && attach_info_field(info, "CacheHit", mxCreateDoubleScalar(cache_hit));
+        info_ok = info_ok && attach_info_field(info, "MapSeconds", mxCreateDoubleScalar(map_seconds));
+        info_ok = info_ok && attach_info_field(info, "PopulateSeconds", mxCreateDoubleScalar(populate_seconds));
+        info_ok = info_ok && attach_info_field(info, "PopulatedBytes", mxCreateDoubleScalar((double)populated_bytes));
+        info_ok = info_ok && attach_info_field(info, "Prefetch", mxCreateDoubleScalar(prefetch));
+        info_ok = info_ok && attach_info_field(info, "KeepCached", mxCreateDoubleScalar(entry->locked));
+        mxArray* slice_info = info_ok ? mxCreateDoubleMatrix(slice_end > 0, slice_end > 0 ? 2 : 0, mxREAL) : NULL;
+        if (slice_info && slice_end > 0) {
+            mxGetPr(slice_info)[0] = (double)(slice_begin + 1);
+            mxGetPr(slice_info)[1] = (double)slice_end;
+        }
+        info_ok = info_ok && attach_info_field(info, "Slice", slice_info);
+        info_ok = info_ok && attach_info_field(info, "MappedBytes", mxCreateDoubleScalar((double)shmem_map_size(entry->total_size, entry->segment_flags)));
+        if (!info_ok) {
+            // the arrays are detached and their references released before matlab destroys them with the error
+            detach_block(output_array, 1);
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        }
+        plhs[3] = info;
+    }
     plhs[0] = output_array;
-    *output_handle = (unsigned long long)shmem;
-    *output_pointer = (unsigned long long)ptr;
+    *output_handle = (unsigned long long)entry->handle;
+    *output_pointer = (unsigned long long)entry->ptr;
 }
@@ -6,6 +6,11 @@ classdef shared_matrix < handle
         BasePointer
         IsAttached
         Platform
+        AttachInfo
+        % transpose attached by get_transposed
+        TransposedArray
+        % writer view opened by open_writer, empty if none
+        WriterView
     end
     
     methods
@@ -15,13 +20,31 @@ classdef shared_matrix < handle
             obj.Handle = uint64(0);
             obj.BasePointer = uint64(0);
             obj.CellArray = [];
+            obj.TransposedArray = [];
             obj.Platform = platform;
+            obj.WriterView = [];
         end
         
-        function arr = get_data(obj)
-            if ~obj.IsAttached
+        function arr = get_data(obj, varargin)
+            % get_data(col_range, ...) maps and returns only the columns [first, last] of a dense matrix (same as
+            % option 'Slice'), the memory mapped by the worker is limited to the page aligned window holding them
+            % optional name-value arguments (applied when the data is attached, see read_shared_matrix.c):
+            %   Mode: 'readwrite' (default), 'readonly' or 'private' (copy-on-write, elements assigned in place by
+            %         this worker are copied into its own memory and never seen by others, see copied_pages())
+            %   Populate: 'none' (default), 'map' or 'parallel', pre-faults pages before returning
+            %   Advice: 'normal' (default), 'sequential', 'random' or 'willneed'
+            %   Columns: [first, last] column range to populate / advise, whole matrix by default
+            %   Slice: [first, last] column range to map and return, whole matrix by default
+            %   Threads: number of prefault threads, 0 (default) for automatic selection
+            %   Prefetch: true for reading the matrix into page cache asynchronously (Linux only)
+            %   KeepCached: true for locking the matrix in memory while it is mapped (Linux only)
+            %   ReadyTimeout: seconds to wait for a matrix still copied by its host (option 'Async'), Inf by default
+            if ~isempty(varargin) && isnumeric(varargin{1})
+                varargin = [{'Slice', double(varargin{1})}, varargin(2:end)];
+            end
+            if ~obj.IsAttached || isempty(obj.CellArray)
                 obj.CellArray = cell(1);
-                [obj.CellArray{1}, obj.Handle, obj.BasePointer] = read_shared_matrix(obj.Name);
+                [obj.CellArray{1}, obj.Handle, obj.BasePointer, obj.AttachInfo] = read_shared_matrix(obj.Name, struct(varargin{:}));
                 arr = obj.CellArray{1};
                 obj.IsAttached = true;
             else
@@ -29,15 +52,206 @@ classdef shared_matrix < handle
             end
         end
         
+        function arr = get_transposed(obj, varargin)
+            % returns the transpose (A.') of a sparse matrix created by shared_matrix_host(A, 'Transpose', true), it is
+            % stored in the same shared memory and attached without copying (the same options as get_data)
+            if ~obj.IsAttached || isempty(obj.TransposedArray)
+                options = struct(varargin{:});
+                options.Transposed = true;
+                obj.TransposedArray = cell(1);
+                [obj.TransposedArray{1}, obj.Handle, obj.BasePointer, obj.AttachInfo] = read_shared_matrix(obj.Name, options);
+                obj.IsAttached = true;
+            end
+            arr = obj.TransposedArray{1};
+        end
+        
+        function arr = decode(obj, col_range, varargin)
+            % returns the columns [first, last] (all columns if omitted or empty) of a matrix created with option
+            % 'Encoding' widened to a private double / single matrix, get_data() returns the raw codes instead
+            % optional name-value arguments (see decode_shared_matrix.c):
+            %   Class: 'double' or 'single', the class of the source matrix by default
+            %   Threads: number of decode threads, 0 (default) for automatic selection
+            %   Kernel: 'auto' (default), 'avx512', 'avx2' or 'scalar'
+            if nargin < 2
+                col_range = [];
+            end
+            if ~obj.IsAttached
+                obj.get_data();
+            end
+            if ~isempty(obj.AttachInfo.Slice)
+                error('SharedMatrix:NotSupported', 'Decoding is not supported for a slice, attach the whole matrix instead');
+            end
+            arr = decode_shared_matrix(obj.BasePointer, double(col_range), struct(varargin{:}));
+        end
+        
+        function [result, info] = compute(obj, operation, x, varargin)
+            % runs a native multi-threaded kernel on the shared matrix in place, without copying it:
+            %   'colsum', 'rowsum', 'min', 'max', 'colnorm': sum(A, 1), sum(A, 2), min(A, [], 1), max(A, [], 1),
+            %                                            vecnorm(A, 2, 1)
+            %   'dot': x.' * A, 'gemv': A * x
+            % optional name-value arguments (see compute_shared_matrix.c):
+            %   Columns: [first, last] columns computed on, all columns by default
+            %   Threads: number of threads, 0 (default) for automatic selection
+            %   Kernel: 'auto' (default), 'avx2' or 'scalar'
+            if nargin < 3
+                x = [];
+            end
+            if ~obj.IsAttached
+                obj.get_data();
+            end
+            if ~isempty(obj.AttachInfo.Slice)
+                error('SharedMatrix:NotSupported', 'Computing is not supported for a slice, attach the whole matrix instead');
+            end
+            [result, info] = compute_shared_matrix(obj.BasePointer, operation, double(full(x)), struct(varargin{:}));
+        end
+        
+        function version = write(obj, first_column, values, varargin)
+            % writes columns of values to the shared matrix starting from first_column (see shared_matrix_host.write),
+            % through the writer view if open_writer() was called (version is empty then), or only to the private copy of
+            % this worker if attached with 'Mode', 'private' (the pages written are copied)
+            if ~isempty(obj.WriterView)
+                output_shared_matrix(obj.WriterView, 'write', double(first_column), values, struct(varargin{:}));
+                version = [];
+                return;
+            end
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory is not attached, call get_data() first');
+            end
+            if strcmp(obj.AttachInfo.Mode, 'readonly')
+                error('SharedMatrix:ReadOnly', 'Shared memory is attached in readonly mode');
+            end
+            if ~isempty(obj.AttachInfo.Slice)
+                error('SharedMatrix:NotSupported', 'Writing is not supported for a slice, attach the whole matrix instead');
+            end
+            version = write_shared_matrix(obj.BasePointer, double(first_column), values, struct(varargin{:}));
+        end
+        
+        function info = accumulate(obj, first_column, values, varargin)
+            % adds values to the columns of an accumulator (shared_matrix_host.accumulator) starting from first_column,
+            % instead of returning them to the client, the host calls merge() once all workers are done
+            % optional name-value arguments (see accumulate_shared_matrix.c):
+            %   Strategy: 'auto' (default), 'atomic' or 'stripe', 'auto' adds atomically and switches to a private
+            %             stripe of the worker once the contention is high
+            %   Threads: number of threads, 0 (default) for automatic selection
+            if ~obj.IsAttached
+                obj.get_data();
+            end
+            if ~strcmp(obj.AttachInfo.Mode, 'readwrite')
+                error('SharedMatrix:ReadOnly', 'Shared memory is attached in %s mode', obj.AttachInfo.Mode);
+            end
+            if ~isempty(obj.AttachInfo.Slice)
+                error('SharedMatrix:NotSupported', 'Accumulating is not supported for a slice, attach the whole matrix instead');
+            end
+            info = accumulate_shared_matrix(obj.BasePointer, double(first_column), values, struct(varargin{:}));
+        end
+        
+        function info = open_writer(obj, col_range)
+            % maps only the columns [first, last] of an output matrix (shared_matrix_host.output) writable, write()
+            % writes them in place afterwards, the ranges of all workers must be disjoint
+            % call close_writer() once all columns are written, the host waits for them by wait_done()
+            if ~isempty(obj.WriterView)
+                error('SharedMatrix:NotSupported', 'A writer view is already open, call close_writer() first');
+            end
+            [obj.WriterView, info] = output_shared_matrix(obj.Name, 'open', double(col_range));
+        end
+        
+        function close_writer(obj, finished)
+            % unmaps the writer view, its columns are counted as completed unless finished is false (e.g. on error)
+            if nargin < 2
+                finished = true;
+            end
+            if ~isempty(obj.WriterView)
+                view = obj.WriterView;
+                obj.WriterView = [];
+                output_shared_matrix(view, 'close', logical(finished));
+            end
+        end
+        
+        function [version, updating] = version(obj)
+            % version of the shared matrix (number of in-place updates by write()), updating is true while an update
+            % is in progress, the data read between two calls returning the same version without updating is
+            % consistent
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory is not attached, call get_data() first');
+            end
+            [version, updating] = read_shared_matrix(obj.Name, 'version');
+        end
+        
+        function version = wait_version(obj, version, timeout)
+            % waits until the shared matrix is updated to a version newer than version (and the update is complete),
+            % or timeout seconds (Inf by default) elapsed, returns the current version, arrays returned by get_data()
+            % already hold the new values
+            if nargin < 3
+                timeout = Inf;
+            end
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory is not attached, call get_data() first');
+            end
+            version = read_shared_matrix(obj.Name, 'wait', [double(version), double(timeout)]);
+        end
+        
+        function columns = refresh(obj)
+            % extends the array returned by get_data() to the columns appended by the host so far (matrices created by
+            % shared_matrix_host.appendable), the array keeps its mapping and nothing is copied, returns the number of
+            % columns, e.g. wait_version(v) followed by refresh() once the host appended
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory is not attached, call get_data() first');
+            end
+            columns = read_shared_matrix(obj.Name, 'extend', obj.CellArray);
+        end
+        
+        function ready = wait_ready(obj, timeout)
+            % waits until the shared matrix created with option 'Async' is completely written, or timeout seconds (Inf
+            % by default) elapsed, returns true if it is written (get_data() itself only waits for the columns it maps)
+            if nargin < 2
+                timeout = Inf;
+            end
+            ready = read_shared_matrix(obj.Name, 'ready', double(timeout));
+        end
+        
+        function [pages, bytes] = copied_pages(obj)
+            % pages of a matrix attached with 'Mode', 'private' which this worker has copied by writing them (NaN if
+            % unknown, Linux only), they are released by detach()
+            pages = 0;
+            bytes = 0;
+            if obj.IsAttached
+                [pages, bytes] = read_shared_matrix(obj.Name, 'copied');
+            end
+        end
+        
+        function s = stats(obj)
+            % usage counters of the shared matrix (attaches and mappings of all processes, see shared_matrix_stats.c)
+            s = shared_matrix_stats(obj.Name);
+        end
+        
         function detach(obj)
             if obj.IsAttached
                 obj.IsAttached = false;
-                delete_shared_matrix(obj.Handle, obj.BasePointer, obj.CellArray, []);
+                % the mapping is kept in the per-process attach cache of read_shared_matrix for later attaches
+                read_shared_matrix(obj.Name, 'detach', [obj.CellArray, obj.TransposedArray]);
+                obj.CellArray = [];
+                obj.TransposedArray = [];
             end
         end
         
         function delete(obj)
+            % a writer view left open is not counted as completed
+            obj.close_writer(false);
             obj.detach();
         end
     end
+    
+    methods (Static)
+        function obj = open_file(path)
+            % opens a persistent shared matrix stored by shared_matrix_host(..., 'File', path), the file is mapped
+            % directly, only the pages accessed are read from disk (or page cache)
+            obj = shared_matrix(['file:' char(path)], test_platform());
+        end
+        
+        function n = flush_cache()
+            % releases all unreferenced mappings of the attach cache in this process
+            % returns the number of mappings which are still referenced by attached arrays
+            n = read_shared_matrix('', 'flush');
+        end
+    end
 end
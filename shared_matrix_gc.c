@@ -0,0 +1,208 @@
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_stats.h"
+#include "shmem_pool.h"
+
+// reasons for reclaiming a segment
+#define SHMEM_GC_HOST_EXITED        1
+#define SHMEM_GC_RELEASED           2
+#define SHMEM_GC_STALE_REFERENCES   3
+#define SHMEM_GC_POOLED             4
+#define SHMEM_GC_TRACE_RING         5
+static const char* shmem_gc_reason_names[] = { "", "HostExited", "Released", "StaleReferences", "Pooled", "TraceRing" };
+
+// why the segment of info is reclaimed at time now, 0 if it is kept
+static int gc_reason(const shmem_segment_info_t* info, double now, double timeout) {
+    if (!info->has_stats)
+        return 0; // created without references, the host is unknown
+    unsigned long long refs = (unsigned long long)shmem_stats_load(info->stats, SHMEM_STATS_REFERENCES);
+    if (refs & SHMEM_REF_PERSISTENT)
+        return 0;
+    double heartbeat = SHMEM_READ_CAST(double, info->stats, SHMEM_STATS_HEARTBEAT);
+    if (refs & SHMEM_REF_RELEASED) {
+        if ((refs & SHMEM_REF_COUNT_MASK) == 0)
+            return SHMEM_GC_RELEASED; // the process dropping the last reference exited before removing it
+        // the remaining references are held by workers which exited without detaching, or by workers which have not
+        // attached or detached for timeout seconds (their mappings stay valid after the segment is removed)
+        return now - heartbeat >= timeout ? SHMEM_GC_STALE_REFERENCES : 0;
+    }
+    int alive = shmem_process_alive(SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_CREATOR_PID),
+                                    SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_CREATOR_START));
+    return alive == 0 ? SHMEM_GC_HOST_EXITED : 0;
+}
+
+// event trace rings of exited processes
+typedef struct {
+    char name[64];
+    unsigned long long pid;
+} gc_trace_ring_t;
+
+typedef struct {
+    gc_trace_ring_t* items;
+    size_t n;
+    size_t capacity;
+    int dry_run;
+} gc_trace_ring_list_t;
+
+#if SHMEM_API == SHMEM_POSIX_API
+// removes the ring of an exited process (unless dry_run is set) and appends it to the list
+static void gc_trace_ring(const char* name, char* ring, unsigned long long pid, unsigned long long pid_start, void* arg) {
+    gc_trace_ring_list_t* list = (gc_trace_ring_list_t*)arg;
+    (void)ring;
+    if (shmem_process_alive(pid, pid_start) != 0 || strlen(name) >= sizeof(list->items[0].name))
+        return;
+    if (list->n == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        gc_trace_ring_t* items = (gc_trace_ring_t*)realloc(list->items, sizeof(gc_trace_ring_t) * capacity);
+        if (items == NULL)
+            return;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    if (!list->dry_run) {
+        SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
+        if (shm_unlink(name) != 0)
+            return; // removed by another process meanwhile
+    }
+    strcpy(list->items[list->n].name, name);
+    list->items[list->n].pid = pid;
+    list->n++;
+}
+#endif
+
+// input arg [1]: (optional) struct of options
+//   DryRun: true for only reporting the segments which would be reclaimed, false (default) otherwise
+//   Timeout: seconds (default 3600) without attach or detach after which a segment released by its host is reclaimed
+//            although workers still hold references (they exited without detaching)
+//   PoolBytes: the oldest segments of the segment pool (see shmem_pool.h) are removed until it holds at most PoolBytes
+//              bytes, Inf (default) for keeping the pool
+// output arg [1]: (optional) struct (n * 1 array) of the reclaimed segments
+//   Name: shared memory name
+//   Bytes: size of the segment in byte
+//   CreatorPid: process id of the host
+//   Reason: "HostExited" (the host exited without detaching), "Released" (released by the host without references
+//           left), "StaleReferences" (released by the host, references are not dropped within Timeout seconds),
+//           "Pooled" (trimmed from the segment pool, CreatorPid is NaN) or "TraceRing" (event trace ring of an exited
+//           process, see shared_matrix_trace, CreatorPid is the process id of the writer)
+// all shared matrices in /dev/shm and on the hugetlbfs mount are checked (POSIX API only, a segment of WIN API is
+// removed by the OS when the last process holding it exits), persistent segments are never reclaimed
+// the host of a segment is checked by its process id and start time, run it in the same pid namespace as the hosts
+// workers still mapping a reclaimed segment are not affected, its memory is freed after they unmap it
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("shared_matrix_gc");
+    MATLAB_PRHS_PTR_CHECK_RANGE(0, 1);
+    if (nlhs > 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 1");
+    const mxArray* options = nrhs > 0 ? prhs[0] : NULL;
+    if (options && mxIsEmpty(options))
+        options = NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 1);
+    int dry_run = shmem_option_scalar(options, "DryRun", 0) != 0;
+    double timeout = shmem_option_scalar(options, "Timeout", 3600);
+    if (!(timeout >= 0))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Timeout must be non-negative");
+    double pool_bytes = shmem_option_scalar(options, "PoolBytes", mxGetInf());
+    if (!(pool_bytes >= 0))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option PoolBytes must be non-negative");
+
+    // SCAN SEGMENTS
+    shmem_segment_list_t list = { NULL, 0, 0 };
+#if SHMEM_API == SHMEM_WIN_API
+    (void)dry_run;
+#elif SHMEM_API == SHMEM_POSIX_API
+    shmem_segment_list_scan(&list);
+#endif
+    double now = shmem_unix_time();
+    int* reasons = (int*)malloc(sizeof(int) * (list.n > 0 ? list.n : 1));
+    if (reasons == NULL) {
+        shmem_segment_list_free(&list);
+        mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+    }
+    // reclaimed segments are moved to the front of the list
+    size_t n_reclaimed = 0;
+    for (size_t i = 0; i < list.n; i++) {
+        int reason = gc_reason(&list.items[i], now, timeout);
+        if (reason == 0)
+            continue;
+        SHMEM_DEBUG_OUTPUT("Reclaim %s: %s\n", list.items[i].name, shmem_gc_reason_names[reason]);
+#if SHMEM_API == SHMEM_POSIX_API
+        if (!dry_run) {
+            SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
+            if (shmem_posix_unlink(list.items[i].name) != 0)
+                continue; // removed by another process meanwhile
+        }
+#endif
+        shmem_segment_info_t reclaimed = list.items[i];
+        list.items[i] = list.items[n_reclaimed];
+        list.items[n_reclaimed] = reclaimed;
+        reasons[n_reclaimed++] = reason;
+    }
+
+    // TRIM SEGMENT POOL
+    shmem_pool_list_t pool_removed = { NULL, 0, 0 };
+#if SHMEM_API == SHMEM_POSIX_API
+    if (pool_bytes < 1.8e19) {
+        unsigned long long max_bytes = (unsigned long long)pool_bytes;
+        if (dry_run) {
+            // the oldest are removed first
+            shmem_pool_scan(&pool_removed, 0);
+            unsigned long long total = 0;
+            for (size_t i = 0; i < pool_removed.n; i++)
+                total += pool_removed.items[i].bytes;
+            size_t n_removed = 0;
+            while (n_removed < pool_removed.n && total > max_bytes)
+                total -= pool_removed.items[n_removed++].bytes;
+            pool_removed.n = n_removed;
+        }
+        else {
+            shmem_pool_trim(max_bytes, &pool_removed);
+        }
+    }
+#endif
+
+    // REMOVE TRACE RINGS
+    gc_trace_ring_list_t rings = { NULL, 0, 0, dry_run };
+#if SHMEM_API == SHMEM_POSIX_API
+    shmem_trace_ring_scan(0, gc_trace_ring, &rings);
+#endif
+
+    // OUTPUT
+    if (nlhs > 0) {
+        const char* fields[] = { "Name", "Bytes", "CreatorPid", "Reason" };
+        plhs[0] = mxCreateStructMatrix(n_reclaimed + pool_removed.n + rings.n, 1, sizeof(fields) / sizeof(fields[0]), fields);
+        if (plhs[0] == NULL) {
+            free(rings.items);
+            free(reasons);
+            shmem_pool_list_free(&pool_removed);
+            shmem_segment_list_free(&list);
+            mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+        }
+        for (size_t i = 0; i < n_reclaimed; i++) {
+            const shmem_segment_info_t* info = &list.items[i];
+            mxSetField(plhs[0], i, "Name", mxCreateString(info->name));
+            mxSetField(plhs[0], i, "Bytes", mxCreateDoubleScalar((double)info->bytes));
+            mxSetField(plhs[0], i, "CreatorPid", mxCreateDoubleScalar((double)SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_CREATOR_PID)));
+            mxSetField(plhs[0], i, "Reason", mxCreateString(shmem_gc_reason_names[reasons[i]]));
+        }
+        for (size_t i = 0; i < pool_removed.n; i++) {
+            mwIndex k = (mwIndex)(n_reclaimed + i);
+            mxSetField(plhs[0], k, "Name", mxCreateString(pool_removed.items[i].name));
+            mxSetField(plhs[0], k, "Bytes", mxCreateDoubleScalar((double)pool_removed.items[i].bytes));
+            mxSetField(plhs[0], k, "CreatorPid", mxCreateDoubleScalar(mxGetNaN()));
+            mxSetField(plhs[0], k, "Reason", mxCreateString(shmem_gc_reason_names[SHMEM_GC_POOLED]));
+        }
+        for (size_t i = 0; i < rings.n; i++) {
+            mwIndex k = (mwIndex)(n_reclaimed + pool_removed.n + i);
+            mxSetField(plhs[0], k, "Name", mxCreateString(rings.items[i].name));
+            mxSetField(plhs[0], k, "Bytes", mxCreateDoubleScalar((double)SHMEM_TRACE_BYTES));
+            mxSetField(plhs[0], k, "CreatorPid", mxCreateDoubleScalar((double)rings.items[i].pid));
+            mxSetField(plhs[0], k, "Reason", mxCreateString(shmem_gc_reason_names[SHMEM_GC_TRACE_RING]));
+        }
+    }
+    free(rings.items);
+    shmem_pool_list_free(&pool_removed);
+    free(reasons);
+    shmem_segment_list_free(&list);
+}
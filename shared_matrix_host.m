@@ -6,10 +6,46 @@ classdef shared_matrix_host < handle
         BasePointer
         IsAttached
         Platform
+        % statistics of copying data into shared memory (Bytes, Seconds, Throughput in GB/s, Threads, NonTemporal, ...)
+        CopyStats
+        % writable array over shared memory (only for matrices created by shared_matrix_host.allocate)
+        CellArray
+        % true if the matrix is stored in a file (option 'File'), the file is kept after detach
+        Persistent
+        % cap of the segment pool applied when the segment is returned to it by detach (option 'PoolBytes')
+        PoolBytes
+        % source variable of option 'Async', kept until detach since it is read by background threads
+        Source
     end
     
     methods
-        function obj = shared_matrix_host(input_variable)
+        function obj = shared_matrix_host(input_variable, varargin)
+            % input_variable: numeric / logical / char array, or a (nested) struct / cell array of them which is stored in
+            %                 one segment
+            % use shared_matrix_host.allocate to create a matrix without a source variable
+            % optional name-value arguments:
+            % 'Threads': number of threads copying the data, 0 (default) for automatic selection
+            % 'NonTemporal': use non-temporal stores, -1 (default) for enabling when data is larger than LLC
+            % 'HugePages': 'none' (default), 'thp', 'hugetlb', or huge page size such as '2M' / '1G' (Linux only)
+            % 'File': path of a file storing the matrix persistently, it is opened by shared_matrix.open_file(path)
+            %         in later sessions (an existing file is replaced after the data is written)
+            % 'Transpose': true for storing the transpose of a sparse matrix too (built by 'Threads' threads), workers
+            %              attach it by accessor.get_transposed()
+            % 'AlignColumns': true for starting the data at a page boundary, slices (accessor.get_data([first, last]))
+            %                 start at a page boundary if a column is a multiple of the page size
+            % 'Encoding': 'none' (default), 'single', 'half', 'bfloat16', 'int8' or 'int16' for storing a real dense
+            %             double / single matrix in reduced precision, workers get the codes by accessor.get_data() and
+            %             decoded columns by accessor.decode([first, last])
+            % 'Scale', 'Offset': elements are stored as (x - Offset) / Scale, integer encodings map the range of the
+            %                    finite elements to the whole code range by default
+            % 'Pool': true for reusing a released segment of the same size class (Linux only), the segment is returned to
+            %         the pool by detach instead of being removed, see shared_matrix_host.trim_pool
+            % 'PoolBytes': cap of the bytes kept in the pool when the segment is returned to it (default 1 GB)
+            % 'Numa': NUMA placement (Linux only), 'none' (default), 'interleave', 'bind' or 'columns' (contiguous column
+            %         blocks of a dense matrix on one node each), reported by accessor.stats()
+            % 'NumaNodes': node ids (0-based) of 'Numa', all online nodes by default, required by 'bind'
+            % 'Async': true for returning before the data is copied (not with 'File', 'Encoding' or 'Transpose'), workers
+            %          may attach right away and wait until the columns they map are written, see wait_ready()
             obj.Name = char(java.util.UUID.randomUUID);
             obj.Platform = test_platform();
             if obj.Platform == 0
@@ -17,10 +53,144 @@ classdef shared_matrix_host < handle
             elseif obj.Platform == 1
                 obj.Name = ['Local\' obj.Name];
             end
-            [obj.BasePointer, obj.Handle] = create_shared_matrix(obj.Name, input_variable);
+            is_allocate = nargin >= 2 && isequal(varargin{1}, '-allocate');
+            is_load = nargin >= 2 && isequal(varargin{1}, '-load');
+            if is_allocate || is_load
+                options = struct(varargin{2:end});
+            else
+                options = struct(varargin{:});
+            end
+            obj.PoolBytes = [];
+            if isfield(options, 'PoolBytes')
+                obj.PoolBytes = double(options.PoolBytes);
+            end
+            obj.Persistent = isfield(options, 'File') && ~isempty(options.File);
+            if obj.Persistent
+                obj.Name = ['file:' char(options.File)];
+            end
+            if is_allocate
+                % called by shared_matrix_host.allocate, input_variable is the matrix description
+                obj.CellArray = cell(1);
+                [obj.BasePointer, obj.Handle, obj.CellArray{1}, obj.Name] = allocate_shared_matrix(obj.Name, input_variable, options);
+            elseif is_load
+                % called by shared_matrix_host.load, input_variable is the path of the source file
+                [obj.BasePointer, obj.Handle, obj.CopyStats, obj.Name] = load_shared_matrix(obj.Name, char(input_variable), options);
+            else
+                [obj.BasePointer, obj.Handle, obj.CopyStats, obj.Name] = create_shared_matrix(obj.Name, input_variable, options);
+                if obj.CopyStats.Async
+                    obj.Source = input_variable;
+                end
+            end
             obj.IsAttached = true;
         end
         
+        function arr = get_data(obj)
+            % returns the matrix allocated in shared memory, assigning elements of the returned array creates a
+            % private copy (copy-on-write of Matlab), use write() to modify the shared memory
+            if ~obj.IsAttached || isempty(obj.CellArray)
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached or is not allocated by shared_matrix_host.allocate');
+            end
+            arr = obj.CellArray{1};
+        end
+        
+        function version = write(obj, first_column, values, varargin)
+            % writes columns of values to the shared matrix starting from first_column in place, or several column
+            % ranges at once: write([c1, c2], {v1, v2}) (dense matrices only)
+            % (sparse matrices must be written in column order, see write_shared_matrix.c)
+            % every write is published as a new version, workers waiting by wait_version() are woken up
+            % optional name-value arguments: 'Threads', 'NonTemporal'
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            version = write_shared_matrix(obj.BasePointer, double(first_column), values, struct(varargin{:}));
+        end
+        
+        function info = accumulate(obj, first_column, values, varargin)
+            % adds values to the columns of an accumulator starting from first_column (see shared_matrix.accumulate)
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            info = accumulate_shared_matrix(obj.BasePointer, double(first_column), values, struct(varargin{:}));
+        end
+        
+        function info = merge(obj, varargin)
+            % adds the private stripes of all workers to the accumulator and frees them, call it once the workers are
+            % done adding (e.g. after parfor), get_data() returns the sums afterwards
+            % optional name-value arguments: 'Threads'
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            info = accumulate_shared_matrix(obj.BasePointer, 'merge', [], struct(varargin{:}));
+        end
+        
+        function [finished, done] = wait_done(obj, timeout, columns)
+            % waits until the workers closed the writer views of all columns of an output matrix (or columns columns),
+            % or timeout seconds (Inf by default) elapsed, returns true if they are completed, get_data() holds the
+            % results afterwards, done is the number of completed columns
+            if nargin < 2
+                timeout = Inf;
+            end
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            if nargin < 3
+                arr = obj.get_data();
+                columns = numel(arr) / max(size(arr, 1), 1);
+            end
+            [finished, done] = output_shared_matrix(obj.BasePointer, 'wait', [double(columns), double(timeout)]);
+        end
+        
+        function reset_done(obj)
+            % clears the completed columns of an output matrix before the workers write it again
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            output_shared_matrix(obj.BasePointer, 'reset');
+        end
+        
+        function [columns, info] = append(obj, values, varargin)
+            % appends the columns of values to a matrix created by shared_matrix_host.appendable, the shared memory grows
+            % by chunks and get_data() covers the new columns, returns the number of committed columns
+            % every append is published as a new version, workers see the columns after accessor.refresh()
+            % optional name-value arguments: 'Threads', 'NonTemporal', 'Chunk' (bytes the shared memory grows by)
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            [columns, info] = append_shared_matrix(obj.BasePointer, obj.Handle, values, obj.CellArray, struct(varargin{:}));
+        end
+        
+        function [result, info] = compute(obj, operation, x, varargin)
+            % runs a native kernel on the shared matrix in place (see shared_matrix.compute)
+            if nargin < 3
+                x = [];
+            end
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            [result, info] = compute_shared_matrix(obj.BasePointer, operation, double(full(x)), struct(varargin{:}));
+        end
+        
+        function version = version(obj)
+            % number of in-place updates made by write() of the host and workers
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            s = shared_matrix_stats(obj.Name);
+            version = s.Version;
+        end
+        
+        function ready = wait_ready(obj, timeout)
+            % waits until the data of option 'Async' is copied into shared memory, or timeout seconds (Inf by default)
+            % elapsed, returns true if the copy is complete
+            if nargin < 2
+                timeout = Inf;
+            end
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            ready = read_shared_matrix(obj.Name, 'ready', double(timeout));
+        end
+        
         function copy = attach(obj)
             if ~obj.IsAttached
                 error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
@@ -28,11 +198,148 @@ classdef shared_matrix_host < handle
             copy = shared_matrix(obj.Name, obj.Platform);
         end
         
+        function s = stats(obj)
+            % usage counters of the shared matrix: ActiveAttaches, Attaches, Detaches, Maps, MappedBytes of all
+            % processes, CreateTime, CreateBytes, ... (see shared_matrix_stats.c)
+            if ~obj.IsAttached
+                error('SharedMatrix:DataDetachedError', 'Shared memory has been detached');
+            end
+            s = shared_matrix_stats(obj.Name);
+        end
+        
         function detach(obj)
+            % drops the reference of the host, the shared memory is removed once no worker has arrays attached from it
             if obj.IsAttached
                 obj.IsAttached = false;
-                delete_shared_matrix(obj.Handle, obj.BasePointer, [], obj.Name);
+                name = obj.Name;
+                if obj.Persistent
+                    name = [];  % keeps the file
+                end
+                delete_shared_matrix(obj.Handle, obj.BasePointer, obj.CellArray, name, struct('PoolBytes', obj.PoolBytes));
+                obj.CellArray = [];
+                obj.Source = [];
+            end
+        end
+        
+        function delete(obj)
+            % the source of option 'Async' is freed with the object, the background copy must finish reading it first
+            if obj.IsAttached && ~isempty(obj.Source)
+                obj.wait_ready();
+            end
+        end
+    end
+    
+    methods (Static)
+        function reclaimed = gc(varargin)
+            % removes shared matrices left behind by hosts which exited without detaching (Linux only)
+            % optional name-value arguments (see shared_matrix_gc.c):
+            % 'DryRun': true for only returning the segments which would be removed
+            % 'Timeout': seconds (default 3600) after which a detached shared matrix whose workers exited without
+            %            detaching is removed
+            reclaimed = shared_matrix_gc(struct(varargin{:}));
+        end
+        
+        function trimmed = trim_pool(max_bytes)
+            % removes the oldest segments of the segment pool until it holds at most max_bytes (0 by default, emptying
+            % the pool), returns the removed segments (see shared_matrix_gc.c), segments of hosts which exited without
+            % detaching and the event trace rings of exited processes are removed by the same pass
+            if nargin < 1
+                max_bytes = 0;
+            end
+            trimmed = shared_matrix_gc(struct('PoolBytes', double(max_bytes), 'Timeout', Inf));
+        end
+        
+        function obj = load(path, varargin)
+            % creates a shared matrix from a file without loading it into Matlab, the elements are read straight into
+            % shared memory, e.g. shared_matrix_host.load('x.npy') or
+            % shared_matrix_host.load('x.bin', 'Class', 'single', 'Dims', [4096, 1024], 'Order', 'C')
+            % optional name-value arguments (see load_shared_matrix.c):
+            % 'Format': 'auto' (default, by file extension), 'raw' or 'npy'
+            % 'Class', 'Dims', 'Complex', 'Order', 'Offset': layout of a raw file, 'Order' is 'F' (column-major,
+            %                                                default) or 'C' (row-major, transposed while reading)
+            % 'Threads': number of reading threads, 0 (default) for automatic selection
+            % 'Direct': true for bypassing page cache, -1 (default) for files of 1 GB and more
+            % 'HugePages', 'File', 'AlignColumns', 'Numa', 'NumaNodes': same as the constructor
+            obj = shared_matrix_host(path, '-load', varargin{:});
+        end
+        
+        function obj = allocate(class_name, dims, varargin)
+            % creates a zero-initialized matrix in shared memory without a source variable, the data is filled by
+            % write() from host or workers, e.g. shared_matrix_host.allocate('double', [4096, 1024])
+            % optional name-value arguments:
+            % 'Complex': true for complex matrix
+            % 'Sparse': true for sparse matrix (double or logical)
+            % 'Nzmax': number of non-zero elements allocated for sparse matrix
+            % 'HugePages', 'File', 'AlignColumns', 'Numa', 'NumaNodes': same as the constructor
+            spec = struct('Class', class_name, 'Dims', double(dims), 'Complex', false, 'Sparse', false, 'Nzmax', 1);
+            options = {};
+            for i = 1:2:length(varargin)
+                if any(strcmp(varargin{i}, {'Complex', 'Sparse', 'Nzmax'}))
+                    spec.(varargin{i}) = varargin{i + 1};
+                else
+                    options(end + 1:end + 2) = varargin(i:i + 1); %#ok<AGROW>
+                end
+            end
+            obj = shared_matrix_host(spec, '-allocate', options{:});
+        end
+        
+        function obj = output(class_name, dims, varargin)
+            % creates a zero-initialized dense matrix in shared memory which workers write their results to in place
+            % instead of returning them (e.g. sliced outputs of parfor), each worker opens a writer view of its columns by
+            % accessor.open_writer([first, last]), the host waits by wait_done(), e.g.
+            % shared_matrix_host.output('double', [4096, 1024])
+            % optional name-value arguments:
+            % 'Complex': true for complex matrix
+            % 'AlignColumns': true (default) for starting the data at a page boundary
+            % 'HugePages', 'File', 'Numa', 'NumaNodes': same as the constructor
+            if ~any(strcmp(varargin(1:2:end), 'AlignColumns'))
+                varargin(end + 1:end + 2) = {'AlignColumns', true};
+            end
+            obj = shared_matrix_host.allocate(class_name, dims, varargin{:});
+        end
+        
+        function obj = appendable(class_name, rows, capacity, varargin)
+            % creates a dense matrix of rows rows in shared memory which grows by append() up to capacity columns, e.g.
+            % a streaming producer: shared_matrix_host.appendable('double', 4096, 1e6), address space is reserved for
+            % the capacity while the shared memory is only backed as far as columns are appended
+            % optional name-value arguments:
+            % 'Columns': number of zero-initialized columns committed from the beginning (0 by default)
+            % 'Complex': true for complex matrix
+            % 'Chunk': bytes the shared memory grows by at a time (64 MB by default)
+            % 'HugePages', 'File', 'AlignColumns', 'Numa', 'NumaNodes': same as the constructor
+            spec = struct('Class', class_name, 'Dims', [double(rows), 0], 'Complex', false, 'Sparse', false, 'Nzmax', 1, 'Capacity', double(capacity));
+            options = {};
+            for i = 1:2:length(varargin)
+                if strcmp(varargin{i}, 'Columns')
+                    spec.Dims(2) = double(varargin{i + 1});
+                elseif strcmp(varargin{i}, 'Complex')
+                    spec.Complex = varargin{i + 1};
+                else
+                    options(end + 1:end + 2) = varargin(i:i + 1); %#ok<AGROW>
+                end
+            end
+            obj = shared_matrix_host(spec, '-allocate', options{:});
+        end
+        
+        function obj = accumulator(class_name, dims, varargin)
+            % creates a zero-initialized numeric matrix in shared memory which workers add their results to by
+            % accessor.accumulate(), the sums are complete after host.merge(), e.g.
+            % shared_matrix_host.accumulator('double', [4096, 1024], 'Stripes', 8)
+            % optional name-value arguments:
+            % 'Complex': true for complex matrix
+            % 'Stripes': number of private stripes (0 by default), workers add to a stripe instead of atomically once
+            %            the contention is high, each stripe in use costs the memory of the matrix
+            % 'HugePages', 'File', 'AlignColumns', 'Numa', 'NumaNodes': same as the constructor
+            spec = struct('Class', class_name, 'Dims', double(dims), 'Complex', false, 'Sparse', false, 'Nzmax', 1, 'Accumulate', true, 'Stripes', 0);
+            options = {};
+            for i = 1:2:length(varargin)
+                if any(strcmp(varargin{i}, {'Complex', 'Stripes'}))
+                    spec.(varargin{i}) = varargin{i + 1};
+                else
+                    options(end + 1:end + 2) = varargin(i:i + 1); %#ok<AGROW>
+                end
             end
+            obj = shared_matrix_host(spec, '-allocate', options{:});
         end
     end
 end
@@ -0,0 +1,152 @@
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_layout.h"
+#include "shmem_stats.h"
+#include "shmem_numa.h"
+
+// counter of STATISTICS as double, NaN if the segment does not hold it
+static double segment_counter(const shmem_segment_info_t* info, int offset) {
+    if (!info->has_stats)
+        return mxGetNaN();
+    if (offset == SHMEM_STATS_CREATE_TIME || offset == SHMEM_STATS_CREATE_SECONDS || offset == SHMEM_STATS_HEARTBEAT)
+        return SHMEM_READ_CAST(double, info->stats, offset);
+    if (offset == SHMEM_STATS_REFERENCES)
+        return (double)(shmem_stats_load(info->stats, offset) & SHMEM_REF_COUNT_MASK);
+    return (double)shmem_stats_load(info->stats, offset);
+}
+
+// NumaNodes (1 * k node ids) and NumaColumns (k * 2 column ranges of policy "columns") of the segment
+static void set_numa_fields(mxArray* out, mwIndex i, const shmem_segment_info_t* info) {
+    int policy = info->has_stats ? (int)SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_NUMA_POLICY) : SHMEM_NUMA_NONE;
+    unsigned long long nodes = info->has_stats ? SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_NUMA_NODES) : 0;
+    int n_nodes = shmem_numa_count(nodes);
+    mxArray* node_ids = mxCreateDoubleMatrix(1, n_nodes, mxREAL);
+    mxArray* columns = mxCreateDoubleMatrix(policy == SHMEM_NUMA_COLUMNS ? n_nodes : 0, 2, mxREAL);
+    unsigned long long n_cols = 1;
+    for (unsigned int j = 1; j < info->n_dims; j++)
+        n_cols *= info->dims[j];
+    for (int node = 0, k = 0; node < SHMEM_NUMA_MAX_NODES && node_ids != NULL; node++) {
+        if (!(nodes & (1ULL << node)))
+            continue;
+        mxGetPr(node_ids)[k] = node;
+        if (policy == SHMEM_NUMA_COLUMNS && columns != NULL) {
+            unsigned long long first, last;
+            shmem_numa_column_block(n_cols, n_nodes, k, &first, &last);
+            mxGetPr(columns)[k] = (double)first + 1;
+            mxGetPr(columns)[k + n_nodes] = (double)last;
+        }
+        k++;
+    }
+    mxSetField(out, i, "NumaPolicy", mxCreateString(shmem_numa_name(policy)));
+    mxSetField(out, i, "NumaNodes", node_ids);
+    mxSetField(out, i, "NumaColumns", columns);
+}
+
+// input arg [1]: (optional) shared memory name, all shared matrices in /dev/shm and on the hugetlbfs mount are listed
+//                if it is omitted or empty (POSIX API only)
+// output arg [1]: struct (n * 1 array when listing) of
+//   Name: shared memory name (accepted by read_shared_matrix)
+//   Bytes: size of the segment in byte
+//   Class: class of the matrix, "struct" or "cell" for struct / cell arrays
+//   Dims: dimensions
+//   CreateTime: creation time in seconds since 1970-01-01 UTC (datetime(t, 'ConvertFrom', 'posixtime'))
+//   CreateBytes, CreateSeconds: bytes copied into the segment by the host and seconds spent on it
+//   CreatorPid: process id of the host
+//   ActiveAttaches: arrays currently attached by all processes (elements of struct / cell arrays are counted one by one)
+//   Attaches, Detaches: arrays attached / detached since creation
+//   Maps: mappings made by all processes (attaches served by the attach cache of a process do not map the segment)
+//   MappedBytes: bytes currently mapped by all processes (including the host)
+//   References: references held by processes (the host, and every process while it has arrays attached)
+//   Heartbeat: last time References changed in seconds since 1970-01-01 UTC
+//   Version: number of in-place updates (write_shared_matrix)
+//   Released: true if the host has detached, the segment is removed when the last reference is dropped
+//   HostAlive: true if the host process is running, false if it exited (NaN if unknown)
+//   ReadyBytes: bytes from the beginning of the segment already written, less than Bytes while the segment is copied
+//               by create_shared_matrix with option Async
+//   NumaPolicy: NUMA placement of the pages ("none", "interleave", "bind" or "columns", see shmem_numa.h)
+//   NumaNodes: node ids of NumaPolicy (0-based)
+//   NumaColumns: [first, last] columns (1-based) placed on each node of NumaNodes (one row for each node) for "columns",
+//                empty otherwise, workers processing these columns are best pinned to that node
+//   OutputDone: columns completed by writer views of an output matrix (output_shared_matrix)
+//   OutputWriters: writer views currently open
+//   Capacity: columns reserved by an appendable matrix (allocate_shared_matrix with Capacity), 0 otherwise, Dims holds
+//             the committed columns and Bytes the part of the segment backed so far
+// counters are NaN for segments created without them
+// the segments are not mapped, calling this function does not change the counters
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("shared_matrix_stats");
+    MATLAB_PRHS_PTR_CHECK_RANGE(0, 1);
+    if (nlhs > 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 1");
+    char shmem_name[MAX_SHMEM_NAME_LENGTH] = "";
+    if (nrhs > 0 && !mxIsEmpty(prhs[0]) && (!mxIsChar(prhs[0]) || mxGetString(prhs[0], shmem_name, MAX_SHMEM_NAME_LENGTH)))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: shared memory name");
+
+    // READ SEGMENTS
+    shmem_segment_list_t list = { NULL, 0, 0 };
+    if (*shmem_name) {
+        list.items = (shmem_segment_info_t*)malloc(sizeof(shmem_segment_info_t));
+        if (list.items == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:OutOfMemory", "Malloc failed to allocate new memory");
+        list.capacity = 1;
+        if (shmem_segment_info_read(shmem_name, list.items)) {
+            free(list.items);
+            mexErrMsgIdAndTxt("SharedMatrix:NotFound", "Shared matrix %s does not exist or is corrupted", shmem_name);
+        }
+        list.n = 1;
+    }
+    else {
+#if SHMEM_API == SHMEM_WIN_API
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Listing shared matrices is not supported by WIN API, specify the name");
+#elif SHMEM_API == SHMEM_POSIX_API
+        shmem_segment_list_scan(&list);
+#endif
+    }
+
+    // OUTPUT
+    const char* fields[] = { "Name", "Bytes", "Class", "Dims", "CreateTime", "CreateBytes", "CreateSeconds", "CreatorPid",
+                             "ActiveAttaches", "Attaches", "Detaches", "Maps", "MappedBytes", "References", "Heartbeat", "Version", "Released", "HostAlive",
+                             "ReadyBytes", "NumaPolicy", "NumaNodes", "NumaColumns", "OutputDone", "OutputWriters", "Capacity" };
+    static const int counters[] = { SHMEM_STATS_CREATE_TIME, SHMEM_STATS_CREATE_BYTES, SHMEM_STATS_CREATE_SECONDS, SHMEM_STATS_CREATOR_PID,
+                                    SHMEM_STATS_ACTIVE_ATTACHES, SHMEM_STATS_ATTACHES, SHMEM_STATS_DETACHES, SHMEM_STATS_MAPS, SHMEM_STATS_MAPPED_BYTES,
+                                    SHMEM_STATS_REFERENCES, SHMEM_STATS_HEARTBEAT, SHMEM_STATS_VERSION };
+    plhs[0] = mxCreateStructMatrix(*shmem_name ? 1 : list.n, 1, sizeof(fields) / sizeof(fields[0]), fields);
+    if (plhs[0] == NULL) {
+        shmem_segment_list_free(&list);
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateStructMatrix");
+    }
+    for (size_t i = 0; i < list.n; i++) {
+        const shmem_segment_info_t* info = &list.items[i];
+        mxSetField(plhs[0], i, "Name", mxCreateString(info->name));
+        mxSetField(plhs[0], i, "Bytes", mxCreateDoubleScalar((double)info->bytes));
+        mxSetField(plhs[0], i, "Class", mxCreateString(shmem_class_name(info->matrix_type)));
+        mxArray* dims = mxCreateDoubleMatrix(1, info->n_dims, mxREAL);
+        if (dims)
+            for (unsigned int j = 0; j < info->n_dims; j++)
+                mxGetPr(dims)[j] = (double)info->dims[j];
+        mxSetField(plhs[0], i, "Dims", dims);
+        for (size_t j = 0; j < sizeof(counters) / sizeof(counters[0]); j++)
+            mxSetFieldByNumber(plhs[0], i, (int)j + 4, mxCreateDoubleScalar(segment_counter(info, counters[j])));
+        double released = mxGetNaN(), host_alive = mxGetNaN(), ready_bytes = mxGetNaN(), output_writers = mxGetNaN();
+        if (info->has_stats) {
+            ready_bytes = (double)info->bytes;
+            unsigned long long ready = SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_FILL_READY);
+            if (SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_FILL_ASYNC) != 0 && ready < info->bytes)
+                ready_bytes = (double)ready;
+            released = (shmem_stats_load(info->stats, SHMEM_STATS_REFERENCES) & SHMEM_REF_RELEASED) != 0;
+            int alive = shmem_process_alive(SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_CREATOR_PID),
+                                            SHMEM_READ_CAST(unsigned long long, info->stats, SHMEM_STATS_CREATOR_START));
+            if (alive >= 0)
+                host_alive = alive;
+            output_writers = SHMEM_READ_CAST(unsigned int, info->stats, SHMEM_STATS_OUTPUT_WRITERS);
+        }
+        mxSetField(plhs[0], i, "Released", mxCreateDoubleScalar(released));
+        mxSetField(plhs[0], i, "HostAlive", mxCreateDoubleScalar(host_alive));
+        mxSetField(plhs[0], i, "ReadyBytes", mxCreateDoubleScalar(ready_bytes));
+        mxSetField(plhs[0], i, "OutputDone", mxCreateDoubleScalar(segment_counter(info, SHMEM_STATS_OUTPUT_DONE)));
+        mxSetField(plhs[0], i, "OutputWriters", mxCreateDoubleScalar(output_writers));
+        mxSetField(plhs[0], i, "Capacity", mxCreateDoubleScalar(segment_counter(info, SHMEM_STATS_APPEND_CAPACITY)));
+        set_numa_fields(plhs[0], i, info);
+    }
+    shmem_segment_list_free(&list);
+}
@@ -0,0 +1,115 @@
+#include "compiler_def.h"
+#include "shmem_stats.h"
+#include "shmem_trace.h"
+
+#if SHMEM_API == SHMEM_POSIX_API
+// writes s as a JSON string
+static void json_write_string(FILE* fp, const char* s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+typedef struct {
+    FILE* fp;
+    unsigned long long n_events;
+} trace_dump_t;
+
+// appends the events of a ring to the traceEvents array (ts / dur in microseconds)
+static void trace_dump_ring(const char* name, char* ring, unsigned long long pid, unsigned long long pid_start, void* arg) {
+    trace_dump_t* dump = (trace_dump_t*)arg;
+    (void)name; (void)pid_start;
+    unsigned long long next = _shmem_trace_load(ring + SHMEM_TRACE_NEXT);
+    unsigned long long first = _shmem_trace_load(ring + SHMEM_TRACE_CLEARED);
+    if (next > SHMEM_TRACE_EVENTS && first < next - SHMEM_TRACE_EVENTS)
+        first = next - SHMEM_TRACE_EVENTS;
+    char ev[SHMEM_TRACE_SLOT_BYTES];
+    for (unsigned long long i = first; i < next; i++) {
+        if (!shmem_trace_read_event(ring, i, ev))
+            continue;
+        double duration = SHMEM_READ_CAST(double, ev, SHMEM_TRACE_EVENT_DURATION);
+        fprintf(dump->fp, "%s\n{\"name\":", dump->n_events ? "," : "");
+        json_write_string(dump->fp, ev + SHMEM_TRACE_EVENT_NAME);
+        fprintf(dump->fp, ",\"cat\":\"shared_matrix\",\"ts\":%.3f,\"pid\":%llu,\"tid\":%llu,",
+                SHMEM_READ_CAST(double, ev, SHMEM_TRACE_EVENT_TIME) * 1e6, pid, SHMEM_READ_CAST(unsigned long long, ev, SHMEM_TRACE_EVENT_TID));
+        if (duration < 0)
+            fprintf(dump->fp, "\"ph\":\"i\",\"s\":\"t\"");
+        else
+            fprintf(dump->fp, "\"ph\":\"X\",\"dur\":%.3f", duration * 1e6);
+        fprintf(dump->fp, ",\"args\":{\"bytes\":%llu}}", SHMEM_READ_CAST(unsigned long long, ev, SHMEM_TRACE_EVENT_ARG));
+        dump->n_events++;
+    }
+}
+
+// discards the events of a ring, the ring of an exited process is removed
+static void trace_clear_ring(const char* name, char* ring, unsigned long long pid, unsigned long long pid_start, void* arg) {
+    (void)arg;
+    if (shmem_process_alive(pid, pid_start) == 0)
+        shm_unlink(name);
+    else
+        _shmem_trace_store(ring + SHMEM_TRACE_CLEARED, _shmem_trace_load(ring + SHMEM_TRACE_NEXT));
+}
+#endif
+
+// input arg [1]: command
+//   'enable' / 'disable': sets / clears the environment variable SHMEM_TRACE of the calling process, the following calls
+//                         of all MEX functions of the process record events (run it on workers by parfevalOnAll)
+//   'dump': writes the events of all processes into input arg [2] (file name) as a Chrome trace (JSON, loaded by
+//           chrome://tracing or ui.perfetto.dev), ts / dur are in microseconds of a monotonic clock
+//   'clear': discards the events recorded so far, the rings of exited processes are removed
+// output arg [1]: (optional) 'enable' / 'disable': whether tracing was enabled before, 'dump': number of events written
+// every process keeps its last SHMEM_TRACE_EVENTS events in /dev/shm (POSIX API only), see shmem_trace.h
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("shared_matrix_trace");
+    MATLAB_PRHS_PTR_CHECK_RANGE(1, 2);
+    if (nlhs > 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidOutput", "Too many output, max output: 1");
+    char command[16];
+    if (!mxIsChar(prhs[0]) || mxGetString(prhs[0], command, sizeof(command)))
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [1]: command");
+#if SHMEM_API == SHMEM_WIN_API
+    (void)nlhs; (void)plhs; (void)nrhs;
+    mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Event tracing is not supported by WIN API");
+#elif SHMEM_API == SHMEM_POSIX_API
+    if (strcmp(command, "enable") == 0 || strcmp(command, "disable") == 0) {
+        int was_enabled = shmem_trace_env_enabled();
+        if (command[0] == 'e')
+            setenv(SHMEM_TRACE_ENV, "1", 1);
+        else
+            unsetenv(SHMEM_TRACE_ENV);
+        shmem_trace_mex("shared_matrix_trace");
+        if (nlhs > 0)
+            plhs[0] = mxCreateLogicalScalar(was_enabled);
+    }
+    else if (strcmp(command, "dump") == 0) {
+        char path[MAX_SHMEM_NAME_LENGTH];
+        if (nrhs < 2 || !mxIsChar(prhs[1]) || mxGetString(prhs[1], path, sizeof(path)))
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Could not get input arg [2]: output file name");
+        trace_dump_t dump = { NULL, 0 };
+        dump.fp = fopen(path, "w");
+        if (dump.fp == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "Could not open file %s for writing: %d", path, errno);
+        fprintf(dump.fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        shmem_trace_ring_scan(0, trace_dump_ring, &dump);
+        fprintf(dump.fp, "\n]}\n");
+        if (fclose(dump.fp) != 0)
+            mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "Failed to write file %s: %d", path, errno);
+        if (nlhs > 0)
+            plhs[0] = mxCreateDoubleScalar((double)dump.n_events);
+    }
+    else if (strcmp(command, "clear") == 0) {
+        shmem_trace_ring_scan(1, trace_clear_ring, NULL);
+    }
+    else {
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Unknown command: %s", command);
+    }
+#endif
+}
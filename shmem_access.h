@@ -0,0 +1,250 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Attach modes: access protection, page population and access pattern hints of a mapped segment
+ *
+ * Populating pages ahead of the computation moves the page fault cost out of it. "map" lets the kernel populate the
+ * page tables (MAP_POPULATE when the segment is mapped, MADV_POPULATE_READ / WRITE on an existing mapping), "parallel"
+ * touches one byte of every page using multiple threads. Both only read the memory.
+ *
+ * Mode "private" maps the segment copy-on-write (MAP_PRIVATE / FILE_MAP_COPY): pages are shared with the segment until
+ * the process writes them, a written page is copied into private memory of the process and changes are never seen by
+ * other processes. Pages are only populated for reading in this mode, MAP_POPULATE and mlock would copy every page of
+ * a writable private mapping.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_ACCESS_H_
+#define _SHARED_MATRIX_SHMEM_ACCESS_H_
+
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_thread.h"
+
+#define SHMEM_ATTACH_READWRITE 0
+#define SHMEM_ATTACH_READONLY  1
+#define SHMEM_ATTACH_PRIVATE   2
+
+#define SHMEM_POPULATE_NONE     0
+#define SHMEM_POPULATE_MAP      1
+#define SHMEM_POPULATE_PARALLEL 2
+
+#define SHMEM_ADVICE_NORMAL     0
+#define SHMEM_ADVICE_SEQUENTIAL 1
+#define SHMEM_ADVICE_RANDOM     2
+#define SHMEM_ADVICE_WILLNEED   3
+
+static const char* const shmem_attach_mode_names[] = { "readwrite", "readonly", "private" };
+static const char* const shmem_populate_names[] = { "none", "map", "parallel" };
+static const char* const shmem_advice_names[] = { "normal", "sequential", "random", "willneed" };
+
+// index of str in names, -1 if not found
+static inline int shmem_parse_enum(const char* str, const char* const* names, int n_names) {
+    for (int i = 0; i < n_names; i++)
+        if (strcmp(str, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+typedef struct {
+    char* ptr;
+    unsigned long long size;
+} shmem_range_t;
+
+// number of columns of the matrix (product of all dimensions except the first one)
+static inline unsigned long long shmem_header_columns(const shmem_header_t* hdr) {
+    unsigned long long n = 1;
+    for (unsigned int i = 1; i < hdr->n_dims; i++)
+        n *= shmem_header_dim(hdr, i);
+    return n;
+}
+
+/*
+ * Memory ranges of the matrix holding columns [col_begin, col_end) (0-based), all dimensions after the first one are
+ * treated as columns. The whole segment (including header) is returned if col_end is 0, up to the last committed column
+ * for an appendable matrix.
+ * returns number of ranges (at most 3: data, ir and jc for sparse matrix)
+ */
+static inline int shmem_column_ranges(const shmem_header_t* hdr, char* base_ptr, unsigned long long col_begin, unsigned long long col_end, shmem_range_t* ranges) {
+    if (col_end == 0) {
+        ranges[0].ptr = base_ptr;
+        // only the committed columns of an appendable matrix are backed by the segment
+        ranges[0].size = (hdr->array_attribute & ARRAY_APPEND) ? shmem_column_offset(hdr, shmem_header_columns(hdr)) : hdr->total_size;
+        return 1;
+    }
+    char* payload_ptr = base_ptr + hdr->header_size;
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(hdr->nzmax, hdr->data_size, &ofs_ir, &ofs_jc);
+        mwIndex* jc = (mwIndex*)(payload_ptr + ofs_jc + ARRAY_HEADER_SIZE);
+        unsigned long long nz_begin = jc[col_begin], nz_end = jc[col_end];
+        ranges[0].ptr = payload_ptr + ARRAY_HEADER_SIZE + nz_begin * hdr->data_size;
+        ranges[0].size = (nz_end - nz_begin) * hdr->data_size;
+        ranges[1].ptr = payload_ptr + ofs_ir + ARRAY_HEADER_SIZE + nz_begin * sizeof(mwIndex);
+        ranges[1].size = (nz_end - nz_begin) * sizeof(mwIndex);
+        ranges[2].ptr = (char*)(jc + col_begin);
+        ranges[2].size = (col_end - col_begin + 1) * sizeof(mwIndex);
+        return 3;
+    }
+    unsigned long long col_bytes = shmem_header_dim(hdr, 0) * hdr->data_size;
+    ranges[0].ptr = payload_ptr + ARRAY_HEADER_SIZE + col_begin * col_bytes;
+    ranges[0].size = (col_end - col_begin) * col_bytes;
+    return 1;
+}
+
+// expand range to page boundaries
+static inline shmem_range_t shmem_range_page_align(shmem_range_t range, unsigned long long page) {
+    unsigned long long begin = (unsigned long long)(size_t)range.ptr / page * page;
+    unsigned long long end = INT_CEIL((unsigned long long)(size_t)range.ptr + range.size, page) * page;
+    range.ptr = (char*)(size_t)begin;
+    range.size = end - begin;
+    return range;
+}
+
+// apply access pattern hint to ranges, not available for WIN API (returns -1)
+static inline int shmem_advise(const shmem_range_t* ranges, int n_ranges, int advice, unsigned long long page) {
+#if SHMEM_API == SHMEM_POSIX_API
+    int native_advice = MADV_NORMAL;
+    if (advice == SHMEM_ADVICE_SEQUENTIAL) native_advice = MADV_SEQUENTIAL;
+    else if (advice == SHMEM_ADVICE_RANDOM) native_advice = MADV_RANDOM;
+    else if (advice == SHMEM_ADVICE_WILLNEED) native_advice = MADV_WILLNEED;
+    int ret = 0;
+    for (int i = 0; i < n_ranges; i++) {
+        if (ranges[i].size == 0) continue;
+        shmem_range_t r = shmem_range_page_align(ranges[i], page);
+        SHMEM_DEBUG_OUTPUT("API call: madvise (%d)\n", native_advice);
+        if (madvise(r.ptr, (size_t)r.size, native_advice) != 0)
+            ret = -1;
+    }
+    return ret;
+#else
+    (void)ranges; (void)n_ranges; (void)advice; (void)page;
+    return -1;
+#endif
+}
+
+// let the kernel populate page tables of an existing mapping, returns -1 if it is unsupported
+static inline int shmem_populate_map(const shmem_range_t* ranges, int n_ranges, int readonly, unsigned long long page) {
+#if SHMEM_API == SHMEM_POSIX_API && defined(MADV_POPULATE_READ) && defined(MADV_POPULATE_WRITE)
+    for (int i = 0; i < n_ranges; i++) {
+        if (ranges[i].size == 0) continue;
+        shmem_range_t r = shmem_range_page_align(ranges[i], page);
+        SHMEM_DEBUG_OUTPUT("API call: madvise (MADV_POPULATE)\n");
+        // populating writable page tables does not modify the data, it saves the write protection faults later
+        if (madvise(r.ptr, (size_t)r.size, readonly ? MADV_POPULATE_READ : MADV_POPULATE_WRITE) != 0)
+            return -1;
+    }
+    return 0;
+#else
+    (void)ranges; (void)n_ranges; (void)readonly; (void)page;
+    return -1;
+#endif
+}
+
+/*
+ * Bytes of [ptr, ptr + size) copied into private memory of this process (written pages of a private mapping), read
+ * from /proc/self/smaps (Linux only), *page_size is set to the page size of the mapping
+ * returns -1 if unknown
+ */
+static inline long long shmem_private_bytes(const void* ptr, unsigned long long size, unsigned long long* page_size) {
+#if defined(__linux__)
+    FILE* smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL)
+        return -1;
+    unsigned long long begin = (unsigned long long)(size_t)ptr, end = begin + size;
+    long long bytes = 0;
+    int inside = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long long lo, hi, kb;
+        // a mapping starts with its address range, fields start with their name
+        if (sscanf(line, "%llx-%llx ", &lo, &hi) == 2) {
+            inside = lo < end && hi > begin;
+            continue;
+        }
+        if (!inside)
+            continue;
+        // copied pages are anonymous pages of the file mapping (private huge pages of hugetlbfs)
+        if (sscanf(line, "Anonymous: %llu kB", &kb) == 1 || sscanf(line, "Private_Hugetlb: %llu kB", &kb) == 1)
+            bytes += (long long)(kb << 10);
+        else if (sscanf(line, "KernelPageSize: %llu kB", &kb) == 1)
+            *page_size = kb << 10;
+    }
+    fclose(smaps);
+    return bytes;
+#else
+    (void)ptr; (void)size; (void)page_size;
+    return -1;
+#endif
+}
+
+typedef struct {
+    const shmem_range_t* ranges;
+    int n_ranges;
+    unsigned long long begin; // page index range in the concatenated page list of all ranges
+    unsigned long long end;
+    unsigned long long page;
+} _shmem_prefault_worker_t;
+
+static void _shmem_prefault_worker(void* arg) {
+    _shmem_prefault_worker_t* w = (_shmem_prefault_worker_t*)arg;
+    unsigned long long range_begin = 0;
+    volatile char sink = 0;
+    for (int i = 0; i < w->n_ranges && range_begin < w->end; i++) {
+        shmem_range_t r = shmem_range_page_align(w->ranges[i], w->page);
+        unsigned long long range_end = range_begin + r.size / w->page;
+        unsigned long long lo = w->begin > range_begin ? w->begin : range_begin;
+        unsigned long long hi = w->end < range_end ? w->end : range_end;
+        for (unsigned long long p = lo; p < hi; p++)
+            sink ^= *(volatile const char*)(r.ptr + (p - range_begin) * w->page);
+        range_begin = range_end;
+    }
+    (void)sink;
+}
+
+/*
+ * Touch every page of ranges using multiple threads (n_threads <= 0: determined by size and number of CPUs)
+ * returns number of bytes populated, the number of threads used is written to out_threads (optional)
+ */
+static inline unsigned long long shmem_parallel_prefault(const shmem_range_t* ranges, int n_ranges, int n_threads, unsigned long long page, int* out_threads) {
+    unsigned long long n_pages = 0;
+    for (int i = 0; i < n_ranges; i++)
+        if (ranges[i].size > 0)
+            n_pages += shmem_range_page_align(ranges[i], page).size / page;
+    unsigned long long max_threads_by_size = n_pages * page / SHMEM_PREFAULT_MIN_BYTES_PER_THREAD;
+    if (n_threads <= 0) {
+        n_threads = shmem_cpu_count();
+        if (n_threads > SHMEM_COPY_MAX_AUTO_THREADS) n_threads = SHMEM_COPY_MAX_AUTO_THREADS;
+    }
+    if ((unsigned long long)n_threads > max_threads_by_size)
+        n_threads = max_threads_by_size > 0 ? (int)max_threads_by_size : 1;
+
+    _shmem_prefault_worker_t static_workers[MAX_STATIC_ALLOCATED_THREADS];
+    _shmem_prefault_worker_t* workers = static_workers;
+    if (n_threads > MAX_STATIC_ALLOCATED_THREADS) {
+        workers = (_shmem_prefault_worker_t*)malloc(sizeof(_shmem_prefault_worker_t) * n_threads);
+        if (workers == NULL) {
+            workers = static_workers;
+            n_threads = 1;
+        }
+    }
+    SHMEM_DEBUG_OUTPUT("Parallel prefault: %lld pages, %d threads\n", n_pages, n_threads);
+    for (int i = 0; i < n_threads; i++) {
+        workers[i].ranges = ranges;
+        workers[i].n_ranges = n_ranges;
+        workers[i].begin = n_pages * i / n_threads;
+        workers[i].end = n_pages * (i + 1) / n_threads;
+        workers[i].page = page;
+    }
+    shmem_parallel_run(n_threads, _shmem_prefault_worker, workers, sizeof(_shmem_prefault_worker_t));
+    if (workers != static_workers)
+        free(workers);
+    if (out_threads)
+        *out_threads = n_threads;
+    return n_pages * page;
+}
+
+#endif
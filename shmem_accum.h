@@ -0,0 +1,496 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Shared accumulators (allocate_shared_matrix with Accumulate set, accumulate_shared_matrix)
+ *
+ * Workers add their results into a dense numeric matrix in shared memory instead of returning them to the client.
+ * An addition goes either
+ *   "atomic": straight into the matrix by lock-free atomic additions (compare-and-swap loops for double / single,
+ *             native atomic additions for integers), or
+ *   "stripe": into a private stripe of the process (a zero-initialized copy of the matrix after the payload) by plain
+ *             additions, the stripes are added to the matrix by a merge once all workers are done.
+ * Atomic additions cost nothing in memory but serialize processes updating the same cache lines, stripes scale with
+ * the number of processes but cost a copy of the matrix for each of them (pages of a stripe are allocated when they
+ * are first written) and a merge. Strategy "auto" uses atomic additions until the contention observed by them is high,
+ * i.e. CAS_RETRIES exceeds 1 / SHMEM_ACCUM_RETRY_RATIO of ATOMIC_ELEMENTS, or SHMEM_ACCUM_STRIPE_ADDERS processes are
+ * adding atomically at once, then a process claims a stripe and keeps it until the next merge (atomic additions are
+ * kept if no stripe is free).
+ *
+ * The merge sums the dirty stripes in blocks of SHMEM_ACCUM_MERGE_BLOCK_BYTES split among threads, the stripes of a
+ * block are summed pairwise (a tree of log2(N_STRIPES) levels) and the root is added to the matrix. Merged stripes are
+ * zeroed (their pages are released on Linux) and their owners dropped. It must not run concurrently with additions.
+ * Integer additions wrap around on overflow instead of saturating.
+ *
+ * ACCUMULATOR block, after the payload of a dense matrix with ARRAY_ACCUMULATE set (starts at a multiple of
+ * SHMEM_BUNDLE_ALIGN_BYTES relative to the matrix header, included in PAYLOAD_SIZE):
+ * (uint64) N_STRIPES, number of stripes
+ * (uint64) STRIPE_BYTES, size of a stripe (the size of ARRAY_DATA padded to the page size of the segment)
+ * (uint64) STRIPE_OFFSET, offset of the first stripe relative to the matrix header (a multiple of the page size)
+ * (padded to SHMEM_STATS_LINE_BYTES)
+ * (uint64) ATOMIC_ELEMENTS, elements added atomically since creation
+ * (uint64) CAS_RETRIES, failed compare-and-swap of atomic additions since creation
+ * (uint64) STRIPE_ELEMENTS, elements added to stripes since creation
+ * (uint64) MERGES, merges since creation
+ * (padded to SHMEM_STATS_LINE_BYTES)
+ * (int64) ADDERS, processes currently adding atomically
+ * (padded to SHMEM_STATS_LINE_BYTES)
+ * STRIPE_TABLE, one line of SHMEM_STATS_LINE_BYTES for each stripe: (uint64) OWNER_PID, 0 for a free stripe,
+ *     (uint64) OWNER_START, start time of the owner (see shmem_process_start_time), (uint64) DIRTY, non-zero if the
+ *     stripe holds additions which are not merged
+ * (padded to page size)
+ * (byte*STRIPE_BYTES*N_STRIPES) STRIPES, same layout as ARRAY_DATA
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_ACCUM_H_
+#define _SHARED_MATRIX_SHMEM_ACCUM_H_
+
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+#include "shmem_codec.h"
+
+// offsets of the fields relative to ACCUMULATOR
+#define SHMEM_ACCUM_N_STRIPES       0
+#define SHMEM_ACCUM_STRIPE_BYTES    8
+#define SHMEM_ACCUM_STRIPE_OFFSET   16
+#define SHMEM_ACCUM_ATOMIC_ELEMENTS (1 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_ACCUM_CAS_RETRIES     (1 * SHMEM_STATS_LINE_BYTES + 8)
+#define SHMEM_ACCUM_STRIPE_ELEMENTS (1 * SHMEM_STATS_LINE_BYTES + 16)
+#define SHMEM_ACCUM_MERGES          (1 * SHMEM_STATS_LINE_BYTES + 24)
+#define SHMEM_ACCUM_ADDERS          (2 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_ACCUM_TABLE           (3 * SHMEM_STATS_LINE_BYTES)
+// offsets relative to an entry of STRIPE_TABLE
+#define SHMEM_ACCUM_OWNER_PID   0
+#define SHMEM_ACCUM_OWNER_START 8
+#define SHMEM_ACCUM_DIRTY       16
+
+#define SHMEM_ACCUM_AUTO   0
+#define SHMEM_ACCUM_ATOMIC 1
+#define SHMEM_ACCUM_STRIPE 2
+
+static inline int shmem_accum_from_name(const char* name) {
+    static const char* names[] = { "auto", "atomic", "stripe" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+static inline const char* shmem_accum_name(int strategy) {
+    static const char* names[] = { "auto", "atomic", "stripe" };
+    return strategy >= 0 && strategy < (int)(sizeof(names) / sizeof(names[0])) ? names[strategy] : "unknown";
+}
+
+// class which supports accumulation (numeric classes, real or complex)
+static inline int shmem_accum_supported(int data_class) {
+    return data_class != mxLOGICAL_CLASS && data_class != mxCHAR_CLASS && shmem_class_size(data_class) > 0;
+}
+
+// offset of ACCUMULATOR relative to the matrix header, data_bytes is the size of ARRAY_DATA
+static inline unsigned long long shmem_accum_offset(unsigned long long header_size, unsigned long long data_bytes) {
+    return shmem_bundle_block_size(header_size, ARRAY_HEADER_SIZE + data_bytes);
+}
+
+/*
+ * Sizes of the stripes of a new accumulator with n_stripes stripes of data_bytes bytes each, page is the page size of
+ * the segment (a power of 2), *payload_size is set to PAYLOAD_SIZE including ACCUMULATOR and STRIPES
+ */
+static inline void shmem_accum_sizes(unsigned long long header_size, unsigned long long data_bytes, unsigned long long n_stripes, unsigned long long page,
+                                     unsigned long long* stripe_bytes, unsigned long long* stripe_offset, unsigned long long* payload_size) {
+    unsigned long long table_end = shmem_accum_offset(header_size, data_bytes) + SHMEM_ACCUM_TABLE + n_stripes * SHMEM_STATS_LINE_BYTES;
+    *stripe_bytes = data_bytes > 0 ? INT_CEIL(data_bytes, page) * page : 0;
+    *stripe_offset = INT_CEIL(table_end, page) * page;
+    *payload_size = *stripe_offset + n_stripes * *stripe_bytes - header_size;
+}
+
+// write ACCUMULATOR of a new (zero-initialized) accumulator mapped at ptr
+static inline void shmem_accum_init(void* ptr, unsigned long long accum_offset, unsigned long long n_stripes, unsigned long long stripe_bytes,
+                                    unsigned long long stripe_offset) {
+    char* accum = ((char*)ptr) + accum_offset;
+    SHMEM_WRITE_CAST(unsigned long long, accum, SHMEM_ACCUM_N_STRIPES, n_stripes);
+    SHMEM_WRITE_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_BYTES, stripe_bytes);
+    SHMEM_WRITE_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_OFFSET, stripe_offset);
+}
+
+// ACCUMULATOR of a parsed header mapped at ptr, NULL if ARRAY_ACCUMULATE is not set or the block is corrupted
+static inline char* shmem_accum_ptr(const shmem_header_t* hdr, void* ptr) {
+    if (!(hdr->array_attribute & ARRAY_ACCUMULATE) || (hdr->array_attribute & ARRAY_SPARSE) || shmem_is_bundle(hdr->matrix_type))
+        return NULL;
+    unsigned long long data_bytes = hdr->data_size;
+    for (unsigned int i = 0; i < hdr->n_dims; i++)
+        data_bytes *= shmem_header_dim(hdr, i);
+    unsigned long long accum_offset = shmem_accum_offset(hdr->header_size, data_bytes);
+    if (accum_offset + SHMEM_ACCUM_TABLE > hdr->total_size)
+        return NULL;
+    char* accum = ((char*)ptr) + accum_offset;
+    unsigned long long n_stripes = SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_N_STRIPES);
+    unsigned long long stripe_bytes = SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_BYTES);
+    unsigned long long stripe_offset = SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_OFFSET);
+    // checked one by one against overflow
+    if (n_stripes > SHMEM_ACCUM_MAX_STRIPES || stripe_bytes < data_bytes || stripe_offset < accum_offset + SHMEM_ACCUM_TABLE + n_stripes * SHMEM_STATS_LINE_BYTES ||
+        stripe_offset > hdr->total_size || (stripe_bytes > 0 && n_stripes > (hdr->total_size - stripe_offset) / stripe_bytes))
+        return NULL;
+    return accum;
+}
+
+static inline unsigned long long shmem_accum_n_stripes(const char* accum) {
+    return SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_N_STRIPES);
+}
+
+// data of stripe i, ptr is the matrix header
+static inline char* shmem_accum_stripe(const char* accum, void* ptr, unsigned long long i) {
+    return ((char*)ptr) + SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_OFFSET) + i * SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_BYTES);
+}
+
+static inline char* _shmem_accum_entry(char* accum, unsigned long long i) {
+    return accum + SHMEM_ACCUM_TABLE + i * SHMEM_STATS_LINE_BYTES;
+}
+
+// compare and swap of a 64-bit word shared by processes, *expected is updated to the current value on failure
+static inline int _shmem_accum_cas64(char* ptr, unsigned long long* expected, unsigned long long desired) {
+#ifdef _MSC_VER
+    unsigned long long actual = (unsigned long long)InterlockedCompareExchange64((volatile LONG64*)ptr, (LONG64)desired, (LONG64)*expected);
+    int swapped = actual == *expected;
+    *expected = actual;
+    return swapped;
+#else
+    return __atomic_compare_exchange_n((volatile unsigned long long*)ptr, expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline unsigned long long shmem_accum_current_pid(void) {
+#if SHMEM_API == SHMEM_WIN_API
+    return GetCurrentProcessId();
+#elif SHMEM_API == SHMEM_POSIX_API
+    return (unsigned long long)getpid();
+#endif
+}
+
+/*
+ * Stripe owned by the calling process (pid started at start_time), a free stripe or the stripe of an exited process is
+ * claimed if the process owns none and claim is set
+ * returns the stripe index, -1 if the process owns no stripe (and none could be claimed)
+ */
+static inline long long shmem_accum_stripe_owned(char* accum, unsigned long long pid, unsigned long long start_time, int claim) {
+    unsigned long long n_stripes = shmem_accum_n_stripes(accum);
+    for (unsigned long long i = 0; i < n_stripes; i++) {
+        char* entry = _shmem_accum_entry(accum, i);
+        if (shmem_sync_load(entry + SHMEM_ACCUM_OWNER_PID) == pid && SHMEM_READ_CAST(unsigned long long, entry, SHMEM_ACCUM_OWNER_START) == start_time)
+            return (long long)i;
+    }
+    for (unsigned long long i = 0; claim && i < n_stripes; i++) {
+        char* entry = _shmem_accum_entry(accum, i);
+        unsigned long long owner = shmem_sync_load(entry + SHMEM_ACCUM_OWNER_PID);
+        // the additions of an exited owner are kept, they are merged together with those of the new owner
+        if (owner != 0 && shmem_process_alive(owner, SHMEM_READ_CAST(unsigned long long, entry, SHMEM_ACCUM_OWNER_START)) != 0)
+            continue;
+        if (_shmem_accum_cas64(entry + SHMEM_ACCUM_OWNER_PID, &owner, pid)) {
+            SHMEM_WRITE_CAST(unsigned long long, entry, SHMEM_ACCUM_OWNER_START, start_time);
+            return (long long)i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Strategy of an addition with strategy "auto" by a process which owns no stripe, adders is the number of processes
+ * adding atomically including the caller
+ */
+static inline int shmem_accum_choose(const char* accum, long long adders) {
+    if (shmem_accum_n_stripes(accum) == 0)
+        return SHMEM_ACCUM_ATOMIC;
+    unsigned long long elements = shmem_sync_load(accum + SHMEM_ACCUM_ATOMIC_ELEMENTS);
+    unsigned long long retries = shmem_sync_load(accum + SHMEM_ACCUM_CAS_RETRIES);
+    if (adders >= SHMEM_ACCUM_STRIPE_ADDERS || (retries > 0 && retries >= elements / SHMEM_ACCUM_RETRY_RATIO))
+        return SHMEM_ACCUM_STRIPE;
+    return SHMEM_ACCUM_ATOMIC;
+}
+
+// atomic additions of n elements of src to dst, returns the number of failed compare-and-swap
+static inline unsigned long long _shmem_accum_atomic_double(double* dst, const double* src, unsigned long long n) {
+    unsigned long long retries = 0;
+    for (unsigned long long i = 0; i < n; i++) {
+        if (src[i] == 0)
+            continue;
+        volatile long long* word = (volatile long long*)(dst + i);
+        long long expected = *word, desired;
+        for (;;) {
+            double value;
+            memcpy(&value, &expected, 8);
+            value += src[i];
+            memcpy(&desired, &value, 8);
+#ifdef _MSC_VER
+            long long actual = InterlockedCompareExchange64((volatile LONG64*)word, desired, expected);
+            if (actual == expected)
+                break;
+            expected = actual;
+#else
+            if (__atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+#endif
+            retries++;
+        }
+    }
+    return retries;
+}
+
+static inline unsigned long long _shmem_accum_atomic_single(float* dst, const float* src, unsigned long long n) {
+    unsigned long long retries = 0;
+    for (unsigned long long i = 0; i < n; i++) {
+        if (src[i] == 0)
+            continue;
+#ifdef _MSC_VER
+        volatile LONG* word = (volatile LONG*)(dst + i);
+        LONG expected = *word, desired;
+#else
+        volatile int* word = (volatile int*)(dst + i);
+        int expected = *word, desired;
+#endif
+        for (;;) {
+            float value;
+            memcpy(&value, &expected, 4);
+            value += src[i];
+            memcpy(&desired, &value, 4);
+#ifdef _MSC_VER
+            LONG actual = InterlockedCompareExchange(word, desired, expected);
+            if (actual == expected)
+                break;
+            expected = actual;
+#else
+            if (__atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+#endif
+            retries++;
+        }
+    }
+    return retries;
+}
+
+#ifdef _MSC_VER
+#    define _SHMEM_ACCUM_FETCH_ADD(T, p, v)                                                                  \
+        (sizeof(T) == 1 ? (void)_InterlockedExchangeAdd8((volatile char*)(p), (char)(v))                   \
+         : sizeof(T) == 2 ? (void)_InterlockedExchangeAdd16((volatile short*)(p), (short)(v))              \
+         : sizeof(T) == 4 ? (void)InterlockedExchangeAdd((volatile LONG*)(p), (LONG)(v))                   \
+                          : (void)InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v)))
+#else
+#    define _SHMEM_ACCUM_FETCH_ADD(T, p, v) (void)__atomic_fetch_add((volatile T*)(p), (T)(v), __ATOMIC_RELAXED)
+#endif
+
+#define _SHMEM_ACCUM_ATOMIC_INT(T, dst, src, n)         \
+    do {                                                \
+        T* d = (T*)(dst);                               \
+        const T* s = (const T*)(src);                   \
+        for (unsigned long long i = 0; i < (n); i++)    \
+            if (s[i] != 0)                              \
+                _SHMEM_ACCUM_FETCH_ADD(T, d + i, s[i]); \
+    } while (0)
+
+#define _SHMEM_ACCUM_PLAIN(T, dst, src, n)           \
+    do {                                             \
+        T* d = (T*)(dst);                            \
+        const T* s = (const T*)(src);                \
+        for (unsigned long long i = 0; i < (n); i++) \
+            d[i] = (T)(d[i] + s[i]);                 \
+    } while (0)
+
+/*
+ * Add n elements (of class data_class, real and imaginary parts are separate elements) of src to dst, atomically if
+ * atomic is set, returns the number of failed compare-and-swap
+ */
+static inline unsigned long long shmem_accum_add(int data_class, char* dst, const char* src, unsigned long long n, int atomic) {
+    switch (data_class) {
+    case mxDOUBLE_CLASS:
+        if (atomic)
+            return _shmem_accum_atomic_double((double*)dst, (const double*)src, n);
+        _SHMEM_ACCUM_PLAIN(double, dst, src, n);
+        break;
+    case mxSINGLE_CLASS:
+        if (atomic)
+            return _shmem_accum_atomic_single((float*)dst, (const float*)src, n);
+        _SHMEM_ACCUM_PLAIN(float, dst, src, n);
+        break;
+#define _SHMEM_ACCUM_INT_CASE(cls, T)                  \
+    case cls:                                          \
+        if (atomic)                                    \
+            _SHMEM_ACCUM_ATOMIC_INT(T, dst, src, n);   \
+        else                                           \
+            _SHMEM_ACCUM_PLAIN(T, dst, src, n);        \
+        break;
+    _SHMEM_ACCUM_INT_CASE(mxINT8_CLASS, signed char)
+    _SHMEM_ACCUM_INT_CASE(mxUINT8_CLASS, unsigned char)
+    _SHMEM_ACCUM_INT_CASE(mxINT16_CLASS, short)
+    _SHMEM_ACCUM_INT_CASE(mxUINT16_CLASS, unsigned short)
+    _SHMEM_ACCUM_INT_CASE(mxINT32_CLASS, int)
+    _SHMEM_ACCUM_INT_CASE(mxUINT32_CLASS, unsigned int)
+    _SHMEM_ACCUM_INT_CASE(mxINT64_CLASS, long long)
+    _SHMEM_ACCUM_INT_CASE(mxUINT64_CLASS, unsigned long long)
+#undef _SHMEM_ACCUM_INT_CASE
+    default:
+        break;
+    }
+    return 0;
+}
+
+typedef struct {
+    int data_class;
+    int elem_size;
+    int atomic;
+    char* dst;
+    const char* src;
+    unsigned long long begin, end; // elements
+    unsigned long long retries;
+} _shmem_accum_worker_t;
+
+static void _shmem_accum_worker(void* arg) {
+    _shmem_accum_worker_t* w = (_shmem_accum_worker_t*)arg;
+    w->retries = shmem_accum_add(w->data_class, w->dst + w->begin * w->elem_size, w->src + w->begin * w->elem_size, w->end - w->begin, w->atomic);
+}
+
+/*
+ * Add n elements of src to dst using multiple threads (ranges of threads are multiples of a cache line), *retries is
+ * set to the number of failed compare-and-swap
+ * returns number of threads used, 0 if memory could not be allocated
+ */
+static inline int shmem_parallel_accumulate(int data_class, char* dst, const char* src, unsigned long long n, int atomic, int n_threads,
+                                            unsigned long long* retries) {
+    int elem_size = shmem_class_size(data_class);
+    unsigned long long line = SHMEM_STATS_LINE_BYTES / elem_size;
+    n_threads = _shmem_codec_threads(n * elem_size, n_threads);
+    if ((unsigned long long)n_threads > n / line + 1)
+        n_threads = (int)(n / line + 1);
+    _shmem_accum_worker_t* workers = (_shmem_accum_worker_t*)calloc(n_threads, sizeof(_shmem_accum_worker_t));
+    if (workers == NULL)
+        return 0;
+    for (int i = 0; i < n_threads; i++) {
+        _shmem_accum_worker_t* w = &workers[i];
+        w->data_class = data_class;
+        w->elem_size = elem_size;
+        w->atomic = atomic;
+        w->dst = dst;
+        w->src = src;
+        w->begin = i == 0 ? 0 : n / line * i / n_threads * line;
+        w->end = i == n_threads - 1 ? n : n / line * (i + 1) / n_threads * line;
+    }
+    shmem_parallel_run(n_threads, _shmem_accum_worker, workers, sizeof(_shmem_accum_worker_t));
+    *retries = 0;
+    for (int i = 0; i < n_threads; i++)
+        *retries += workers[i].retries;
+    free(workers);
+    return n_threads;
+}
+
+typedef struct {
+    int data_class;
+    int elem_size;
+    char* dst;
+    char** stripes;
+    int n_stripes;
+    int zero;
+    unsigned long long begin, end; // blocks
+    unsigned long long n; // elements of the matrix
+} _shmem_accum_merge_worker_t;
+
+static void _shmem_accum_merge_worker(void* arg) {
+    _shmem_accum_merge_worker_t* w = (_shmem_accum_merge_worker_t*)arg;
+    unsigned long long block = SHMEM_ACCUM_MERGE_BLOCK_BYTES / w->elem_size;
+    for (unsigned long long b = w->begin; b < w->end; b++) {
+        unsigned long long first = b * block;
+        unsigned long long count = first + block < w->n ? block : w->n - first;
+        unsigned long long ofs = first * w->elem_size;
+        if (w->zero) {
+            for (int i = 0; i < w->n_stripes; i++)
+                memset(w->stripes[i] + ofs, 0, count * w->elem_size);
+            continue;
+        }
+        // pairwise: stripe i += stripe i + step, the sum ends up in the first stripe
+        for (int step = 1; step < w->n_stripes; step *= 2)
+            for (int i = 0; i + step < w->n_stripes; i += 2 * step)
+                shmem_accum_add(w->data_class, w->stripes[i] + ofs, w->stripes[i + step] + ofs, count, 0);
+        shmem_accum_add(w->data_class, w->dst + ofs, w->stripes[0] + ofs, count, 0);
+    }
+}
+
+// release the pages of a merged stripe (reads return zeros afterwards), returns 0 on success
+static inline int _shmem_accum_release_pages(char* stripe, unsigned long long stripe_bytes) {
+#if SHMEM_API == SHMEM_POSIX_API && defined(MADV_REMOVE)
+    if (stripe_bytes == 0)
+        return 0;
+    SHMEM_DEBUG_OUTPUT("API call: madvise (MADV_REMOVE, %lld bytes)\n", stripe_bytes);
+    return madvise(stripe, stripe_bytes, MADV_REMOVE) == 0 ? 0 : -1;
+#else
+    (void)stripe; (void)stripe_bytes;
+    return -1;
+#endif
+}
+
+/*
+ * Merge the dirty stripes of the accumulator (ACCUMULATOR at accum, matrix header at ptr) into its n elements at dst
+ * using multiple threads, the stripes are zeroed and released
+ * returns the number of merged stripes, -1 if memory could not be allocated, *n_threads is set to the threads used
+ */
+static inline long long shmem_accum_merge(char* accum, void* ptr, int data_class, char* dst, unsigned long long n, int* n_threads) {
+    unsigned long long n_stripes = shmem_accum_n_stripes(accum);
+    unsigned long long stripe_bytes = SHMEM_READ_CAST(unsigned long long, accum, SHMEM_ACCUM_STRIPE_BYTES);
+    int elem_size = shmem_class_size(data_class);
+    char* static_stripes[MAX_STATIC_ALLOCATED_THREADS];
+    char** stripes = n_stripes <= MAX_STATIC_ALLOCATED_THREADS ? static_stripes : (char**)malloc(sizeof(char*) * n_stripes);
+    if (stripes == NULL)
+        return -1;
+    int n_dirty = 0;
+    for (unsigned long long i = 0; i < n_stripes; i++)
+        if (shmem_sync_load(_shmem_accum_entry(accum, i) + SHMEM_ACCUM_DIRTY))
+            stripes[n_dirty++] = shmem_accum_stripe(accum, ptr, i);
+    *n_threads = 0;
+    unsigned long long block = SHMEM_ACCUM_MERGE_BLOCK_BYTES / elem_size;
+    unsigned long long n_blocks = n > 0 ? INT_CEIL(n, block) : 0;
+    if (n_dirty > 0 && n_blocks > 0) {
+        *n_threads = _shmem_codec_threads(n * elem_size * (n_dirty + 1ULL), *n_threads);
+        if ((unsigned long long)*n_threads > n_blocks)
+            *n_threads = (int)n_blocks;
+        _shmem_accum_merge_worker_t* workers = (_shmem_accum_merge_worker_t*)calloc(*n_threads, sizeof(_shmem_accum_merge_worker_t));
+        if (workers == NULL) {
+            if (stripes != static_stripes)
+                free(stripes);
+            return -1;
+        }
+        for (int i = 0; i < *n_threads; i++) {
+            _shmem_accum_merge_worker_t* w = &workers[i];
+            w->data_class = data_class;
+            w->elem_size = elem_size;
+            w->dst = dst;
+            w->stripes = stripes;
+            w->n_stripes = n_dirty;
+            w->begin = n_blocks * i / *n_threads;
+            w->end = n_blocks * (i + 1) / *n_threads;
+            w->n = n;
+        }
+        shmem_parallel_run(*n_threads, _shmem_accum_merge_worker, workers, sizeof(_shmem_accum_merge_worker_t));
+        // stripes are zeroed by releasing their pages, or by the threads if it is not supported
+        int zero = 0;
+        for (int i = 0; i < n_dirty && !zero; i++)
+            zero = _shmem_accum_release_pages(stripes[i], stripe_bytes) != 0;
+        if (zero) {
+            for (int i = 0; i < *n_threads; i++)
+                workers[i].zero = 1;
+            shmem_parallel_run(*n_threads, _shmem_accum_merge_worker, workers, sizeof(_shmem_accum_merge_worker_t));
+        }
+        free(workers);
+    }
+    for (unsigned long long i = 0; i < n_stripes; i++) {
+        char* entry = _shmem_accum_entry(accum, i);
+        SHMEM_WRITE_CAST(unsigned long long, entry, SHMEM_ACCUM_DIRTY, 0);
+        SHMEM_WRITE_CAST(unsigned long long, entry, SHMEM_ACCUM_OWNER_START, 0);
+        SHMEM_WRITE_CAST(unsigned long long, entry, SHMEM_ACCUM_OWNER_PID, 0);
+    }
+    shmem_sync_add(accum + SHMEM_ACCUM_MERGES, 1);
+    if (stripes != static_stripes)
+        free(stripes);
+    return n_dirty;
+}
+
+#endif
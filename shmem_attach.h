@@ -0,0 +1,197 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Zero-copy Matlab arrays over shared memory payload
+ *
+ * The returned arrays are created empty (no data buffer is allocated by Matlab), then their data pointers are set to
+ * the payload. They MUST be detached by shmem_detach_array before Matlab destroys them, otherwise Matlab frees
+ * memory it does not own.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_ATTACH_H_
+#define _SHARED_MATRIX_SHMEM_ATTACH_H_
+
+#include "compiler_def.h"
+#include "shmem_layout.h"
+
+static inline mxArray* _shmem_create_attached_array(const shmem_header_t* hdr, char* payload_ptr, const char** err_id, const char** err_msg) {
+    mwSize static_dims[MAX_STATIC_ALLOCATED_DIMS]; // pre-allocated stack space
+    mwSize* dims = (hdr->n_dims <= MAX_STATIC_ALLOCATED_DIMS) ? static_dims : (mwSize*)malloc(sizeof(mwSize) * hdr->n_dims);
+    if (dims == NULL) {
+        *err_id = "SharedMatrix:OutOfMemory";
+        *err_msg = "Malloc failed to allocate new memory";
+        return NULL;
+    }
+    for (unsigned int i = 0; i < hdr->n_dims; i++)
+        dims[i] = (mwSize)shmem_header_dim(hdr, i);
+#define SHMEM_ATTACH_FAIL(id, msg) { if (dims != static_dims) free(dims); *err_id = id; *err_msg = msg; return NULL; }
+
+    if (hdr->array_attribute & ARRAY_COMPLEX) {
+#ifndef SHMEM_COMPLEX_SUPPORTED
+        SHMEM_ATTACH_FAIL("SharedMatrix:NotSupported", "Complex array is not supported before R2018a");
+#endif
+    }
+    mxComplexity complex_flag = (hdr->array_attribute & ARRAY_COMPLEX) ? mxCOMPLEX : mxREAL;
+    mxArray* output_array = NULL;
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        // sparse array
+        if (hdr->n_dims != 2)
+            SHMEM_ATTACH_FAIL("SharedMatrix:DimensionError", "Sparse matrix only supports 2 dimensions");
+        if (hdr->matrix_type == mxDOUBLE_CLASS)
+            output_array = mxCreateSparse(0, 0, 0, complex_flag);
+        else if (hdr->matrix_type == mxLOGICAL_CLASS)
+            output_array = mxCreateSparseLogicalMatrix(0, 0, 0);
+        else
+            SHMEM_ATTACH_FAIL("SharedMatrix:DataTypeError", "Sparse matrix only supports double and logical data");
+    }
+    else if (hdr->matrix_type == mxLOGICAL_CLASS) {
+        output_array = mxCreateLogicalMatrix(0, 0);
+    }
+    else if (hdr->matrix_type == mxCHAR_CLASS) {
+        const mwSize zero_dims[] = { 0, 0 };
+        output_array = mxCreateCharArray(2, zero_dims);
+    }
+    else {
+        // raw codes for an encoded matrix (decoded by decode_shared_matrix)
+        output_array = mxCreateNumericMatrix(0, 0, (mxClassID)shmem_storage_class(hdr), complex_flag);
+    }
+    if (output_array == NULL)
+        SHMEM_ATTACH_FAIL("SharedMatrix:MatlabError", "Failed to call Matlab mex API: mxCreateNumericMatrix");
+    SHMEM_DEBUG_OUTPUT("Output mxArray created: %p\n", output_array);
+
+    // ATTACH PTR
+    char* ptr_pr = payload_ptr + ARRAY_HEADER_SIZE;
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        // an empty sparse matrix still owns small Pr / Ir / Jc buffers
+        mxSetNzmax(output_array, (mwSize)hdr->nzmax);
+        void* original_pr = mxGetData(output_array);
+        void* original_ir = mxGetIr(output_array);
+        void* original_jc = mxGetJc(output_array);
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(hdr->nzmax, hdr->data_size, &ofs_ir, &ofs_jc);
+        mxSetM(output_array, dims[0]);
+        mxSetN(output_array, dims[1]);
+        SHMEM_DEBUG_OUTPUT("Set ir: %p\n", payload_ptr + ofs_ir + ARRAY_HEADER_SIZE);
+        mxSetIr(output_array, (mwIndex*)(payload_ptr + ofs_ir + ARRAY_HEADER_SIZE));
+        SHMEM_DEBUG_OUTPUT("Set jc: %p\n", payload_ptr + ofs_jc + ARRAY_HEADER_SIZE);
+        mxSetJc(output_array, (mwIndex*)(payload_ptr + ofs_jc + ARRAY_HEADER_SIZE));
+        if (original_ir) mxFree(original_ir);
+        if (original_jc) mxFree(original_jc);
+        if (original_pr) mxFree(original_pr);
+    }
+    else {
+        mxSetDimensions(output_array, dims, hdr->n_dims);
+    }
+    SHMEM_DEBUG_OUTPUT("Set pr: %p\n", ptr_pr);
+    if (hdr->array_attribute & ARRAY_COMPLEX) {
+#ifdef SHMEM_COMPLEX_SUPPORTED
+        set_ic_ptr(output_array, (int)hdr->matrix_type, ptr_pr);
+#endif
+    }
+    else {
+        mxSetData(output_array, ptr_pr);
+    }
+    if (dims != static_dims)
+        free(dims);
+#undef SHMEM_ATTACH_FAIL
+    return output_array;
+}
+
+/*
+ * Create an array referencing the payload (payload_ptr points to the beginning of payload, i.e. ARRAY_HEADER)
+ * returns NULL on failure, err is set to the error identifier and message
+ */
+static inline mxArray* shmem_create_attached_array(const shmem_header_t* hdr, char* payload_ptr, const char** err_id, const char** err_msg) {
+    double trace_start = shmem_trace_begin();
+    mxArray* output_array = _shmem_create_attached_array(hdr, payload_ptr, err_id, err_msg);
+    shmem_trace_end("mx attach array", trace_start, 0);
+    return output_array;
+}
+
+// data pointer of an array created by shmem_create_attached_array (NULL if it is detached)
+static inline void* shmem_attached_data(const mxArray* arr) {
+    if (mxIsComplex(arr)) {
+#ifdef SHMEM_COMPLEX_SUPPORTED
+        return get_ic_ptr(arr, (int)mxGetClassID(arr));
+#else
+        return NULL;
+#endif
+    }
+    return mxGetData(arr);
+}
+
+// extend an array created by shmem_create_attached_array over a dense 2-D matrix to n_cols columns, the columns must be
+// mapped after the data of the array (see ARRAY_APPEND)
+static inline void shmem_extend_array(mxArray* arr, unsigned long long n_cols) {
+    mxSetN(arr, (mwSize)n_cols);
+}
+
+/*
+ * Detach the shared memory from array, the array becomes an empty (0x0) matrix
+ * returns 0 if the array could not be detached (complex array before R2018a)
+ */
+static inline int shmem_detach_array(mxArray* data_array) {
+    double trace_start = shmem_trace_begin();
+    // set dimension
+    const mwSize zero_dims[] = { 0, 0 };
+    mxSetDimensions(data_array, zero_dims, 2);
+
+    if (mxIsSparse(data_array)) {
+        // sparse array
+        mxSetNzmax(data_array, 0);
+        SHMEM_DEBUG_OUTPUT("CALL mxSetNzmax done\n");
+        mxSetIr(data_array, NULL);
+        SHMEM_DEBUG_OUTPUT("CALL mxSetIr done\n");
+        mxSetJc(data_array, NULL);
+        SHMEM_DEBUG_OUTPUT("CALL mxSetJc done\n");
+    }
+
+    // detach array
+    if (mxIsComplex(data_array)) {
+#ifndef SHMEM_COMPLEX_SUPPORTED
+        shmem_trace_end("mx detach array", trace_start, 0);
+        return 0;
+#else
+        set_ic_ptr(data_array, (int)mxGetClassID(data_array), NULL);
+#endif
+    }
+    else {
+        mxSetData(data_array, NULL);
+    }
+    SHMEM_DEBUG_OUTPUT("CALL mxSetPr done\n");
+    shmem_trace_end("mx detach array", trace_start, 0);
+    return 1;
+}
+
+#if ARRAY_HEADER_SIZE > 0
+// fill ARRAY_HEADER in front of every buffer of the payload of a matrix without source array, the content is taken from
+// a matlab array of the same kind (create_shared_matrix copies it from the input array)
+static inline void shmem_write_array_headers(const shmem_header_t* hdr, char* payload_ptr) {
+    mxComplexity complex_flag = (hdr->array_attribute & ARRAY_COMPLEX) ? mxCOMPLEX : mxREAL;
+    mxArray* template_array = NULL;
+    if (hdr->array_attribute & ARRAY_SPARSE)
+        template_array = hdr->matrix_type == mxLOGICAL_CLASS ? mxCreateSparseLogicalMatrix(1, 1, 1) : mxCreateSparse(1, 1, 1, complex_flag);
+    else if (hdr->matrix_type == mxLOGICAL_CLASS)
+        template_array = mxCreateLogicalMatrix(1, 1);
+    else
+        template_array = mxCreateNumericMatrix(1, 1, (mxClassID)hdr->matrix_type, complex_flag);
+    if (template_array == NULL)
+        return;
+    const char* template_pr = (const char*)shmem_attached_data(template_array);
+    if (template_pr)
+        memcpy(payload_ptr, template_pr - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(hdr->nzmax, hdr->data_size, &ofs_ir, &ofs_jc);
+        memcpy(payload_ptr + ofs_ir, ((const char*)mxGetIr(template_array)) - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+        memcpy(payload_ptr + ofs_jc, ((const char*)mxGetJc(template_array)) - ARRAY_HEADER_SIZE, ARRAY_HEADER_SIZE);
+    }
+    mxDestroyArray(template_array);
+}
+#endif
+
+#endif
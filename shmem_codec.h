@@ -0,0 +1,481 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Reduced precision encodings of dense real double / single matrices
+ *
+ * An element x is stored as the code q = (x - OFFSET) / SCALE, and decoded as x = q * SCALE + OFFSET:
+ *   single:   IEEE 754 binary32
+ *   half:     IEEE 754 binary16, rounded to nearest even, values beyond +-65504 become +-Inf
+ *   bfloat16: upper 16 bits of binary32, rounded to nearest even
+ *   int8:     signed integer in [-127, 127], rounded to nearest, clamped (NaN is stored as 0)
+ *   int16:    signed integer in [-32767, 32767], rounded to nearest, clamped (NaN is stored as 0)
+ * Integer encodings map [min, max] of the finite elements to the whole code range unless SCALE / OFFSET are given.
+ *
+ * Codes are widened by SIMD kernels selected at run time: AVX-512F (16 codes per iteration), AVX2 with F16C and FMA
+ * (8 codes per iteration) or a scalar fallback. Encoding happens once on create and is scalar.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_CODEC_H_
+#define _SHARED_MATRIX_SHMEM_CODEC_H_
+
+#include "compiler_def.h"
+#include "shmem_thread.h"
+#include <math.h>
+
+#define SHMEM_ENCODING_NONE     0
+#define SHMEM_ENCODING_SINGLE   1
+#define SHMEM_ENCODING_HALF     2
+#define SHMEM_ENCODING_BFLOAT16 3
+#define SHMEM_ENCODING_INT8     4
+#define SHMEM_ENCODING_INT16    5
+
+// decode kernels, in ascending order of preference
+#define SHMEM_CODEC_KERNEL_SCALAR 0
+#define SHMEM_CODEC_KERNEL_AVX2   1
+#define SHMEM_CODEC_KERNEL_AVX512 2
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    include <cpuid.h>
+#    define SHMEM_CODEC_X86
+#    define SHMEM_CODEC_TARGET(isa) __attribute__((target(isa)))
+#    define SHMEM_CODEC_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#    include <immintrin.h>
+#    include <intrin.h>
+#    define SHMEM_CODEC_X86
+#    define SHMEM_CODEC_TARGET(isa)
+#    define SHMEM_CODEC_INLINE static __forceinline
+#endif
+
+// encoding id of the name used by option Encoding, -1 if invalid
+static inline int shmem_encoding_from_name(const char* name) {
+    static const char* names[] = { "none", "single", "half", "bfloat16", "int8", "int16" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+// size of a code in byte, 0 if encoding is invalid
+static inline int shmem_encoding_size(unsigned long long encoding) {
+    switch (encoding) {
+    case SHMEM_ENCODING_SINGLE: return 4;
+    case SHMEM_ENCODING_HALF: case SHMEM_ENCODING_BFLOAT16: case SHMEM_ENCODING_INT16: return 2;
+    case SHMEM_ENCODING_INT8: return 1;
+    default: return 0;
+    }
+}
+
+// class of the Matlab array holding the raw codes (as attached by read_shared_matrix)
+static inline int shmem_encoding_class(unsigned long long encoding) {
+    switch (encoding) {
+    case SHMEM_ENCODING_SINGLE: return mxSINGLE_CLASS;
+    case SHMEM_ENCODING_HALF: case SHMEM_ENCODING_BFLOAT16: return mxUINT16_CLASS;
+    case SHMEM_ENCODING_INT16: return mxINT16_CLASS;
+    case SHMEM_ENCODING_INT8: return mxINT8_CLASS;
+    default: return mxUNKNOWN_CLASS;
+    }
+}
+
+// largest code of an integer encoding, 0 for floating point encodings
+static inline double shmem_encoding_max_code(int encoding) {
+    return encoding == SHMEM_ENCODING_INT8 ? 127.0 : (encoding == SHMEM_ENCODING_INT16 ? 32767.0 : 0.0);
+}
+
+// binary16 / bfloat16 conversions, bit manipulations are independent of the compiler's floating point options
+static inline unsigned short shmem_float_to_half(float f) {
+    unsigned int x, sign, o;
+    memcpy(&x, &f, 4);
+    sign = x & 0x80000000u;
+    x ^= sign;
+    if (x >= (143u << 23)) {
+        // overflow (>= 65536) or Inf / NaN
+        o = x > (255u << 23) ? 0x7e00 : 0x7c00;
+    }
+    else if (x < (113u << 23)) {
+        // subnormal or zero, the addition rounds the mantissa to nearest even
+        const unsigned int magic_bits = 126u << 23;
+        float v, magic;
+        memcpy(&v, &x, 4);
+        memcpy(&magic, &magic_bits, 4);
+        v += magic;
+        memcpy(&x, &v, 4);
+        o = x - magic_bits;
+    }
+    else {
+        unsigned int mant_odd = (x >> 13) & 1;
+        x += 0xc8000fffu + mant_odd; // rebias exponent ((15 - 127) << 23) and round to nearest even
+        o = x >> 13;
+    }
+    return (unsigned short)(o | (sign >> 16));
+}
+
+static inline float shmem_half_to_float(unsigned short h) {
+    unsigned int o = (h & 0x7fffu) << 13;
+    unsigned int exp = o & (0x7c00u << 13);
+    o += (127u - 15u) << 23;
+    if (exp == (0x7c00u << 13)) {
+        o += (128u - 16u) << 23; // Inf / NaN
+    }
+    else if (exp == 0) {
+        // subnormal
+        const unsigned int magic_bits = 113u << 23;
+        float v, magic;
+        o += 1u << 23;
+        memcpy(&v, &o, 4);
+        memcpy(&magic, &magic_bits, 4);
+        v -= magic;
+        memcpy(&o, &v, 4);
+    }
+    o |= (unsigned int)(h & 0x8000u) << 16;
+    float f;
+    memcpy(&f, &o, 4);
+    return f;
+}
+
+static inline unsigned short shmem_float_to_bfloat16(float f) {
+    unsigned int x;
+    memcpy(&x, &f, 4);
+    if ((x & 0x7fffffffu) > 0x7f800000u)
+        return (unsigned short)((x >> 16) | 0x40); // quiet NaN
+    x += 0x7fffu + ((x >> 16) & 1);
+    return (unsigned short)(x >> 16);
+}
+
+static inline float shmem_bfloat16_to_float(unsigned short b) {
+    unsigned int x = (unsigned int)b << 16;
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+// encode n elements of src (double, or single if src_single) to dst
+static inline void shmem_encode_range(const void* src, int src_single, unsigned long long n, int encoding, double scale, double offset, void* dst) {
+    double inv_scale = 1.0 / scale;
+    double max_code = shmem_encoding_max_code(encoding);
+    for (unsigned long long i = 0; i < n; i++) {
+        double v = src_single ? (double)((const float*)src)[i] : ((const double*)src)[i];
+        if (scale != 1.0 || offset != 0.0)
+            v = (v - offset) * inv_scale;
+        switch (encoding) {
+        case SHMEM_ENCODING_SINGLE: ((float*)dst)[i] = (float)v; break;
+        case SHMEM_ENCODING_HALF: ((unsigned short*)dst)[i] = shmem_float_to_half((float)v); break;
+        case SHMEM_ENCODING_BFLOAT16: ((unsigned short*)dst)[i] = shmem_float_to_bfloat16((float)v); break;
+        default:
+            // integer encodings, NaN fails both comparisons and is stored as 0
+            v = v > max_code ? max_code : (v < -max_code ? -max_code : (v == v ? floor(v + 0.5) : 0.0));
+            if (encoding == SHMEM_ENCODING_INT8) ((signed char*)dst)[i] = (signed char)v;
+            else ((short*)dst)[i] = (short)v;
+            break;
+        }
+    }
+}
+
+// decode n codes of src to dst (double, or single if dst_single), scalar kernel
+static inline void _shmem_decode_scalar(const void* src, int encoding, unsigned long long n, double scale, double offset, void* dst, int dst_single) {
+    for (unsigned long long i = 0; i < n; i++) {
+        double q;
+        switch (encoding) {
+        case SHMEM_ENCODING_SINGLE: q = ((const float*)src)[i]; break;
+        case SHMEM_ENCODING_HALF: q = shmem_half_to_float(((const unsigned short*)src)[i]); break;
+        case SHMEM_ENCODING_BFLOAT16: q = shmem_bfloat16_to_float(((const unsigned short*)src)[i]); break;
+        case SHMEM_ENCODING_INT8: q = ((const signed char*)src)[i]; break;
+        default: q = ((const short*)src)[i]; break;
+        }
+        if (dst_single) ((float*)dst)[i] = (float)q * (float)scale + (float)offset;
+        else ((double*)dst)[i] = q * scale + offset;
+    }
+}
+
+#ifdef SHMEM_CODEC_X86
+// widen 8 codes at src to single precision
+SHMEM_CODEC_TARGET("avx2,f16c,fma") SHMEM_CODEC_INLINE __m256 _shmem_load8_avx2(const char* src, const int encoding) {
+    switch (encoding) {
+    case SHMEM_ENCODING_SINGLE: return _mm256_loadu_ps((const float*)src);
+    case SHMEM_ENCODING_HALF: return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)src));
+    case SHMEM_ENCODING_BFLOAT16: return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src)), 16));
+    case SHMEM_ENCODING_INT8: return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)src)));
+    default: return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)src)));
+    }
+}
+
+// encoding is a constant in every call of _shmem_decode_avx2, the switch of _shmem_load8_avx2 is resolved at compile time
+SHMEM_CODEC_TARGET("avx2,f16c,fma") SHMEM_CODEC_INLINE void _shmem_decode_avx2_impl(const char* src, const int encoding, unsigned long long n,
+                                                                                double scale, double offset, void* dst, int dst_single) {
+    const int code_size = shmem_encoding_size(encoding);
+    unsigned long long i = 0;
+    if (dst_single) {
+        float* out = (float*)dst;
+        __m256 s = _mm256_set1_ps((float)scale), o = _mm256_set1_ps((float)offset);
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_shmem_load8_avx2(src + i * code_size, encoding), s, o));
+    }
+    else {
+        double* out = (double*)dst;
+        __m256d s = _mm256_set1_pd(scale), o = _mm256_set1_pd(offset);
+        for (; i + 8 <= n; i += 8) {
+            __m256 v = _shmem_load8_avx2(src + i * code_size, encoding);
+            _mm256_storeu_pd(out + i, _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), s, o));
+            _mm256_storeu_pd(out + i + 4, _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), s, o));
+        }
+    }
+    _shmem_decode_scalar(src + i * code_size, encoding, n - i, scale, offset, ((char*)dst) + i * (dst_single ? 4 : 8), dst_single);
+}
+
+SHMEM_CODEC_TARGET("avx2,f16c,fma") static void _shmem_decode_avx2(const void* src, int encoding, unsigned long long n, double scale, double offset, void* dst, int dst_single) {
+    switch (encoding) {
+    case SHMEM_ENCODING_SINGLE: _shmem_decode_avx2_impl((const char*)src, SHMEM_ENCODING_SINGLE, n, scale, offset, dst, dst_single); break;
+    case SHMEM_ENCODING_HALF: _shmem_decode_avx2_impl((const char*)src, SHMEM_ENCODING_HALF, n, scale, offset, dst, dst_single); break;
+    case SHMEM_ENCODING_BFLOAT16: _shmem_decode_avx2_impl((const char*)src, SHMEM_ENCODING_BFLOAT16, n, scale, offset, dst, dst_single); break;
+    case SHMEM_ENCODING_INT8: _shmem_decode_avx2_impl((const char*)src, SHMEM_ENCODING_INT8, n, scale, offset, dst, dst_single); break;
+    default: _shmem_decode_avx2_impl((const char*)src, SHMEM_ENCODING_INT16, n, scale, offset, dst, dst_single); break;
+    }
+}
+
+// widen 16 codes at src to single precision
+SHMEM_CODEC_TARGET("avx512f") SHMEM_CODEC_INLINE __m512 _shmem_load16_avx512(const char* src, const int encoding) {
+    switch (encoding) {
+    case SHMEM_ENCODING_SINGLE: return _mm512_loadu_ps((const float*)src);
+    case SHMEM_ENCODING_HALF: return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)src));
+    case SHMEM_ENCODING_BFLOAT16: return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)src)), 16));
+    case SHMEM_ENCODING_INT8: return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)src)));
+    default: return _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)src)));
+    }
+}
+
+SHMEM_CODEC_TARGET("avx512f") SHMEM_CODEC_INLINE void _shmem_decode_avx512_impl(const char* src, const int encoding, unsigned long long n,
+                                                                            double scale, double offset, void* dst, int dst_single) {
+    const int code_size = shmem_encoding_size(encoding);
+    unsigned long long i = 0;
+    if (dst_single) {
+        float* out = (float*)dst;
+        __m512 s = _mm512_set1_ps((float)scale), o = _mm512_set1_ps((float)offset);
+        for (; i + 16 <= n; i += 16)
+            _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_shmem_load16_avx512(src + i * code_size, encoding), s, o));
+    }
+    else {
+        double* out = (double*)dst;
+        __m512d s = _mm512_set1_pd(scale), o = _mm512_set1_pd(offset);
+        for (; i + 16 <= n; i += 16) {
+            __m512 v = _shmem_load16_avx512(src + i * code_size, encoding);
+            __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+            _mm512_storeu_pd(out + i, _mm512_fmadd_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(v)), s, o));
+            _mm512_storeu_pd(out + i + 8, _mm512_fmadd_pd(_mm512_cvtps_pd(hi), s, o));
+        }
+    }
+    _shmem_decode_scalar(src + i * code_size, encoding, n - i, scale, offset, ((char*)dst) + i * (dst_single ? 4 : 8), dst_single);
+}
+
+SHMEM_CODEC_TARGET("avx512f") static void _shmem_decode_avx512(const void* src, int encoding, unsigned long long n, double scale, double offset, void* dst, int dst_single) {
+    switch (encoding) {
+    case SHMEM_ENCODING_SINGLE: _shmem_decode_avx512_impl((const char*)src, SHMEM_ENCODING_SINGLE, n, scale, offset, dst, dst_single); break;
+    case SHMEM_ENCODING_HALF: _shmem_decode_avx512_impl((const char*)src, SHMEM_ENCODING_HALF, n, scale, offset, dst, dst_single); break;
+    case SHMEM_ENCODING_BFLOAT16: _shmem_decode_avx512_impl((const char*)src, SHMEM_ENCODING_BFLOAT16, n, scale, offset, dst, dst_single); break;
+    case SHMEM_ENCODING_INT8: _shmem_decode_avx512_impl((const char*)src, SHMEM_ENCODING_INT8, n, scale, offset, dst, dst_single); break;
+    default: _shmem_decode_avx512_impl((const char*)src, SHMEM_ENCODING_INT16, n, scale, offset, dst, dst_single); break;
+    }
+}
+
+// XCR0, the register states enabled by the OS
+static inline unsigned long long _shmem_codec_xgetbv(void) {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif // SHMEM_CODEC_X86
+
+// best decode kernel supported by CPU and OS
+static inline int shmem_codec_kernel(void) {
+    static int kernel = -1;
+    if (kernel >= 0)
+        return kernel;
+    int result = SHMEM_CODEC_KERNEL_SCALAR;
+#ifdef SHMEM_CODEC_X86
+    unsigned int regs1[4] = { 0 }, regs7[4] = { 0 };
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    memcpy(regs1, info, sizeof(regs1));
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        memcpy(regs7, info, sizeof(regs7));
+    }
+#else
+    __get_cpuid(1, &regs1[0], &regs1[1], &regs1[2], &regs1[3]);
+    __get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3]);
+#endif
+    int osxsave = (regs1[2] >> 27) & 1, fma = (regs1[2] >> 12) & 1, f16c = (regs1[2] >> 29) & 1;
+    int avx2 = (regs7[1] >> 5) & 1, avx512f = (regs7[1] >> 16) & 1;
+    unsigned long long xcr0 = osxsave ? _shmem_codec_xgetbv() : 0;
+    if (avx2 && fma && f16c && (xcr0 & 0x6) == 0x6) {
+        result = SHMEM_CODEC_KERNEL_AVX2;
+        if (avx512f && (xcr0 & 0xe6) == 0xe6)
+            result = SHMEM_CODEC_KERNEL_AVX512;
+    }
+#endif
+    kernel = result;
+    return kernel;
+}
+
+static inline const char* shmem_codec_kernel_name(int kernel) {
+    return kernel == SHMEM_CODEC_KERNEL_AVX512 ? "avx512" : (kernel == SHMEM_CODEC_KERNEL_AVX2 ? "avx2" : "scalar");
+}
+
+// decode n codes of src to dst (double, or single if dst_single) using kernel (downgraded if it is not supported)
+static inline void shmem_decode_range(const void* src, int encoding, unsigned long long n, double scale, double offset, void* dst, int dst_single, int kernel) {
+    if (kernel > shmem_codec_kernel())
+        kernel = shmem_codec_kernel();
+#ifdef SHMEM_CODEC_X86
+    if (kernel == SHMEM_CODEC_KERNEL_AVX512) {
+        _shmem_decode_avx512(src, encoding, n, scale, offset, dst, dst_single);
+        return;
+    }
+    if (kernel == SHMEM_CODEC_KERNEL_AVX2) {
+        _shmem_decode_avx2(src, encoding, n, scale, offset, dst, dst_single);
+        return;
+    }
+#endif
+    _shmem_decode_scalar(src, encoding, n, scale, offset, dst, dst_single);
+}
+
+typedef struct {
+    const char* src;
+    char* dst;
+    int src_single; // encode: source is single precision, decode: destination is single precision
+    int encoding;
+    int kernel;
+    int phase; // 0: min / max of the source, 1: encode, 2: decode
+    double scale;
+    double offset;
+    unsigned long long begin; // range of elements
+    unsigned long long end;
+    double min; // phase 0, finite elements only
+    double max;
+} _shmem_codec_worker_t;
+
+static void _shmem_codec_worker(void* arg) {
+    _shmem_codec_worker_t* w = (_shmem_codec_worker_t*)arg;
+    int src_size = w->src_single ? 4 : 8;
+    int code_size = shmem_encoding_size(w->encoding);
+    unsigned long long n = w->end - w->begin;
+    if (w->phase == 0) {
+        double lo = HUGE_VAL, hi = -HUGE_VAL;
+        for (unsigned long long i = w->begin; i < w->end; i++) {
+            double v = w->src_single ? (double)((const float*)w->src)[i] : ((const double*)w->src)[i];
+            if (v - v != 0) continue; // NaN / Inf
+            if (v < lo) lo = v;
+            if (v > hi) hi = v;
+        }
+        w->min = lo;
+        w->max = hi;
+    }
+    else if (w->phase == 1) {
+        shmem_encode_range(w->src + w->begin * src_size, w->src_single, n, w->encoding, w->scale, w->offset, w->dst + w->begin * code_size);
+    }
+    else {
+        shmem_decode_range(w->src + w->begin * code_size, w->encoding, n, w->scale, w->offset, w->dst + w->begin * src_size, w->src_single, w->kernel);
+    }
+}
+
+// number of threads for bytes of source and destination (n_threads <= 0: determined by size and CPUs)
+static inline int _shmem_codec_threads(unsigned long long bytes, int n_threads) {
+    if (n_threads > 0)
+        return n_threads;
+    unsigned long long max_threads_by_size = bytes / SHMEM_COPY_MIN_BYTES_PER_THREAD;
+    n_threads = shmem_cpu_count();
+    if (n_threads > SHMEM_COPY_MAX_AUTO_THREADS) n_threads = SHMEM_COPY_MAX_AUTO_THREADS;
+    if ((unsigned long long)n_threads > max_threads_by_size)
+        n_threads = max_threads_by_size > 0 ? (int)max_threads_by_size : 1;
+    return n_threads;
+}
+
+// run the phase on n elements split evenly among n_threads workers (ranges are multiples of 64 elements), w is the
+// template of all workers, returns 0 if memory for the workers could not be allocated
+static inline int _shmem_codec_run(const _shmem_codec_worker_t* w, unsigned long long n, int n_threads, _shmem_codec_worker_t** result) {
+    _shmem_codec_worker_t* workers = (_shmem_codec_worker_t*)malloc(sizeof(_shmem_codec_worker_t) * n_threads);
+    if (workers == NULL)
+        return 0;
+    for (int i = 0; i < n_threads; i++) {
+        workers[i] = *w;
+        workers[i].begin = i == 0 ? 0 : workers[i - 1].end;
+        workers[i].end = i == n_threads - 1 ? n : (n / n_threads * (i + 1)) & ~63ULL;
+        if (workers[i].end < workers[i].begin) workers[i].end = workers[i].begin;
+    }
+    shmem_parallel_run(n_threads, _shmem_codec_worker, workers, sizeof(_shmem_codec_worker_t));
+    if (result) *result = workers;
+    else free(workers);
+    return 1;
+}
+
+/*
+ * Encode n elements of src (double, or single if src_single) to dst using multiple threads, scale and offset of an
+ * integer encoding are computed from the range of the finite elements if *scale is 0
+ * returns number of threads used, 0 if memory for the workers could not be allocated
+ */
+static inline int shmem_parallel_encode(const void* src, int src_single, unsigned long long n, int encoding, double* scale, double* offset, void* dst, int n_threads) {
+    n_threads = _shmem_codec_threads(n * (src_single ? 4 : 8), n_threads);
+    _shmem_codec_worker_t w;
+    memset(&w, 0, sizeof(w));
+    w.src = (const char*)src;
+    w.dst = (char*)dst;
+    w.src_single = src_single;
+    w.encoding = encoding;
+    if (*scale == 0) {
+        double max_code = shmem_encoding_max_code(encoding);
+        *scale = 1;
+        *offset = 0;
+        if (max_code > 0) {
+            _shmem_codec_worker_t* workers = NULL;
+            if (!_shmem_codec_run(&w, n, n_threads, &workers))
+                return 0;
+            double lo = HUGE_VAL, hi = -HUGE_VAL;
+            for (int i = 0; i < n_threads; i++) {
+                if (workers[i].min < lo) lo = workers[i].min;
+                if (workers[i].max > hi) hi = workers[i].max;
+            }
+            free(workers);
+            if (lo <= hi) {
+                *offset = lo / 2 + hi / 2;
+                if (hi > lo) *scale = (hi / 2 - lo / 2) / max_code;
+            }
+            SHMEM_DEBUG_OUTPUT("Encoding range: [%f, %f]\n", lo, hi);
+        }
+    }
+    w.phase = 1;
+    w.scale = *scale;
+    w.offset = *offset;
+    return _shmem_codec_run(&w, n, n_threads, NULL) ? n_threads : 0;
+}
+
+/*
+ * Decode n codes of src to dst (double, or single if dst_single) using multiple threads and kernel (downgraded if it
+ * is not supported)
+ * returns number of threads used, 0 if memory for the workers could not be allocated
+ */
+static inline int shmem_parallel_decode(const void* src, int encoding, unsigned long long n, double scale, double offset, void* dst, int dst_single, int kernel, int n_threads) {
+    n_threads = _shmem_codec_threads(n * (shmem_encoding_size(encoding) + (dst_single ? 4 : 8)), n_threads);
+    _shmem_codec_worker_t w;
+    memset(&w, 0, sizeof(w));
+    w.src = (const char*)src;
+    w.dst = (char*)dst;
+    w.src_single = dst_single;
+    w.encoding = encoding;
+    w.kernel = kernel;
+    w.phase = 2;
+    w.scale = scale;
+    w.offset = offset;
+    return _shmem_codec_run(&w, n, n_threads, NULL) ? n_threads : 0;
+}
+
+#endif
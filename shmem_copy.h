@@ -0,0 +1,384 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Multi-threaded payload copy engine
+ *
+ * All copy tasks (e.g. Pr / Ir / Jc of a sparse matrix) are concatenated into one byte stream, which is split into
+ * contiguous ranges (one per thread) at page boundaries of the destination. Each thread is the first one touching the
+ * pages of its range, so freshly created shared memory pages are distributed over the NUMA nodes the threads run on.
+ * Destination buffers larger than the last level cache are written with non-temporal (streaming) stores.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_COPY_H_
+#define _SHARED_MATRIX_SHMEM_COPY_H_
+
+#include "compiler_def.h"
+#include "shmem_thread.h"
+#include "shmem_sync.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#    include <emmintrin.h>
+#    define SHMEM_HAS_STREAM_STORE
+#endif
+
+typedef struct {
+    char* dst;
+    const char* src;
+    unsigned long long size;
+} shmem_copy_task_t;
+
+typedef struct {
+    int n_threads; // <= 0: determined by payload size and number of CPUs
+    int non_temporal; // < 0: enabled when payload is larger than LLC, 0: disabled, > 0: enabled
+} shmem_copy_options_t;
+
+typedef struct {
+    unsigned long long bytes;
+    double seconds;
+    int n_threads;
+    int non_temporal;
+} shmem_copy_stats_t;
+
+typedef struct {
+    const shmem_copy_task_t* tasks;
+    int n_tasks;
+    unsigned long long begin; // range in the concatenated stream of all tasks
+    unsigned long long end;
+    int non_temporal;
+    int index;
+    int n_threads;
+} _shmem_copy_worker_t;
+
+// memcpy using non-temporal stores for the 16-byte aligned part of destination
+static inline void shmem_stream_copy(char* dst, const char* src, unsigned long long size) {
+#ifdef SHMEM_HAS_STREAM_STORE
+    unsigned long long head = (16 - ((unsigned long long)(size_t)dst & 15)) & 15;
+    if (head > size) head = size;
+    memcpy(dst, src, (size_t)head);
+    dst += head; src += head; size -= head;
+    while (size >= 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(src));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(src + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(src + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i*)(src + 48));
+        _mm_stream_si128((__m128i*)(dst), v0);
+        _mm_stream_si128((__m128i*)(dst + 16), v1);
+        _mm_stream_si128((__m128i*)(dst + 32), v2);
+        _mm_stream_si128((__m128i*)(dst + 48), v3);
+        dst += 64; src += 64; size -= 64;
+    }
+    memcpy(dst, src, (size_t)size);
+#else
+    memcpy(dst, src, (size_t)size);
+#endif
+}
+
+// copy the range [begin, end) of the concatenated stream of all tasks
+static inline void _shmem_copy_range(const shmem_copy_task_t* tasks, int n_tasks, unsigned long long begin, unsigned long long end, int non_temporal) {
+    unsigned long long task_begin = 0;
+    for (int i = 0; i < n_tasks && task_begin < end; i++) {
+        unsigned long long task_end = task_begin + tasks[i].size;
+        unsigned long long lo = begin > task_begin ? begin : task_begin;
+        unsigned long long hi = end < task_end ? end : task_end;
+        // copy chunk by chunk, keeps the progress granularity bounded for huge payloads
+        for (unsigned long long pos = lo; pos < hi; pos += SHMEM_COPY_CHUNK_BYTES) {
+            unsigned long long n = hi - pos < SHMEM_COPY_CHUNK_BYTES ? hi - pos : SHMEM_COPY_CHUNK_BYTES;
+            char* dst = tasks[i].dst + (pos - task_begin);
+            const char* src = tasks[i].src + (pos - task_begin);
+            if (non_temporal)
+                shmem_stream_copy(dst, src, n);
+            else
+                memcpy(dst, src, (size_t)n);
+        }
+        task_begin = task_end;
+    }
+#ifdef SHMEM_HAS_STREAM_STORE
+    if (non_temporal)
+        _mm_sfence();
+#endif
+}
+
+static void _shmem_copy_worker(void* arg) {
+    _shmem_copy_worker_t* w = (_shmem_copy_worker_t*)arg;
+    // the calling (Matlab) thread keeps its affinity
+    if (w->index > 0)
+        shmem_thread_bind_spread(w->index, w->n_threads);
+    double trace_start = shmem_trace_begin();
+    _shmem_copy_range(w->tasks, w->n_tasks, w->begin, w->end, w->non_temporal);
+    shmem_trace_end("memcpy", trace_start, w->end - w->begin);
+}
+
+// maps a position of the concatenated stream to the next position whose destination address is page aligned
+static inline unsigned long long _shmem_copy_align_split(const shmem_copy_task_t* tasks, int n_tasks, unsigned long long pos, unsigned long long page) {
+    unsigned long long task_begin = 0;
+    for (int i = 0; i < n_tasks; i++) {
+        unsigned long long task_end = task_begin + tasks[i].size;
+        if (pos < task_end) {
+            unsigned long long addr = (unsigned long long)(size_t)(tasks[i].dst + (pos - task_begin));
+            unsigned long long aligned = INT_CEIL(addr, page) * page;
+            pos += aligned - addr;
+            return pos < task_end ? pos : task_end;
+        }
+        task_begin = task_end;
+    }
+    return pos;
+}
+
+// number of threads and use of non-temporal stores for copying total bytes
+static inline void _shmem_copy_config(unsigned long long total, const shmem_copy_options_t* options, int* n_threads_out, int* non_temporal_out) {
+    int n_threads = options ? options->n_threads : 0;
+    unsigned long long max_threads_by_size = total / SHMEM_COPY_MIN_BYTES_PER_THREAD;
+    if (n_threads <= 0) {
+        n_threads = shmem_cpu_count();
+        if (n_threads > SHMEM_COPY_MAX_AUTO_THREADS) n_threads = SHMEM_COPY_MAX_AUTO_THREADS;
+    }
+    if ((unsigned long long)n_threads > max_threads_by_size)
+        n_threads = max_threads_by_size > 0 ? (int)max_threads_by_size : 1;
+
+    int non_temporal = options ? options->non_temporal : -1;
+    if (non_temporal < 0)
+        non_temporal = total > shmem_llc_size();
+#ifndef SHMEM_HAS_STREAM_STORE
+    non_temporal = 0;
+#endif
+    *n_threads_out = n_threads;
+    *non_temporal_out = non_temporal;
+}
+
+// copy all tasks using multiple threads, stats is optional
+static inline void shmem_parallel_copy(const shmem_copy_task_t* tasks, int n_tasks, const shmem_copy_options_t* options, shmem_copy_stats_t* stats) {
+    double start_time = shmem_time_seconds();
+    double trace_start = shmem_trace_begin();
+    unsigned long long total = 0;
+    for (int i = 0; i < n_tasks; i++)
+        total += tasks[i].size;
+
+    // THREAD COUNT
+    int n_threads, non_temporal;
+    _shmem_copy_config(total, options, &n_threads, &non_temporal);
+    SHMEM_DEBUG_OUTPUT("Parallel copy: %lld bytes, %d threads, non-temporal: %d\n", total, n_threads, non_temporal);
+
+    // SPLIT AT PAGE BOUNDARIES
+    _shmem_copy_worker_t static_workers[MAX_STATIC_ALLOCATED_THREADS];
+    _shmem_copy_worker_t* workers = static_workers;
+    if (n_threads > MAX_STATIC_ALLOCATED_THREADS) {
+        workers = (_shmem_copy_worker_t*)malloc(sizeof(_shmem_copy_worker_t) * n_threads);
+        if (workers == NULL) {
+            workers = static_workers;
+            n_threads = 1;
+        }
+    }
+    unsigned long long page = shmem_page_size();
+    unsigned long long begin = 0;
+    for (int i = 0; i < n_threads; i++) {
+        unsigned long long end = (i == n_threads - 1) ? total : _shmem_copy_align_split(tasks, n_tasks, total / n_threads * (i + 1), page);
+        if (end < begin) end = begin;
+        workers[i].tasks = tasks;
+        workers[i].n_tasks = n_tasks;
+        workers[i].begin = begin;
+        workers[i].end = end;
+        workers[i].non_temporal = non_temporal;
+        workers[i].index = i;
+        workers[i].n_threads = n_threads;
+        begin = end;
+    }
+
+    shmem_parallel_run(n_threads, _shmem_copy_worker, workers, sizeof(_shmem_copy_worker_t));
+    if (workers != static_workers)
+        free(workers);
+    shmem_trace_end("parallel copy", trace_start, total);
+
+    if (stats) {
+        stats->bytes = total;
+        stats->seconds = shmem_time_seconds() - start_time;
+        stats->n_threads = n_threads;
+        stats->non_temporal = non_temporal;
+    }
+}
+
+/*
+ * Asynchronous copy into a new segment (option Async of create_shared_matrix)
+ *
+ * The stream of all tasks is split into chunks of SHMEM_COPY_CHUNK_BYTES, which are claimed by the copy threads in
+ * ascending order. Whenever the chunks before a position are all complete, FILL_READY of the segment is raised to the
+ * destination address of that position (see shmem_sync.h), so readers wait for the chunks they access only. The copy
+ * threads are started by a background thread, which marks the fill complete and sets finished when they are done.
+ * The sources must stay valid and unchanged until then.
+ */
+typedef struct {
+    shmem_copy_task_t* tasks; // owned by the job
+    int n_tasks;
+    unsigned long long total; // bytes of the stream
+    unsigned long long n_chunks;
+    volatile unsigned long long next_chunk; // next chunk to be claimed
+    volatile unsigned long long frontier; // chunks [0, frontier) are complete
+    volatile unsigned char* done; // completion of each chunk
+    const char* base; // beginning of the segment
+    char* stats; // STATISTICS of the segment
+    int ordered; // destinations of the tasks are in ascending order, FILL_READY is raised chunk by chunk
+    int n_threads;
+    int non_temporal;
+    double start_time;
+    volatile int finished;
+    shmem_thread_t thread;
+} shmem_async_copy_t;
+
+typedef struct {
+    shmem_async_copy_t* job;
+    int index;
+} _shmem_async_worker_t;
+
+static inline unsigned long long _shmem_async_fetch_add(volatile unsigned long long* value, unsigned long long delta) {
+#ifdef _MSC_VER
+    return (unsigned long long)InterlockedExchangeAdd64((volatile LONG64*)value, (LONG64)delta);
+#else
+    return __atomic_fetch_add(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// destination address of position pos of the stream (end of the last task if pos is the end of the stream)
+static inline const char* _shmem_copy_stream_address(const shmem_copy_task_t* tasks, int n_tasks, unsigned long long pos) {
+    unsigned long long task_begin = 0;
+    for (int i = 0; i < n_tasks; i++) {
+        if (pos < task_begin + tasks[i].size || i == n_tasks - 1)
+            return tasks[i].dst + (pos - task_begin);
+        task_begin += tasks[i].size;
+    }
+    return NULL;
+}
+
+static void _shmem_async_worker(void* arg) {
+    _shmem_async_worker_t* w = (_shmem_async_worker_t*)arg;
+    shmem_async_copy_t* job = w->job;
+    shmem_thread_bind_spread(w->index, job->n_threads);
+    while (1) {
+        unsigned long long chunk = _shmem_async_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->n_chunks)
+            break;
+        unsigned long long begin = chunk * SHMEM_COPY_CHUNK_BYTES;
+        unsigned long long end = begin + SHMEM_COPY_CHUNK_BYTES < job->total ? begin + SHMEM_COPY_CHUNK_BYTES : job->total;
+        double trace_start = shmem_trace_begin();
+        _shmem_copy_range(job->tasks, job->n_tasks, begin, end, job->non_temporal);
+        shmem_trace_end("memcpy (async)", trace_start, end - begin);
+#ifdef _MSC_VER
+        MemoryBarrier();
+        job->done[chunk] = 1;
+#else
+        __atomic_store_n(&job->done[chunk], 1, __ATOMIC_SEQ_CST);
+#endif
+        if (!job->ordered)
+            continue;
+        // advance the frontier over complete chunks, FILL_READY never decreases
+        unsigned long long frontier = job->frontier;
+        while (frontier < job->n_chunks && job->done[frontier]) {
+#ifdef _MSC_VER
+            unsigned long long actual = (unsigned long long)InterlockedCompareExchange64((volatile LONG64*)&job->frontier, (LONG64)(frontier + 1), (LONG64)frontier);
+            frontier = actual == frontier ? frontier + 1 : actual;
+#else
+            unsigned long long expected = frontier;
+            if (__atomic_compare_exchange_n(&job->frontier, &expected, frontier + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                frontier++;
+            else
+                frontier = expected;
+#endif
+        }
+        unsigned long long ready = frontier * SHMEM_COPY_CHUNK_BYTES < job->total ? frontier * SHMEM_COPY_CHUNK_BYTES : job->total;
+        shmem_fill_publish(job->stats, (unsigned long long)(_shmem_copy_stream_address(job->tasks, job->n_tasks, ready) - job->base));
+    }
+}
+
+static void _shmem_async_main(void* arg) {
+    shmem_async_copy_t* job = (shmem_async_copy_t*)arg;
+    _shmem_async_worker_t static_workers[MAX_STATIC_ALLOCATED_THREADS];
+    _shmem_async_worker_t* workers = static_workers;
+    int n_threads = job->n_threads;
+    if (n_threads > MAX_STATIC_ALLOCATED_THREADS) {
+        workers = (_shmem_async_worker_t*)malloc(sizeof(_shmem_async_worker_t) * n_threads);
+        if (workers == NULL) {
+            workers = static_workers;
+            n_threads = 1;
+        }
+    }
+    for (int i = 0; i < n_threads; i++) {
+        workers[i].job = job;
+        workers[i].index = i;
+    }
+    shmem_parallel_run(n_threads, _shmem_async_worker, workers, sizeof(_shmem_async_worker_t));
+    if (workers != static_workers)
+        free(workers);
+    SHMEM_WRITE_CAST(double, job->stats, SHMEM_STATS_CREATE_SECONDS, shmem_time_seconds() - job->start_time);
+    // the segment is not accessed by the job after this point, the host may unmap it
+    shmem_fill_end(job->stats);
+#ifdef _MSC_VER
+    MemoryBarrier();
+    job->finished = 1;
+#else
+    __atomic_store_n(&job->finished, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*
+ * Start copying tasks (copied into the job) into the segment at base holding STATISTICS stats in background, stats
+ * (optional) receives the bytes, thread count and use of non-temporal stores (Seconds is 0)
+ * returns the job (to be released by shmem_async_copy_free after finished is set), or NULL if it could not be started
+ */
+static inline shmem_async_copy_t* shmem_async_copy_start(const shmem_copy_task_t* tasks, int n_tasks, const shmem_copy_options_t* options,
+                                                         const char* base, char* stats, shmem_copy_stats_t* copy_stats) {
+    if (stats == NULL)
+        return NULL;
+    shmem_async_copy_t* job = (shmem_async_copy_t*)calloc(1, sizeof(shmem_async_copy_t));
+    if (job == NULL)
+        return NULL;
+    job->tasks = (shmem_copy_task_t*)malloc(sizeof(shmem_copy_task_t) * (n_tasks > 0 ? n_tasks : 1));
+    job->ordered = 1;
+    for (int i = 0; i < n_tasks; i++) {
+        if (job->tasks)
+            job->tasks[i] = tasks[i];
+        job->total += tasks[i].size;
+        if (i > 0 && tasks[i].dst < tasks[i - 1].dst + tasks[i - 1].size)
+            job->ordered = 0;
+    }
+    job->n_tasks = n_tasks;
+    job->n_chunks = INT_CEIL(job->total, SHMEM_COPY_CHUNK_BYTES);
+    job->done = (volatile unsigned char*)calloc(job->n_chunks > 0 ? job->n_chunks : 1, 1);
+    job->base = base;
+    job->stats = stats;
+    job->start_time = shmem_time_seconds();
+    _shmem_copy_config(job->total, options, &job->n_threads, &job->non_temporal);
+    if (job->tasks == NULL || job->done == NULL) {
+        free(job->tasks);
+        free((void*)job->done);
+        free(job);
+        return NULL;
+    }
+    shmem_fill_begin(stats, n_tasks > 0 ? (unsigned long long)(tasks[0].dst - base) : 0);
+    SHMEM_DEBUG_OUTPUT("Async copy: %lld bytes, %d threads, non-temporal: %d\n", job->total, job->n_threads, job->non_temporal);
+    if (shmem_thread_start(&job->thread, _shmem_async_main, job) != 0) {
+        shmem_fill_end(stats);
+        free(job->tasks);
+        free((void*)job->done);
+        free(job);
+        return NULL;
+    }
+    if (copy_stats) {
+        copy_stats->bytes = job->total;
+        copy_stats->seconds = 0;
+        copy_stats->n_threads = job->n_threads;
+        copy_stats->non_temporal = job->non_temporal;
+    }
+    return job;
+}
+
+// wait for the job to finish and release it
+static inline void shmem_async_copy_free(shmem_async_copy_t* job) {
+    shmem_thread_join(&job->thread);
+    free(job->tasks);
+    free((void*)job->done);
+    free(job);
+}
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Reductions and products computed directly on the payload of a shared matrix (compute_shared_matrix)
+ *
+ * A matrix is read in place, column by column (dense, or the non-zero elements of a CSC column), by the typed
+ * primitives of shmem_kernel_ops_t. Sums and products are accumulated in double precision for every class, min / max
+ * keep the class of the matrix and ignore NaN. Double / single primitives have AVX2 + FMA kernels selected at run time
+ * by shmem_codec_kernel() (AVX-512 capable CPUs use them as well), the other classes use unrolled scalar loops with
+ * independent accumulators, which compilers vectorize. The summation order of the kernels differs, so their results may
+ * differ in the last bits.
+ *
+ * Work is split among threads by columns (balanced by non-zero elements for a sparse matrix); row results (rowsum,
+ * gemv) of a dense matrix are split by rows and processed in blocks of rows which stay in cache, those of a sparse matrix
+ * are accumulated in a private vector of every thread and summed afterwards.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_KERNELS_H_
+#define _SHARED_MATRIX_SHMEM_KERNELS_H_
+
+#include "compiler_def.h"
+#include "shmem_codec.h"
+#include <math.h>
+
+// operations of compute_shared_matrix
+#define SHMEM_KERNEL_COLSUM  0 // sum(A, 1)
+#define SHMEM_KERNEL_ROWSUM  1 // sum(A, 2)
+#define SHMEM_KERNEL_MIN     2 // min(A, [], 1)
+#define SHMEM_KERNEL_MAX     3 // max(A, [], 1)
+#define SHMEM_KERNEL_DOT     4 // x.' * A
+#define SHMEM_KERNEL_GEMV    5 // A * x
+#define SHMEM_KERNEL_COLNORM 6 // vecnorm(A, 2, 1)
+
+// operation id of the name accepted by compute_shared_matrix, -1 if invalid
+static inline int shmem_kernel_from_name(const char* name) {
+    static const char* names[] = { "colsum", "rowsum", "min", "max", "dot", "gemv", "colnorm" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+// rows of a dense matrix processed across all columns at once by a row kernel (16 KB of the result)
+#define SHMEM_KERNEL_ROW_BLOCK 2048
+
+// row kernels produce an n_rows * 1 result, the others a 1 * n_cols result
+static inline int shmem_kernel_is_row(int op) {
+    return op == SHMEM_KERNEL_ROWSUM || op == SHMEM_KERNEL_GEMV;
+}
+
+// typed primitives, src points to the first element, n is the number of elements
+typedef struct {
+    double (*sum)(const void* src, unsigned long long n);
+    double (*sumsq)(const void* src, unsigned long long n);
+    double (*dot)(const void* src, const double* x, unsigned long long n); // sum(src .* x)
+    void (*axpy)(const void* src, double alpha, double* y, unsigned long long n); // y += alpha * src
+    double (*sparse_dot)(const void* src, const mwIndex* ir, const double* x, unsigned long long n); // sum(src .* x(ir))
+    void (*sparse_axpy)(const void* src, const mwIndex* ir, double alpha, double* y, unsigned long long n); // y(ir) += alpha * src
+    // min / max of the non-NaN elements written to dst (same class), implicit_zero includes a zero element (sparse
+    // column with less non-zero elements than rows), NaN if all elements are NaN
+    void (*minmax)(const void* src, unsigned long long n, int is_max, int implicit_zero, void* dst);
+} shmem_kernel_ops_t;
+
+// best < 0 in the min / max kernels, left out for unsigned types where it never holds (-Wtype-limits)
+#define _SHMEM_KERNEL_BELOW_ZERO_signed(T, x) ((x) < (T)0)
+#define _SHMEM_KERNEL_BELOW_ZERO_unsigned(T, x) 0
+
+#define _SHMEM_KERNEL_DEFINE_OPS(T, suffix, sign) \
+static double _shmem_sum_##suffix(const void* src, unsigned long long n) { \
+    const T* a = (const T*)src; \
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+    unsigned long long i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        s0 += (double)a[i]; s1 += (double)a[i + 1]; s2 += (double)a[i + 2]; s3 += (double)a[i + 3]; \
+    } \
+    for (; i < n; i++) s0 += (double)a[i]; \
+    return (s0 + s1) + (s2 + s3); \
+} \
+static double _shmem_sumsq_##suffix(const void* src, unsigned long long n) { \
+    const T* a = (const T*)src; \
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+    unsigned long long i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        double v0 = (double)a[i], v1 = (double)a[i + 1], v2 = (double)a[i + 2], v3 = (double)a[i + 3]; \
+        s0 += v0 * v0; s1 += v1 * v1; s2 += v2 * v2; s3 += v3 * v3; \
+    } \
+    for (; i < n; i++) s0 += (double)a[i] * (double)a[i]; \
+    return (s0 + s1) + (s2 + s3); \
+} \
+static double _shmem_dot_##suffix(const void* src, const double* x, unsigned long long n) { \
+    const T* a = (const T*)src; \
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+    unsigned long long i = 0; \
+    for (; i + 4 <= n; i += 4) { \
+        s0 += (double)a[i] * x[i]; s1 += (double)a[i + 1] * x[i + 1]; \
+        s2 += (double)a[i + 2] * x[i + 2]; s3 += (double)a[i + 3] * x[i + 3]; \
+    } \
+    for (; i < n; i++) s0 += (double)a[i] * x[i]; \
+    return (s0 + s1) + (s2 + s3); \
+} \
+static void _shmem_axpy_##suffix(const void* src, double alpha, double* y, unsigned long long n) { \
+    const T* a = (const T*)src; \
+    for (unsigned long long i = 0; i < n; i++) y[i] += alpha * (double)a[i]; \
+} \
+static double _shmem_sparse_dot_##suffix(const void* src, const mwIndex* ir, const double* x, unsigned long long n) { \
+    const T* a = (const T*)src; \
+    double s0 = 0, s1 = 0; \
+    unsigned long long i = 0; \
+    for (; i + 2 <= n; i += 2) { s0 += (double)a[i] * x[ir[i]]; s1 += (double)a[i + 1] * x[ir[i + 1]]; } \
+    for (; i < n; i++) s0 += (double)a[i] * x[ir[i]]; \
+    return s0 + s1; \
+} \
+static void _shmem_sparse_axpy_##suffix(const void* src, const mwIndex* ir, double alpha, double* y, unsigned long long n) { \
+    const T* a = (const T*)src; \
+    for (unsigned long long i = 0; i < n; i++) y[ir[i]] += alpha * (double)a[i]; \
+} \
+static void _shmem_minmax_##suffix(const void* src, unsigned long long n, int is_max, int implicit_zero, void* dst) { \
+    const T* a = (const T*)src; \
+    unsigned long long i = 0; \
+    while (i < n && a[i] != a[i]) i++; /* NaN fails all comparisons, only the first element must be a number */ \
+    T best = i < n ? a[i] : (n > 0 ? a[0] : (T)0); \
+    if (is_max) { for (; i < n; i++) if (a[i] > best) best = a[i]; } \
+    else { for (; i < n; i++) if (a[i] < best) best = a[i]; } \
+    if (implicit_zero && (best != best || (is_max ? _SHMEM_KERNEL_BELOW_ZERO_##sign(T, best) : best > (T)0))) best = (T)0; \
+    *(T*)dst = best; \
+} \
+static const shmem_kernel_ops_t _shmem_kernel_ops_##suffix = { \
+    _shmem_sum_##suffix, _shmem_sumsq_##suffix, _shmem_dot_##suffix, _shmem_axpy_##suffix, \
+    _shmem_sparse_dot_##suffix, _shmem_sparse_axpy_##suffix, _shmem_minmax_##suffix \
+};
+
+_SHMEM_KERNEL_DEFINE_OPS(double, double, signed)
+_SHMEM_KERNEL_DEFINE_OPS(float, single, signed)
+_SHMEM_KERNEL_DEFINE_OPS(signed char, int8, signed)
+_SHMEM_KERNEL_DEFINE_OPS(unsigned char, uint8, unsigned)
+_SHMEM_KERNEL_DEFINE_OPS(short, int16, signed)
+_SHMEM_KERNEL_DEFINE_OPS(unsigned short, uint16, unsigned)
+_SHMEM_KERNEL_DEFINE_OPS(int, int32, signed)
+_SHMEM_KERNEL_DEFINE_OPS(unsigned int, uint32, unsigned)
+_SHMEM_KERNEL_DEFINE_OPS(long long, int64, signed)
+_SHMEM_KERNEL_DEFINE_OPS(unsigned long long, uint64, unsigned)
+
+#ifdef SHMEM_CODEC_X86
+SHMEM_CODEC_TARGET("avx2,fma") SHMEM_CODEC_INLINE double _shmem_hsum_avx2(__m256d v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+// 4 elements at a widened to double (double or single precision source)
+SHMEM_CODEC_TARGET("avx2,fma") SHMEM_CODEC_INLINE __m256d _shmem_load4_avx2(const void* a, unsigned long long i, const int single) {
+    return single ? _mm256_cvtps_pd(_mm_loadu_ps((const float*)a + i)) : _mm256_loadu_pd((const double*)a + i);
+}
+
+#define _SHMEM_KERNEL_DEFINE_AVX2(T, suffix, single) \
+SHMEM_CODEC_TARGET("avx2,fma") static double _shmem_sum_avx2_##suffix(const void* src, unsigned long long n) { \
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd(); \
+    unsigned long long i = 0; \
+    for (; i + 16 <= n; i += 16) { \
+        s0 = _mm256_add_pd(s0, _shmem_load4_avx2(src, i, single)); \
+        s1 = _mm256_add_pd(s1, _shmem_load4_avx2(src, i + 4, single)); \
+        s2 = _mm256_add_pd(s2, _shmem_load4_avx2(src, i + 8, single)); \
+        s3 = _mm256_add_pd(s3, _shmem_load4_avx2(src, i + 12, single)); \
+    } \
+    for (; i + 4 <= n; i += 4) s0 = _mm256_add_pd(s0, _shmem_load4_avx2(src, i, single)); \
+    double s = _shmem_hsum_avx2(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3))); \
+    for (; i < n; i++) s += (double)((const T*)src)[i]; \
+    return s; \
+} \
+SHMEM_CODEC_TARGET("avx2,fma") static double _shmem_sumsq_avx2_##suffix(const void* src, unsigned long long n) { \
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd(); \
+    unsigned long long i = 0; \
+    for (; i + 16 <= n; i += 16) { \
+        __m256d v0 = _shmem_load4_avx2(src, i, single), v1 = _shmem_load4_avx2(src, i + 4, single); \
+        __m256d v2 = _shmem_load4_avx2(src, i + 8, single), v3 = _shmem_load4_avx2(src, i + 12, single); \
+        s0 = _mm256_fmadd_pd(v0, v0, s0); s1 = _mm256_fmadd_pd(v1, v1, s1); \
+        s2 = _mm256_fmadd_pd(v2, v2, s2); s3 = _mm256_fmadd_pd(v3, v3, s3); \
+    } \
+    for (; i + 4 <= n; i += 4) { \
+        __m256d v = _shmem_load4_avx2(src, i, single); \
+        s0 = _mm256_fmadd_pd(v, v, s0); \
+    } \
+    double s = _shmem_hsum_avx2(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3))); \
+    for (; i < n; i++) s += (double)((const T*)src)[i] * (double)((const T*)src)[i]; \
+    return s; \
+} \
+SHMEM_CODEC_TARGET("avx2,fma") static double _shmem_dot_avx2_##suffix(const void* src, const double* x, unsigned long long n) { \
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd(); \
+    unsigned long long i = 0; \
+    for (; i + 16 <= n; i += 16) { \
+        s0 = _mm256_fmadd_pd(_shmem_load4_avx2(src, i, single), _mm256_loadu_pd(x + i), s0); \
+        s1 = _mm256_fmadd_pd(_shmem_load4_avx2(src, i + 4, single), _mm256_loadu_pd(x + i + 4), s1); \
+        s2 = _mm256_fmadd_pd(_shmem_load4_avx2(src, i + 8, single), _mm256_loadu_pd(x + i + 8), s2); \
+        s3 = _mm256_fmadd_pd(_shmem_load4_avx2(src, i + 12, single), _mm256_loadu_pd(x + i + 12), s3); \
+    } \
+    for (; i + 4 <= n; i += 4) s0 = _mm256_fmadd_pd(_shmem_load4_avx2(src, i, single), _mm256_loadu_pd(x + i), s0); \
+    double s = _shmem_hsum_avx2(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3))); \
+    for (; i < n; i++) s += (double)((const T*)src)[i] * x[i]; \
+    return s; \
+} \
+SHMEM_CODEC_TARGET("avx2,fma") static void _shmem_axpy_avx2_##suffix(const void* src, double alpha, double* y, unsigned long long n) { \
+    __m256d a = _mm256_set1_pd(alpha); \
+    unsigned long long i = 0; \
+    for (; i + 8 <= n; i += 8) { \
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _shmem_load4_avx2(src, i, single), _mm256_loadu_pd(y + i))); \
+        _mm256_storeu_pd(y + i + 4, _mm256_fmadd_pd(a, _shmem_load4_avx2(src, i + 4, single), _mm256_loadu_pd(y + i + 4))); \
+    } \
+    for (; i < n; i++) y[i] += alpha * (double)((const T*)src)[i]; \
+} \
+static const shmem_kernel_ops_t _shmem_kernel_ops_avx2_##suffix = { \
+    _shmem_sum_avx2_##suffix, _shmem_sumsq_avx2_##suffix, _shmem_dot_avx2_##suffix, _shmem_axpy_avx2_##suffix, \
+    _shmem_sparse_dot_##suffix, _shmem_sparse_axpy_##suffix, _shmem_minmax_##suffix \
+};
+
+_SHMEM_KERNEL_DEFINE_AVX2(double, double, 0)
+_SHMEM_KERNEL_DEFINE_AVX2(float, single, 1)
+#endif // SHMEM_CODEC_X86
+
+// primitives of the elements of matrix_type (data_size in byte) for kernel, NULL if the class is not supported
+static inline const shmem_kernel_ops_t* shmem_kernel_ops(int matrix_type, int data_size, int kernel) {
+    if (kernel > shmem_codec_kernel())
+        kernel = shmem_codec_kernel();
+    switch (matrix_type) {
+    case mxDOUBLE_CLASS:
+#ifdef SHMEM_CODEC_X86
+        if (kernel >= SHMEM_CODEC_KERNEL_AVX2) return &_shmem_kernel_ops_avx2_double;
+#endif
+        return &_shmem_kernel_ops_double;
+    case mxSINGLE_CLASS:
+#ifdef SHMEM_CODEC_X86
+        if (kernel >= SHMEM_CODEC_KERNEL_AVX2) return &_shmem_kernel_ops_avx2_single;
+#endif
+        return &_shmem_kernel_ops_single;
+    case mxINT8_CLASS: return &_shmem_kernel_ops_int8;
+    case mxUINT8_CLASS: case mxLOGICAL_CLASS: return &_shmem_kernel_ops_uint8;
+    case mxINT16_CLASS: return &_shmem_kernel_ops_int16;
+    case mxUINT16_CLASS: return &_shmem_kernel_ops_uint16;
+    case mxCHAR_CLASS: return data_size == 2 ? &_shmem_kernel_ops_uint16 : &_shmem_kernel_ops_uint8;
+    case mxINT32_CLASS: return &_shmem_kernel_ops_int32;
+    case mxUINT32_CLASS: return &_shmem_kernel_ops_uint32;
+    case mxINT64_CLASS: return &_shmem_kernel_ops_int64;
+    case mxUINT64_CLASS: return &_shmem_kernel_ops_uint64;
+    default: return NULL;
+    }
+}
+
+// a matrix read in place: Pr of a dense matrix (column-major), or Pr / Ir / Jc of a sparse matrix
+typedef struct {
+    const char* pr;
+    const mwIndex* ir; // NULL for a dense matrix
+    const mwIndex* jc;
+    unsigned long long n_rows;
+    int data_size;
+} shmem_kernel_matrix_t;
+
+typedef struct {
+    const shmem_kernel_ops_t* ops;
+    const shmem_kernel_matrix_t* a;
+    int op;
+    int phase; // 0: compute, 1: sum the private results of sparse row kernels
+    const double* x; // dot: n_rows elements, gemv: one element for each column of the range
+    unsigned long long col_first; // first column of the range, element 0 of a column result / x of gemv
+    unsigned long long col_begin; // columns of this worker
+    unsigned long long col_end;
+    unsigned long long row_begin; // rows of this worker (dense row kernels, phase 1)
+    unsigned long long row_end;
+    char* out; // column kernels: element per column, row kernels: n_rows doubles (private for sparse row kernels)
+    double* const* partials; // phase 1: private results of all n_partials workers
+    int n_partials;
+} _shmem_kernel_worker_t;
+
+static void _shmem_kernel_worker(void* arg) {
+    _shmem_kernel_worker_t* w = (_shmem_kernel_worker_t*)arg;
+    const shmem_kernel_matrix_t* a = w->a;
+    const shmem_kernel_ops_t* ops = w->ops;
+    double* y = (double*)w->out;
+    if (w->phase == 1) {
+        for (unsigned long long r = w->row_begin; r < w->row_end; r++) {
+            double s = 0;
+            for (int i = 0; i < w->n_partials; i++)
+                s += w->partials[i][r];
+            y[r] = s;
+        }
+        return;
+    }
+    if (shmem_kernel_is_row(w->op) && a->ir == NULL) {
+        // dense: the block of y stays in cache while the columns are streamed
+        for (unsigned long long r0 = w->row_begin; r0 < w->row_end; r0 += SHMEM_KERNEL_ROW_BLOCK) {
+            unsigned long long n = w->row_end - r0 < SHMEM_KERNEL_ROW_BLOCK ? w->row_end - r0 : SHMEM_KERNEL_ROW_BLOCK;
+            memset(y + r0, 0, n * sizeof(double));
+            for (unsigned long long col = w->col_begin; col < w->col_end; col++) {
+                double alpha = w->op == SHMEM_KERNEL_GEMV ? w->x[col - w->col_first] : 1.0;
+                if (alpha != 0)
+                    ops->axpy(a->pr + (col * a->n_rows + r0) * a->data_size, alpha, y + r0, n);
+            }
+        }
+        return;
+    }
+    if (shmem_kernel_is_row(w->op)) {
+        memset(y, 0, a->n_rows * sizeof(double));
+        for (unsigned long long col = w->col_begin; col < w->col_end; col++) {
+            double alpha = w->op == SHMEM_KERNEL_GEMV ? w->x[col - w->col_first] : 1.0;
+            if (alpha != 0)
+                ops->sparse_axpy(a->pr + a->jc[col] * a->data_size, a->ir + a->jc[col], alpha, y, a->jc[col + 1] - a->jc[col]);
+        }
+        return;
+    }
+    for (unsigned long long col = w->col_begin; col < w->col_end; col++) {
+        const char* src = a->pr + col * a->n_rows * a->data_size;
+        unsigned long long n = a->n_rows;
+        if (a->ir != NULL) {
+            src = a->pr + a->jc[col] * a->data_size;
+            n = a->jc[col + 1] - a->jc[col];
+        }
+        unsigned long long k = col - w->col_first;
+        switch (w->op) {
+        case SHMEM_KERNEL_COLSUM: y[k] = ops->sum(src, n); break;
+        case SHMEM_KERNEL_COLNORM: y[k] = sqrt(ops->sumsq(src, n)); break;
+        case SHMEM_KERNEL_DOT:
+            y[k] = a->ir != NULL ? ops->sparse_dot(src, a->ir + a->jc[col], w->x, n) : ops->dot(src, w->x, n);
+            break;
+        default:
+            ops->minmax(src, n, w->op == SHMEM_KERNEL_MAX, a->ir != NULL && n < a->n_rows, w->out + k * a->data_size);
+            break;
+        }
+    }
+}
+
+/*
+ * Compute op on the columns [col_begin, col_end) of matrix a using multiple threads and kernel (downgraded if it is
+ * not supported), x is the vector of dot / gemv
+ * out receives col_end - col_begin elements (double, or the class of the matrix for min / max) for column kernels and
+ * n_rows doubles for row kernels
+ * returns number of threads used, 0 if memory could not be allocated
+ */
+static inline int shmem_parallel_compute(const shmem_kernel_matrix_t* a, const shmem_kernel_ops_t* ops, int op, const double* x,
+                                         unsigned long long col_begin, unsigned long long col_end, void* out, int n_threads) {
+    unsigned long long n_cols = col_end - col_begin;
+    unsigned long long nnz = a->ir != NULL ? a->jc[col_end] - a->jc[col_begin] : n_cols * a->n_rows;
+    n_threads = _shmem_codec_threads(nnz * a->data_size, n_threads);
+    int dense_rows = shmem_kernel_is_row(op) && a->ir == NULL;
+    unsigned long long units = dense_rows ? a->n_rows : n_cols;
+    if ((unsigned long long)n_threads > units)
+        n_threads = units > 0 ? (int)units : 1;
+    int sparse_rows = shmem_kernel_is_row(op) && a->ir != NULL && n_threads > 1;
+
+    _shmem_kernel_worker_t* workers = (_shmem_kernel_worker_t*)calloc(n_threads, sizeof(_shmem_kernel_worker_t));
+    double** partials = sparse_rows ? (double**)calloc(n_threads, sizeof(double*)) : NULL;
+    int ok = workers != NULL && (!sparse_rows || partials != NULL);
+    for (int i = 0; ok && sparse_rows && i < n_threads; i++)
+        ok = (partials[i] = (double*)malloc((a->n_rows > 0 ? a->n_rows : 1) * sizeof(double))) != NULL;
+    for (int i = 0; ok && i < n_threads; i++) {
+        _shmem_kernel_worker_t* w = &workers[i];
+        w->ops = ops;
+        w->a = a;
+        w->op = op;
+        w->x = x;
+        w->col_first = col_begin;
+        w->out = sparse_rows ? (char*)partials[i] : (char*)out;
+        w->col_begin = col_begin;
+        w->col_end = col_end;
+        w->row_begin = 0;
+        w->row_end = a->n_rows;
+        if (dense_rows) {
+            w->row_begin = i == 0 ? 0 : workers[i - 1].row_end;
+            w->row_end = i == n_threads - 1 ? a->n_rows : (a->n_rows / n_threads * (i + 1)) & ~7ULL;
+            if (w->row_end < w->row_begin) w->row_end = w->row_begin;
+        }
+        else if (i > 0) {
+            if (a->ir != NULL) {
+                // first column after an even share of the non-zero elements
+                unsigned long long target = a->jc[col_begin] + nnz / n_threads * i;
+                unsigned long long lo = workers[i - 1].col_begin, hi = col_end;
+                while (lo < hi) {
+                    unsigned long long mid = lo + (hi - lo) / 2;
+                    if (a->jc[mid] < target) lo = mid + 1;
+                    else hi = mid;
+                }
+                w->col_begin = lo;
+            }
+            else {
+                w->col_begin = col_begin + n_cols / n_threads * i;
+            }
+            workers[i - 1].col_end = w->col_begin;
+        }
+    }
+    if (ok) {
+        shmem_parallel_run(n_threads, _shmem_kernel_worker, workers, sizeof(_shmem_kernel_worker_t));
+        if (sparse_rows) {
+            for (int i = 0; i < n_threads; i++) {
+                _shmem_kernel_worker_t* w = &workers[i];
+                w->phase = 1;
+                w->out = (char*)out;
+                w->partials = partials;
+                w->n_partials = n_threads;
+                w->row_begin = i == 0 ? 0 : workers[i - 1].row_end;
+                w->row_end = i == n_threads - 1 ? a->n_rows : a->n_rows / n_threads * (i + 1);
+            }
+            shmem_parallel_run(n_threads, _shmem_kernel_worker, workers, sizeof(_shmem_kernel_worker_t));
+        }
+    }
+    for (int i = 0; partials != NULL && i < n_threads; i++)
+        free(partials[i]);
+    free(partials);
+    free(workers);
+    return ok ? n_threads : 0;
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Parsing and offsets of the memory layout documented in compiler_def.h
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_LAYOUT_H_
+#define _SHARED_MATRIX_SHMEM_LAYOUT_H_
+
+#include "compiler_def.h"
+#include "shmem_codec.h"
+
+// size of each FIELD_NAMES entry of a bundle (namelengthmax of Matlab + terminating null)
+#define SHMEM_BUNDLE_FIELD_NAME_BYTES 64
+// STATISTICS block of the segment header (see shmem_stats.h), each counter is placed in its own cache line
+#define SHMEM_STATS_LINE_BYTES 64
+#define SHMEM_STATS_BYTES (8 * SHMEM_STATS_LINE_BYTES)
+
+// header fields in native types, dims points to the (unaligned) MATRIX_DIMENSIONS array in shared memory
+typedef struct {
+    unsigned int layout_version;
+    unsigned int header_size;
+    unsigned long long matrix_type;
+    unsigned long long array_attribute; // MATRIX_FLAG without segment attributes
+    unsigned long long segment_flags; // MATRIX_FLAG & SHMEM_FLAG_SEGMENT_MASK
+    unsigned long long payload_size;
+    unsigned int n_dims;
+    const char* dims;
+    unsigned long long nzmax;
+    unsigned long long encoding; // SHMEM_ENCODING_NONE unless ARRAY_ENCODED is set
+    double scale;
+    double offset;
+    unsigned long long n_fields; // bundle only (matrix_type is mxSTRUCT_CLASS or mxCELL_CLASS), 0 for cell
+    unsigned long long n_blocks; // bundle only, number of BLOCK_OFFSETS
+    int data_size; // size of an element in byte (doubled for complex), 0 for bundle
+    unsigned long long total_size; // header + payload
+    unsigned long long stats_offset; // offset of STATISTICS relative to the header, 0 if SHMEM_FLAG_STATS is not set
+} shmem_header_t;
+
+// size of an element of the given class in byte, 0 if class is unsupported
+static inline int shmem_class_size(unsigned long long matrix_type) {
+    if (matrix_type == mxCHAR_CLASS) return 2;
+    if (matrix_type == mxINT8_CLASS || matrix_type == mxUINT8_CLASS || matrix_type == mxLOGICAL_CLASS) return 1;
+    if (matrix_type == mxINT16_CLASS || matrix_type == mxUINT16_CLASS) return 2;
+    if (matrix_type == mxINT32_CLASS || matrix_type == mxUINT32_CLASS || matrix_type == mxSINGLE_CLASS) return 4;
+    if (matrix_type == mxINT64_CLASS || matrix_type == mxUINT64_CLASS || matrix_type == mxDOUBLE_CLASS) return 8;
+    return 0;
+}
+
+// whether the block of matrix_type is a bundle (struct or cell array)
+static inline int shmem_is_bundle(unsigned long long matrix_type) {
+    return matrix_type == mxSTRUCT_CLASS || matrix_type == mxCELL_CLASS;
+}
+
+static inline unsigned long long shmem_header_dim(const shmem_header_t* hdr, unsigned int i) {
+    return SHMEM_READ_CAST(unsigned long long, hdr->dims, i * 8);
+}
+
+// class id of the class name returned by mxGetClassName (numeric and logical classes only), mxUNKNOWN_CLASS if invalid
+static inline int shmem_class_from_name(const char* name) {
+    static const struct { const char* name; int cls; } classes[] = {
+        { "double", mxDOUBLE_CLASS }, { "single", mxSINGLE_CLASS }, { "logical", mxLOGICAL_CLASS },
+        { "int8", mxINT8_CLASS }, { "uint8", mxUINT8_CLASS }, { "int16", mxINT16_CLASS }, { "uint16", mxUINT16_CLASS },
+        { "int32", mxINT32_CLASS }, { "uint32", mxUINT32_CLASS }, { "int64", mxINT64_CLASS }, { "uint64", mxUINT64_CLASS }
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+        if (strcmp(name, classes[i].name) == 0)
+            return classes[i].cls;
+    return mxUNKNOWN_CLASS;
+}
+
+// class name of matrix_type (as mxGetClassName), "unknown" if unsupported
+static inline const char* shmem_class_name(unsigned long long matrix_type) {
+    static const struct { const char* name; unsigned long long cls; } classes[] = {
+        { "double", mxDOUBLE_CLASS }, { "single", mxSINGLE_CLASS }, { "logical", mxLOGICAL_CLASS }, { "char", mxCHAR_CLASS },
+        { "int8", mxINT8_CLASS }, { "uint8", mxUINT8_CLASS }, { "int16", mxINT16_CLASS }, { "uint16", mxUINT16_CLASS },
+        { "int32", mxINT32_CLASS }, { "uint32", mxUINT32_CLASS }, { "int64", mxINT64_CLASS }, { "uint64", mxUINT64_CLASS },
+        { "struct", mxSTRUCT_CLASS }, { "cell", mxCELL_CLASS }
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+        if (matrix_type == classes[i].cls)
+            return classes[i].name;
+    return "unknown";
+}
+
+// offsets of SPARSE_MATRIX_IR / SPARSE_MATRIX_JC relative to the beginning of payload
+static inline void shmem_sparse_offsets(unsigned long long nzmax, int data_size, unsigned long long* ofs_ir, unsigned long long* ofs_jc) {
+    *ofs_ir = nzmax * data_size + ARRAY_HEADER_SIZE;
+    *ofs_ir = INT_CEIL(*ofs_ir, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
+    *ofs_jc = *ofs_ir + nzmax * sizeof(mwIndex) + ARRAY_HEADER_SIZE;
+    *ofs_jc = INT_CEIL(*ofs_jc, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
+}
+
+/*
+ * Padded sizes of header and payload of a matrix, data_size is the size of an element (doubled for complex), nzmax is
+ * only used for sparse matrix
+ */
+static inline void shmem_layout_sizes(int data_size, unsigned long long array_attribute, unsigned int n_dims, const mwSize* dims, unsigned long long nzmax,
+                                      unsigned int* header_size_padded, unsigned long long* payload_size_padded) {
+    unsigned long long payload_size = 0;
+    unsigned int header_size = 36 + n_dims * 8;
+    if (array_attribute & ARRAY_SPARSE) {
+        // sparse array: Pr (Pi), Ir, Jc
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(nzmax, data_size, &ofs_ir, &ofs_jc);
+        payload_size = ofs_jc + (dims[1] + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE;
+        header_size += 8; // extra header for NZ_MAX
+    }
+    else {
+        // dense array
+        unsigned long long n_elements = 1;
+        for (unsigned int i = 0; i < n_dims; i++)
+            n_elements *= dims[i];
+        payload_size = ARRAY_HEADER_SIZE + n_elements * data_size;
+        if (array_attribute & ARRAY_ENCODED)
+            header_size += 24; // extra header for ENCODING, SCALE and OFFSET
+    }
+    *header_size_padded = INT_CEIL(header_size, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
+    *payload_size_padded = INT_CEIL(payload_size, SHMEM_DATA_PADDED_BYTES) * SHMEM_DATA_PADDED_BYTES;
+    SHMEM_DEBUG_OUTPUT("Header size: %d (padded: %d)\n", header_size, *header_size_padded);
+    SHMEM_DEBUG_OUTPUT("Payload size: %lld (padded: %lld)\n", payload_size, *payload_size_padded);
+}
+
+// header size including the STATISTICS block, header_size_padded is the size of the header without it
+static inline unsigned long long shmem_stats_header_size(unsigned long long header_size_padded) {
+    return INT_CEIL(header_size_padded, SHMEM_STATS_LINE_BYTES) * SHMEM_STATS_LINE_BYTES + SHMEM_STATS_BYTES;
+}
+
+// offset of STATISTICS in a header whose fields end at fields_size, returns 0 if it exceeds header_size
+static inline unsigned long long _shmem_stats_offset(unsigned long long fields_size, unsigned long long header_size) {
+    unsigned long long stats_offset = INT_CEIL(fields_size, SHMEM_STATS_LINE_BYTES) * SHMEM_STATS_LINE_BYTES;
+    return stats_offset + SHMEM_STATS_BYTES <= header_size ? stats_offset : 0;
+}
+
+/*
+ * Pad the header of a dense matrix so that ARRAY_DATA starts at a multiple of page (a power of 2, at least
+ * SHMEM_DATA_PADDED_BYTES), columns of a slice then start at a page boundary if the size of a column is a multiple of
+ * page. Columns themselves could not be padded, Matlab requires them to be contiguous.
+ * returns the padded header size, or header_size_padded if the padded header does not fit in HEADER_SIZE
+ */
+static inline unsigned int shmem_align_data_start(unsigned int header_size_padded, unsigned long long page) {
+    unsigned long long aligned = INT_CEIL(header_size_padded + ARRAY_HEADER_SIZE, page) * page - ARRAY_HEADER_SIZE;
+    return aligned > 0xffffffffULL ? header_size_padded : (unsigned int)aligned;
+}
+
+// offset of the first element of column col (0-based, all dimensions after the first one are columns) of a dense
+// matrix, relative to the matrix header
+static inline unsigned long long shmem_column_offset(const shmem_header_t* hdr, unsigned long long col) {
+    return hdr->header_size + ARRAY_HEADER_SIZE + col * shmem_header_dim(hdr, 0) * hdr->data_size;
+}
+
+// write matrix header to the beginning of shared memory, flag is MATRIX_FLAG (array attributes and segment flags)
+static inline void shmem_write_header(void* ptr, unsigned int header_size_padded, int data_class, unsigned long long flag, unsigned long long payload_size_padded,
+                                      unsigned int n_dims, const mwSize* dims, unsigned long long nzmax) {
+    SHMEM_WRITE_CAST(unsigned int, ptr, 0, SHMEM_MEMORY_LAYOUT_VERSION); // LAYOUT_VERSION
+    SHMEM_WRITE_CAST(unsigned int, ptr, 4, header_size_padded); // HEADER_SIZE
+    SHMEM_WRITE_CAST(unsigned long long, ptr, 8, data_class); // MATRIX_TYPE
+    SHMEM_WRITE_CAST(unsigned long long, ptr, 16, flag); // MATRIX_FLAG
+    SHMEM_WRITE_CAST(unsigned long long, ptr, 24, payload_size_padded); // PAYLOAD_SIZE
+    SHMEM_WRITE_CAST(unsigned int, ptr, 32, n_dims); // N_MATRIX_DIMENSION
+    for (unsigned int i = 0; i < n_dims; i++)
+        SHMEM_WRITE_CAST(unsigned long long, ptr, 36+i*8, dims[i]);
+    if (flag & ARRAY_SPARSE)
+        SHMEM_WRITE_CAST(unsigned long long, ptr, 36+n_dims*8, nzmax);
+}
+
+// write ENCODING, SCALE and OFFSET of a dense matrix header written by shmem_write_header with ARRAY_ENCODED set
+static inline void shmem_write_encoding(void* ptr, unsigned int n_dims, unsigned long long encoding, double scale, double offset) {
+    SHMEM_WRITE_CAST(unsigned long long, ptr, 36+n_dims*8, encoding);
+    SHMEM_WRITE_CAST(double, ptr, 44+n_dims*8, scale);
+    SHMEM_WRITE_CAST(double, ptr, 52+n_dims*8, offset);
+}
+
+/*
+ * Parse header at ptr, available is the number of readable bytes starting from ptr (fields up to NZ_MAX must be
+ * readable, or up to OFFSET if ARRAY_ENCODED is set, the padding and anything behind it are not required)
+ * returns NULL on success, or the error message
+ */
+static inline const char* shmem_parse_header(const void* ptr, unsigned long long available, shmem_header_t* hdr) {
+    if (available < 36)
+        return "Read invalid header size";
+    hdr->layout_version = SHMEM_READ_CAST(unsigned int, ptr, 0);
+    if (hdr->layout_version != SHMEM_MEMORY_LAYOUT_VERSION)
+        return "Read invalid memory layout version";
+    hdr->header_size = SHMEM_READ_CAST(unsigned int, ptr, 4);
+    hdr->matrix_type = SHMEM_READ_CAST(unsigned long long, ptr, 8);
+    unsigned long long flag = SHMEM_READ_CAST(unsigned long long, ptr, 16);
+    hdr->array_attribute = flag & ~SHMEM_FLAG_SEGMENT_MASK;
+    hdr->segment_flags = flag & SHMEM_FLAG_SEGMENT_MASK;
+    hdr->payload_size = SHMEM_READ_CAST(unsigned long long, ptr, 24);
+    hdr->n_dims = SHMEM_READ_CAST(unsigned int, ptr, 32);
+    hdr->dims = ((const char*)ptr) + 36;
+    if (hdr->header_size == 0 || hdr->n_dims == 0 || 36 + hdr->n_dims * 8ULL > hdr->header_size)
+        return "Read invalid header size";
+    if (36 + hdr->n_dims * 8ULL + 8 > available)
+        return "Header is not completely readable";
+    hdr->nzmax = 0;
+    hdr->encoding = SHMEM_ENCODING_NONE;
+    hdr->scale = 1;
+    hdr->offset = 0;
+    hdr->n_fields = 0;
+    hdr->n_blocks = 0;
+    hdr->stats_offset = 0;
+    if (shmem_is_bundle(hdr->matrix_type)) {
+        // bundle: field names and block offsets follow the dimensions
+        hdr->data_size = 0;
+        hdr->n_fields = SHMEM_READ_CAST(unsigned long long, ptr, 36 + hdr->n_dims * 8);
+        unsigned long long n_elements = 1;
+        for (unsigned int i = 0; i < hdr->n_dims; i++)
+            n_elements *= shmem_header_dim(hdr, i);
+        hdr->n_blocks = hdr->matrix_type == mxSTRUCT_CLASS ? n_elements * hdr->n_fields : n_elements;
+        if (hdr->matrix_type == mxCELL_CLASS && hdr->n_fields != 0)
+            return "Read invalid bundle header";
+        // checked one by one against overflow
+        unsigned long long toc_bytes = hdr->header_size - (36 + hdr->n_dims * 8ULL + 8);
+        if (36 + hdr->n_dims * 8ULL + 8 > hdr->header_size || hdr->n_fields > toc_bytes / SHMEM_BUNDLE_FIELD_NAME_BYTES ||
+            hdr->n_blocks > (toc_bytes - hdr->n_fields * SHMEM_BUNDLE_FIELD_NAME_BYTES) / 8)
+            return "Read invalid bundle header";
+        if (hdr->segment_flags & SHMEM_FLAG_STATS) {
+            hdr->stats_offset = _shmem_stats_offset(36 + hdr->n_dims * 8ULL + 8 + hdr->n_fields * SHMEM_BUNDLE_FIELD_NAME_BYTES + hdr->n_blocks * 8, hdr->header_size);
+            if (hdr->stats_offset == 0)
+                return "Read invalid header size";
+        }
+        hdr->total_size = hdr->header_size + hdr->payload_size;
+        return NULL;
+    }
+    hdr->data_size = shmem_class_size(hdr->matrix_type);
+    if (hdr->data_size == 0)
+        return "Read invalid matrix type";
+    if (hdr->array_attribute & ARRAY_COMPLEX)
+        hdr->data_size *= 2;
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        if (36 + hdr->n_dims * 8ULL + 8 > hdr->header_size)
+            return "Read invalid header size";
+        hdr->nzmax = SHMEM_READ_CAST(unsigned long long, ptr, 36 + hdr->n_dims * 8);
+    }
+    if (hdr->array_attribute & ARRAY_ENCODED) {
+        if (hdr->array_attribute & (ARRAY_SPARSE | ARRAY_COMPLEX | ARRAY_LOGICAL))
+            return "Read invalid encoded matrix attribute";
+        if (36 + hdr->n_dims * 8ULL + 24 > hdr->header_size)
+            return "Read invalid header size";
+        if (36 + hdr->n_dims * 8ULL + 24 > available)
+            return "Header is not completely readable";
+        hdr->encoding = SHMEM_READ_CAST(unsigned long long, ptr, 36 + hdr->n_dims * 8);
+        hdr->scale = SHMEM_READ_CAST(double, ptr, 44 + hdr->n_dims * 8);
+        hdr->offset = SHMEM_READ_CAST(double, ptr, 52 + hdr->n_dims * 8);
+        hdr->data_size = shmem_encoding_size(hdr->encoding);
+        if (hdr->data_size == 0)
+            return "Read invalid encoding";
+    }
+    if (hdr->segment_flags & SHMEM_FLAG_STATS) {
+        unsigned long long optional_size = (hdr->array_attribute & ARRAY_SPARSE) ? 8 : ((hdr->array_attribute & ARRAY_ENCODED) ? 24 : 0);
+        hdr->stats_offset = _shmem_stats_offset(36 + hdr->n_dims * 8ULL + optional_size, hdr->header_size);
+        if (hdr->stats_offset == 0)
+            return "Read invalid header size";
+    }
+    hdr->total_size = hdr->header_size + hdr->payload_size;
+    return NULL;
+}
+
+// size of a block in bundle (the header and payload of a matrix or bundle), padded to SHMEM_BUNDLE_ALIGN_BYTES
+static inline unsigned long long shmem_bundle_block_size(unsigned long long header_size, unsigned long long payload_size) {
+    return INT_CEIL(header_size + payload_size, SHMEM_BUNDLE_ALIGN_BYTES) * SHMEM_BUNDLE_ALIGN_BYTES;
+}
+
+// padded size of a bundle header (HEADER_SIZE is limited to 32 bits, checked by caller)
+static inline unsigned long long shmem_bundle_header_size(unsigned int n_dims, unsigned long long n_fields, unsigned long long n_blocks) {
+    unsigned long long header_size = 36 + n_dims * 8ULL + 8 + n_fields * SHMEM_BUNDLE_FIELD_NAME_BYTES + n_blocks * 8;
+    return INT_CEIL(header_size, SHMEM_BUNDLE_ALIGN_BYTES) * SHMEM_BUNDLE_ALIGN_BYTES;
+}
+
+// write bundle header (field names and block offsets are written by shmem_bundle_field_name / shmem_bundle_set_offset)
+static inline void shmem_write_bundle_header(void* ptr, unsigned int header_size_padded, int bundle_class, unsigned long long flag,
+                                             unsigned long long payload_size_padded, unsigned int n_dims, const mwSize* dims, unsigned long long n_fields) {
+    shmem_write_header(ptr, header_size_padded, bundle_class, flag, payload_size_padded, n_dims, dims, 0);
+    SHMEM_WRITE_CAST(unsigned long long, ptr, 36 + n_dims * 8, n_fields); // N_FIELDS
+}
+
+// the i-th field name of a parsed bundle header (ptr points to the bundle header), SHMEM_BUNDLE_FIELD_NAME_BYTES bytes
+static inline char* shmem_bundle_field_name(const shmem_header_t* hdr, void* ptr, unsigned long long i) {
+    return ((char*)ptr) + 36 + hdr->n_dims * 8ULL + 8 + i * SHMEM_BUNDLE_FIELD_NAME_BYTES;
+}
+
+static inline void shmem_bundle_set_offset(const shmem_header_t* hdr, void* ptr, unsigned long long i, unsigned long long block_offset) {
+    SHMEM_WRITE_CAST(unsigned long long, shmem_bundle_field_name(hdr, ptr, hdr->n_fields), i * 8, block_offset);
+}
+
+/*
+ * Offset of the i-th block of a parsed bundle header, relative to the bundle header
+ * returns 0 for an unassigned element, or if the block is outside of the bundle
+ */
+static inline unsigned long long shmem_bundle_offset(const shmem_header_t* hdr, const void* ptr, unsigned long long i) {
+    unsigned long long block_offset = SHMEM_READ_CAST(unsigned long long, shmem_bundle_field_name(hdr, (void*)ptr, hdr->n_fields), i * 8);
+    if (block_offset < hdr->header_size || block_offset >= hdr->total_size)
+        return 0;
+    return block_offset;
+}
+
+// offset of TRANSPOSED_MATRIX relative to the header of a sparse matrix with ARRAY_TRANSPOSE set
+static inline unsigned long long shmem_transpose_offset(const shmem_header_t* hdr) {
+    unsigned long long ofs_ir, ofs_jc;
+    shmem_sparse_offsets(hdr->nzmax, hdr->data_size, &ofs_ir, &ofs_jc);
+    return shmem_bundle_block_size(hdr->header_size, ofs_jc + (shmem_header_dim(hdr, 1) + 1) * sizeof(mwIndex) + ARRAY_HEADER_SIZE);
+}
+
+// number of bytes required by shmem_parse_header, reads n_dims and MATRIX_FLAG from at least 36 readable bytes
+static inline unsigned long long shmem_header_probe_size(const void* ptr) {
+    unsigned long long optional_size = (SHMEM_READ_CAST(unsigned long long, ptr, 16) & ARRAY_ENCODED) ? 24 : 8;
+    return 36 + SHMEM_READ_CAST(unsigned int, ptr, 32) * 8ULL + optional_size;
+}
+
+// class of the array attached to the payload of a parsed matrix header, the class of the codes if ARRAY_ENCODED is set
+static inline int shmem_storage_class(const shmem_header_t* hdr) {
+    if (hdr->array_attribute & ARRAY_ENCODED)
+        return shmem_encoding_class(hdr->encoding);
+    return (int)hdr->matrix_type;
+}
+
+#endif
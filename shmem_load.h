@@ -0,0 +1,497 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Streaming a matrix stored in a file into a new segment (load_shared_matrix)
+ *
+ * Supported files:
+ *   raw: elements without any header (after Offset bytes), class, dimensions and order are given by the caller
+ *   npy: NumPy format 1.0 - 3.0, little-endian bool / integer / float / complex dtypes, the dimensions and order are
+ *        read from the header
+ *
+ * The file is read by several threads, each claiming chunks of SHMEM_LOAD_CHUNK_BYTES in ascending order, so that the
+ * device sees several large requests in flight. A column-major (Fortran order) file is read straight into the
+ * segment. A row-major (C order) 2-D matrix is read a block of rows at a time into a private buffer and transposed into
+ * the columns of the segment by a cache-blocked kernel.
+ *
+ * Unbuffered reads (O_DIRECT / FILE_FLAG_NO_BUFFERING) bypass page cache, the file is not kept in memory next to the
+ * segment. Their offsets, sizes and buffers must be aligned to SHMEM_LOAD_DIRECT_ALIGN: aligned chunks are read into
+ * the segment directly if the segment and the file are aligned alike, other chunks go through an aligned buffer. A
+ * file system rejecting unbuffered reads falls back to buffered reads.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_LOAD_H_
+#define _SHARED_MATRIX_SHMEM_LOAD_H_
+
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_thread.h"
+
+#define SHMEM_LOAD_RAW 0
+#define SHMEM_LOAD_NPY 1
+// maximum number of dimensions of a source file
+#define SHMEM_LOAD_MAX_DIMS 32
+// maximum size of the header of a npy file
+#define SHMEM_LOAD_NPY_MAX_HEADER (1 << 20)
+// edge of the square tiles transposed by shmem_load_transpose_rows, a tile of double elements fits in L1 cache
+#define SHMEM_LOAD_TILE 32
+
+// description of the matrix stored in a source file
+typedef struct {
+    int data_class;
+    int complex_flag; // elements are interleaved (real, imaginary) pairs
+    int data_size; // size of an element in byte (doubled for complex)
+    unsigned int n_dims;
+    mwSize dims[SHMEM_LOAD_MAX_DIMS]; // dimensions of the matrix (column-major)
+    int c_order; // elements are stored row by row (2-D matrices only)
+    unsigned long long data_offset; // offset of the first element in the file
+} shmem_load_desc_t;
+
+static inline unsigned long long shmem_load_desc_bytes(const shmem_load_desc_t* desc) {
+    unsigned long long n = desc->data_size;
+    for (unsigned int i = 0; i < desc->n_dims; i++)
+        n *= desc->dims[i];
+    return n;
+}
+
+#if SHMEM_API == SHMEM_WIN_API
+typedef HANDLE shmem_load_file_t;
+#    define SHMEM_LOAD_NO_FILE INVALID_HANDLE_VALUE
+#elif SHMEM_API == SHMEM_POSIX_API
+typedef int shmem_load_file_t;
+#    define SHMEM_LOAD_NO_FILE (-1)
+#endif
+
+// open path for reading, unbuffered if direct is set, returns SHMEM_LOAD_NO_FILE on failure
+static inline shmem_load_file_t shmem_load_open(const char* path, int direct) {
+#if SHMEM_API == SHMEM_WIN_API
+    SHMEM_DEBUG_OUTPUT("API call: CreateFileA\n");
+    return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                       direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+#elif SHMEM_API == SHMEM_POSIX_API
+    int flags = O_RDONLY;
+    if (direct) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        return SHMEM_LOAD_NO_FILE;
+#endif
+    }
+    SHMEM_DEBUG_OUTPUT("API call: open\n");
+    return open(path, flags);
+#endif
+}
+
+static inline void shmem_load_close(shmem_load_file_t file) {
+    if (file == SHMEM_LOAD_NO_FILE)
+        return;
+#if SHMEM_API == SHMEM_WIN_API
+    CloseHandle(file);
+#elif SHMEM_API == SHMEM_POSIX_API
+    close(file);
+#endif
+}
+
+// size of the file in byte, returns 0 on success
+static inline int shmem_load_file_size(shmem_load_file_t file, unsigned long long* size) {
+#if SHMEM_API == SHMEM_WIN_API
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size))
+        return -1;
+    *size = (unsigned long long)file_size.QuadPart;
+#elif SHMEM_API == SHMEM_POSIX_API
+    struct stat st;
+    if (fstat(file, &st) != 0)
+        return -1;
+    *size = (unsigned long long)st.st_size;
+#endif
+    return 0;
+}
+
+/*
+ * Read size bytes at offset into buf, stops early at the end of file
+ * returns the number of bytes read, or -1 on failure (*err is set to errno / GetLastError)
+ */
+static inline long long shmem_load_pread(shmem_load_file_t file, void* buf, unsigned long long size, unsigned long long offset, int* err) {
+    unsigned long long done = 0;
+    while (done < size) {
+        unsigned long long request = size - done;
+        if (request > (1ULL << 30))
+            request = 1ULL << 30;
+#if SHMEM_API == SHMEM_WIN_API
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)((offset + done) & 0xffffffff);
+        ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+        DWORD n_read = 0;
+        if (!ReadFile(file, (char*)buf + done, (DWORD)request, &n_read, &ov)) {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+            *err = (int)GetLastError();
+            return -1;
+        }
+#elif SHMEM_API == SHMEM_POSIX_API
+        ssize_t n_read = pread(file, (char*)buf + done, (size_t)request, (off_t)(offset + done));
+        if (n_read < 0) {
+            if (errno == EINTR)
+                continue;
+            *err = errno;
+            return -1;
+        }
+#endif
+        if (n_read == 0)
+            break;
+        done += (unsigned long long)n_read;
+    }
+    return (long long)done;
+}
+
+// dtype of a npy file (e.g. "<f8") to class id and element size, returns 0 if it is not supported
+static inline int _shmem_load_npy_dtype(const char* descr, int* data_class, int* complex_flag) {
+    static const struct { char kind; int size; int cls; int complex_flag; } dtypes[] = {
+        { 'b', 1, mxLOGICAL_CLASS, 0 }, { 'i', 1, mxINT8_CLASS, 0 }, { 'u', 1, mxUINT8_CLASS, 0 },
+        { 'i', 2, mxINT16_CLASS, 0 }, { 'u', 2, mxUINT16_CLASS, 0 }, { 'i', 4, mxINT32_CLASS, 0 },
+        { 'u', 4, mxUINT32_CLASS, 0 }, { 'i', 8, mxINT64_CLASS, 0 }, { 'u', 8, mxUINT64_CLASS, 0 },
+        { 'f', 4, mxSINGLE_CLASS, 0 }, { 'f', 8, mxDOUBLE_CLASS, 0 }, { 'c', 8, mxSINGLE_CLASS, 1 },
+        { 'c', 16, mxDOUBLE_CLASS, 1 }
+    };
+    char order = descr[0], kind = descr[1];
+    int size = atoi(descr + 2);
+    // matlab runs on little-endian machines only, "|" is used for single byte types
+    if (order != '<' && order != '|' && order != '=' && !(order == '>' && size == 1))
+        return 0;
+    for (size_t i = 0; i < sizeof(dtypes) / sizeof(dtypes[0]); i++)
+        if (dtypes[i].kind == kind && dtypes[i].size == size) {
+            *data_class = dtypes[i].cls;
+            *complex_flag = dtypes[i].complex_flag;
+            return 1;
+        }
+    return 0;
+}
+
+// value of key in the header dictionary of a npy file (pointer after the colon), NULL if it is missing
+static inline const char* _shmem_load_npy_value(const char* dict, const char* key) {
+    const char* p = strstr(dict, key);
+    if (p == NULL)
+        return NULL;
+    p = strchr(p + strlen(key), ':');
+    if (p == NULL)
+        return NULL;
+    for (p++; *p == ' '; p++);
+    return p;
+}
+
+/*
+ * Parse the header dictionary of a npy file, e.g. {'descr': '<f8', 'fortran_order': False, 'shape': (3, 4), }
+ * returns NULL on success, or an error message
+ */
+static inline const char* shmem_load_npy_dict(const char* dict, shmem_load_desc_t* desc) {
+    const char* descr = _shmem_load_npy_value(dict, "'descr'");
+    const char* fortran_order = _shmem_load_npy_value(dict, "'fortran_order'");
+    const char* shape = _shmem_load_npy_value(dict, "'shape'");
+    if (descr == NULL || fortran_order == NULL || shape == NULL || (*descr != '\'' && *descr != '"') || *shape != '(')
+        return "Invalid npy header";
+    char dtype[16];
+    size_t n = 0;
+    for (descr++; *descr && *descr != '\'' && *descr != '"' && n < sizeof(dtype) - 1; descr++)
+        dtype[n++] = *descr;
+    dtype[n] = 0;
+    if (n < 3 || !_shmem_load_npy_dtype(dtype, &desc->data_class, &desc->complex_flag))
+        return "Unsupported npy dtype, only little-endian bool, integer, float and complex types are supported";
+#ifndef SHMEM_COMPLEX_SUPPORTED
+    if (desc->complex_flag)
+        return "Complex array is not supported before R2018a";
+#endif
+    desc->data_size = shmem_class_size(desc->data_class) * (desc->complex_flag ? 2 : 1);
+    desc->c_order = strncmp(fortran_order, "True", 4) != 0;
+    unsigned int n_dims = 0;
+    unsigned long long npy_dims[SHMEM_LOAD_MAX_DIMS];
+    for (const char* p = shape + 1; *p && *p != ')';) {
+        if (*p == ' ' || *p == ',') {
+            p++;
+            continue;
+        }
+        char* end = NULL;
+        unsigned long long dim = strtoull(p, &end, 10);
+        if (end == p || n_dims == SHMEM_LOAD_MAX_DIMS)
+            return "Invalid npy shape";
+        if (*end == 'L')
+            end++; // long integers written by Python 2
+        npy_dims[n_dims++] = dim;
+        p = end;
+    }
+    // a scalar is 1 x 1, a vector is a column
+    desc->n_dims = n_dims < 2 ? 2 : n_dims;
+    desc->dims[0] = n_dims > 0 ? (mwSize)npy_dims[0] : 1;
+    desc->dims[1] = n_dims > 1 ? (mwSize)npy_dims[1] : 1;
+    for (unsigned int i = 2; i < n_dims; i++)
+        desc->dims[i] = (mwSize)npy_dims[i];
+    if (n_dims < 2)
+        desc->c_order = 0;
+    if (desc->c_order && n_dims > 2)
+        return "C order npy arrays of more than 2 dimensions are not supported, save them by numpy.asfortranarray";
+    return NULL;
+}
+
+/*
+ * Read the header of a npy file
+ * returns NULL on success, or an error message
+ */
+static inline const char* shmem_load_npy_header(shmem_load_file_t file, shmem_load_desc_t* desc) {
+    unsigned char prefix[12];
+    int err = 0;
+    if (shmem_load_pread(file, prefix, sizeof(prefix), 0, &err) != (long long)sizeof(prefix) || memcmp(prefix, "\x93NUMPY", 6) != 0)
+        return "Not a npy file";
+    unsigned long long header_len = 0, dict_offset = 0;
+    if (prefix[6] == 1) {
+        header_len = prefix[8] | ((unsigned long long)prefix[9] << 8);
+        dict_offset = 10;
+    }
+    else if (prefix[6] == 2 || prefix[6] == 3) {
+        header_len = prefix[8] | ((unsigned long long)prefix[9] << 8) | ((unsigned long long)prefix[10] << 16) | ((unsigned long long)prefix[11] << 24);
+        dict_offset = 12;
+    }
+    else {
+        return "Unsupported npy format version";
+    }
+    if (header_len == 0 || header_len > SHMEM_LOAD_NPY_MAX_HEADER)
+        return "Invalid npy header size";
+    char* dict = (char*)malloc(header_len + 1);
+    if (dict == NULL)
+        return "Malloc failed to allocate new memory";
+    const char* err_msg = NULL;
+    if (shmem_load_pread(file, dict, header_len, dict_offset, &err) != (long long)header_len) {
+        err_msg = "Invalid npy header";
+    }
+    else {
+        dict[header_len] = 0;
+        err_msg = shmem_load_npy_dict(dict, desc);
+    }
+    free(dict);
+    desc->data_offset = dict_offset + header_len;
+    return err_msg;
+}
+
+/*
+ * Transpose n_block_rows rows of a row-major n_rows x n_cols matrix (src, the rows of the block only) into rows
+ * [first_row, first_row + n_block_rows) of the column-major matrix dst, elements of data_size bytes
+ */
+#define _SHMEM_LOAD_TRANSPOSE_KERNEL(type, n_words) \
+    for (unsigned long long jj = 0; jj < n_cols; jj += SHMEM_LOAD_TILE) { \
+        unsigned long long j_end = jj + SHMEM_LOAD_TILE < n_cols ? jj + SHMEM_LOAD_TILE : n_cols; \
+        for (unsigned long long ii = 0; ii < n_block_rows; ii += SHMEM_LOAD_TILE) { \
+            unsigned long long i_end = ii + SHMEM_LOAD_TILE < n_block_rows ? ii + SHMEM_LOAD_TILE : n_block_rows; \
+            for (unsigned long long j = jj; j < j_end; j++) { \
+                type* d = (type*)dst + (j * n_rows + first_row) * (n_words); \
+                const type* s = (const type*)src + j * (n_words); \
+                for (unsigned long long i = ii; i < i_end; i++) \
+                    for (int w = 0; w < (n_words); w++) \
+                        d[i * (n_words) + w] = s[i * n_cols * (n_words) + w]; \
+            } \
+        } \
+    }
+static inline void shmem_load_transpose_rows(const char* src, char* dst, unsigned long long n_rows, unsigned long long n_cols,
+                                             unsigned long long first_row, unsigned long long n_block_rows, int data_size) {
+    if (data_size == 1) {
+        _SHMEM_LOAD_TRANSPOSE_KERNEL(unsigned char, 1);
+    }
+    else if (data_size == 2) {
+        _SHMEM_LOAD_TRANSPOSE_KERNEL(unsigned short, 1);
+    }
+    else if (data_size == 4) {
+        _SHMEM_LOAD_TRANSPOSE_KERNEL(unsigned int, 1);
+    }
+    else if (data_size == 8) {
+        _SHMEM_LOAD_TRANSPOSE_KERNEL(unsigned long long, 1);
+    }
+    else if (data_size == 16) {
+        _SHMEM_LOAD_TRANSPOSE_KERNEL(unsigned long long, 2);
+    }
+}
+#undef _SHMEM_LOAD_TRANSPOSE_KERNEL
+
+typedef struct {
+    shmem_load_file_t file; // buffered
+    shmem_load_file_t direct_file; // unbuffered, SHMEM_LOAD_NO_FILE if unavailable
+    const shmem_load_desc_t* desc;
+    char* dst; // first element in the segment
+    unsigned long long total; // bytes of the elements
+    unsigned long long n_rows, n_cols; // of the matrix (C order only)
+    unsigned long long rows_per_block; // C order only
+    unsigned long long block_bytes; // bytes of the file read at once (rows_per_block rows for C order)
+    unsigned long long n_blocks;
+    volatile long long next_block;
+    volatile int direct_failed; // the file system rejected an unbuffered read
+    volatile int error; // errno / GetLastError of the first failed read, -1 if the file is truncated
+} shmem_load_job_t;
+
+typedef struct {
+    shmem_load_job_t* job;
+    int index;
+    int n_threads;
+} _shmem_load_worker_t;
+
+static inline int _shmem_load_failed(shmem_load_job_t* job, int err) {
+#ifdef _MSC_VER
+    InterlockedCompareExchange((volatile LONG*)&job->error, (LONG)err, 0);
+#else
+    int expected = 0;
+    __atomic_compare_exchange_n(&job->error, &expected, err, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+    return -1;
+}
+
+/*
+ * Read size bytes at offset of the file to dst, through the aligned buffer bounce (block_bytes + 2 *
+ * SHMEM_LOAD_DIRECT_ALIGN bytes) if the read is unbuffered and not aligned, dst may point into bounce at the alignment
+ * of offset
+ * returns 0 on success, -1 on failure (job->error is set)
+ */
+static inline int _shmem_load_read(shmem_load_job_t* job, char* dst, unsigned long long size, unsigned long long offset, char* bounce) {
+    int err = 0;
+    long long n_read;
+    if (job->direct_file != SHMEM_LOAD_NO_FILE && !job->direct_failed) {
+        const unsigned long long align = SHMEM_LOAD_DIRECT_ALIGN;
+        if (offset % align == 0 && size % align == 0 && (unsigned long long)(size_t)dst % align == 0) {
+            n_read = shmem_load_pread(job->direct_file, dst, size, offset, &err);
+            if (n_read == (long long)size)
+                return 0;
+        }
+        else {
+            unsigned long long aligned_begin = offset / align * align;
+            unsigned long long aligned_size = INT_CEIL(offset + size - aligned_begin, align) * align;
+            n_read = shmem_load_pread(job->direct_file, bounce, aligned_size, aligned_begin, &err);
+            if (n_read >= (long long)(offset + size - aligned_begin)) {
+                if (dst != bounce + (offset - aligned_begin))
+                    memcpy(dst, bounce + (offset - aligned_begin), (size_t)size);
+                return 0;
+            }
+        }
+        if (n_read >= 0)
+            return _shmem_load_failed(job, -1);
+#if SHMEM_API == SHMEM_POSIX_API
+        if (err != EINVAL)
+#else
+        if (err != ERROR_INVALID_PARAMETER)
+#endif
+            return _shmem_load_failed(job, err);
+        // alignment is not accepted by the file system, read through page cache from now on
+        job->direct_failed = 1;
+    }
+    n_read = shmem_load_pread(job->file, dst, size, offset, &err);
+    if (n_read < 0)
+        return _shmem_load_failed(job, err);
+    return n_read == (long long)size ? 0 : _shmem_load_failed(job, -1);
+}
+
+static void _shmem_load_worker(void* arg) {
+    _shmem_load_worker_t* worker = (_shmem_load_worker_t*)arg;
+    shmem_load_job_t* job = worker->job;
+    const shmem_load_desc_t* desc = job->desc;
+    if (worker->n_threads > 1)
+        shmem_thread_bind_spread(worker->index, worker->n_threads);
+    // aligned buffer for unbuffered reads and rows of C order
+    char* buffer = NULL;
+    char* bounce = NULL;
+    if (job->direct_file != SHMEM_LOAD_NO_FILE || desc->c_order) {
+        buffer = (char*)malloc((size_t)(job->block_bytes + 3 * SHMEM_LOAD_DIRECT_ALIGN));
+        if (buffer == NULL) {
+            _shmem_load_failed(job, ENOMEM);
+            return;
+        }
+        bounce = (char*)(size_t)(INT_CEIL((unsigned long long)(size_t)buffer, SHMEM_LOAD_DIRECT_ALIGN) * SHMEM_LOAD_DIRECT_ALIGN);
+    }
+    while (!job->error) {
+#ifdef _MSC_VER
+        long long block = InterlockedIncrement64((volatile LONG64*)&job->next_block) - 1;
+#else
+        long long block = __atomic_fetch_add(&job->next_block, 1, __ATOMIC_SEQ_CST);
+#endif
+        if (block >= (long long)job->n_blocks)
+            break;
+        unsigned long long begin = (unsigned long long)block * job->block_bytes;
+        unsigned long long size = job->total - begin < job->block_bytes ? job->total - begin : job->block_bytes;
+        if (!desc->c_order) {
+            _shmem_load_read(job, job->dst + begin, size, desc->data_offset + begin, bounce);
+            continue;
+        }
+        // rows are read to the buffer at the alignment of their file offset (in place for unbuffered reads), then
+        // transposed
+        char* rows_ptr = bounce + (desc->data_offset + begin) % SHMEM_LOAD_DIRECT_ALIGN;
+        if (_shmem_load_read(job, rows_ptr, size, desc->data_offset + begin, bounce) == 0) {
+            unsigned long long first_row = (unsigned long long)block * job->rows_per_block;
+            shmem_load_transpose_rows(rows_ptr, job->dst, job->n_rows, job->n_cols, first_row, size / (job->n_cols * desc->data_size), desc->data_size);
+        }
+    }
+    free(buffer);
+}
+
+/*
+ * Read the elements of the file described by desc into dst using n_threads threads (0: automatic selection)
+ * *direct is cleared if unbuffered reads are not used
+ * returns 0 on success, errno / GetLastError of the failed read, -1 if the file is truncated, or ENOMEM
+ */
+static inline int shmem_load_parallel_read(const char* path, const shmem_load_desc_t* desc, char* dst, int* direct, int* n_threads) {
+    shmem_load_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.desc = desc;
+    job.dst = dst;
+    job.total = shmem_load_desc_bytes(desc);
+    job.file = shmem_load_open(path, 0);
+    if (job.file == SHMEM_LOAD_NO_FILE)
+#if SHMEM_API == SHMEM_WIN_API
+        return (int)GetLastError();
+#else
+        return errno;
+#endif
+    job.direct_file = *direct ? shmem_load_open(path, 1) : SHMEM_LOAD_NO_FILE;
+#if SHMEM_API == SHMEM_POSIX_API && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(job.file, (off_t)desc->data_offset, (off_t)job.total, POSIX_FADV_SEQUENTIAL);
+#endif
+    job.block_bytes = SHMEM_LOAD_CHUNK_BYTES;
+    if (desc->c_order) {
+        job.n_rows = desc->dims[0];
+        job.n_cols = desc->dims[1];
+        unsigned long long row_bytes = job.n_cols * desc->data_size;
+        job.rows_per_block = row_bytes > 0 && row_bytes < SHMEM_LOAD_CHUNK_BYTES ? SHMEM_LOAD_CHUNK_BYTES / row_bytes : 1;
+        job.block_bytes = job.rows_per_block * (row_bytes > 0 ? row_bytes : 1);
+    }
+    job.n_blocks = job.total > 0 ? INT_CEIL(job.total, job.block_bytes) : 0;
+
+    // reads are overlapped by all threads, a thread for every chunk at most
+    int threads = *n_threads;
+    if (threads <= 0) {
+        threads = shmem_cpu_count();
+        if (threads > SHMEM_COPY_MAX_AUTO_THREADS) threads = SHMEM_COPY_MAX_AUTO_THREADS;
+    }
+    if ((unsigned long long)threads > job.n_blocks)
+        threads = job.n_blocks > 0 ? (int)job.n_blocks : 1;
+    _shmem_load_worker_t static_workers[MAX_STATIC_ALLOCATED_THREADS];
+    _shmem_load_worker_t* workers = static_workers;
+    if (threads > MAX_STATIC_ALLOCATED_THREADS) {
+        workers = (_shmem_load_worker_t*)malloc(sizeof(_shmem_load_worker_t) * threads);
+        if (workers == NULL) {
+            workers = static_workers;
+            threads = 1;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        workers[i].job = &job;
+        workers[i].index = i;
+        workers[i].n_threads = threads;
+    }
+    SHMEM_DEBUG_OUTPUT("Parallel read: %lld bytes, %d threads, direct: %d, C order: %d\n", job.total, threads, job.direct_file != SHMEM_LOAD_NO_FILE, desc->c_order);
+    shmem_parallel_run(threads, _shmem_load_worker, workers, sizeof(_shmem_load_worker_t));
+    if (workers != static_workers)
+        free(workers);
+    *direct = job.direct_file != SHMEM_LOAD_NO_FILE && !job.direct_failed;
+    *n_threads = threads;
+    shmem_load_close(job.direct_file);
+    shmem_load_close(job.file);
+    return job.error;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * NUMA placement of new segments (option Numa of create_shared_matrix / allocate_shared_matrix, Linux only)
+ *
+ * "none": pages are placed by the default policy of the kernel (the node of the thread touching them first)
+ * "interleave": pages are interleaved across NumaNodes (all online nodes by default)
+ * "bind": pages are allocated on NumaNodes only (required)
+ * "columns": the columns of a dense matrix are split into one contiguous block for each node of NumaNodes (all online
+ *            nodes by default, in ascending order), block k is preferably allocated on the k-th node, the header and
+ *            the page shared by two blocks belong to the former block
+ *
+ * The policy is set on the shared memory object by mbind before the payload is written, it applies to every process
+ * mapping the segment. It is recorded in the STATISTICS block (NUMA_POLICY and NUMA_NODES, see shmem_stats.h) and
+ * reported by shared_matrix_stats, so that workers can be pinned to the node of the columns they process.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_NUMA_H_
+#define _SHARED_MATRIX_SHMEM_NUMA_H_
+
+#include "compiler_def.h"
+#include "shmem_stats.h"
+
+#if SHMEM_API == SHMEM_POSIX_API
+#    include <sys/syscall.h>
+#endif
+
+#define SHMEM_NUMA_NONE       0
+#define SHMEM_NUMA_INTERLEAVE 1
+#define SHMEM_NUMA_BIND       2
+#define SHMEM_NUMA_COLUMNS    3
+// nodes are recorded as a 64-bit mask
+#define SHMEM_NUMA_MAX_NODES  64
+
+// memory policy modes and flags of mbind (linux/mempolicy.h)
+#define _SHMEM_MPOL_PREFERRED  1
+#define _SHMEM_MPOL_BIND       2
+#define _SHMEM_MPOL_INTERLEAVE 3
+#define _SHMEM_MPOL_MF_MOVE    (1 << 1)
+
+typedef struct {
+    int policy;
+    unsigned long long nodes; // bit i: node i
+} shmem_numa_t;
+
+static inline int shmem_numa_from_name(const char* name) {
+    static const char* names[] = { "none", "interleave", "bind", "columns" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+static inline const char* shmem_numa_name(int policy) {
+    static const char* names[] = { "none", "interleave", "bind", "columns" };
+    return policy >= 0 && policy < (int)(sizeof(names) / sizeof(names[0])) ? names[policy] : "unknown";
+}
+
+static inline int shmem_numa_count(unsigned long long nodes) {
+    int n = 0;
+    for (; nodes; nodes &= nodes - 1)
+        n++;
+    return n;
+}
+
+// mask of online nodes (/sys/devices/system/node/online, e.g. "0-3,6"), node 0 only if unknown
+static inline unsigned long long shmem_numa_online_nodes(void) {
+    unsigned long long nodes = 0;
+#if SHMEM_API == SHMEM_POSIX_API
+    char buf[256];
+    int fd = open("/sys/devices/system/node/online", O_RDONLY);
+    if (fd != -1) {
+        ssize_t n_read = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        buf[n_read > 0 ? n_read : 0] = 0;
+        for (char* p = buf; *p >= '0' && *p <= '9';) {
+            unsigned long first = strtoul(p, &p, 10), last = first;
+            if (*p == '-')
+                last = strtoul(p + 1, &p, 10);
+            for (unsigned long i = first; i <= last && i < SHMEM_NUMA_MAX_NODES; i++)
+                nodes |= 1ULL << i;
+            if (*p == ',')
+                p++;
+        }
+    }
+#endif
+    return nodes ? nodes : 1;
+}
+
+/*
+ * Read options Numa and NumaNodes (node ids, 0-based) to numa, raises matlab error if they are invalid
+ * returns 1 if a policy other than "none" is requested
+ */
+static inline int shmem_option_numa(const mxArray* options, shmem_numa_t* numa) {
+    char policy_name[16];
+    shmem_option_string(options, "Numa", policy_name, sizeof(policy_name), "none");
+    numa->policy = shmem_numa_from_name(policy_name);
+    numa->nodes = 0;
+    if (numa->policy < 0)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Numa must be \"none\", \"interleave\", \"bind\" or \"columns\"");
+    if (numa->policy == SHMEM_NUMA_NONE)
+        return 0;
+    unsigned long long online = shmem_numa_online_nodes();
+    const mxArray* node_ids = mxGetField(options, 0, "NumaNodes");
+    if (node_ids != NULL && !mxIsEmpty(node_ids)) {
+        if (!mxIsDouble(node_ids) || mxIsComplex(node_ids))
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option NumaNodes must be a double vector of node ids");
+        const double* ids = mxGetPr(node_ids);
+        for (size_t i = 0; i < mxGetNumberOfElements(node_ids); i++) {
+            if (ids[i] < 0 || ids[i] >= SHMEM_NUMA_MAX_NODES || ids[i] != (double)(int)ids[i] || !(online & (1ULL << (int)ids[i])))
+                mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "NUMA node %g is not online", ids[i]);
+            numa->nodes |= 1ULL << (int)ids[i];
+        }
+    }
+    else if (numa->policy == SHMEM_NUMA_BIND) {
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option NumaNodes is required by Numa \"bind\"");
+    }
+    else {
+        numa->nodes = online;
+    }
+    return 1;
+}
+
+// columns [*first, *last) of block k of n_blocks, for n_cols columns split by policy "columns"
+static inline void shmem_numa_column_block(unsigned long long n_cols, int n_blocks, int k, unsigned long long* first, unsigned long long* last) {
+    *first = n_cols * k / n_blocks;
+    *last = n_cols * (k + 1) / n_blocks;
+}
+
+#if SHMEM_API == SHMEM_POSIX_API
+static inline int _shmem_numa_mbind(char* ptr, unsigned long long length, int mode, unsigned long long nodes) {
+    if (length == 0)
+        return 0;
+    unsigned long mask[SHMEM_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    for (int i = 0; i < SHMEM_NUMA_MAX_NODES; i++)
+        if (nodes & (1ULL << i))
+            mask[i / (8 * sizeof(unsigned long))] |= 1UL << (i % (8 * sizeof(unsigned long)));
+    SHMEM_DEBUG_OUTPUT("API call: mbind (mode %d, nodes %llx, %lld bytes)\n", mode, nodes, length);
+    // maxnode is one more than the number of bits of mask (the kernel drops the last bit)
+    if (syscall(SYS_mbind, ptr, (unsigned long)length, mode, mask, (unsigned long)SHMEM_NUMA_MAX_NODES + 1, _SHMEM_MPOL_MF_MOVE) != 0)
+        return errno;
+    return 0;
+}
+#endif
+
+/*
+ * Apply numa to the segment mapped at ptr (total_size bytes, mapped with pages of page_size bytes), before the pages are
+ * written. For "columns", the payload has n_cols columns of column_bytes bytes starting at data_offset.
+ * returns 0 on success, or errno of mbind (ENOSYS if NUMA placement is not supported)
+ */
+static inline int shmem_numa_apply(void* ptr, unsigned long long total_size, unsigned long long page_size, const shmem_numa_t* numa,
+                                   unsigned long long data_offset, unsigned long long column_bytes, unsigned long long n_cols) {
+#if SHMEM_API == SHMEM_POSIX_API
+    char* base = (char*)ptr;
+    unsigned long long length = INT_CEIL(total_size, page_size) * page_size;
+    if (numa->policy == SHMEM_NUMA_INTERLEAVE)
+        return _shmem_numa_mbind(base, length, _SHMEM_MPOL_INTERLEAVE, numa->nodes);
+    if (numa->policy == SHMEM_NUMA_BIND)
+        return _shmem_numa_mbind(base, length, _SHMEM_MPOL_BIND, numa->nodes);
+    if (numa->policy == SHMEM_NUMA_COLUMNS) {
+        int n_blocks = shmem_numa_count(numa->nodes);
+        unsigned long long begin = 0;
+        int node = -1;
+        for (int k = 0; k < n_blocks; k++) {
+            do node++; while (!(numa->nodes & (1ULL << node)));
+            unsigned long long first, last;
+            shmem_numa_column_block(n_cols, n_blocks, k, &first, &last);
+            // the block ends at the first page starting after its last column
+            unsigned long long end = k == n_blocks - 1 ? length : INT_CEIL(data_offset + last * column_bytes, page_size) * page_size;
+            if (end > length)
+                end = length;
+            if (end > begin) {
+                int ret = _shmem_numa_mbind(base + begin, end - begin, _SHMEM_MPOL_PREFERRED, 1ULL << node);
+                if (ret)
+                    return ret;
+                begin = end;
+            }
+        }
+    }
+    return 0;
+#else
+    (void)ptr; (void)total_size; (void)page_size; (void)data_offset; (void)column_bytes; (void)n_cols;
+    return numa->policy == SHMEM_NUMA_NONE ? 0 : ENOSYS;
+#endif
+}
+
+// record numa in STATISTICS (no-op if stats is NULL)
+static inline void shmem_numa_record(char* stats, const shmem_numa_t* numa) {
+    if (stats == NULL)
+        return;
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_NUMA_POLICY, (unsigned long long)numa->policy);
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_NUMA_NODES, numa->policy == SHMEM_NUMA_NONE ? 0 : numa->nodes);
+}
+
+/*
+ * Set up numa placement of a new segment, falls back to "none" with a warning if the placement fails, the policy is
+ * recorded by shmem_numa_record once the header is written
+ */
+static inline void shmem_numa_setup(void* ptr, unsigned long long total_size, unsigned long long segment_flags, shmem_numa_t* numa,
+                                    unsigned long long data_offset, unsigned long long column_bytes, unsigned long long n_cols) {
+    if (numa->policy == SHMEM_NUMA_NONE)
+        return;
+    unsigned long long page_size = shmem_flag_page_size(segment_flags) ? shmem_flag_page_size(segment_flags) : shmem_page_size();
+    int ret = shmem_numa_apply(ptr, total_size, page_size, numa, data_offset, column_bytes, n_cols);
+    if (ret) {
+        mexWarnMsgIdAndTxt("SharedMatrix:NumaFallback", "NUMA placement \"%s\" failed (errno: %d), using the default placement instead",
+                           shmem_numa_name(numa->policy), ret);
+        numa->policy = SHMEM_NUMA_NONE;
+        numa->nodes = 0;
+    }
+}
+
+#endif
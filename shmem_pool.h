@@ -0,0 +1,233 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Pool of released shared memory objects, reused by create_shared_matrix (option Pool, POSIX API only)
+ *
+ * A segment created with option Pool is sized to a size class (64 KB, then four classes between consecutive powers of
+ * two, at most 25% larger than requested) and flagged with SHMEM_FLAG_POOLED. When the host drops the last reference
+ * of such a segment, its header is invalidated and the object is renamed to
+ *   /dev/shm/SHMEM_POOL_PREFIX<class bytes>_<pid>_<nanoseconds>
+ * instead of being unlinked. Its pages stay allocated in tmpfs, the next create of the same size class in any process
+ * renames it to the new name (rename is atomic, only one process can claim an entry) and maps it with MAP_POPULATE,
+ * which skips zeroing new pages and the page faults of the first touch.
+ *
+ * Pooled objects are not listed as shared matrices (their header is invalid). They are kept until they are reused, the
+ * pool exceeds its cap (the oldest are removed first) or they are trimmed by shared_matrix_gc with option PoolBytes, the
+ * pool is not emptied automatically when Matlab exits.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_POOL_H_
+#define _SHARED_MATRIX_SHMEM_POOL_H_
+
+#include "compiler_def.h"
+#include "shmem_segment.h"
+#include "shmem_stats.h"
+
+// name prefix of pooled shared memory objects
+#define SHMEM_POOL_PREFIX "shared_matrix_pool_"
+// smallest size class
+#define SHMEM_POOL_MIN_CLASS (64ULL << 10)
+// default cap of the bytes kept in the pool
+#define SHMEM_POOL_DEFAULT_BYTES (1ULL << 30)
+
+// size class holding size bytes
+static inline unsigned long long shmem_pool_class_size(unsigned long long size) {
+    if (size <= SHMEM_POOL_MIN_CLASS)
+        return SHMEM_POOL_MIN_CLASS;
+    unsigned long long power = SHMEM_POOL_MIN_CLASS;
+    while (power <= size / 2)
+        power *= 2;
+    unsigned long long step = power / 4;
+    return INT_CEIL(size, step) * step;
+}
+
+typedef struct {
+    char name[MAX_SHMEM_NAME_LENGTH];
+    unsigned long long bytes;
+    double changed; // time of returning to the pool in seconds since 1970-01-01 UTC
+} shmem_pool_entry_t;
+
+typedef struct {
+    shmem_pool_entry_t* items; // oldest first
+    size_t n;
+    size_t capacity;
+} shmem_pool_list_t;
+
+static inline void shmem_pool_list_free(shmem_pool_list_t* list) {
+    free(list->items);
+    list->items = NULL;
+    list->n = list->capacity = 0;
+}
+
+#if SHMEM_API == SHMEM_POSIX_API
+#include <sys/stat.h>
+
+// path of a shared memory object name
+static inline int _shmem_pool_path(const char* name, char* path, size_t len) {
+    int n = snprintf(path, len, SHMEM_POSIX_SHM_DIR "/%s", *name == '/' ? name + 1 : name);
+    return n > 0 && (size_t)n < len ? 0 : -1;
+}
+
+static int _shmem_pool_entry_compare(const void* a, const void* b) {
+    double x = ((const shmem_pool_entry_t*)a)->changed, y = ((const shmem_pool_entry_t*)b)->changed;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// list the pooled objects of size class bytes (0: all), oldest first
+static inline void shmem_pool_scan(shmem_pool_list_t* list, unsigned long long bytes) {
+    DIR* d = opendir(SHMEM_POSIX_SHM_DIR);
+    if (d == NULL)
+        return;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        unsigned long long entry_bytes = 0;
+        if (strncmp(ent->d_name, SHMEM_POOL_PREFIX, sizeof(SHMEM_POOL_PREFIX) - 1) != 0 ||
+            sscanf(ent->d_name + sizeof(SHMEM_POOL_PREFIX) - 1, "%llu_", &entry_bytes) != 1 || (bytes != 0 && entry_bytes != bytes))
+            continue;
+        if (list->n == list->capacity) {
+            size_t capacity = list->capacity ? list->capacity * 2 : 16;
+            shmem_pool_entry_t* items = (shmem_pool_entry_t*)realloc(list->items, sizeof(shmem_pool_entry_t) * capacity);
+            if (items == NULL)
+                break;
+            list->items = items;
+            list->capacity = capacity;
+        }
+        shmem_pool_entry_t* entry = &list->items[list->n];
+        char path[MAX_SHMEM_NAME_LENGTH];
+        struct stat st;
+        if (snprintf(entry->name, sizeof(entry->name), "%s", ent->d_name) >= (int)sizeof(entry->name) ||
+            _shmem_pool_path(entry->name, path, sizeof(path)) || stat(path, &st) != 0)
+            continue; // taken by another process meanwhile
+        entry->bytes = (unsigned long long)st.st_size;
+        entry->changed = st.st_ctim.tv_sec + st.st_ctim.tv_nsec * 1e-9; // rename updates ctime
+        list->n++;
+    }
+    closedir(d);
+    if (list->n > 1)
+        qsort(list->items, list->n, sizeof(shmem_pool_entry_t), _shmem_pool_entry_compare);
+}
+
+/*
+ * Remove the oldest pooled objects until the pool holds at most max_bytes, removed objects are appended to removed
+ * (optional), returns the bytes left in the pool
+ */
+static inline unsigned long long shmem_pool_trim(unsigned long long max_bytes, shmem_pool_list_t* removed) {
+    shmem_pool_list_t list = { NULL, 0, 0 };
+    shmem_pool_scan(&list, 0);
+    unsigned long long total = 0;
+    for (size_t i = 0; i < list.n; i++)
+        total += list.items[i].bytes;
+    for (size_t i = 0; i < list.n && total > max_bytes; i++) {
+        SHMEM_DEBUG_OUTPUT("API call: shm_unlink (%s)\n", list.items[i].name);
+        if (shm_unlink(list.items[i].name) != 0)
+            continue; // taken by another process meanwhile
+        total -= list.items[i].bytes;
+        if (removed != NULL && removed->n == removed->capacity) {
+            size_t capacity = removed->capacity ? removed->capacity * 2 : 16;
+            shmem_pool_entry_t* items = (shmem_pool_entry_t*)realloc(removed->items, sizeof(shmem_pool_entry_t) * capacity);
+            if (items == NULL)
+                continue;
+            removed->items = items;
+            removed->capacity = capacity;
+        }
+        if (removed != NULL)
+            removed->items[removed->n++] = list.items[i];
+    }
+    shmem_pool_list_free(&list);
+    return total;
+}
+
+/*
+ * Create a pooled segment holding total_size bytes and map it, a pooled object of its size class is reused if there is
+ * one (*reused is set to 1)
+ * returns 0 on success, or errno of the failed API call (failed_api is set to its name)
+ */
+static inline int shmem_pool_create(const char* name, unsigned long long total_size, int* out_fd, void** out_ptr, int* reused, const char** failed_api) {
+    unsigned long long class_size = shmem_pool_class_size(total_size);
+    char path[MAX_SHMEM_NAME_LENGTH], pooled_path[MAX_SHMEM_NAME_LENGTH];
+    *reused = 0;
+    if (_shmem_pool_path(name, path, sizeof(path)) == 0) {
+        shmem_pool_list_t list = { NULL, 0, 0 };
+        shmem_pool_scan(&list, class_size);
+        // the most recently returned object is the most likely to be cached
+        for (size_t i = list.n; i-- > 0 && !*reused;) {
+            SHMEM_DEBUG_OUTPUT("API call: rename (%s)\n", list.items[i].name);
+            if (list.items[i].bytes == class_size && _shmem_pool_path(list.items[i].name, pooled_path, sizeof(pooled_path)) == 0 &&
+                rename(pooled_path, path) == 0)
+                *reused = 1;
+        }
+        shmem_pool_list_free(&list);
+    }
+    SHMEM_DEBUG_OUTPUT("API call: shm_open\n");
+    int fd = shm_open(name, *reused ? O_RDWR : O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        *failed_api = "shm_open";
+        return errno;
+    }
+    SHMEM_DEBUG_OUTPUT("API call: ftruncate\n");
+    if (!*reused && shmem_posix_truncate(fd, class_size) == -1) {
+        int trunc_errno = errno;
+        close(fd);
+        shm_unlink(name);
+        *failed_api = "ftruncate";
+        return trunc_errno;
+    }
+    int map_flags = 0;
+#ifdef MAP_POPULATE
+    if (*reused)
+        map_flags = MAP_POPULATE; // the pages exist already, only the page tables are filled
+#endif
+    SHMEM_DEBUG_OUTPUT("API call: mmap\n");
+    void* ptr = shmem_posix_map_ex(fd, total_size, PROT_READ | PROT_WRITE, 0, map_flags);
+    if (ptr == MAP_FAILED) {
+        int map_errno = errno;
+        close(fd);
+        shm_unlink(name);
+        *failed_api = "mmap";
+        return map_errno;
+    }
+    *out_fd = fd;
+    *out_ptr = ptr;
+    return 0;
+}
+
+/*
+ * Return the pooled segment of name (mapped at ptr, released by all processes) to the pool, the oldest pooled objects
+ * are removed if the pool would hold more than max_bytes
+ * returns 0 on success, -1 if the segment must be removed instead
+ */
+static inline int shmem_pool_put(const char* name, void* ptr, unsigned long long max_bytes) {
+    char path[MAX_SHMEM_NAME_LENGTH], pooled_name[MAX_SHMEM_NAME_LENGTH], pooled_path[MAX_SHMEM_NAME_LENGTH];
+    struct stat st;
+    if (_shmem_pool_path(name, path, sizeof(path)) || stat(path, &st) != 0)
+        return -1;
+    unsigned long long bytes = (unsigned long long)st.st_size;
+    if (bytes != shmem_pool_class_size(bytes) || bytes > max_bytes)
+        return -1;
+    shmem_pool_trim(max_bytes - bytes, NULL);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    snprintf(pooled_name, sizeof(pooled_name), SHMEM_POOL_PREFIX "%llu_%lu_%lld%09ld", bytes, (unsigned long)getpid(), (long long)ts.tv_sec, ts.tv_nsec);
+    if (_shmem_pool_path(pooled_name, pooled_path, sizeof(pooled_path)))
+        return -1;
+    // the object is not recognized as a shared matrix anymore
+    SHMEM_WRITE_CAST(unsigned int, ptr, 0, 0);
+    SHMEM_DEBUG_OUTPUT("API call: rename (%s)\n", pooled_name);
+    return rename(path, pooled_path) == 0 ? 0 : -1;
+}
+
+// whether the object mapped by fd is still the shared memory object of name (not unlinked, renamed or replaced)
+static inline int shmem_pool_same_object(int fd, const char* name) {
+    char path[MAX_SHMEM_NAME_LENGTH];
+    struct stat st, named;
+    if (fstat(fd, &st) != 0 || _shmem_pool_path(name, path, sizeof(path)) || stat(path, &named) != 0)
+        return 0;
+    return st.st_ino == named.st_ino && st.st_dev == named.st_dev;
+}
+#endif // SHMEM_POSIX_API
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Backing storage of shared memory segments
+ *
+ * A segment name is either a POSIX shared memory object name (default, stored in /dev/shm), or a path prefixed by
+ * SHMEM_FILE_NAME_PREFIX (e.g. "file:/dev/hugepages/<uuid>"), which is opened as a regular file. Files located on a
+ * hugetlbfs mount are backed by huge pages. Shared memory objects can additionally be advised to use transparent huge
+ * pages (THP), in that case every mapping is aligned to the huge page size. A file on a regular file system persists
+ * after the segment is released (persistent shared matrix), it has exactly the same layout and is mapped the same way.
+ *
+ * The page size used for mapping is recorded in MATRIX_FLAG (see SHMEM_FLAG_PAGE_SHIFT), length of every mapping (and
+ * unmapping) is rounded up to it, since hugetlbfs refuses to unmap a partial huge page.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_SEGMENT_H_
+#define _SHARED_MATRIX_SHMEM_SEGMENT_H_
+
+#include "compiler_def.h"
+
+// Huge page modes requested at creation time
+#define SHMEM_HUGEPAGE_NONE    0
+#define SHMEM_HUGEPAGE_THP     1
+#define SHMEM_HUGEPAGE_HUGETLB 2
+
+static inline int shmem_name_is_file(const char* name) {
+    return strncmp(name, SHMEM_FILE_NAME_PREFIX, sizeof(SHMEM_FILE_NAME_PREFIX) - 1) == 0;
+}
+
+// file path of a file backed segment name
+static inline const char* shmem_file_path(const char* name) {
+    return name + sizeof(SHMEM_FILE_NAME_PREFIX) - 1;
+}
+
+// page size (in byte) of the mapping described by segment flags, 0 for the default page size
+static inline unsigned long long shmem_flag_page_size(unsigned long long flags) {
+    unsigned long long shift = (flags >> SHMEM_FLAG_PAGE_SHIFT_OFFSET) & 0xff;
+    return shift ? (1ULL << shift) : 0;
+}
+
+// length of the mapping covering size bytes of the segment
+static inline unsigned long long shmem_map_size(unsigned long long size, unsigned long long flags) {
+    unsigned long long page = shmem_flag_page_size(flags);
+    return page ? INT_CEIL(size, page) * page : size;
+}
+
+// alignment (in byte) of the offset of a mapping which covers only a part of the segment
+static inline unsigned long long shmem_map_granularity(unsigned long long flags) {
+#if SHMEM_API == SHMEM_WIN_API
+    (void)flags;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#elif SHMEM_API == SHMEM_POSIX_API
+    if (flags & SHMEM_FLAG_HUGETLB)
+        return shmem_flag_page_size(flags);
+    long n = sysconf(_SC_PAGESIZE);
+    return n > 0 ? (unsigned long long)n : 4096;
+#endif
+}
+
+static inline unsigned long long shmem_page_shift_flag(unsigned long long page_size) {
+    unsigned long long shift = 0;
+    while ((1ULL << shift) < page_size) shift++;
+    return shift << SHMEM_FLAG_PAGE_SHIFT_OFFSET;
+}
+
+// parse memory size string like "2M", "1G", "2048k" (suffix is case insensitive), returns 0 if invalid
+static inline unsigned long long shmem_parse_size(const char* str) {
+    char* end = NULL;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) return 0;
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; break;
+    case 'm': case 'M': value <<= 20; break;
+    case 'g': case 'G': value <<= 30; break;
+    case '\0': break;
+    default: return 0;
+    }
+    return value;
+}
+
+#if SHMEM_API == SHMEM_POSIX_API
+#include <sys/vfs.h>
+
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+static inline int shmem_posix_open(const char* name, int oflag) {
+    double trace_start = shmem_trace_begin();
+    int fd = shmem_name_is_file(name) ? open(shmem_file_path(name), oflag, 0666) : shm_open(name, oflag, 0666);
+    shmem_trace_end("shm_open", trace_start, 0);
+    return fd;
+}
+
+static inline int shmem_posix_unlink(const char* name) {
+    double trace_start = shmem_trace_begin();
+    int ret = shmem_name_is_file(name) ? unlink(shmem_file_path(name)) : shm_unlink(name);
+    shmem_trace_end("shm_unlink", trace_start, 0);
+    return ret;
+}
+
+// ftruncate fd to size bytes, returns -1 on failure (errno is set)
+static inline int shmem_posix_truncate(int fd, unsigned long long size) {
+    double trace_start = shmem_trace_begin();
+    int ret = ftruncate(fd, (off_t)size);
+    shmem_trace_end("ftruncate", trace_start, size);
+    return ret;
+}
+
+// segment flags which can be derived from an opened handle (used before the header is readable)
+static inline unsigned long long shmem_posix_handle_flags(int fd) {
+    struct statfs fs;
+    if (fstatfs(fd, &fs) == 0 && (unsigned long long)fs.f_type == HUGETLBFS_MAGIC)
+        return SHMEM_FLAG_HUGETLB | shmem_page_shift_flag((unsigned long long)fs.f_bsize);
+    return 0;
+}
+
+static inline void* _shmem_posix_map_ex(int fd, unsigned long long size, int prot, unsigned long long flags, int map_flags) {
+    unsigned long long length = shmem_map_size(size, flags);
+    if (!(flags & SHMEM_FLAG_THP))
+        return mmap(0, length, prot, MAP_SHARED | map_flags, fd, 0);
+    // reserve a larger address range, then place the mapping at a huge page aligned address inside it
+    unsigned long long align = shmem_flag_page_size(flags);
+    char* reserved = (char*)mmap(0, length + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+        return MAP_FAILED;
+    char* aligned = (char*)(INT_CEIL((unsigned long long)(size_t)reserved, align) * align);
+    void* ptr = mmap(aligned, length, prot, MAP_SHARED | MAP_FIXED | map_flags, fd, 0);
+    if (ptr == MAP_FAILED) {
+        int map_errno = errno;
+        munmap(reserved, length + align);
+        errno = map_errno;
+        return MAP_FAILED;
+    }
+    if (aligned > reserved)
+        munmap(reserved, aligned - reserved);
+    if (reserved + length + align > aligned + length)
+        munmap(aligned + length, (reserved + length + align) - (aligned + length));
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, length, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+// mmap size bytes (rounded up to the page size in flags) of fd with additional mmap flags (e.g. MAP_POPULATE),
+// returns MAP_FAILED on failure
+static inline void* shmem_posix_map_ex(int fd, unsigned long long size, int prot, unsigned long long flags, int map_flags) {
+    double trace_start = shmem_trace_begin();
+    void* ptr = _shmem_posix_map_ex(fd, size, prot, flags, map_flags);
+    shmem_trace_end("mmap", trace_start, shmem_map_size(size, flags));
+    return ptr;
+}
+
+static inline void* shmem_posix_map(int fd, unsigned long long size, int prot, unsigned long long flags) {
+    return shmem_posix_map_ex(fd, size, prot, flags, 0);
+}
+
+static inline int shmem_posix_unmap(void* ptr, unsigned long long size, unsigned long long flags) {
+    double trace_start = shmem_trace_begin();
+    int ret = munmap(ptr, shmem_map_size(size, flags));
+    shmem_trace_end("munmap", trace_start, shmem_map_size(size, flags));
+    return ret;
+}
+
+// default huge page size reported by /proc/meminfo, 0 if unavailable
+static inline unsigned long long shmem_default_hugepage_size(void) {
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (f == NULL) return 0;
+    char line[256];
+    unsigned long long size_kb = 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "Hugepagesize: %llu kB", &size_kb) == 1)
+            break;
+    fclose(f);
+    return size_kb << 10;
+}
+
+// find a hugetlbfs mount point with the given page size (0: any), returns page size of the mount or 0 if not found
+static inline unsigned long long shmem_find_hugetlbfs(unsigned long long page_size, char* mount_point, size_t len) {
+    FILE* f = fopen("/proc/mounts", "r");
+    if (f == NULL) return 0;
+    char line[1024], dev[256], dir[512], type[64], opts[512];
+    unsigned long long found = 0;
+    unsigned long long default_size = shmem_default_hugepage_size();
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%255s %511s %63s %511s", dev, dir, type, opts) != 4 || strcmp(type, "hugetlbfs") != 0)
+            continue;
+        unsigned long long mount_size = default_size;
+        const char* opt = strstr(opts, "pagesize=");
+        if (opt != NULL)
+            mount_size = shmem_parse_size(opt + 9);
+        if (mount_size == 0 || (page_size != 0 && mount_size != page_size) || strlen(dir) >= len)
+            continue;
+        strcpy(mount_point, dir);
+        found = mount_size;
+    }
+    fclose(f);
+    return found;
+}
+
+// whether shmem THP is enabled for madvise-d mappings (/sys/kernel/mm/transparent_hugepage/shmem_enabled)
+static inline int shmem_thp_available(void) {
+    FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+    if (f == NULL) return 0;
+    char line[256] = "";
+    char* ok = fgets(line, sizeof(line), f);
+    fclose(f);
+    if (ok == NULL) return 0;
+    return strstr(line, "[never]") == NULL && strstr(line, "[deny]") == NULL;
+}
+
+/*
+ * Create a segment of total_size bytes and map it, tries the requested huge page mode first and falls back to
+ * THP and then regular pages if it is unavailable.
+ * name: requested shared memory name, overwritten by the actual name (file: prefixed path when hugetlbfs is used)
+ * returns 0 on success, or errno of the failed API call (failed_api is set to its name)
+ */
+static inline int shmem_posix_create(char* name, size_t name_len, unsigned long long total_size, int hugepage_mode, unsigned long long hugepage_size,
+                                     int* out_fd, void** out_ptr, unsigned long long* out_flags, const char** failed_api) {
+    if (hugepage_mode == SHMEM_HUGEPAGE_HUGETLB) {
+        char mount_point[512];
+        unsigned long long page = shmem_find_hugetlbfs(hugepage_size, mount_point, sizeof(mount_point));
+        char path_name[MAX_SHMEM_NAME_LENGTH];
+        int n = page != 0 ? snprintf(path_name, sizeof(path_name), SHMEM_FILE_NAME_PREFIX "%s/%s", mount_point, name) : -1;
+        // the path replaces name, a truncated one is not used
+        if (n > 0 && (size_t)n < sizeof(path_name) && (size_t)n < name_len) {
+            unsigned long long flags = SHMEM_FLAG_HUGETLB | shmem_page_shift_flag(page);
+            SHMEM_DEBUG_OUTPUT("API call: open (%s)\n", path_name);
+            int fd = shmem_posix_open(path_name, O_CREAT | O_EXCL | O_RDWR);
+            if (fd != -1) {
+                SHMEM_DEBUG_OUTPUT("API call: ftruncate\n");
+                void* ptr = MAP_FAILED;
+                if (shmem_posix_truncate(fd, shmem_map_size(total_size, flags)) != -1) {
+                    SHMEM_DEBUG_OUTPUT("API call: mmap\n");
+                    ptr = shmem_posix_map(fd, total_size, PROT_READ | PROT_WRITE, flags);
+                }
+                if (ptr != MAP_FAILED) {
+                    strcpy(name, path_name);
+                    *out_fd = fd;
+                    *out_ptr = ptr;
+                    *out_flags = flags;
+                    return 0;
+                }
+                // not enough huge pages reserved
+                close(fd);
+                shmem_posix_unlink(path_name);
+            }
+        }
+        SHMEM_DEBUG_OUTPUT("hugetlbfs unavailable, falling back to THP\n");
+        hugepage_mode = SHMEM_HUGEPAGE_THP;
+    }
+    unsigned long long flags = 0;
+    if (hugepage_mode == SHMEM_HUGEPAGE_THP) {
+        unsigned long long page = shmem_default_hugepage_size();
+        if (page != 0 && shmem_thp_available())
+            flags = SHMEM_FLAG_THP | shmem_page_shift_flag(page);
+        else
+            SHMEM_DEBUG_OUTPUT("THP unavailable, falling back to regular pages\n");
+    }
+    SHMEM_DEBUG_OUTPUT("API call: shm_open\n");
+    int fd = shmem_posix_open(name, O_CREAT | O_RDWR);
+    if (fd == -1) {
+        *failed_api = "shm_open";
+        return errno;
+    }
+    // a file placed on hugetlbfs by user
+    if (shmem_name_is_file(name) && shmem_posix_handle_flags(fd))
+        flags = shmem_posix_handle_flags(fd);
+    SHMEM_DEBUG_OUTPUT("API call: ftruncate\n");
+    if (shmem_posix_truncate(fd, shmem_map_size(total_size, flags)) == -1) {
+        int trunc_errno = errno;
+        SHMEM_DEBUG_OUTPUT("API call: close\n");
+        close(fd);
+        SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
+        shmem_posix_unlink(name);
+        *failed_api = "ftruncate";
+        return trunc_errno;
+    }
+    SHMEM_DEBUG_OUTPUT("API call: mmap\n");
+    void* ptr = shmem_posix_map(fd, total_size, PROT_READ | PROT_WRITE, flags);
+    if (ptr == MAP_FAILED) {
+        int map_errno = errno;
+        SHMEM_DEBUG_OUTPUT("API call: close\n");
+        close(fd);
+        SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
+        shmem_posix_unlink(name);
+        *failed_api = "mmap";
+        return map_errno;
+    }
+    *out_fd = fd;
+    *out_ptr = ptr;
+    *out_flags = flags;
+    return 0;
+}
+#endif // SHMEM_POSIX_API
+
+#if SHMEM_API == SHMEM_WIN_API
+/*
+ * Create a file mapping object of a file backed segment (the file is created if create_size > 0, otherwise it is
+ * opened), returns NULL on failure (GetLastError is preserved)
+ */
+static inline HANDLE shmem_win_open_file(const char* name, int readonly, unsigned long long create_size) {
+    DWORD access = readonly ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE);
+    SHMEM_DEBUG_OUTPUT("API call: CreateFileA\n");
+    HANDLE file = CreateFileA(shmem_file_path(name), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                              create_size ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    SHMEM_DEBUG_OUTPUT("API call: CreateFileMappingA\n");
+    HANDLE mapping = CreateFileMappingA(file, NULL, readonly ? PAGE_READONLY : PAGE_READWRITE, (DWORD)((create_size >> 32) & 0xffffffff), (DWORD)(create_size & 0xffffffff), NULL);
+    DWORD mapping_err = GetLastError();
+    // the mapping object keeps the file open
+    CloseHandle(file);
+    SetLastError(mapping_err);
+    return mapping;
+}
+
+typedef HANDLE shmem_handle_t;
+#elif SHMEM_API == SHMEM_POSIX_API
+typedef int shmem_handle_t;
+#endif
+
+// parse option HugePages of an option struct, raises matlab error if invalid
+static inline void shmem_option_hugepages(const mxArray* options, int* hugepage_mode, unsigned long long* hugepage_size) {
+    char hugepage_str[16];
+    shmem_option_string(options, "HugePages", hugepage_str, sizeof(hugepage_str), "none");
+    *hugepage_mode = SHMEM_HUGEPAGE_NONE;
+    *hugepage_size = 0;
+    if (strcmp(hugepage_str, "thp") == 0)
+        *hugepage_mode = SHMEM_HUGEPAGE_THP;
+    else if (strcmp(hugepage_str, "hugetlb") == 0)
+        *hugepage_mode = SHMEM_HUGEPAGE_HUGETLB;
+    else if (strcmp(hugepage_str, "none") != 0) {
+        *hugepage_mode = SHMEM_HUGEPAGE_HUGETLB;
+        *hugepage_size = shmem_parse_size(hugepage_str);
+        if (*hugepage_size == 0)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Invalid option HugePages: %s", hugepage_str);
+    }
+}
+
+// page size which the data of a new segment is aligned to for the requested huge page mode (AlignColumns)
+static inline unsigned long long shmem_align_page_size(int hugepage_mode, unsigned long long hugepage_size) {
+#if SHMEM_API == SHMEM_POSIX_API
+    if (hugepage_mode == SHMEM_HUGEPAGE_HUGETLB) {
+        unsigned long long page = hugepage_size ? hugepage_size : shmem_default_hugepage_size();
+        if (page > 0)
+            return page;
+    }
+#endif
+    (void)hugepage_mode; (void)hugepage_size;
+    return shmem_map_granularity(0);
+}
+
+/*
+ * Create and map a new segment of total_size bytes, raises matlab error on failure and a warning if the requested huge
+ * page mode is unavailable
+ * name: requested shared memory name, overwritten by the actual name (POSIX API, see shmem_posix_create)
+ */
+static inline void shmem_create_segment(char* name, unsigned long long total_size, int hugepage_mode, unsigned long long hugepage_size,
+                                        shmem_handle_t* out_handle, void** out_ptr, unsigned long long* out_flags) {
+    unsigned long long segment_flags = 0;
+#if SHMEM_API == SHMEM_WIN_API
+    HANDLE shmem = NULL;
+    if (shmem_name_is_file(name)) {
+        shmem = shmem_win_open_file(name, 0, total_size);
+    }
+    else {
+        SHMEM_DEBUG_OUTPUT("API call: CreateFileMappingA\n");
+        shmem = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((total_size >> 32) & 0xffffffff), (DWORD)(total_size & 0xffffffff), name);
+    }
+    if (shmem == NULL) {
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API CreateFileMappingA failed: %d", GetLastError());
+    }
+    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile\n");
+    void* ptr = MapViewOfFile(shmem, FILE_MAP_ALL_ACCESS, 0, 0, total_size);
+    if (ptr == NULL) {
+        int map_vof_err = GetLastError();
+        SHMEM_DEBUG_OUTPUT("API call: CloseHandle\n");
+        CloseHandle(shmem);
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "WIN API MapViewOfFile failed: %d", map_vof_err);
+    }
+#elif SHMEM_API == SHMEM_POSIX_API
+    int shmem = -1;
+    void* ptr = NULL;
+    const char* failed_api = NULL;
+    int create_errno = shmem_posix_create(name, MAX_SHMEM_NAME_LENGTH, total_size, hugepage_mode, hugepage_size, &shmem, &ptr, &segment_flags, &failed_api);
+    if (create_errno)
+        mexErrMsgIdAndTxt("SharedMatrix:NativeAPICallFailed", "POSIX API %s failed: %d", failed_api, create_errno);
+#endif
+    if (hugepage_mode == SHMEM_HUGEPAGE_HUGETLB && !(segment_flags & SHMEM_FLAG_HUGETLB))
+        mexWarnMsgIdAndTxt("SharedMatrix:HugePageFallback", "No usable hugetlbfs mount or not enough huge pages reserved, using %s instead", (segment_flags & SHMEM_FLAG_THP) ? "transparent huge pages" : "regular pages");
+    else if (hugepage_mode == SHMEM_HUGEPAGE_THP && !(segment_flags & SHMEM_FLAG_THP))
+        mexWarnMsgIdAndTxt("SharedMatrix:HugePageFallback", "Transparent huge pages are unavailable for shared memory, using regular pages instead");
+    SHMEM_DEBUG_OUTPUT("Handle: %lld\n", (unsigned long long)shmem);
+    SHMEM_DEBUG_OUTPUT("Shared memory pointer: %p\n", ptr);
+    *out_handle = shmem;
+    *out_ptr = ptr;
+    *out_flags = segment_flags;
+}
+
+// unmap and remove a segment created by shmem_create_segment (used for cleanup on failure)
+static inline void shmem_destroy_segment(const char* name, shmem_handle_t handle, void* ptr, unsigned long long total_size, unsigned long long segment_flags) {
+#if SHMEM_API == SHMEM_WIN_API
+    (void)name; (void)total_size; (void)segment_flags;
+    SHMEM_DEBUG_OUTPUT("API call: UnmapViewOfFile\n");
+    UnmapViewOfFile(ptr);
+    SHMEM_DEBUG_OUTPUT("API call: CloseHandle\n");
+    CloseHandle(handle);
+    if (shmem_name_is_file(name))
+        DeleteFileA(shmem_file_path(name));
+#elif SHMEM_API == SHMEM_POSIX_API
+    SHMEM_DEBUG_OUTPUT("API call: munmap\n");
+    shmem_posix_unmap(ptr, total_size, segment_flags);
+    SHMEM_DEBUG_OUTPUT("API call: close\n");
+    close(handle);
+    SHMEM_DEBUG_OUTPUT("API call: shm_unlink\n");
+    shmem_posix_unlink(name);
+#endif
+}
+
+/*
+ * Resize the backing object of a segment created by shmem_create_segment to size bytes (rounded up to the page size
+ * recorded in segment_flags), the mapping is not changed, returns 0 on success or the error code
+ * A section of WIN API is committed at its full size when it is created, it is not resized.
+ */
+static inline int shmem_resize_segment(shmem_handle_t handle, unsigned long long size, unsigned long long segment_flags) {
+#if SHMEM_API == SHMEM_WIN_API
+    (void)handle; (void)size; (void)segment_flags;
+    return 0;
+#elif SHMEM_API == SHMEM_POSIX_API
+    SHMEM_DEBUG_OUTPUT("API call: ftruncate\n");
+    return shmem_posix_truncate(handle, shmem_map_size(size, segment_flags)) == 0 ? 0 : errno;
+#endif
+}
+
+/*
+ * Name of the temporary file a persistent (file backed) segment is written to before it is published by
+ * shmem_publish_segment, readers never see a partially written file
+ */
+static inline int shmem_staging_name(const char* name, char* staging_name, size_t len) {
+#if SHMEM_API == SHMEM_WIN_API
+    unsigned long pid = (unsigned long)GetCurrentProcessId();
+#elif SHMEM_API == SHMEM_POSIX_API
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    int n = snprintf(staging_name, len, "%s.tmp%lu", name, pid);
+    return n > 0 && (size_t)n < len ? 0 : -1;
+}
+
+// atomically replace the file of name by the staging file, returns 0 on success
+static inline int shmem_publish_segment(const char* staging_name, const char* name) {
+    SHMEM_DEBUG_OUTPUT("API call: rename\n");
+#if SHMEM_API == SHMEM_WIN_API
+    return MoveFileExA(shmem_file_path(staging_name), shmem_file_path(name), MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#elif SHMEM_API == SHMEM_POSIX_API
+    return rename(shmem_file_path(staging_name), shmem_file_path(name));
+#endif
+}
+
+#endif
@@ -0,0 +1,429 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Usage counters and references of a segment (STATISTICS block of the segment header, see compiler_def.h)
+ *
+ * (double) CREATE_TIME, creation time of the segment (seconds since 1970-01-01 UTC)
+ * (uint64) CREATE_BYTES, bytes copied into the segment by create_shared_matrix
+ * (double) CREATE_SECONDS, seconds spent on copying (including transpose and encoding)
+ * (uint64) CREATOR_PID, process id of the host (owner of the segment)
+ * (uint64) CREATOR_START, start time of the host process (clock ticks since boot, Linux only, 0 if unknown), tells a
+ *     reused process id from the host
+ * (uint64) NUMA_POLICY, NUMA placement of the segment (see shmem_numa.h), 0 for the default placement
+ * (uint64) NUMA_NODES, mask of the nodes of NUMA_POLICY (bit i: node i)
+ * (uint64) APPEND_CAPACITY, columns reserved by an appendable matrix (ARRAY_APPEND), 0 otherwise
+ * (padded to SHMEM_STATS_LINE_BYTES)
+ * (int64) ACTIVE_ATTACHES, arrays currently attached to the segment by all processes
+ * (uint64) ATTACHES, arrays attached since creation
+ * (uint64) DETACHES, arrays detached since creation
+ * (uint64) MAPS, mappings made by all processes (an attach served by the attach cache does not map the segment)
+ * (int64) MAPPED_BYTES, bytes currently mapped by all processes
+ * (uint64) REFERENCES, bit 0-61: references held by processes (the host, and every mapping of the attach cache of a
+ *     process while arrays are attached from it), bit 62: SHMEM_REF_PERSISTENT, bit 63: SHMEM_REF_RELEASED
+ * (double) HEARTBEAT, last time REFERENCES was changed (seconds since 1970-01-01 UTC)
+ * (uint64) APPEND_COLUMNS, committed columns of an appendable matrix (append_shared_matrix, see shmem_sync.h), the
+ *     last dimension of the header follows it
+ * (uint64) APPEND_BYTES, bytes from the beginning of the segment backed by the shared memory object
+ * (padded to SHMEM_STATS_LINE_BYTES)
+ * (uint64) UPDATES_BEGIN, in-place updates started (write_shared_matrix)
+ * (uint64) VERSION, in-place updates completed, the data is not being updated if it equals UPDATES_BEGIN (see
+ *     shmem_sync.h)
+ * (uint32) VERSION_WAITERS, processes waiting for a newer VERSION
+ * (uint64) FILL_ASYNC, non-zero if the payload is copied by background threads (option Async of create_shared_matrix,
+ *     see shmem_sync.h)
+ * (uint64) FILL_READY, bytes from the beginning of the segment which are completely written if FILL_ASYNC is set, ~0
+ *     once the copy is complete
+ * (uint32) FILL_WAITERS, processes waiting for FILL_READY
+ * (uint64) OUTPUT_DONE, columns completed by writer views of an output matrix (output_shared_matrix, see shmem_sync.h)
+ * (uint32) OUTPUT_WRITERS, writer views currently open
+ * (uint32) OUTPUT_WAITERS, processes waiting for OUTPUT_DONE
+ * each group of fields above starts at a multiple of SHMEM_STATS_LINE_BYTES, updates from different processes on
+ * different groups do not share a cache line
+ *
+ * Counters are updated with relaxed atomic operations, an attach served by the attach cache costs two atomic additions.
+ * Arrays of a struct / cell array are counted one by one. Counters of a process which exits without detaching are
+ * not decreased.
+ *
+ * The segment is removed (unlinked) by the process dropping the last reference after the host released it, workers
+ * still attached when the host detaches keep the name valid for further attaches of other workers. A segment whose
+ * host exited without detaching, or whose remaining references are held by workers which exited without detaching, is
+ * left behind and reclaimed by shared_matrix_gc.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_STATS_H_
+#define _SHARED_MATRIX_SHMEM_STATS_H_
+
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_segment.h"
+
+#if SHMEM_API == SHMEM_POSIX_API
+#    include <time.h>
+#    include <signal.h>
+#endif
+
+// offsets of the fields relative to STATISTICS
+#define SHMEM_STATS_CREATE_TIME     0
+#define SHMEM_STATS_CREATE_BYTES    8
+#define SHMEM_STATS_CREATE_SECONDS  16
+#define SHMEM_STATS_CREATOR_PID     24
+#define SHMEM_STATS_CREATOR_START   32
+#define SHMEM_STATS_NUMA_POLICY     40
+#define SHMEM_STATS_NUMA_NODES      48
+#define SHMEM_STATS_APPEND_CAPACITY 56
+#define SHMEM_STATS_ACTIVE_ATTACHES (1 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_ATTACHES        (2 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_DETACHES        (3 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_MAPS            (4 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_MAPPED_BYTES    (5 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_REFERENCES      (6 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_HEARTBEAT       (6 * SHMEM_STATS_LINE_BYTES + 8)
+#define SHMEM_STATS_APPEND_COLUMNS  (6 * SHMEM_STATS_LINE_BYTES + 16)
+#define SHMEM_STATS_APPEND_BYTES    (6 * SHMEM_STATS_LINE_BYTES + 24)
+#define SHMEM_STATS_UPDATES_BEGIN   (7 * SHMEM_STATS_LINE_BYTES)
+#define SHMEM_STATS_VERSION         (7 * SHMEM_STATS_LINE_BYTES + 8)
+#define SHMEM_STATS_VERSION_WAITERS (7 * SHMEM_STATS_LINE_BYTES + 16)
+#define SHMEM_STATS_FILL_ASYNC      (7 * SHMEM_STATS_LINE_BYTES + 24)
+#define SHMEM_STATS_FILL_READY      (7 * SHMEM_STATS_LINE_BYTES + 32)
+#define SHMEM_STATS_FILL_WAITERS    (7 * SHMEM_STATS_LINE_BYTES + 40)
+#define SHMEM_STATS_OUTPUT_DONE     (7 * SHMEM_STATS_LINE_BYTES + 48)
+#define SHMEM_STATS_OUTPUT_WRITERS  (7 * SHMEM_STATS_LINE_BYTES + 56)
+#define SHMEM_STATS_OUTPUT_WAITERS  (7 * SHMEM_STATS_LINE_BYTES + 60)
+
+// bits of REFERENCES
+// the host has released the segment, it is removed when the last reference is dropped
+#define SHMEM_REF_RELEASED   (1ULL << 63)
+// persistent (file backed) segment, never removed by references or shared_matrix_gc
+#define SHMEM_REF_PERSISTENT (1ULL << 62)
+#define SHMEM_REF_COUNT_MASK (SHMEM_REF_PERSISTENT - 1)
+
+// add delta to the counter at offset of STATISTICS (no-op if stats is NULL)
+static inline void shmem_stats_add(char* stats, int offset, long long delta) {
+    if (stats == NULL)
+        return;
+    volatile long long* counter = (volatile long long*)(stats + offset);
+#ifdef _MSC_VER
+    InterlockedExchangeAdd64((volatile LONG64*)counter, delta);
+#else
+    __atomic_fetch_add(counter, delta, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline long long shmem_stats_load(const char* stats, int offset) {
+    volatile const long long* counter = (volatile const long long*)(stats + offset);
+#ifdef _MSC_VER
+    return *counter; // aligned 64-bit loads are atomic on x64
+#else
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif
+}
+
+// current time in seconds since 1970-01-01 UTC
+static inline double shmem_unix_time(void) {
+#if SHMEM_API == SHMEM_WIN_API
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    unsigned long long ticks = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime; // 100 ns since 1601
+    return (double)(ticks - 116444736000000000ULL) * 1e-7;
+#elif SHMEM_API == SHMEM_POSIX_API
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/*
+ * Whether process pid started at start_time (0: not checked) is running
+ * returns 1 if it is running, 0 if it has exited, -1 if it could not be determined
+ */
+static inline int shmem_process_alive(unsigned long long pid, unsigned long long start_time) {
+    if (pid == 0)
+        return -1;
+#if SHMEM_API == SHMEM_WIN_API
+    (void)start_time;
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+    if (process == NULL)
+        return GetLastError() == ERROR_INVALID_PARAMETER ? 0 : -1;
+    DWORD exit_code = 0;
+    int alive = GetExitCodeProcess(process, &exit_code) ? exit_code == STILL_ACTIVE : -1;
+    CloseHandle(process);
+    return alive;
+#elif SHMEM_API == SHMEM_POSIX_API
+    if (pid > 0x7fffffffULL)
+        return -1;
+    if (kill((pid_t)pid, 0) != 0 && errno == ESRCH)
+        return 0;
+    unsigned long long actual_start = start_time ? shmem_process_start_time(pid) : 0;
+    return actual_start && actual_start != start_time ? 0 : 1;
+#endif
+}
+
+// record creation of the segment (STATISTICS is zero-initialized), the host maps map_bytes bytes and holds a reference
+static inline void shmem_stats_init(char* stats, unsigned long long create_bytes, double create_seconds, unsigned long long map_bytes, int persistent) {
+    if (stats == NULL)
+        return;
+    double now = shmem_unix_time();
+    SHMEM_WRITE_CAST(double, stats, SHMEM_STATS_CREATE_TIME, now);
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_CREATE_BYTES, create_bytes);
+    SHMEM_WRITE_CAST(double, stats, SHMEM_STATS_CREATE_SECONDS, create_seconds);
+#if SHMEM_API == SHMEM_WIN_API
+    unsigned long long pid = GetCurrentProcessId();
+#elif SHMEM_API == SHMEM_POSIX_API
+    unsigned long long pid = getpid();
+#endif
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_CREATOR_PID, pid);
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_CREATOR_START, shmem_process_start_time(pid));
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_REFERENCES, persistent ? SHMEM_REF_PERSISTENT | 1 : 1);
+    SHMEM_WRITE_CAST(double, stats, SHMEM_STATS_HEARTBEAT, now);
+    shmem_stats_add(stats, SHMEM_STATS_MAPS, 1);
+    shmem_stats_add(stats, SHMEM_STATS_MAPPED_BYTES, (long long)map_bytes);
+}
+
+// compare and swap REFERENCES, *expected is updated to the current value on failure, returns 1 on success
+static inline int shmem_ref_cas(char* stats, unsigned long long* expected, unsigned long long desired) {
+    volatile long long* refs = (volatile long long*)(stats + SHMEM_STATS_REFERENCES);
+#ifdef _MSC_VER
+    long long actual = InterlockedCompareExchange64((volatile LONG64*)refs, (long long)desired, (long long)*expected);
+    int swapped = (unsigned long long)actual == *expected;
+    *expected = (unsigned long long)actual;
+    return swapped;
+#else
+    long long expected_value = (long long)*expected;
+    int swapped = __atomic_compare_exchange_n(refs, &expected_value, (long long)desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    *expected = (unsigned long long)expected_value;
+    return swapped;
+#endif
+}
+
+/*
+ * Take a reference for a mapping of this process
+ * returns 0 if the segment is released by the host and all references are dropped (it is being removed), 1 otherwise
+ * (also if stats is NULL)
+ */
+static inline int shmem_ref_acquire(char* stats) {
+    if (stats == NULL)
+        return 1;
+    unsigned long long refs = (unsigned long long)shmem_stats_load(stats, SHMEM_STATS_REFERENCES);
+    do {
+        if ((refs & SHMEM_REF_RELEASED) && (refs & SHMEM_REF_COUNT_MASK) == 0)
+            return 0;
+    } while (!shmem_ref_cas(stats, &refs, refs + 1));
+    SHMEM_WRITE_CAST(double, stats, SHMEM_STATS_HEARTBEAT, shmem_unix_time());
+    return 1;
+}
+
+/*
+ * Drop a reference, the host drops its reference with release_segment set (the segment is removed when the last
+ * reference is dropped, ignored for persistent segments)
+ * returns 1 if the caller dropped the last reference of a released segment and has to remove it, 0 otherwise
+ */
+static inline int shmem_ref_release(char* stats, int release_segment) {
+    if (stats == NULL)
+        return 0;
+    unsigned long long refs = (unsigned long long)shmem_stats_load(stats, SHMEM_STATS_REFERENCES);
+    unsigned long long new_refs;
+    do {
+        new_refs = refs;
+        if (new_refs & SHMEM_REF_COUNT_MASK)
+            new_refs--;
+        if (release_segment && !(new_refs & SHMEM_REF_PERSISTENT))
+            new_refs |= SHMEM_REF_RELEASED;
+    } while (!shmem_ref_cas(stats, &refs, new_refs));
+    SHMEM_WRITE_CAST(double, stats, SHMEM_STATS_HEARTBEAT, shmem_unix_time());
+    return new_refs == SHMEM_REF_RELEASED && refs != SHMEM_REF_RELEASED;
+}
+
+// STATISTICS of a parsed header mapped writable at ptr, NULL if the header does not hold it
+static inline char* shmem_stats_ptr(const shmem_header_t* hdr, void* ptr) {
+    return hdr->stats_offset ? ((char*)ptr) + hdr->stats_offset : NULL;
+}
+
+/*
+ * Map the beginning of segment name writable for updating the counters of a read-only or partial (slice) mapping
+ * returns STATISTICS, or NULL if the header does not hold it or the segment could not be opened for writing (e.g. a
+ * read-only file), *map_ptr and *map_size are set for shmem_stats_unmap
+ */
+static inline char* shmem_stats_map(const char* name, const shmem_header_t* hdr, void** map_ptr, unsigned long long* map_size) {
+    *map_ptr = NULL;
+    *map_size = 0;
+    if (hdr->stats_offset == 0)
+        return NULL;
+    unsigned long long granularity = shmem_map_granularity(hdr->segment_flags);
+    unsigned long long size = INT_CEIL(hdr->stats_offset + SHMEM_STATS_BYTES, granularity) * granularity;
+#if SHMEM_API == SHMEM_WIN_API
+    HANDLE shmem = NULL;
+    if (shmem_name_is_file(name)) {
+        shmem = shmem_win_open_file(name, 0, 0);
+    }
+    else {
+        SHMEM_DEBUG_OUTPUT("API call: OpenFileMappingA\n");
+        shmem = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    }
+    if (shmem == NULL)
+        return NULL;
+    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile (statistics)\n");
+    void* ptr = MapViewOfFile(shmem, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size);
+    // the view keeps the section alive
+    CloseHandle(shmem);
+    if (ptr == NULL)
+        return NULL;
+#elif SHMEM_API == SHMEM_POSIX_API
+    int fd = shmem_posix_open(name, O_RDWR);
+    if (fd == -1)
+        return NULL;
+    SHMEM_DEBUG_OUTPUT("API call: mmap (statistics)\n");
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return NULL;
+#endif
+    *map_ptr = ptr;
+    *map_size = size;
+    return ((char*)ptr) + hdr->stats_offset;
+}
+
+static inline void shmem_stats_unmap(void* map_ptr, unsigned long long map_size) {
+    if (map_ptr == NULL)
+        return;
+#if SHMEM_API == SHMEM_WIN_API
+    (void)map_size;
+    UnmapViewOfFile(map_ptr);
+#elif SHMEM_API == SHMEM_POSIX_API
+    munmap(map_ptr, map_size);
+#endif
+}
+
+// header and STATISTICS of a segment read without mapping it
+typedef struct {
+    char name[MAX_SHMEM_NAME_LENGTH];
+    unsigned long long bytes; // size of the segment
+    unsigned long long matrix_type;
+    unsigned int n_dims;
+    unsigned long long* dims;
+    int has_stats;
+    char stats[SHMEM_STATS_BYTES];
+} shmem_segment_info_t;
+
+typedef struct {
+    shmem_segment_info_t* items;
+    size_t n;
+    size_t capacity;
+} shmem_segment_list_t;
+
+// copy the parsed header to info, returns 0 on success
+static inline int _shmem_segment_info_fill(shmem_segment_info_t* info, const shmem_header_t* hdr) {
+    info->matrix_type = hdr->matrix_type;
+    info->n_dims = hdr->n_dims;
+    info->dims = (unsigned long long*)malloc(sizeof(unsigned long long) * (hdr->n_dims > 0 ? hdr->n_dims : 1));
+    if (info->dims == NULL)
+        return -1;
+    for (unsigned int i = 0; i < hdr->n_dims; i++)
+        info->dims[i] = shmem_header_dim(hdr, i);
+    return 0;
+}
+
+/*
+ * Read header and STATISTICS of segment name (by pread without mapping it, POSIX API)
+ * returns 0 on success, -1 if the segment could not be opened or is not a shared matrix of this layout version
+ */
+static inline int shmem_segment_info_read(const char* name, shmem_segment_info_t* info) {
+    memset(info, 0, sizeof(shmem_segment_info_t));
+    snprintf(info->name, sizeof(info->name), "%s", name);
+#if SHMEM_API == SHMEM_WIN_API
+    HANDLE shmem = NULL;
+    if (shmem_name_is_file(name)) {
+        shmem = shmem_win_open_file(name, 1, 0);
+    }
+    else {
+        SHMEM_DEBUG_OUTPUT("API call: OpenFileMappingA\n");
+        shmem = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    }
+    if (shmem == NULL)
+        return -1;
+    SHMEM_DEBUG_OUTPUT("API call: MapViewOfFile\n");
+    void* ptr = MapViewOfFile(shmem, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(shmem);
+    if (ptr == NULL)
+        return -1;
+    MEMORY_BASIC_INFORMATION mem_info;
+    info->bytes = VirtualQuery(ptr, &mem_info, sizeof(mem_info)) ? mem_info.RegionSize : 0;
+    shmem_header_t hdr = { 0 };
+    int ret = shmem_parse_header(ptr, info->bytes, &hdr) == NULL ? _shmem_segment_info_fill(info, &hdr) : -1;
+    if (ret == 0 && hdr.stats_offset && hdr.stats_offset + SHMEM_STATS_BYTES <= info->bytes) {
+        memcpy(info->stats, (const char*)ptr + hdr.stats_offset, SHMEM_STATS_BYTES);
+        info->has_stats = 1;
+    }
+    UnmapViewOfFile(ptr);
+    return ret;
+#elif SHMEM_API == SHMEM_POSIX_API
+    int fd = shmem_posix_open(name, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    char header_buf[SHMEM_HEADER_PROBE_BYTES];
+    shmem_header_t hdr = { 0 };
+    int ret = -1;
+    SHMEM_DEBUG_OUTPUT("API call: pread\n");
+    ssize_t n_read = fstat(fd, &st) == 0 ? pread(fd, header_buf, sizeof(header_buf), 0) : -1;
+    if (n_read >= 36 && shmem_header_probe_size(header_buf) <= (unsigned long long)n_read &&
+        shmem_parse_header(header_buf, (unsigned long long)n_read, &hdr) == NULL) {
+        info->bytes = (unsigned long long)st.st_size;
+        ret = _shmem_segment_info_fill(info, &hdr);
+    }
+    if (ret == 0 && hdr.stats_offset)
+        info->has_stats = pread(fd, info->stats, SHMEM_STATS_BYTES, (off_t)hdr.stats_offset) == SHMEM_STATS_BYTES;
+    close(fd);
+    return ret;
+#endif
+}
+
+#if SHMEM_API == SHMEM_POSIX_API
+// append all shared matrices in directory dir, names are prefix + file name
+static inline void _shmem_segment_list_scan_dir(shmem_segment_list_t* list, const char* dir, const char* prefix) {
+    DIR* d = opendir(dir);
+    if (d == NULL)
+        return;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (list->n == list->capacity) {
+            size_t capacity = list->capacity ? list->capacity * 2 : 16;
+            shmem_segment_info_t* items = (shmem_segment_info_t*)realloc(list->items, sizeof(shmem_segment_info_t) * capacity);
+            if (items == NULL)
+                break;
+            list->items = items;
+            list->capacity = capacity;
+        }
+        char name[MAX_SHMEM_NAME_LENGTH];
+        if (snprintf(name, sizeof(name), "%s%s", prefix, ent->d_name) >= (int)sizeof(name))
+            continue;
+        if (shmem_segment_info_read(name, &list->items[list->n]) == 0)
+            list->n++;
+    }
+    closedir(d);
+}
+
+// append all shared matrices in /dev/shm and on the hugetlbfs mount (POSIX API only)
+static inline void shmem_segment_list_scan(shmem_segment_list_t* list) {
+    _shmem_segment_list_scan_dir(list, SHMEM_POSIX_SHM_DIR, "");
+    char mount_point[512];
+    if (shmem_find_hugetlbfs(0, mount_point, sizeof(mount_point))) {
+        char prefix[sizeof(mount_point) + sizeof(SHMEM_FILE_NAME_PREFIX) + 1];
+        snprintf(prefix, sizeof(prefix), SHMEM_FILE_NAME_PREFIX "%s/", mount_point);
+        _shmem_segment_list_scan_dir(list, mount_point, prefix);
+    }
+}
+#endif
+
+static inline void shmem_segment_list_free(shmem_segment_list_t* list) {
+    for (size_t i = 0; i < list->n; i++)
+        free(list->items[i].dims);
+    free(list->items);
+}
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Versioned in-place updates of a segment (UPDATES_BEGIN, VERSION and VERSION_WAITERS of STATISTICS)
+ *
+ * A writer increases UPDATES_BEGIN before writing and VERSION after writing, concurrent writers of disjoint columns
+ * are allowed. A reader gets a consistent view of the data it read if
+ *   v = VERSION; (UPDATES_BEGIN == v); ... read ...; (UPDATES_BEGIN == v)
+ * holds, i.e. no update started or was in progress meanwhile (a seqlock with several writers). Arrays stay attached
+ * to the same mapping, an update costs writing the changed columns and two atomic additions (and a wake-up call if
+ * any process waits).
+ *
+ * Waiting processes sleep on the low 32 bits of VERSION (futex on Linux, polling otherwise).
+ *
+ * Asynchronous fill (FILL_ASYNC, FILL_READY and FILL_WAITERS of STATISTICS)
+ *
+ * A segment created with option Async is returned to the host right after its headers are written, the payload is
+ * copied by background threads in ascending order. FILL_READY is raised to the end of every completed prefix of the
+ * segment, it is set to ~0 once the copy is complete. Readers wait (sleeping on the low 32 bits of FILL_READY) only
+ * until the bytes they access are below FILL_READY, e.g. a slice waits for its columns. Setting FILL_READY to ~0 is the
+ * last access of the copy to the segment, the host may unmap it as soon as it is visible.
+ *
+ * Completion barrier of output matrices (OUTPUT_DONE, OUTPUT_WRITERS and OUTPUT_WAITERS of STATISTICS)
+ *
+ * Workers open writer views of disjoint column ranges of an output matrix, OUTPUT_WRITERS counts the open views. A view
+ * closed after its columns are written adds them to OUTPUT_DONE. The host waits (sleeping on the low 32 bits of
+ * OUTPUT_DONE) until OUTPUT_DONE reaches the expected number of columns and no view is open, the columns are visible
+ * to it from then on.
+ *
+ * Appendable matrices (APPEND_COLUMNS and APPEND_BYTES of STATISTICS)
+ *
+ * A single producer (the host) appends columns to a matrix allocated with a capacity. The backing object is grown by
+ * whole chunks to APPEND_BYTES before the columns are written, then APPEND_COLUMNS and the last dimension of the header
+ * are raised inside one in-place update (a new version). Mappings cover the capacity from the beginning, a reader
+ * extends its arrays to APPEND_COLUMNS without remapping or copying. Nothing beyond APPEND_BYTES is ever accessed.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_SYNC_H_
+#define _SHARED_MATRIX_SHMEM_SYNC_H_
+
+#include "compiler_def.h"
+#include "shmem_stats.h"
+#include "shmem_thread.h"
+
+#if SHMEM_API == SHMEM_POSIX_API
+#    include <time.h>
+#    ifdef __linux__
+#        include <linux/futex.h>
+#        include <sys/syscall.h>
+#        include <limits.h>
+#    endif
+#endif
+
+// longest single sleep while waiting (in seconds), waiting is resumed after it
+#define SHMEM_WAIT_SLICE_SECONDS 1.0
+// polling interval (in seconds) without futex
+#define SHMEM_WAIT_POLL_SECONDS 0.001
+
+// sequentially consistent load / addition, a waiter and a writer always see either the update or the waiter
+static inline unsigned long long shmem_sync_load(const char* ptr) {
+    volatile const unsigned long long* value = (volatile const unsigned long long*)ptr;
+#ifdef _MSC_VER
+    MemoryBarrier();
+    return *value; // aligned 64-bit loads are atomic on x64
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void shmem_sync_add(char* ptr, long long delta) {
+    volatile long long* value = (volatile long long*)ptr;
+#ifdef _MSC_VER
+    InterlockedExchangeAdd64((volatile LONG64*)value, delta);
+#else
+    __atomic_fetch_add(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/*
+ * Sleep until the 32-bit word at addr (shared by processes) differs from expected, a wake-up call is made or seconds
+ * elapsed, may return early
+ */
+static inline void shmem_futex_wait(volatile unsigned int* addr, unsigned int expected, double seconds) {
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    // not FUTEX_PRIVATE_FLAG, the word is mapped by other processes
+    syscall(SYS_futex, (unsigned int*)addr, FUTEX_WAIT, expected, &ts, NULL, 0);
+#else
+    double poll = seconds < SHMEM_WAIT_POLL_SECONDS ? seconds : SHMEM_WAIT_POLL_SECONDS;
+    if (*addr != expected)
+        return;
+#    if SHMEM_API == SHMEM_WIN_API
+    Sleep((DWORD)(poll * 1000));
+#    elif SHMEM_API == SHMEM_POSIX_API
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long)(poll * 1e9);
+    nanosleep(&ts, NULL);
+#    endif
+#endif
+}
+
+// wake all processes sleeping on the 32-bit word at addr
+static inline void shmem_futex_wake(volatile unsigned int* addr) {
+#if defined(__linux__)
+    syscall(SYS_futex, (unsigned int*)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)addr;
+#endif
+}
+
+// start an in-place update (no-op if stats is NULL)
+static inline void shmem_version_begin(char* stats) {
+    if (stats)
+        shmem_sync_add(stats + SHMEM_STATS_UPDATES_BEGIN, 1);
+}
+
+// publish an in-place update started by shmem_version_begin, waiting processes are woken up
+static inline void shmem_version_end(char* stats) {
+    if (stats == NULL)
+        return;
+    shmem_sync_add(stats + SHMEM_STATS_VERSION, 1);
+    if (shmem_sync_load(stats + SHMEM_STATS_VERSION_WAITERS) & 0xffffffffULL)
+        shmem_futex_wake((volatile unsigned int*)(stats + SHMEM_STATS_VERSION));
+}
+
+// current version, *updating is set if an update is in progress
+static inline unsigned long long shmem_version_load(const char* stats, int* updating) {
+    unsigned long long version = shmem_sync_load(stats + SHMEM_STATS_VERSION);
+    *updating = shmem_sync_load(stats + SHMEM_STATS_UPDATES_BEGIN) != version;
+    return version;
+}
+
+/*
+ * Wait until the version is newer than version and no update is in progress, or timeout seconds elapsed
+ * returns the current version (not newer than version on timeout)
+ */
+static inline unsigned long long shmem_version_wait(char* stats, unsigned long long version, double timeout) {
+    int updating = 0;
+    unsigned long long current = shmem_version_load(stats, &updating);
+    if (current > version && !updating)
+        return current;
+    volatile unsigned int* waiters = (volatile unsigned int*)(stats + SHMEM_STATS_VERSION_WAITERS);
+    volatile unsigned int* word = (volatile unsigned int*)(stats + SHMEM_STATS_VERSION); // low 32 bits (little endian)
+#ifdef _MSC_VER
+    InterlockedIncrement((volatile LONG*)waiters);
+#else
+    __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+#endif
+    double deadline = shmem_time_seconds() + timeout;
+    while (1) {
+        current = shmem_version_load(stats, &updating);
+        if (current > version && !updating)
+            break;
+        double remaining = deadline - shmem_time_seconds();
+        if (remaining <= 0)
+            break;
+        shmem_futex_wait(word, (unsigned int)current, remaining < SHMEM_WAIT_SLICE_SECONDS ? remaining : SHMEM_WAIT_SLICE_SECONDS);
+    }
+#ifdef _MSC_VER
+    InterlockedDecrement((volatile LONG*)waiters);
+#else
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+#endif
+    return current;
+}
+
+// mark the segment as being filled, bytes [0, ready) are written (no-op if stats is NULL)
+static inline void shmem_fill_begin(char* stats, unsigned long long ready) {
+    if (stats == NULL)
+        return;
+    SHMEM_WRITE_CAST(unsigned long long, stats, SHMEM_STATS_FILL_READY, ready);
+    shmem_sync_add(stats + SHMEM_STATS_FILL_ASYNC, 1);
+}
+
+// raise FILL_READY to ready (never lowered), returns whether it is raised
+static inline int _shmem_fill_raise(char* stats, unsigned long long ready) {
+    volatile unsigned long long* value = (volatile unsigned long long*)(stats + SHMEM_STATS_FILL_READY);
+    unsigned long long current = shmem_sync_load(stats + SHMEM_STATS_FILL_READY);
+    while (current < ready) {
+#ifdef _MSC_VER
+        unsigned long long actual = (unsigned long long)InterlockedCompareExchange64((volatile LONG64*)value, (LONG64)ready, (LONG64)current);
+        if (actual == current)
+            return 1;
+        current = actual;
+#else
+        if (__atomic_compare_exchange_n(value, &current, ready, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 1;
+#endif
+    }
+    return 0;
+}
+
+// raise FILL_READY to ready (never lowered), waiting processes are woken up
+static inline void shmem_fill_publish(char* stats, unsigned long long ready) {
+    if (_shmem_fill_raise(stats, ready) && (shmem_sync_load(stats + SHMEM_STATS_FILL_WAITERS) & 0xffffffffULL))
+        shmem_futex_wake((volatile unsigned int*)(stats + SHMEM_STATS_FILL_READY));
+}
+
+// the whole segment is written, FILL_READY is raised to ~0 so that every waiter is released
+static inline void shmem_fill_end(char* stats) {
+    if (stats == NULL)
+        return;
+    volatile unsigned int* word = (volatile unsigned int*)(stats + SHMEM_STATS_FILL_READY);
+    _shmem_fill_raise(stats, ~0ULL);
+    // the segment may be unmapped from now on, waking up an unmapped address only fails
+    shmem_futex_wake(word);
+}
+
+// whether bytes [0, end) of the segment are written (also true for segments without STATISTICS)
+static inline int shmem_fill_ready(const char* stats, unsigned long long end) {
+    return stats == NULL || shmem_sync_load(stats + SHMEM_STATS_FILL_ASYNC) == 0 || shmem_sync_load(stats + SHMEM_STATS_FILL_READY) >= end;
+}
+
+/*
+ * Wait until bytes [0, end) of the segment are written (~0ULL: until the fill is complete), timeout seconds elapsed
+ * or the host exited
+ * returns 1 if they are written, 0 otherwise
+ */
+static inline int shmem_fill_wait(char* stats, unsigned long long end, double timeout) {
+    if (shmem_fill_ready(stats, end))
+        return 1;
+    volatile unsigned int* waiters = (volatile unsigned int*)(stats + SHMEM_STATS_FILL_WAITERS);
+    volatile unsigned int* word = (volatile unsigned int*)(stats + SHMEM_STATS_FILL_READY); // low 32 bits (little endian)
+#ifdef _MSC_VER
+    InterlockedIncrement((volatile LONG*)waiters);
+#else
+    __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+#endif
+    double deadline = shmem_time_seconds() + timeout;
+    double next_check = shmem_time_seconds() + SHMEM_WAIT_SLICE_SECONDS;
+    int ready = 0;
+    while (!(ready = shmem_fill_ready(stats, end))) {
+        double now = shmem_time_seconds();
+        double remaining = deadline - now;
+        if (remaining <= 0)
+            break;
+        // the copy threads run in the host, nothing is written anymore if it exited
+        if (now >= next_check) {
+            if (shmem_process_alive(SHMEM_READ_CAST(unsigned long long, stats, SHMEM_STATS_CREATOR_PID),
+                                    SHMEM_READ_CAST(unsigned long long, stats, SHMEM_STATS_CREATOR_START)) == 0)
+                break;
+            next_check = now + SHMEM_WAIT_SLICE_SECONDS;
+        }
+        unsigned int current = (unsigned int)shmem_sync_load(stats + SHMEM_STATS_FILL_READY);
+        if (shmem_fill_ready(stats, end))
+            continue;
+        shmem_futex_wait(word, current, remaining < SHMEM_WAIT_SLICE_SECONDS ? remaining : SHMEM_WAIT_SLICE_SECONDS);
+    }
+#ifdef _MSC_VER
+    InterlockedDecrement((volatile LONG*)waiters);
+#else
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+#endif
+    return ready;
+}
+
+// sequentially consistent addition to a 32-bit counter
+static inline void _shmem_sync_add32(char* ptr, int delta) {
+    volatile unsigned int* value = (volatile unsigned int*)ptr;
+#ifdef _MSC_VER
+    InterlockedExchangeAdd((volatile LONG*)value, (LONG)delta);
+#else
+    __atomic_fetch_add(value, (unsigned int)delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline unsigned int _shmem_sync_load32(const char* ptr) {
+    volatile const unsigned int* value = (volatile const unsigned int*)ptr;
+#ifdef _MSC_VER
+    MemoryBarrier();
+    return *value;
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// a writer view of an output matrix is opened (no-op if stats is NULL)
+static inline void shmem_output_open(char* stats) {
+    if (stats)
+        _shmem_sync_add32(stats + SHMEM_STATS_OUTPUT_WRITERS, 1);
+}
+
+// a writer view is closed after n_cols columns are written, waiting processes are woken up
+static inline void shmem_output_close(char* stats, unsigned long long n_cols) {
+    if (stats == NULL)
+        return;
+    if (n_cols)
+        shmem_sync_add(stats + SHMEM_STATS_OUTPUT_DONE, (long long)n_cols);
+    _shmem_sync_add32(stats + SHMEM_STATS_OUTPUT_WRITERS, -1);
+    // woken up even if no column is added, the waiter checks OUTPUT_WRITERS again
+    if (_shmem_sync_load32(stats + SHMEM_STATS_OUTPUT_WAITERS))
+        shmem_futex_wake((volatile unsigned int*)(stats + SHMEM_STATS_OUTPUT_DONE));
+}
+
+// whether n_cols columns are completed and no writer view is open, *done is set to the completed columns
+static inline int shmem_output_done(const char* stats, unsigned long long n_cols, unsigned long long* done) {
+    *done = shmem_sync_load(stats + SHMEM_STATS_OUTPUT_DONE);
+    return *done >= n_cols && _shmem_sync_load32(stats + SHMEM_STATS_OUTPUT_WRITERS) == 0;
+}
+
+/*
+ * Wait until n_cols columns are completed and no writer view is open, or timeout seconds elapsed
+ * returns 1 if they are completed, 0 otherwise, *done is set to the completed columns
+ */
+static inline int shmem_output_wait(char* stats, unsigned long long n_cols, double timeout, unsigned long long* done) {
+    if (shmem_output_done(stats, n_cols, done))
+        return 1;
+    volatile unsigned int* word = (volatile unsigned int*)(stats + SHMEM_STATS_OUTPUT_DONE); // low 32 bits (little endian)
+    _shmem_sync_add32(stats + SHMEM_STATS_OUTPUT_WAITERS, 1);
+    double deadline = shmem_time_seconds() + timeout;
+    int finished = 0;
+    while (!(finished = shmem_output_done(stats, n_cols, done))) {
+        double remaining = deadline - shmem_time_seconds();
+        if (remaining <= 0)
+            break;
+        shmem_futex_wait(word, (unsigned int)*done, remaining < SHMEM_WAIT_SLICE_SECONDS ? remaining : SHMEM_WAIT_SLICE_SECONDS);
+    }
+    _shmem_sync_add32(stats + SHMEM_STATS_OUTPUT_WAITERS, -1);
+    return finished;
+}
+
+// start a new round of writer views, OUTPUT_DONE is cleared (the host calls it while no view is open)
+static inline void shmem_output_reset(char* stats) {
+    if (stats)
+        shmem_sync_add(stats + SHMEM_STATS_OUTPUT_DONE, -(long long)shmem_sync_load(stats + SHMEM_STATS_OUTPUT_DONE));
+}
+
+// committed columns of an appendable matrix, the columns before it are completely written
+static inline unsigned long long shmem_append_columns(const char* stats) {
+    return shmem_sync_load(stats + SHMEM_STATS_APPEND_COLUMNS);
+}
+
+/*
+ * Commit the columns of an appendable matrix up to n_cols (written before), header points to the matrix header
+ * APPEND_COLUMNS is raised first, the last dimension of the header never runs ahead of the written columns
+ */
+static inline void shmem_append_publish(char* stats, void* header, const shmem_header_t* hdr, unsigned long long n_cols) {
+    shmem_sync_add(stats + SHMEM_STATS_APPEND_COLUMNS, (long long)(n_cols - shmem_append_columns(stats)));
+    SHMEM_WRITE_CAST(unsigned long long, header, 36 + (hdr->n_dims - 1) * 8, n_cols);
+}
+
+// bytes of the segment backing the first n_cols columns of an appendable matrix, grown by chunk_bytes at a time
+static inline unsigned long long shmem_append_backing_bytes(const shmem_header_t* hdr, unsigned long long n_cols, unsigned long long chunk_bytes) {
+    unsigned long long bytes = INT_CEIL(shmem_column_offset(hdr, n_cols), chunk_bytes) * chunk_bytes;
+    return bytes < hdr->total_size ? bytes : hdr->total_size;
+}
+
+#endif
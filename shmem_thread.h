@@ -0,0 +1,223 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Portable helpers for native worker threads, timing, processes and CPU topology
+ *
+ * NOTICE: Matlab mex API (mx* / mex*) must NOT be called from any thread started here
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_THREAD_H_
+#define _SHARED_MATRIX_SHMEM_THREAD_H_
+
+#include "compiler_def.h"
+
+#if SHMEM_API == SHMEM_POSIX_API
+#    include <pthread.h>
+#    include <time.h>
+#    ifdef __linux__
+#        include <sys/syscall.h>
+#    endif
+#endif
+
+typedef void (*shmem_thread_proc)(void* arg);
+
+typedef struct {
+    shmem_thread_proc proc;
+    void* arg;
+#if SHMEM_API == SHMEM_WIN_API
+    HANDLE handle;
+#elif SHMEM_API == SHMEM_POSIX_API
+    pthread_t handle;
+#endif
+} shmem_thread_t;
+
+#if SHMEM_API == SHMEM_WIN_API
+static DWORD WINAPI _shmem_thread_entry(LPVOID param) {
+    shmem_thread_t* t = (shmem_thread_t*)param;
+    t->proc(t->arg);
+    return 0;
+}
+#elif SHMEM_API == SHMEM_POSIX_API
+static void* _shmem_thread_entry(void* param) {
+    shmem_thread_t* t = (shmem_thread_t*)param;
+    t->proc(t->arg);
+    return NULL;
+}
+#endif
+
+// start a native thread, returns 0 on success (t must stay valid until shmem_thread_join returns)
+static inline int shmem_thread_start(shmem_thread_t* t, shmem_thread_proc proc, void* arg) {
+    t->proc = proc;
+    t->arg = arg;
+#if SHMEM_API == SHMEM_WIN_API
+    t->handle = CreateThread(NULL, 0, _shmem_thread_entry, t, 0, NULL);
+    return t->handle == NULL ? -1 : 0;
+#elif SHMEM_API == SHMEM_POSIX_API
+    return pthread_create(&t->handle, NULL, _shmem_thread_entry, t);
+#endif
+}
+
+static inline void shmem_thread_join(shmem_thread_t* t) {
+#if SHMEM_API == SHMEM_WIN_API
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#elif SHMEM_API == SHMEM_POSIX_API
+    pthread_join(t->handle, NULL);
+#endif
+}
+
+// run proc(args + i * arg_stride) for i in [0, n_threads), the calling thread executes i = 0,
+// falls back to run the remaining work items serially if a thread could not be started
+static inline void shmem_parallel_run(int n_threads, shmem_thread_proc proc, void* args, size_t arg_stride) {
+    shmem_thread_t static_threads[MAX_STATIC_ALLOCATED_THREADS];
+    shmem_thread_t* threads = static_threads;
+    int* started = NULL;
+    if (n_threads > MAX_STATIC_ALLOCATED_THREADS)
+        threads = (shmem_thread_t*)malloc(sizeof(shmem_thread_t) * n_threads);
+    if (threads != NULL && n_threads > 1)
+        started = (int*)calloc(n_threads, sizeof(int));
+    for (int i = 1; i < n_threads; i++) {
+        void* arg = ((char*)args) + i * arg_stride;
+        if (started != NULL && shmem_thread_start(&threads[i], proc, arg) == 0)
+            started[i] = 1;
+    }
+    proc(args);
+    for (int i = 1; i < n_threads; i++) {
+        if (started != NULL && started[i])
+            shmem_thread_join(&threads[i]);
+        else
+            proc(((char*)args) + i * arg_stride);
+    }
+    free(started);
+    if (threads != static_threads)
+        free(threads);
+}
+
+/*
+ * Start time of process pid in clock ticks since boot (field 22 of /proc/<pid>/stat), 0 if unknown
+ * (pid, start time) identifies a process, a process id is reused after the process exits
+ */
+static inline unsigned long long shmem_process_start_time(unsigned long long pid) {
+#if SHMEM_API == SHMEM_POSIX_API
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%llu/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    ssize_t n_read = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n_read <= 0)
+        return 0;
+    buf[n_read] = 0;
+    // the command name (field 2) is enclosed in parentheses and may contain spaces
+    const char* p = strrchr(buf, ')');
+    for (int field = 2; p != NULL && field < 22; field++)
+        p = strchr(p + 1, ' ');
+    return p ? strtoull(p + 1, NULL, 10) : 0;
+#else
+    (void)pid;
+    return 0;
+#endif
+}
+
+// number of online logical processors
+static inline int shmem_cpu_count(void) {
+#if SHMEM_API == SHMEM_WIN_API
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#elif SHMEM_API == SHMEM_POSIX_API
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// size (in byte) of the memory page used by regular shared memory mappings
+static inline unsigned long long shmem_page_size(void) {
+#if SHMEM_API == SHMEM_WIN_API
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#elif SHMEM_API == SHMEM_POSIX_API
+    long n = sysconf(_SC_PAGESIZE);
+    return n > 0 ? (unsigned long long)n : 4096;
+#endif
+}
+
+// size (in byte) of the last level cache, SHMEM_DEFAULT_LLC_BYTES if it is not reported by the OS
+static inline unsigned long long shmem_llc_size(void) {
+    unsigned long long llc = 0;
+#if SHMEM_API == SHMEM_WIN_API
+    DWORD len = 0;
+    GetLogicalProcessorInformation(NULL, &len);
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*)malloc(len);
+    if (info != NULL && GetLogicalProcessorInformation(info, &len)) {
+        for (DWORD i = 0; i < len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); i++)
+            if (info[i].Relationship == RelationCache && info[i].Cache.Level >= 2 && info[i].Cache.Size > llc)
+                llc = info[i].Cache.Size;
+    }
+    free(info);
+#elif SHMEM_API == SHMEM_POSIX_API
+#    ifdef _SC_LEVEL3_CACHE_SIZE
+    long n = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (n > 0) llc = (unsigned long long)n;
+#    endif
+#    ifdef _SC_LEVEL2_CACHE_SIZE
+    if (llc == 0) {
+        long n2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (n2 > 0) llc = (unsigned long long)n2;
+    }
+#    endif
+#endif
+    return llc ? llc : SHMEM_DEFAULT_LLC_BYTES;
+}
+
+// monotonic wall clock in seconds
+static inline double shmem_time_seconds(void) {
+#if SHMEM_API == SHMEM_WIN_API
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#elif SHMEM_API == SHMEM_POSIX_API
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+// pin the calling thread to the (index * n_allowed / count)-th CPU of the process affinity mask, so that
+// a group of worker threads spreads evenly over all sockets (first-touch then places pages on every NUMA node)
+static inline void shmem_thread_bind_spread(int index, int count) {
+#if SHMEM_API == SHMEM_POSIX_API && defined(__linux__) && defined(SYS_sched_setaffinity)
+    unsigned long mask[SHMEM_MAX_CPU_MASK_WORDS];
+    const int bits = (int)(sizeof(unsigned long) * 8);
+    memset(mask, 0, sizeof(mask));
+    if (count <= 1 || syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) < 0)
+        return;
+    int n_allowed = 0;
+    for (int i = 0; i < SHMEM_MAX_CPU_MASK_WORDS * bits; i++)
+        if (mask[i / bits] & (1UL << (i % bits))) n_allowed++;
+    if (n_allowed <= 1)
+        return;
+    int target = (int)(((long long)index * n_allowed) / count);
+    for (int i = 0; i < SHMEM_MAX_CPU_MASK_WORDS * bits; i++) {
+        if (!(mask[i / bits] & (1UL << (i % bits)))) continue;
+        if (target-- == 0) {
+            memset(mask, 0, sizeof(mask));
+            mask[i / bits] = 1UL << (i % bits);
+            syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+            return;
+        }
+    }
+#else
+    (void)index; (void)count;
+#endif
+}
+
+#endif
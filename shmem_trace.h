@@ -0,0 +1,278 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Event tracing (POSIX API only)
+ *
+ * Tracing is always compiled in and enabled at run time by the environment variable SHMEM_TRACE_ENV, which every MEX
+ * function reads once per call (shmem_trace_mex). While it is disabled, a trace point costs a NULL check and its
+ * arguments are not evaluated. While it is enabled, every process writes its events into a ring in the shared memory
+ * object SHMEM_TRACE_NAME_PREFIX<pid>, shared by all MEX functions (and their native threads) of the process. The rings
+ * of all processes are merged into a Chrome trace (JSON) by shared_matrix_trace('dump', file).
+ *
+ * MEMORY LAYOUT OF THE RING
+ * (uint64) MAGIC, SHMEM_TRACE_MAGIC
+ * (uint64) N_EVENTS, capacity of the ring (SHMEM_TRACE_EVENTS)
+ * (uint64) NEXT, events claimed since creation, event i is stored in slot i % N_EVENTS
+ * (uint64) CLEARED, events before it are discarded (shared_matrix_trace('clear'))
+ * (uint64) PID, process id of the writer
+ * (uint64) PID_START, start time of the writer (see shmem_process_start_time), tells a reused process id
+ * (padded to SHMEM_TRACE_HEADER_BYTES)
+ * N_EVENTS slots of SHMEM_TRACE_SLOT_BYTES bytes:
+ *   (uint64) SEQ, i + 1 once event i is completely written, 0 while it is being written
+ *   (double) TIME, begin of the event (seconds of shmem_time_seconds, a monotonic clock shared by all processes)
+ *   (double) DURATION, seconds, negative for an instant event
+ *   (uint64) TID, thread id of the writer
+ *   (uint64) ARG, bytes processed by the event (0 if not applicable)
+ *   (char[]) NAME, null-terminated, truncated to SHMEM_TRACE_NAME_BYTES - 1 characters
+ *
+ * Writers claim a slot by an atomic addition on NEXT and never wait. A reader skips a slot whose SEQ changes while it is
+ * copied (being overwritten after the ring wrapped around).
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_TRACE_H_
+#define _SHARED_MATRIX_SHMEM_TRACE_H_
+
+#include <stdarg.h>
+#include "compiler_def.h"
+#include "shmem_thread.h"
+
+#define SHMEM_TRACE_MAGIC 0x3145434152544d53ULL // "SMTRACE1"
+#define SHMEM_TRACE_HEADER_BYTES 64
+#define SHMEM_TRACE_SLOT_BYTES 128
+#define SHMEM_TRACE_NAME_BYTES (SHMEM_TRACE_SLOT_BYTES - SHMEM_TRACE_EVENT_NAME)
+#define SHMEM_TRACE_BYTES (SHMEM_TRACE_HEADER_BYTES + SHMEM_TRACE_EVENTS * (unsigned long long)SHMEM_TRACE_SLOT_BYTES)
+
+// offsets of the header fields
+#define SHMEM_TRACE_N_EVENTS  8
+#define SHMEM_TRACE_NEXT      16
+#define SHMEM_TRACE_CLEARED   24
+#define SHMEM_TRACE_PID       32
+#define SHMEM_TRACE_PID_START 40
+// offsets of the event fields
+#define SHMEM_TRACE_EVENT_SEQ      0
+#define SHMEM_TRACE_EVENT_TIME     8
+#define SHMEM_TRACE_EVENT_DURATION 16
+#define SHMEM_TRACE_EVENT_TID      24
+#define SHMEM_TRACE_EVENT_ARG      32
+#define SHMEM_TRACE_EVENT_NAME     40
+
+typedef struct {
+    char* ring;              // ring of the process while tracing is enabled, NULL otherwise
+    char* map;               // mapped ring, kept until the module is unloaded (native threads may still write into it)
+    unsigned long long pid;  // process which mapped the ring (a forked child maps its own ring)
+} _shmem_trace_state_t;
+
+// tracing state of the calling MEX module
+static inline _shmem_trace_state_t* _shmem_trace_state(void) {
+    static _shmem_trace_state_t state = { NULL, NULL, 0 };
+    return &state;
+}
+
+#define SHMEM_TRACE_RING (*(char* volatile*)&_shmem_trace_state()->ring)
+// records a formatted instant event (used by SHMEM_DEBUG_OUTPUT), evaluates to 0
+#define SHMEM_TRACE_MESSAGE(...) (SHMEM_TRACE_RING ? shmem_trace_message(__VA_ARGS__) : 0)
+
+#if SHMEM_API == SHMEM_POSIX_API
+static inline unsigned long long _shmem_trace_load(const char* ptr) {
+    return __atomic_load_n((const unsigned long long*)ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void _shmem_trace_store(char* ptr, unsigned long long value) {
+    __atomic_store_n((unsigned long long*)ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline unsigned long long _shmem_trace_tid(void) {
+#    if defined(__linux__) && defined(SYS_gettid)
+    return (unsigned long long)syscall(SYS_gettid);
+#    else
+    return (unsigned long long)(size_t)pthread_self();
+#    endif
+}
+
+// maps the ring of the calling process (created if it does not exist), returns NULL on failure
+static inline char* _shmem_trace_map_ring(void) {
+    char name[64];
+    unsigned long long pid = (unsigned long long)getpid();
+    snprintf(name, sizeof(name), SHMEM_TRACE_NAME_PREFIX "%llu", pid);
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((unsigned long long)st.st_size != SHMEM_TRACE_BYTES && ftruncate(fd, (off_t)SHMEM_TRACE_BYTES) != 0)) {
+        close(fd);
+        return NULL;
+    }
+    char* ring = (char*)mmap(0, SHMEM_TRACE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+        return NULL;
+    // the MEX functions of a process are called by one Matlab thread, the ring is initialized once
+    unsigned long long pid_start = shmem_process_start_time(pid);
+    if (SHMEM_READ_CAST(unsigned long long, ring, 0) != SHMEM_TRACE_MAGIC ||
+        SHMEM_READ_CAST(unsigned long long, ring, SHMEM_TRACE_N_EVENTS) != SHMEM_TRACE_EVENTS) {
+        memset(ring, 0, SHMEM_TRACE_HEADER_BYTES);
+        SHMEM_WRITE_CAST(unsigned long long, ring, SHMEM_TRACE_N_EVENTS, SHMEM_TRACE_EVENTS);
+        _shmem_trace_store(ring, SHMEM_TRACE_MAGIC);
+    }
+    if (SHMEM_READ_CAST(unsigned long long, ring, SHMEM_TRACE_PID) != pid ||
+        SHMEM_READ_CAST(unsigned long long, ring, SHMEM_TRACE_PID_START) != pid_start) {
+        // left behind by an exited process with the same id
+        _shmem_trace_store(ring + SHMEM_TRACE_CLEARED, _shmem_trace_load(ring + SHMEM_TRACE_NEXT));
+        SHMEM_WRITE_CAST(unsigned long long, ring, SHMEM_TRACE_PID, pid);
+        SHMEM_WRITE_CAST(unsigned long long, ring, SHMEM_TRACE_PID_START, pid_start);
+    }
+    return ring;
+}
+
+// appends an event to ring, duration < 0 for an instant event
+static inline void _shmem_trace_record(char* ring, const char* name, double time, double duration, unsigned long long bytes) {
+    int saved_errno = errno;
+    unsigned long long seq = __atomic_fetch_add((unsigned long long*)(ring + SHMEM_TRACE_NEXT), 1ULL, __ATOMIC_RELAXED);
+    char* ev = ring + SHMEM_TRACE_HEADER_BYTES + (seq & (SHMEM_TRACE_EVENTS - 1)) * SHMEM_TRACE_SLOT_BYTES;
+    _shmem_trace_store(ev + SHMEM_TRACE_EVENT_SEQ, 0);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    SHMEM_WRITE_CAST(double, ev, SHMEM_TRACE_EVENT_TIME, time);
+    SHMEM_WRITE_CAST(double, ev, SHMEM_TRACE_EVENT_DURATION, duration);
+    SHMEM_WRITE_CAST(unsigned long long, ev, SHMEM_TRACE_EVENT_TID, _shmem_trace_tid());
+    SHMEM_WRITE_CAST(unsigned long long, ev, SHMEM_TRACE_EVENT_ARG, bytes);
+    snprintf(ev + SHMEM_TRACE_EVENT_NAME, SHMEM_TRACE_NAME_BYTES, "%s", name);
+    _shmem_trace_store(ev + SHMEM_TRACE_EVENT_SEQ, seq + 1);
+    errno = saved_errno; // trace points are placed between a failed API call and the report of its errno
+}
+
+/*
+ * Copies event i of ring into ev (SHMEM_TRACE_SLOT_BYTES bytes), returns 0 if it is not available (discarded,
+ * overwritten or being written)
+ */
+static inline int shmem_trace_read_event(const char* ring, unsigned long long i, char* ev) {
+    const char* slot = ring + SHMEM_TRACE_HEADER_BYTES + (i & (SHMEM_TRACE_EVENTS - 1)) * SHMEM_TRACE_SLOT_BYTES;
+    if (_shmem_trace_load(slot + SHMEM_TRACE_EVENT_SEQ) != i + 1)
+        return 0;
+    memcpy(ev, slot, SHMEM_TRACE_SLOT_BYTES);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (_shmem_trace_load(slot + SHMEM_TRACE_EVENT_SEQ) != i + 1)
+        return 0;
+    ev[SHMEM_TRACE_EVENT_NAME + SHMEM_TRACE_NAME_BYTES - 1] = 0;
+    return 1;
+}
+
+/*
+ * Calls proc on the ring of every process in /dev/shm (mapped read-only, or read-write if writable is set), pid and
+ * pid_start identify the writer of the ring, returns the number of rings visited
+ */
+typedef void (*shmem_trace_ring_proc)(const char* name, char* ring, unsigned long long pid, unsigned long long pid_start, void* arg);
+static inline int shmem_trace_ring_scan(int writable, shmem_trace_ring_proc proc, void* arg) {
+    DIR* d = opendir(SHMEM_POSIX_SHM_DIR);
+    if (d == NULL)
+        return 0;
+    int n_rings = 0;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strncmp(ent->d_name, SHMEM_TRACE_NAME_PREFIX, sizeof(SHMEM_TRACE_NAME_PREFIX) - 1) != 0)
+            continue;
+        int fd = shm_open(ent->d_name, writable ? O_RDWR : O_RDONLY, 0600);
+        if (fd == -1)
+            continue;
+        struct stat st;
+        char* ring = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (unsigned long long)st.st_size == SHMEM_TRACE_BYTES)
+            ring = (char*)mmap(0, SHMEM_TRACE_BYTES, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ring == MAP_FAILED)
+            continue;
+        if (_shmem_trace_load(ring) == SHMEM_TRACE_MAGIC && SHMEM_READ_CAST(unsigned long long, ring, SHMEM_TRACE_N_EVENTS) == SHMEM_TRACE_EVENTS) {
+            proc(ent->d_name, ring, SHMEM_READ_CAST(unsigned long long, ring, SHMEM_TRACE_PID), SHMEM_READ_CAST(unsigned long long, ring, SHMEM_TRACE_PID_START), arg);
+            n_rings++;
+        }
+        munmap(ring, SHMEM_TRACE_BYTES);
+    }
+    closedir(d);
+    return n_rings;
+}
+
+// maps the ring of the calling process into state, the ring inherited by a forked child is replaced
+static inline void _shmem_trace_map_state(_shmem_trace_state_t* state) {
+    unsigned long long pid = (unsigned long long)getpid();
+    if (state->map != NULL && state->pid == pid)
+        return;
+    // native threads of the parent do not exist in the child
+    if (state->map != NULL)
+        munmap(state->map, SHMEM_TRACE_BYTES);
+    state->map = _shmem_trace_map_ring();
+    state->pid = pid;
+}
+#else
+static inline void _shmem_trace_map_state(_shmem_trace_state_t* state) {
+    (void)state;
+}
+
+static inline void _shmem_trace_record(char* ring, const char* name, double time, double duration, unsigned long long bytes) {
+    (void)ring; (void)name; (void)time; (void)duration; (void)bytes;
+}
+#endif
+
+// whether SHMEM_TRACE_ENV is set to a non-zero value
+static inline int shmem_trace_env_enabled(void) {
+    const char* env = getenv(SHMEM_TRACE_ENV);
+    return env != NULL && env[0] != 0 && strcmp(env, "0") != 0;
+}
+
+/*
+ * Called on entry of every MEX function, follows SHMEM_TRACE_ENV and records an instant event named mex_name
+ * the ring stays mapped after tracing is disabled, native threads started by a previous call may still write into it
+ */
+static inline void shmem_trace_mex(const char* mex_name) {
+    _shmem_trace_state_t* state = _shmem_trace_state();
+    if (!shmem_trace_env_enabled()) {
+        state->ring = NULL;
+        return;
+    }
+    _shmem_trace_map_state(state);
+    state->ring = state->map;
+    if (state->ring)
+        _shmem_trace_record(state->ring, mex_name, shmem_time_seconds(), -1, 0);
+}
+
+// begin of a span, pass the result to shmem_trace_end (0 while tracing is disabled)
+static inline double shmem_trace_begin(void) {
+    return SHMEM_TRACE_RING ? shmem_time_seconds() : 0;
+}
+
+// records a span named name from start (shmem_trace_begin) to now, bytes processed by it (0 if not applicable)
+static inline void shmem_trace_end(const char* name, double start, unsigned long long bytes) {
+    char* ring = SHMEM_TRACE_RING;
+    if (ring == NULL || start == 0)
+        return;
+    _shmem_trace_record(ring, name, start, shmem_time_seconds() - start, bytes);
+}
+
+// records an instant event
+static inline void shmem_trace_instant(const char* name, unsigned long long bytes) {
+    char* ring = SHMEM_TRACE_RING;
+    if (ring != NULL)
+        _shmem_trace_record(ring, name, shmem_time_seconds(), -1, bytes);
+}
+
+// records a formatted instant event without trailing line breaks (empty messages are skipped), returns 0
+static inline int shmem_trace_message(const char* fmt, ...) {
+    char* ring = SHMEM_TRACE_RING;
+    if (ring == NULL)
+        return 0;
+    char name[SHMEM_TRACE_NAME_BYTES];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(name, sizeof(name), fmt, args);
+    va_end(args);
+    size_t len = strlen(name);
+    while (len > 0 && (name[len - 1] == '\n' || name[len - 1] == '\r'))
+        name[--len] = 0;
+    if (len > 0)
+        _shmem_trace_record(ring, name, shmem_time_seconds(), -1, 0);
+    return 0;
+}
+
+#endif
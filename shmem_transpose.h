@@ -0,0 +1,176 @@
+/*
+ * Shared matrix in Matlab
+ * Author: Xuebin Zhou
+ * License: GNU GPLv3
+ */
+
+/*
+ * Multi-threaded transpose of a sparse matrix (CSC to CSC of the transpose, i.e. CSR of the source)
+ *
+ * A counting sort of the non-zero elements by row, in four parallel phases:
+ *   1. every thread counts the elements of each row in its range of columns (ranges are balanced by non-zero elements)
+ *   2. the counts of a range of rows are summed up over all threads
+ *   3. the column pointers of the transpose (prefix sums of the row counts) and the position of the first element of
+ *      each thread in every row are computed for a range of rows
+ *   4. every thread scatters the elements of its columns to these positions
+ * Threads handle the columns in ascending order, hence the row indices of each column of the transpose are sorted.
+ * Each thread owns a counter for every row, the number of threads is limited so that the counters are not larger than
+ * the row indices.
+ */
+#pragma once
+#ifndef _SHARED_MATRIX_SHMEM_TRANSPOSE_H_
+#define _SHARED_MATRIX_SHMEM_TRANSPOSE_H_
+
+#include "compiler_def.h"
+#include "shmem_thread.h"
+
+typedef struct {
+    unsigned long long n_rows; // of the source matrix
+    unsigned long long n_cols;
+    const mwIndex* jc;
+    const mwIndex* ir;
+    const char* pr; // real / interleaved complex data
+    int data_size; // size of an element in byte (doubled for complex)
+    mwIndex* dst_jc; // n_rows + 1 elements
+    mwIndex* dst_ir; // jc[n_cols] elements
+    char* dst_pr;
+} shmem_sparse_transpose_t;
+
+typedef struct {
+    const shmem_sparse_transpose_t* t;
+    mwIndex** counters; // counters[i]: n_rows counters of thread i
+    unsigned long long* row_sums; // sum of the row counts of every thread's range of rows
+    int phase;
+    int index;
+    int n_threads;
+    unsigned long long col_begin; // range of columns (phase 1 and 4)
+    unsigned long long col_end;
+    unsigned long long row_begin; // range of rows (phase 2 and 3)
+    unsigned long long row_end;
+} _shmem_transpose_worker_t;
+
+// copy an element of data_size bytes, sizes of numeric classes are handled with constant memcpy
+static inline void _shmem_transpose_copy_element(char* dst, const char* src, int data_size) {
+    switch (data_size) {
+    case 1: *dst = *src; break;
+    case 8: memcpy(dst, src, 8); break;
+    case 16: memcpy(dst, src, 16); break;
+    default: memcpy(dst, src, (size_t)data_size); break;
+    }
+}
+
+static void _shmem_transpose_worker(void* arg) {
+    _shmem_transpose_worker_t* w = (_shmem_transpose_worker_t*)arg;
+    const shmem_sparse_transpose_t* t = w->t;
+    mwIndex* counter = w->counters[w->index];
+    if (w->phase == 1) {
+        memset(counter, 0, sizeof(mwIndex) * t->n_rows);
+        for (mwIndex k = t->jc[w->col_begin]; k < t->jc[w->col_end]; k++)
+            counter[t->ir[k]]++;
+    }
+    else if (w->phase == 2) {
+        unsigned long long sum = 0;
+        for (unsigned long long r = w->row_begin; r < w->row_end; r++)
+            for (int i = 0; i < w->n_threads; i++)
+                sum += w->counters[i][r];
+        w->row_sums[w->index] = sum;
+    }
+    else if (w->phase == 3) {
+        // row_sums holds the first element of the range of rows now
+        mwIndex pos = (mwIndex)w->row_sums[w->index];
+        for (unsigned long long r = w->row_begin; r < w->row_end; r++) {
+            t->dst_jc[r] = pos;
+            for (int i = 0; i < w->n_threads; i++) {
+                mwIndex n = w->counters[i][r];
+                w->counters[i][r] = pos;
+                pos += n;
+            }
+        }
+    }
+    else {
+        for (unsigned long long c = w->col_begin; c < w->col_end; c++) {
+            for (mwIndex k = t->jc[c]; k < t->jc[c + 1]; k++) {
+                mwIndex pos = counter[t->ir[k]]++;
+                t->dst_ir[pos] = (mwIndex)c;
+                _shmem_transpose_copy_element(t->dst_pr + pos * t->data_size, t->pr + k * t->data_size, t->data_size);
+            }
+        }
+    }
+}
+
+// first column whose elements start at or after the nz-th non-zero element
+static inline unsigned long long _shmem_transpose_split_column(const mwIndex* jc, unsigned long long n_cols, unsigned long long nz) {
+    unsigned long long lo = 0, hi = n_cols;
+    while (lo < hi) {
+        unsigned long long mid = lo + (hi - lo) / 2;
+        if (jc[mid] < nz) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Transpose t using multiple threads (n_threads <= 0: determined by the number of non-zero elements and CPUs)
+ * returns number of threads used, 0 if memory for the row counters could not be allocated
+ */
+static inline int shmem_parallel_sparse_transpose(const shmem_sparse_transpose_t* t, int n_threads) {
+    unsigned long long nnz = t->jc[t->n_cols];
+    unsigned long long max_threads_by_size = nnz * (sizeof(mwIndex) + t->data_size) / SHMEM_COPY_MIN_BYTES_PER_THREAD;
+    if (n_threads <= 0) {
+        n_threads = shmem_cpu_count();
+        if (n_threads > SHMEM_COPY_MAX_AUTO_THREADS) n_threads = SHMEM_COPY_MAX_AUTO_THREADS;
+        if ((unsigned long long)n_threads > max_threads_by_size)
+            n_threads = max_threads_by_size > 0 ? (int)max_threads_by_size : 1;
+    }
+    // counters of all threads are not larger than the row indices
+    if (n_threads > 1 && (unsigned long long)n_threads * t->n_rows > nnz)
+        n_threads = t->n_rows > 0 && nnz / t->n_rows > 1 ? (int)(nnz / t->n_rows) : 1;
+    SHMEM_DEBUG_OUTPUT("Parallel sparse transpose: %lld non-zero elements, %d threads\n", nnz, n_threads);
+
+    _shmem_transpose_worker_t* workers = (_shmem_transpose_worker_t*)malloc(sizeof(_shmem_transpose_worker_t) * n_threads);
+    mwIndex** counters = (mwIndex**)calloc(n_threads, sizeof(mwIndex*));
+    unsigned long long* row_sums = (unsigned long long*)malloc(sizeof(unsigned long long) * n_threads);
+    int ok = workers != NULL && counters != NULL && row_sums != NULL;
+    for (int i = 0; ok && i < n_threads; i++)
+        ok = (counters[i] = (mwIndex*)malloc(sizeof(mwIndex) * (t->n_rows > 0 ? t->n_rows : 1))) != NULL;
+    if (ok) {
+        unsigned long long col_begin = 0;
+        for (int i = 0; i < n_threads; i++) {
+            unsigned long long col_end = i == n_threads - 1 ? t->n_cols : _shmem_transpose_split_column(t->jc, t->n_cols, nnz / n_threads * (i + 1));
+            if (col_end < col_begin) col_end = col_begin;
+            workers[i].t = t;
+            workers[i].counters = counters;
+            workers[i].row_sums = row_sums;
+            workers[i].index = i;
+            workers[i].n_threads = n_threads;
+            workers[i].col_begin = col_begin;
+            workers[i].col_end = col_end;
+            workers[i].row_begin = t->n_rows * i / n_threads;
+            workers[i].row_end = t->n_rows * (i + 1) / n_threads;
+            col_begin = col_end;
+        }
+        for (int phase = 1; phase <= 4; phase++) {
+            for (int i = 0; i < n_threads; i++)
+                workers[i].phase = phase;
+            shmem_parallel_run(n_threads, _shmem_transpose_worker, workers, sizeof(_shmem_transpose_worker_t));
+            if (phase == 2) {
+                // exclusive prefix sum over the ranges of rows
+                unsigned long long pos = 0;
+                for (int i = 0; i < n_threads; i++) {
+                    unsigned long long n = row_sums[i];
+                    row_sums[i] = pos;
+                    pos += n;
+                }
+            }
+        }
+        t->dst_jc[t->n_rows] = (mwIndex)nnz;
+    }
+    for (int i = 0; counters != NULL && i < n_threads; i++)
+        free(counters[i]);
+    free(counters);
+    free(row_sums);
+    free(workers);
+    return ok ? n_threads : 0;
+}
+
+#endif
@@ -0,0 +1,38 @@
+% throughput and error of the reduced precision encodings (option 'Encoding' of shared_matrix_host)
+a = randn(8192, 2048) * 100;
+encodings = {'single', 'half', 'bfloat16', 'int8', 'int16'};
+% bound of the absolute error of every encoding (relative to the largest element for floating point encodings)
+max_abs = max(abs(a(:)));
+bounds = [max_abs * 2^-24, max_abs * 2^-11, max_abs * 2^-8, (max(a(:)) - min(a(:))) / 254, (max(a(:)) - min(a(:))) / 65534];
+kernels = {'scalar', 'avx2', 'avx512'};
+classes = {'double', 'single'};
+n_repeats = 5;
+for i = 1:length(encodings)
+    host = shared_matrix_host(a, 'Encoding', encodings{i});
+    dev = host.attach();
+    codes = dev.get_data('Populate', 'parallel');
+    info = whos('codes');
+    fprintf('%s: %.1f MB in shared memory (%.1fx smaller), encoded in %.3f s\n', encodings{i}, info.bytes / 1e6, ...
+        8 * numel(codes) / info.bytes, host.CopyStats.EncodeSeconds);
+    for k = 1:length(kernels)
+        for c = 1:length(classes)
+            [b, stats] = decode_shared_matrix(dev.BasePointer, [], struct('Kernel', kernels{k}, 'Class', classes{c}, 'Threads', 1));
+            err = max(abs(double(b(:)) - a(:)));
+            % single precision decoding adds the rounding error of single
+            if err > bounds(i) * 1.0001 + strcmp(classes{c}, 'single') * max_abs * 2^-23
+                error('SharedMatrix:TestFailed', '%s (%s, %s): error %g exceeds %g', encodings{i}, kernels{k}, classes{c}, err, bounds(i));
+            end
+            seconds = inf;
+            for r = 1:n_repeats
+                [~, stats] = decode_shared_matrix(dev.BasePointer, [], struct('Kernel', kernels{k}, 'Class', classes{c}, 'Threads', 1));
+                seconds = min(seconds, stats.Seconds);
+            end
+            fprintf('  %-6s -> %-6s (%s): %6.2f GB/s codes, %6.2f GB/s output, max error %g\n', kernels{k}, classes{c}, stats.Kernel, ...
+                stats.Bytes / seconds / 1e9, numel(a) * (4 + 4 * strcmp(classes{c}, 'double')) / seconds / 1e9, err);
+        end
+    end
+    [~, stats] = decode_shared_matrix(dev.BasePointer, [], struct('Class', 'single'));
+    fprintf('  auto, %d threads: %.2f GB/s codes\n', stats.Threads, stats.Throughput);
+    dev.detach();
+    host.detach();
+end
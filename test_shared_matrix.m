@@ -34,4 +34,401 @@ host.detach();
 if abs(sum_a - sum_b) > 1e-5
     error('Data incorrect');
 end
+% test creation options
+large_a = randn(4096, 600);
+warning('off', 'SharedMatrix:HugePageFallback');
+host = shared_matrix_host(large_a, 'Threads', 4, 'NonTemporal', 1, 'HugePages', 'thp');
+warning('on', 'SharedMatrix:HugePageFallback');
+if host.CopyStats.Bytes < numel(large_a) * 8 || host.CopyStats.PageSize <= 0
+    error('Copy statistics incorrect');
+end
+dev = host.attach();
+b = dev.get_data();
+if ~isequal(b, large_a)
+    error('Data incorrect');
+end
+dev.detach();
+% test attach cache
+dev = host.attach();
+dev2 = host.attach();
+b = dev.get_data();
+b2 = dev2.get_data();
+if dev.BasePointer ~= dev2.BasePointer || ~isequal(b, b2)
+    error('Attach cache not used');
+end
+dev.detach();
+if ~isequal(b2, large_a)
+    error('Data incorrect after partial detach');
+end
+dev2.detach();
+% test attach modes
+dev = host.attach();
+b = dev.get_data('Mode', 'readonly', 'Populate', 'parallel', 'Advice', 'sequential', 'Columns', [1, 300]);
+if ~isequal(b, large_a) || ~strcmp(dev.AttachInfo.Mode, 'readonly') || dev.AttachInfo.PopulatedBytes <= 0
+    error('Attach mode incorrect');
+end
+dev.detach();
+host.detach();
+% test allocation in shared memory
+host = shared_matrix_host.allocate('single', [300, 40]);
+values = single(randn(300, 40));
+host.write(1, values(:, 1:10));
+dev = host.attach();
+dev.get_data();
+dev.write(11, values(:, 11:40));
+if ~isequal(host.get_data(), values)
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+sparse_values = sprandn(200, 30, 0.1);
+host = shared_matrix_host.allocate('double', [200, 30], 'Sparse', true, 'Nzmax', nnz(sparse_values));
+host.write(1, sparse_values(:, 1:12));
+host.write(13, sparse_values(:, 13:30));
+if ~isequal(host.get_data(), sparse_values)
+    error('Data incorrect');
+end
+host.detach();
+% test bundle of variables
+small_a = single(abs_a);
+host = create_shmat(large_a, sparse_a, small_a);
+[dev, data] = attach_shmat(host);
+if ~isequal(data.large_a, large_a) || ~isequal(data.sparse_a, sparse_a) || ~isequal(data.small_a, small_a)
+    error('Data incorrect');
+end
+detach_shmat(dev);
+detach_shmat(host);
+% test nested struct / cell array
+nested = struct('name', {'first', 'second'}, 'data', {{large_a, []}, struct('s', sparse_a)});
+host = shared_matrix_host(nested);
+dev = host.attach();
+b = dev.get_data();
+if ~isequal(b, nested)
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+% test transposed sparse matrix
+host = shared_matrix_host(sparse_a, 'Transpose', true);
+dev = host.attach();
+b = dev.get_transposed();
+if ~isequal(b, sparse_a.') || ~isequal(dev.get_data(), sparse_a)
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+% test column slice
+host = shared_matrix_host(large_a, 'AlignColumns', true);
+dev = host.attach();
+b = dev.get_data([3, 10], 'Mode', 'readonly');
+if ~isequal(b, large_a(:, 3:10)) || dev.AttachInfo.MappedBytes >= numel(large_a) * 8
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+% test reduced precision storage
+host = shared_matrix_host(large_a, 'Encoding', 'int16');
+dev = host.attach();
+codes = dev.get_data();
+b = dev.decode([3, 10]);
+if ~isa(codes, 'int16') || ~isequal(size(codes), size(large_a)) || max(max(abs(b - large_a(:, 3:10)))) > (max(large_a(:)) - min(large_a(:))) / 65534
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+% test usage statistics
+host = shared_matrix_host(large_a);
+dev = host.attach();
+dev.get_data('Mode', 'readonly');
+stats = host.stats();
+if stats.ActiveAttaches ~= 1 || stats.Attaches ~= 1 || stats.CreateBytes < numel(large_a) * 8
+    error('Statistics incorrect');
+end
+dev.detach();
+stats = dev.stats();
+if stats.ActiveAttaches ~= 0 || stats.Detaches ~= 1
+    error('Statistics incorrect');
+end
+if test_platform() == 2
+    segments = shared_matrix_stats();
+    if ~any(strcmp({segments.Name}, host.Name))
+        error('Segment not listed');
+    end
+end
+host.detach();
+% test reference counting, the segment is kept until the worker detaches
+host = shared_matrix_host(large_a);
+dev = host.attach();
+dev.get_data();
+host.detach();
+stats = dev.stats();
+if stats.References ~= 1 || ~stats.Released
+    error('References incorrect');
+end
+b = dev.get_data();
+if ~isequal(b, large_a)
+    error('Data incorrect');
+end
+clear b;
+dev.detach();
+try
+    shared_matrix_stats(dev.Name);
+    error('Shared memory not removed');
+catch err
+    if ~strcmp(err.identifier, 'SharedMatrix:NotFound')
+        rethrow(err);
+    end
+end
+if test_platform() == 2
+    host = shared_matrix_host(large_a);
+    reclaimed = shared_matrix_host.gc('DryRun', true);
+    if ~isempty(reclaimed) && any(strcmp({reclaimed.Name}, host.Name))
+        error('Live segment reclaimed');
+    end
+    host.detach();
+end
+% test in-place updates
+host = shared_matrix_host(large_a);
+dev = host.attach();
+b = dev.get_data('Mode', 'readonly');
+if dev.version() ~= 0 || dev.wait_version(0, 0.01) ~= 0
+    error('Version incorrect');
+end
+v = host.write([2, 5], {ones(size(large_a, 1), 1), 2 * ones(size(large_a, 1), 2)});
+[version, updating] = dev.version();
+if v ~= 1 || version ~= 1 || updating || dev.wait_version(0, 1) ~= 1 || host.version() ~= 1
+    error('Version incorrect');
+end
+if any(b(:, 2) ~= 1) || any(any(b(:, 5:6) ~= 2)) || ~isequal(b(:, 3:4), large_a(:, 3:4))
+    error('Data incorrect');
+end
+clear b;
+dev.detach();
+host.detach();
+% test native kernels
+host = shared_matrix_host(large_a);
+dev = host.attach();
+x = randn(size(large_a, 2), 1);
+if norm(dev.compute('gemv', x) - large_a * x) > 1e-8 * norm(large_a * x) || ...
+        norm(dev.compute('colsum') - sum(large_a, 1)) > 1e-8 * norm(sum(large_a, 1)) || ...
+        ~isequal(dev.compute('max', [], 'Columns', [2, 3]), max(large_a(:, 2:3), [], 1)) || ...
+        ~isequal(host.compute('min', [], 'Kernel', 'scalar'), min(large_a, [], 1))
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+host = shared_matrix_host(sparse_values);
+x = randn(size(sparse_values, 1), 1);
+if norm(host.compute('dot', x) - x.' * sparse_values) > 1e-8 * norm(x.' * sparse_values) || ...
+        norm(host.compute('rowsum') - full(sum(sparse_values, 2))) > 1e-8 * norm(full(sum(sparse_values, 2))) || ...
+        norm(host.compute('colnorm', [], 'Threads', 3) - sqrt(full(sum(sparse_values .^ 2, 1)))) > 1e-8
+    error('Data incorrect');
+end
+host.detach();
+% test segment pool (Linux only)
+if test_platform() == 2
+    host = shared_matrix_host(large_a, 'Pool', true);
+    host.detach();
+    host = shared_matrix_host(large_a, 'Pool', true);
+    dev = host.attach();
+    b = dev.get_data();
+    stats = dev.stats();
+    if ~host.CopyStats.PoolReused || ~isequal(b, large_a) || stats.Attaches ~= 1
+        error('Data incorrect');
+    end
+    clear b;
+    dev.detach();
+    host.detach();
+    % unassigned elements of a nested cell / struct in a reused segment
+    host = shared_matrix_host({large_a, {1, 2, 3}}, 'Pool', true);
+    host.detach();
+    unassigned = {large_a, cell(1, 3)};
+    unassigned{2}{3} = zeros(100, 1);
+    host = shared_matrix_host(unassigned, 'Pool', true);
+    dev = host.attach();
+    b = dev.get_data();
+    if ~host.CopyStats.PoolReused || ~isequal(b, unassigned)
+        error('Data incorrect');
+    end
+    clear b;
+    dev.detach();
+    host.detach();
+    shared_matrix_host.trim_pool();
+end
+% test NUMA placement (Linux only)
+if test_platform() == 2
+    host = shared_matrix_host(large_a, 'Numa', 'columns');
+    stats = host.stats();
+    if ~strcmp(stats.NumaPolicy, 'columns') || isempty(stats.NumaNodes) || stats.NumaColumns(1, 1) ~= 1 || ...
+            stats.NumaColumns(end, 2) ~= size(large_a, 2)
+        error('NUMA policy incorrect');
+    end
+    dev = host.attach();
+    if ~isequal(dev.get_data(), large_a)
+        error('Data incorrect');
+    end
+    dev.detach();
+    host.detach();
+    host = shared_matrix_host.allocate('double', [100, 10], 'Numa', 'bind', 'NumaNodes', 0);
+    stats = host.stats();
+    if ~strcmp(stats.NumaPolicy, 'bind') || ~isequal(stats.NumaNodes, 0)
+        error('NUMA policy incorrect');
+    end
+    host.detach();
+end
+% test asynchronous creation
+host = shared_matrix_host(large_a, 'Async', true);
+dev = host.attach();
+b = dev.get_data([2, 3]);
+if ~host.CopyStats.Async || ~isequal(b, large_a(:, 2:3))
+    error('Data incorrect');
+end
+clear b;
+dev.detach();
+if ~host.wait_ready() || ~isequal(dev.get_data(), large_a)
+    error('Data incorrect');
+end
+stats = host.stats();
+if stats.ReadyBytes ~= stats.Bytes
+    error('Ready bytes incorrect');
+end
+dev.detach();
+host.detach();
+% test accumulator, atomic additions and stripes
+host = shared_matrix_host.accumulator('double', size(large_a), 'Stripes', 2);
+dev = host.attach();
+dev.accumulate(1, large_a, 'Strategy', 'atomic');
+info = dev.accumulate(2, large_a(:, 1:end-1), 'Strategy', 'stripe');
+if ~strcmp(info.Strategy, 'stripe') || info.Stripe ~= 1
+    error('Accumulation strategy incorrect');
+end
+host.merge();
+expected = large_a;
+expected(:, 2:end) = expected(:, 2:end) + large_a(:, 1:end-1);
+if max(max(abs(dev.get_data() - expected))) > 1e-12
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+% test private attach, written columns are only seen by the private copy
+host = shared_matrix_host(large_a);
+dev = host.attach();
+dev2 = host.attach();
+b = dev.get_data('Mode', 'private');
+dev.write(2, -large_a(:, 2));
+if ~isequal(b(:, 2), -large_a(:, 2)) || ~isequal(dev2.get_data(), large_a)
+    error('Data incorrect');
+end
+pages = dev.copied_pages();
+if pages < 1  % NaN if unknown
+    error('Copied pages incorrect');
+end
+clear b;
+dev.detach();
+dev2.detach();
+host.detach();
+% test output matrix written through writer views of disjoint column ranges
+host = shared_matrix_host.output('double', size(large_a));
+half = floor(size(large_a, 2) / 2);
+ranges = [1, half; half + 1, size(large_a, 2)];
+for w = 1:2
+    dev = host.attach();
+    dev.open_writer(ranges(w, :));
+    dev.write(ranges(w, 1), large_a(:, ranges(w, 1):ranges(w, 2)));
+    dev.close_writer();
+end
+[finished, done] = host.wait_done(10);
+if ~finished || done ~= size(large_a, 2) || ~isequal(host.get_data(), large_a)
+    error('Data incorrect');
+end
+host.reset_done();
+dev.open_writer([1, 1]);
+dev.close_writer(false);
+if host.wait_done(0.1)
+    error('Completion barrier incorrect');
+end
+host.detach();
+% test appendable matrix growing by chunks, attached arrays are extended in place
+host = shared_matrix_host.appendable('double', size(large_a, 1), 3 * size(large_a, 2), 'Chunk', 65536);
+dev = host.attach();
+b = dev.get_data();
+host.append(large_a(:, 1:half));
+n = host.append(large_a(:, half + 1:end), 'Chunk', 65536);
+if n ~= size(large_a, 2) || dev.refresh() ~= n || ~isequal(dev.get_data(), large_a) || ~isequal(host.get_data(), large_a)
+    error('Data incorrect');
+end
+s = host.stats();
+if s.Capacity ~= 3 * size(large_a, 2) || s.Dims(2) ~= n
+    error('Stats incorrect');
+end
+try
+    host.append(zeros(size(large_a, 1), 2 * n + 1));
+    error('Capacity not checked');
+catch err
+    if ~strcmp(err.identifier, 'SharedMatrix:CapacityExceeded')
+        rethrow(err);
+    end
+end
+clear b;
+dev.detach();
+host.detach();
+% test event tracing, the dump is a Chrome trace with the system calls of create and attach
+if test_platform() == 2
+    shared_matrix_trace('enable');
+    host = shared_matrix_host(large_a);
+    dev = host.attach();
+    b = dev.get_data();
+    clear b;
+    dev.detach();
+    host.detach();
+    file_path = [tempname '.json'];
+    n = shared_matrix_trace('dump', file_path);
+    shared_matrix_trace('disable');
+    trace = jsondecode(fileread(file_path));
+    events = trace.traceEvents;
+    if isstruct(events)
+        events = num2cell(events); % decoded as a cell array when the events have different fields
+    end
+    names = cellfun(@(e) e.name, events, 'UniformOutput', false);
+    if n == 0 || ~all(ismember({'shm_open', 'ftruncate', 'mmap', 'munmap', 'mx attach array'}, names))
+        error('Trace incorrect');
+    end
+    shared_matrix_trace('clear');
+    delete(file_path);
+end
+% test loading from a raw file, column-major and row-major
+file_path = [tempname '.bin'];
+fid = fopen(file_path, 'w');
+fwrite(fid, large_a, 'double');
+fclose(fid);
+host = shared_matrix_host.load(file_path, 'Class', 'double', 'Dims', size(large_a));
+dev = host.attach();
+if ~isequal(dev.get_data(), large_a) || host.CopyStats.Bytes ~= numel(large_a) * 8
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+host = shared_matrix_host.load(file_path, 'Class', 'double', 'Dims', fliplr(size(large_a)), 'Order', 'C');
+dev = host.attach();
+if ~isequal(dev.get_data(), large_a.') || ~host.CopyStats.Transposed
+    error('Data incorrect');
+end
+dev.detach();
+host.detach();
+delete(file_path);
+% test persistent shared matrix
+file_path = [tempname '.shmat'];
+host = shared_matrix_host(large_a, 'File', file_path);
+host.detach();
+if ~exist(file_path, 'file')
+    error('Persistent file removed');
+end
+dev = shared_matrix.open_file(file_path);
+b = dev.get_data('Mode', 'readonly', 'Prefetch', true);
+if ~isequal(b, large_a)
+    error('Data incorrect');
+end
+dev.detach();
+shared_matrix.flush_cache();
+delete(file_path);
 clear
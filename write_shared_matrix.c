@@ -0,0 +1,181 @@
+#include "compiler_def.h"
+#include "shmem_layout.h"
+#include "shmem_copy.h"
+#include "shmem_stats.h"
+#include "shmem_sync.h"
+
+// columns of values written to the shared matrix starting from column col (0-based)
+typedef struct {
+    unsigned long long col;
+    const mxArray* values;
+    unsigned long long n_cols;
+    const char* src_pr;
+} write_range_t;
+
+// number of columns, all dimensions after the first one are treated as columns
+static unsigned long long write_columns(const shmem_header_t* hdr) {
+    unsigned long long n_cols = 1;
+    for (unsigned int i = 1; i < hdr->n_dims; i++)
+        n_cols *= shmem_header_dim(hdr, i);
+    return n_cols;
+}
+
+// check values of range against the shared matrix at ptr_base, raises matlab error on failure
+static void write_range_check(const shmem_header_t* hdr, const char* ptr_base, double first_col, write_range_t* range) {
+    const mxArray* values = range->values;
+    if (mxGetClassID(values) != (mxClassID)hdr->matrix_type)
+        mexErrMsgIdAndTxt("SharedMatrix:DataTypeError", "Values must have the same class as the shared matrix");
+    if (!mxIsComplex(values) != !(hdr->array_attribute & ARRAY_COMPLEX))
+        mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Complexity of values differs from the shared matrix");
+    if (!mxIsSparse(values) != !(hdr->array_attribute & ARRAY_SPARSE))
+        mexErrMsgIdAndTxt("SharedMatrix:AttributeError", "Sparsity of values differs from the shared matrix");
+    unsigned long long n_rows = shmem_header_dim(hdr, 0);
+    unsigned long long n_cols = write_columns(hdr);
+    if (first_col < 1 || first_col != (double)(unsigned long long)first_col)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Column index must be a positive integer");
+    range->col = (unsigned long long)first_col - 1;
+    range->n_cols = 0;
+    if (mxIsEmpty(values))
+        return;
+    if (mxGetM(values) != n_rows)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Values must have %lld rows", n_rows);
+    range->n_cols = mxGetNumberOfElements(values) / n_rows;
+    if (mxIsSparse(values))
+        range->n_cols = mxGetN(values);
+    if (range->col + range->n_cols > n_cols)
+        mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Column index exceeds matrix dimensions");
+
+    range->src_pr = NULL;
+    if (hdr->array_attribute & ARRAY_COMPLEX) {
+#ifdef SHMEM_COMPLEX_SUPPORTED
+        range->src_pr = (const char*)get_ic_ptr(values, (int)hdr->matrix_type);
+#endif
+    }
+    else {
+        range->src_pr = (const char*)mxGetData(values);
+    }
+    if (range->src_pr == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:MatlabError", "Got null pointer from non-empty array");
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(hdr->nzmax, hdr->data_size, &ofs_ir, &ofs_jc);
+        const mwIndex* dst_jc = (const mwIndex*)(ptr_base + hdr->header_size + ofs_jc + ARRAY_HEADER_SIZE);
+        if (dst_jc[range->col] + mxGetJc(values)[range->n_cols] > hdr->nzmax)
+            mexErrMsgIdAndTxt("SharedMatrix:DimensionError", "Number of non-zero elements exceeds Nzmax of the shared matrix");
+    }
+}
+
+// write the columns of a checked range
+static void write_range(const shmem_header_t* hdr, char* ptr_base, const write_range_t* range, const shmem_copy_options_t* copy_options) {
+    if (range->n_cols == 0)
+        return;
+    char* payload_ptr = ptr_base + hdr->header_size;
+    shmem_copy_task_t copy_tasks[2];
+    int n_copy_tasks = 0;
+    if (hdr->array_attribute & ARRAY_SPARSE) {
+        unsigned long long n_cols = write_columns(hdr);
+        unsigned long long ofs_ir, ofs_jc;
+        shmem_sparse_offsets(hdr->nzmax, hdr->data_size, &ofs_ir, &ofs_jc);
+        mwIndex* dst_jc = (mwIndex*)(payload_ptr + ofs_jc + ARRAY_HEADER_SIZE);
+        const mwIndex* src_jc = mxGetJc(range->values);
+        unsigned long long col = range->col;
+        unsigned long long nz_begin = dst_jc[col];
+        unsigned long long nnz = src_jc[range->n_cols];
+        copy_tasks[n_copy_tasks].dst = payload_ptr + ARRAY_HEADER_SIZE + nz_begin * hdr->data_size;
+        copy_tasks[n_copy_tasks].src = range->src_pr;
+        copy_tasks[n_copy_tasks++].size = nnz * hdr->data_size;
+        copy_tasks[n_copy_tasks].dst = payload_ptr + ofs_ir + ARRAY_HEADER_SIZE + nz_begin * sizeof(mwIndex);
+        copy_tasks[n_copy_tasks].src = (const char*)mxGetIr(range->values);
+        copy_tasks[n_copy_tasks++].size = nnz * sizeof(mwIndex);
+        shmem_parallel_copy(copy_tasks, n_copy_tasks, copy_options, NULL);
+        // Jc is updated after the elements, the trailing columns stay valid (empty)
+        for (unsigned long long i = 1; i <= range->n_cols; i++)
+            dst_jc[col + i] = (mwIndex)(nz_begin + src_jc[i]);
+        for (unsigned long long i = col + range->n_cols + 1; i <= n_cols; i++)
+            dst_jc[i] = (mwIndex)(nz_begin + nnz);
+    }
+    else {
+        unsigned long long col_bytes = shmem_header_dim(hdr, 0) * hdr->data_size;
+        copy_tasks[n_copy_tasks].dst = payload_ptr + ARRAY_HEADER_SIZE + range->col * col_bytes;
+        copy_tasks[n_copy_tasks].src = range->src_pr;
+        copy_tasks[n_copy_tasks++].size = range->n_cols * col_bytes;
+        shmem_parallel_copy(copy_tasks, n_copy_tasks, copy_options, NULL);
+    }
+}
+
+// input arg [1]: base pointer of the shared memory (created by host, or attached with "readwrite" mode)
+// input arg [2]: index of the first column written (1-based), all dimensions after the first one are treated as columns
+//                or a vector of first columns, one for each element of input arg [3] (dense matrix only)
+// input arg [3]: values, same class / complexity / sparsity as the shared matrix, with the same number of rows,
+//                its columns are written to the shared matrix
+//                or a cell of values, all column ranges are published as one update
+//                sparse matrix must be written in column order: the first written column is appended after the last
+//                non-zero element of the previous column, columns after the written ones become empty
+// input arg [4]: (optional) struct of options
+//   Threads / NonTemporal: same as create_shared_matrix
+// output arg [1]: (optional) version of the shared matrix after the update
+// every call is an in-place update which increases the version of the shared matrix (see shmem_sync.h), processes
+// waiting for a newer version are woken up, arrays attached by workers see the new values without attaching again
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    shmem_trace_mex("write_shared_matrix");
+    if (nlhs > 1)
+        mexErrMsgIdAndTxt("SharedMatrix:TooManyOutput", "write_shared_matrix returns at most one value");
+    MATLAB_PRHS_PTR_CHECK_RANGE(3, 4);
+    const mxArray* options = nrhs > 3 ? prhs[3] : NULL;
+    if (options)
+        MATLAB_OPTIONS_CHECK(options, 4);
+
+    // address containing base ptr
+    if (!mxIsUint64(prhs[0]) || mxGetNumberOfElements(prhs[0]) != 1)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [1] must be a uint64 base pointer");
+    char* ptr_base = (char*)*(unsigned long long*)mxGetData(prhs[0]);
+    if (ptr_base == NULL)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Pointer address is assigned to zero");
+    shmem_header_t hdr = { 0 };
+    const char* header_err = shmem_parse_header(ptr_base, SHMEM_READ_CAST(unsigned int, ptr_base, 4), &hdr);
+    if (header_err)
+        mexErrMsgIdAndTxt("SharedMatrix:CorruptMemory", "%s", header_err);
+
+    if (shmem_is_bundle(hdr.matrix_type))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Struct / cell array could not be written");
+    if (hdr.array_attribute & ARRAY_TRANSPOSE)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Matrix created with option Transpose could not be written, its transpose would be outdated");
+    if (hdr.array_attribute & ARRAY_ENCODED)
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Matrix created with option Encoding could not be written");
+
+    // VALUE CHECK
+    size_t n_ranges = mxIsCell(prhs[2]) ? mxGetNumberOfElements(prhs[2]) : 1;
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) || mxGetNumberOfElements(prhs[1]) != n_ranges)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Input arg [2] must be one first column for each element of input arg [3]");
+    if (n_ranges > 1 && (hdr.array_attribute & ARRAY_SPARSE))
+        mexErrMsgIdAndTxt("SharedMatrix:NotSupported", "Sparse matrix is written one column range at a time");
+    write_range_t static_ranges[MAX_STATIC_ALLOCATED_DIMS];
+    write_range_t* ranges = n_ranges <= MAX_STATIC_ALLOCATED_DIMS ? static_ranges : (write_range_t*)mxMalloc(sizeof(write_range_t) * n_ranges);
+    for (size_t i = 0; i < n_ranges; i++) {
+        ranges[i].values = mxIsCell(prhs[2]) ? mxGetCell(prhs[2], i) : prhs[2];
+        if (ranges[i].values == NULL)
+            mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Got null array object pointer");
+        write_range_check(&hdr, ptr_base, mxGetPr(prhs[1])[i], &ranges[i]);
+    }
+
+    shmem_copy_options_t copy_options;
+    copy_options.n_threads = (int)shmem_option_scalar(options, "Threads", 0);
+    copy_options.non_temporal = (int)shmem_option_scalar(options, "NonTemporal", -1);
+    if (copy_options.n_threads < 0 || copy_options.n_threads > SHMEM_COPY_MAX_THREADS)
+        mexErrMsgIdAndTxt("SharedMatrix:InvalidInput", "Option Threads must be in range [0, %d]", SHMEM_COPY_MAX_THREADS);
+
+    // WRITE COLUMNS
+    char* stats = shmem_stats_ptr(&hdr, ptr_base);
+    // a copy in background (option Async of create_shared_matrix) would overwrite the columns
+    shmem_fill_wait(stats, ~0ULL, mxGetInf());
+    shmem_version_begin(stats);
+    for (size_t i = 0; i < n_ranges; i++)
+        write_range(&hdr, ptr_base, &ranges[i], &copy_options);
+    shmem_version_end(stats);
+    if (ranges != static_ranges)
+        mxFree(ranges);
+    if (nlhs > 0) {
+        int updating = 0;
+        plhs[0] = mxCreateDoubleScalar(stats ? (double)shmem_version_load(stats, &updating) : 0);
+    }
+}